@@ -0,0 +1,111 @@
+/* How much does each io_loop iteration cost with lots of idle connections?
+ * We create num_idle (default 10000) socketpairs which just sit waiting to
+ * read, and ping a single byte back and forth NUM_ITERS times over one more
+ * pair. */
+#include <ccan/io/io.h>
+#include <ccan/time/time.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+#include <signal.h>
+
+#define NUM_ITERS 10000
+
+struct pinger {
+	unsigned int iters;
+	char c;
+};
+
+static struct io_plan *ping(struct io_conn *conn, struct pinger *p);
+
+static struct io_plan *pong(struct io_conn *conn, struct pinger *p)
+{
+	if (++p->iters == NUM_ITERS) {
+		io_break(p);
+		return io_close(conn);
+	}
+	return io_read(conn, &p->c, 1, ping, p);
+}
+
+static struct io_plan *ping(struct io_conn *conn, struct pinger *p)
+{
+	return io_write(conn, &p->c, 1, pong, p);
+}
+
+static struct io_plan *init_idle(struct io_conn *conn, char *buf)
+{
+	return io_read(conn, buf, 1, io_close_cb, NULL);
+}
+
+static struct io_plan *init_pinger(struct io_conn *conn, struct pinger *p)
+{
+	return ping(conn, p);
+}
+
+static struct io_plan *init_ponger(struct io_conn *conn, struct pinger *p)
+{
+	return io_read(conn, &p->c, 1, ping, p);
+}
+
+static void run(const char *name, bool epoll, unsigned int num_idle)
+{
+	struct pinger p1, p2;
+	int fds[2], *idle_fds;
+	const tal_t *ctx = tal(NULL, char);
+	char *buf = tal_arr(ctx, char, num_idle);
+	struct timemono start;
+	unsigned int i;
+
+	if (epoll && !io_use_epoll(true))
+		errx(1, "epoll not supported");
+
+	idle_fds = tal_arr(ctx, int, num_idle);
+	for (i = 0; i < num_idle; i++) {
+		if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+			err(1, "socketpair %u", i);
+		io_new_conn(ctx, fds[0], init_idle, buf + i);
+		idle_fds[i] = fds[1];
+	}
+
+	p1.iters = p2.iters = 0;
+	p1.c = p2.c = 'x';
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+		err(1, "socketpair");
+	io_new_conn(ctx, fds[0], init_pinger, &p1);
+	io_new_conn(ctx, fds[1], init_ponger, &p2);
+
+	start = time_mono();
+	if (io_loop(NULL, NULL) != &p1 && p2.iters != NUM_ITERS)
+		errx(1, "io_loop?");
+
+	printf("%s: %u idle conns, %u iterations: %llu usec\n",
+	       name, num_idle, NUM_ITERS,
+	       (long long)time_to_usec(timemono_since(start)));
+
+	/* Hang up on everyone, and let them all close. */
+	for (i = 0; i < num_idle; i++)
+		close(idle_fds[i]);
+	while (io_loop(NULL, NULL) != NULL);
+	tal_free(ctx);
+	io_use_epoll(false);
+}
+
+int main(int argc, char *argv[])
+{
+	struct rlimit rl;
+	unsigned int num_idle = argc > 1 ? atoi(argv[1]) : 10000;
+
+	signal(SIGPIPE, SIG_IGN);
+	if (getrlimit(RLIMIT_NOFILE, &rl) != 0)
+		err(1, "Getting fd limit");
+	rl.rlim_cur = num_idle * 2 + 10;
+	if (setrlimit(RLIMIT_NOFILE, &rl) != 0)
+		err(1, "Raising fd limit to %llu", (long long)rl.rlim_cur);
+
+	run("poll", false, num_idle);
+	run("epoll", true, num_idle);
+	return 0;
+}
@@ -350,6 +350,10 @@ struct io_plan *io_write_partial_(struct io_conn *conn,
  * Sometimes it's neater to plan a callback rather than call it directly;
  * for example, if you only need to read data for one path and not another.
  *
+ * Always callbacks are run in the order they were planned, once per
+ * io_loop() iteration: if @next returns io_always() again, other ready
+ * fds get serviced before it is called again.
+ *
  * Example:
  * static struct io_plan *init_conn_with_nothing(struct io_conn *conn,
  *						 void *unused)
@@ -778,7 +782,24 @@ struct timemono (*io_time_override(struct timemono (*now)(void)))(void);
  * io usually uses poll() internally, but this forces it to use your
  * function (eg. for debugging, suppressing fds, or polling on others unknown
  * to ccan/io).  Returns the old one.
+ *
+ * If io_use_epoll() is in effect, your function is usually handed a single
+ * fd: the epoll fd which becomes readable when any of ours are ready.
  */
 int (*io_poll_override(int (*poll)(struct pollfd *fds, nfds_t nfds, int timeout)))(struct pollfd *, nfds_t, int);
 
+/**
+ * io_use_epoll - use epoll() instead of poll() to wait for fds.
+ * @use: true to use epoll, false to go back to poll().
+ *
+ * poll() means scanning every fd on every loop, which adds up when you
+ * have thousands of (mostly idle) connections.  With epoll, the cost of
+ * a loop depends only on how many fds are actually ready.  Semantics are
+ * unchanged; io will still use poll() while any connection is exclusive,
+ * or watching an fd which epoll does not support (eg. a regular file).
+ *
+ * Returns false if epoll isn't available (in which case poll() is used).
+ */
+bool io_use_epoll(bool use);
+
 #endif /* CCAN_IO_H */
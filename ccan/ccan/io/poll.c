@@ -4,12 +4,19 @@
 #include <assert.h>
 #include <poll.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <limits.h>
 #include <errno.h>
 #include <ccan/time/time.h>
 #include <ccan/timer/timer.h>
+#if HAVE_SYS_EPOLL_H
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+#endif
 
 static size_t num_fds = 0, max_fds = 0, num_waiting = 0, num_always = 0, max_always = 0, num_exclusive = 0;
 static struct pollfd *pollfds = NULL;
@@ -32,6 +39,185 @@ int (*io_poll_override(int (*poll)(struct pollfd *fds, nfds_t nfds, int timeout)
 	return old;
 }
 
+#if HAVE_SYS_EPOLL_H
+/* We keep pollfds[] up-to-date even when using epoll: it's cheap, and we
+ * fall back to it whenever something is exclusive. */
+struct epoll_slot {
+	/* The fd registered under this fd number, or NULL. */
+	struct fd *fd;
+	/* Events we told epoll about (0 == not registered). */
+	short events;
+	/* Bumped whenever fd is removed, so we can spot stale events. */
+	uint32_t gen;
+	/* epoll refuses some fds (eg. regular files), poll() doesn't. */
+	bool unsupported;
+};
+
+#define EPOLL_MAX_EVENTS 256
+static int epoll_fd = -1;
+static struct epoll_slot *epoll_slots = NULL;
+static size_t num_epoll_unsupported = 0;
+static bool epoll_forked = false, epoll_atfork_registered = false;
+
+static void epoll_atfork_child(void)
+{
+	epoll_forked = true;
+}
+
+/* An epoll instance is shared with any child we fork: if the child touched
+ * it, it would change what the parent is watching!  So it needs its own. */
+static void epoll_check_fork(void)
+{
+	if (!epoll_forked)
+		return;
+
+	epoll_forked = false;
+	if (epoll_fd < 0)
+		return;
+
+	close(epoll_fd);
+	epoll_fd = -1;
+	epoll_slots = tal_free(epoll_slots);
+	num_epoll_unsupported = 0;
+	io_use_epoll(true);
+}
+
+static struct epoll_slot *epoll_slot(int fdnum)
+{
+	size_t old = tal_count(epoll_slots);
+
+	if (fdnum >= old) {
+		size_t num = old ? old : 64;
+
+		while (num <= fdnum)
+			num *= 2;
+		if (!epoll_slots)
+			epoll_slots = tal_arrz(NULL, struct epoll_slot, num);
+		else if (tal_resize(&epoll_slots, num))
+			memset(epoll_slots + old, 0,
+			       (num - old) * sizeof(epoll_slots[0]));
+		if (tal_count(epoll_slots) <= fdnum)
+			return NULL;
+	}
+	return &epoll_slots[fdnum];
+}
+
+/* Tell epoll what we want for this fd (0 == nothing). */
+static void epoll_update(struct fd *fd, short events)
+{
+	struct epoll_slot *slot;
+	struct epoll_event ev;
+	int op;
+
+	epoll_check_fork();
+	if (epoll_fd < 0)
+		return;
+
+	slot = epoll_slot(fd->fd);
+	/* OOM: we'll notice we're missing events and fall back to poll() */
+	if (!slot) {
+		num_epoll_unsupported++;
+		return;
+	}
+
+	slot->fd = fd;
+	if (slot->unsupported || slot->events == events)
+		return;
+
+	/* Unlike poll() with a negative fd, epoll always reports errors and
+	 * hangups, so we have to remove idle fds entirely. */
+	if (!events)
+		op = EPOLL_CTL_DEL;
+	else if (!slot->events)
+		op = EPOLL_CTL_ADD;
+	else
+		op = EPOLL_CTL_MOD;
+
+	memset(&ev, 0, sizeof(ev));
+	if (events & POLLIN)
+		ev.events |= EPOLLIN;
+	if (events & POLLOUT)
+		ev.events |= EPOLLOUT;
+	ev.data.u64 = ((uint64_t)slot->gen << 32) | (uint32_t)fd->fd;
+
+	if (epoll_ctl(epoll_fd, op, fd->fd, &ev) != 0 && op == EPOLL_CTL_ADD) {
+		slot->unsupported = true;
+		num_epoll_unsupported++;
+		return;
+	}
+	/* (If MOD or DEL failed, fd was already closed underneath us) */
+	slot->events = events;
+}
+
+static void epoll_remove(struct fd *fd)
+{
+	struct epoll_slot *slot;
+
+	epoll_check_fork();
+	if (epoll_fd < 0 || fd->fd >= tal_count(epoll_slots))
+		return;
+
+	slot = &epoll_slots[fd->fd];
+	if (slot->fd != fd)
+		return;
+
+	epoll_update(fd, 0);
+	if (slot->unsupported) {
+		slot->unsupported = false;
+		num_epoll_unsupported--;
+	}
+	slot->fd = NULL;
+	slot->gen++;
+}
+
+bool io_use_epoll(bool use)
+{
+	epoll_check_fork();
+	if (use == (epoll_fd >= 0))
+		return true;
+
+	if (!use) {
+		close(epoll_fd);
+		epoll_fd = -1;
+		epoll_slots = tal_free(epoll_slots);
+		num_epoll_unsupported = 0;
+		return true;
+	}
+
+	if (!epoll_atfork_registered) {
+		if (pthread_atfork(NULL, NULL, epoll_atfork_child) != 0)
+			return false;
+		epoll_atfork_registered = true;
+	}
+
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (epoll_fd < 0)
+		return false;
+
+	/* Register anything we already have. */
+	for (size_t i = 0; i < num_fds; i++) {
+		if (pollfds[i].fd >= 0)
+			epoll_update(fds[i], pollfds[i].events);
+		else if (epoll_slot(fds[i]->fd))
+			epoll_slots[fds[i]->fd].fd = fds[i];
+	}
+	return true;
+}
+#else
+static void epoll_update(struct fd *fd, short events)
+{
+}
+
+static void epoll_remove(struct fd *fd)
+{
+}
+
+bool io_use_epoll(bool use)
+{
+	return !use;
+}
+#endif /* !HAVE_SYS_EPOLL_H */
+
 static bool add_fd(struct fd *fd, short events)
 {
 	if (!max_fds) {
@@ -69,6 +255,7 @@ static bool add_fd(struct fd *fd, short events)
 	if (events)
 		num_waiting++;
 
+	epoll_update(fd, events);
 	return true;
 }
 
@@ -78,6 +265,7 @@ static void del_fd(struct fd *fd)
 
 	assert(n != -1);
 	assert(n < num_fds);
+	epoll_remove(fd);
 	if (pollfds[n].events)
 		num_waiting--;
 	if (n != num_fds - 1) {
@@ -107,8 +295,8 @@ static void del_fd(struct fd *fd)
 
 static void destroy_listener(struct io_listener *l)
 {
-	close(l->fd.fd);
 	del_fd(&l->fd);
+	close(l->fd.fd);
 }
 
 bool add_listener(struct io_listener *l)
@@ -137,9 +325,9 @@ static void remove_from_always(const struct io_plan *plan)
 	pos = find_always(plan);
 	assert(pos >= 0);
 
-	/* Move last one down if we made a hole */
-	if (pos != num_always-1)
-		always[pos] = always[num_always-1];
+	/* Keep them in order, so we service them first-come first-served */
+	memmove(always + pos, always + pos + 1,
+		(num_always - pos - 1) * sizeof(always[0]));
 	num_always--;
 
 	/* Only free if no fds left either. */
@@ -203,6 +391,8 @@ void backend_new_plan(struct io_conn *conn)
 
 	if (pfd->events)
 		num_waiting++;
+
+	epoll_update(&conn->fd, pfd->events);
 }
 
 void backend_wake(const void *wait)
@@ -231,9 +421,10 @@ static void destroy_conn(struct io_conn *conn, bool close_fd)
 {
 	int saved_errno = errno;
 
+	/* Remove before close, so epoll doesn't keep watching a dup */
+	del_fd(&conn->fd);
 	if (close_fd)
 		close(conn->fd.fd);
-	del_fd(&conn->fd);
 
 	remove_from_always(&conn->plan[IO_IN]);
 	remove_from_always(&conn->plan[IO_OUT]);
@@ -284,24 +475,44 @@ static bool *exclusive(struct io_plan *plan)
 	return &conn->fd.exclusive[plan->dir];
 }
 
-/* For simplicity, we do one always at a time */
-static bool handle_always(void)
+static bool always_runnable(const struct io_plan *plan)
 {
-	/* Backwards is simple easier to remove entries */
-	for (int i = num_always - 1; i >= 0; i--) {
-		struct io_plan *plan = always[i];
+	return !num_exclusive || *exclusive((struct io_plan *)plan);
+}
+
+static bool have_always(void)
+{
+	for (size_t i = 0; i < num_always; i++)
+		if (always_runnable(always[i]))
+			return true;
+	return false;
+}
+
+/* We only run the always plans which were pending when we started: if
+ * they add more (eg. a conn which keeps returning io_always()), those wait
+ * until we've polled again.  Otherwise a single busy conn can starve
+ * every fd we're watching. */
+static void handle_always(void)
+{
+	size_t budget = num_always;
+
+	while (budget-- && !io_loop_return) {
+		struct io_plan *plan;
+		size_t i;
+
+		for (i = 0; i < num_always; i++)
+			if (always_runnable(always[i]))
+				break;
+		if (i == num_always)
+			return;
 
-		if (num_exclusive && !*exclusive(plan))
-			continue;
 		/* Remove first: it might re-add */
-		if (i != num_always-1)
-			always[i] = always[num_always-1];
+		plan = always[i];
+		memmove(always + i, always + i + 1,
+			(num_always - i - 1) * sizeof(always[0]));
 		num_always--;
 		io_do_always(plan);
-		return true;
 	}
-
-	return false;
 }
 
 bool backend_set_exclusive(struct io_plan *plan, bool excl)
@@ -359,6 +570,122 @@ static void restore_pollfds(void)
 	}
 }
 
+/* Returns false if it didn't handle this event. */
+static bool fd_ready(struct fd *fd, int events)
+{
+	if (fd->listener) {
+		struct io_listener *l = (void *)fd;
+		if (events & POLLIN) {
+			accept_conn(l);
+			return true;
+		} else if (events & (POLLHUP|POLLNVAL|POLLERR)) {
+			errno = EBADF;
+			io_close_listener(l);
+			return true;
+		}
+	} else {
+		struct io_conn *c = (void *)fd;
+		if (events & (POLLIN|POLLOUT)) {
+			io_ready(c, events);
+			return true;
+		} else if (events & (POLLHUP|POLLNVAL|POLLERR)) {
+			errno = EBADF;
+			io_close(c);
+			return true;
+		}
+	}
+	return false;
+}
+
+static int do_poll(int ms_timeout)
+{
+	int i, r;
+
+	/* We do this temporarily, assuming exclusive is unusual */
+	exclude_pollfds();
+	r = pollfn(pollfds, num_fds, ms_timeout);
+	restore_pollfds();
+
+	if (r < 0)
+		return r;
+
+	for (i = 0; i < num_fds && !io_loop_return; i++) {
+		int events = pollfds[i].revents;
+
+		/* Clear so we don't get confused if exclusive next time */
+		pollfds[i].revents = 0;
+
+		if (r == 0)
+			break;
+
+		if (fd_ready(fds[i], events))
+			r--;
+	}
+	return 0;
+}
+
+#if HAVE_SYS_EPOLL_H
+static bool using_epoll(void)
+{
+	epoll_check_fork();
+	/* Exclusive and unsupported fds need the full poll() treatment */
+	return epoll_fd >= 0 && !num_exclusive && !num_epoll_unsupported;
+}
+
+static int do_epoll(int ms_timeout)
+{
+	struct epoll_event events[EPOLL_MAX_EVENTS];
+	struct pollfd pfd;
+	int i, r;
+
+	/* We still sleep via pollfn, so overrides (eg. sanity checks before
+	 * sleeping) work: they simply see a single fd, the epoll one. */
+	pfd.fd = epoll_fd;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	r = pollfn(&pfd, 1, ms_timeout);
+	if (r <= 0)
+		return r;
+
+	r = epoll_wait(epoll_fd, events, EPOLL_MAX_EVENTS, 0);
+	for (i = 0; i < r && !io_loop_return; i++) {
+		uint32_t fdnum = events[i].data.u64;
+		uint32_t gen = events[i].data.u64 >> 32;
+		struct epoll_slot *slot;
+		int pevents = 0;
+
+		/* Earlier callbacks may have closed this (or even reused the
+		 * fd number), or changed what we're waiting for. */
+		slot = &epoll_slots[fdnum];
+		if (!slot->fd || slot->gen != gen || !slot->events)
+			continue;
+
+		if (events[i].events & EPOLLIN)
+			pevents |= POLLIN;
+		if (events[i].events & EPOLLOUT)
+			pevents |= POLLOUT;
+		pevents &= slot->events;
+		if (events[i].events & EPOLLHUP)
+			pevents |= POLLHUP;
+		if (events[i].events & EPOLLERR)
+			pevents |= POLLERR;
+
+		fd_ready(slot->fd, pevents);
+	}
+	return r;
+}
+#else
+static bool using_epoll(void)
+{
+	return false;
+}
+
+static int do_epoll(int ms_timeout)
+{
+	abort();
+}
+#endif /* !HAVE_SYS_EPOLL_H */
+
 /* This is the main loop. */
 void *io_loop(struct timers *timers, struct timer **expired)
 {
@@ -372,19 +699,23 @@ void *io_loop(struct timers *timers, struct timer **expired)
 		*expired = NULL;
 
 	while (!io_loop_return) {
-		int i, r, ms_timeout = -1;
+		int r, ms_timeout = -1;
 
-		if (handle_always()) {
-			/* Could have started/finished more. */
-			continue;
-		}
+		handle_always();
+		if (io_loop_return)
+			break;
 
 		/* Everything closed? */
 		if (num_fds == 0)
 			break;
 
-		/* You can't tell them all to go to sleep! */
-		assert(num_waiting);
+		/* If there's more to do, just check what's ready, don't sleep */
+		if (have_always())
+			ms_timeout = 0;
+		else {
+			/* You can't tell them all to go to sleep! */
+			assert(num_waiting);
+		}
 
 		if (timers) {
 			struct timemono now, first;
@@ -397,7 +728,7 @@ void *io_loop(struct timers *timers, struct timer **expired)
 				break;
 
 			/* Now figure out how long to wait for the next one. */
-			if (timer_earliest(timers, &first)) {
+			if (ms_timeout != 0 && timer_earliest(timers, &first)) {
 				uint64_t next;
 				next = time_to_msec(timemono_between(first, now));
 				if (next < INT_MAX)
@@ -407,10 +738,10 @@ void *io_loop(struct timers *timers, struct timer **expired)
 			}
 		}
 
-		/* We do this temporarily, assuming exclusive is unusual */
-		exclude_pollfds();
-		r = pollfn(pollfds, num_fds, ms_timeout);
-		restore_pollfds();
+		if (using_epoll())
+			r = do_epoll(ms_timeout);
+		else
+			r = do_poll(ms_timeout);
 
 		if (r < 0) {
 			/* Signals shouldn't break us, unless they set
@@ -419,36 +750,6 @@ void *io_loop(struct timers *timers, struct timer **expired)
 				continue;
 			break;
 		}
-
-		for (i = 0; i < num_fds && !io_loop_return; i++) {
-			struct io_conn *c = (void *)fds[i];
-			int events = pollfds[i].revents;
-
-			/* Clear so we don't get confused if exclusive next time */
-			pollfds[i].revents = 0;
-
-			if (r == 0)
-				break;
-
-			if (fds[i]->listener) {
-				struct io_listener *l = (void *)fds[i];
-				if (events & POLLIN) {
-					accept_conn(l);
-					r--;
-				} else if (events & (POLLHUP|POLLNVAL|POLLERR)) {
-					r--;
-					errno = EBADF;
-					io_close_listener(l);
-				}
-			} else if (events & (POLLIN|POLLOUT)) {
-				r--;
-				io_ready(c, events);
-			} else if (events & (POLLHUP|POLLNVAL|POLLERR)) {
-				r--;
-				errno = EBADF;
-				io_close(c);
-			}
-		}
 	}
 
 	ret = io_loop_return;
@@ -0,0 +1,69 @@
+#include <ccan/io/io.h>
+/* Include the C files directly. */
+#include <ccan/io/poll.c>
+#include <ccan/io/io.c>
+#include <ccan/tap/tap.h>
+#include <sys/wait.h>
+#include <stdio.h>
+
+#define MAX_SPINS 1000
+
+struct data {
+	int spins;
+	bool read_done;
+	char buf[4];
+};
+
+/* This conn would happily spin forever with io_always. */
+static struct io_plan *spin(struct io_conn *conn, struct data *d)
+{
+	if (d->read_done || ++d->spins == MAX_SPINS)
+		return io_close(conn);
+	return io_always(conn, spin, d);
+}
+
+static struct io_plan *read_done(struct io_conn *conn, struct data *d)
+{
+	d->read_done = true;
+	return io_close(conn);
+}
+
+static struct io_plan *init_spin(struct io_conn *conn, struct data *d)
+{
+	return io_always(conn, spin, d);
+}
+
+static struct io_plan *init_read(struct io_conn *conn, struct data *d)
+{
+	return io_read(conn, d->buf, sizeof(d->buf), read_done, d);
+}
+
+int main(void)
+{
+	struct data d;
+	int spinfds[2], readfds[2];
+
+	/* This is how many tests you plan to run */
+	plan_tests(4);
+	d.spins = 0;
+	d.read_done = false;
+
+	ok1(pipe(spinfds) == 0);
+	ok1(pipe(readfds) == 0);
+	/* Data is already waiting for the reader. */
+	write(readfds[1], "abcd", 4);
+
+	io_new_conn(NULL, spinfds[0], init_spin, &d);
+	io_new_conn(NULL, readfds[0], init_read, &d);
+	io_loop(NULL, NULL);
+
+	/* The reader must get a look in long before the spinner gives up. */
+	ok1(d.read_done);
+	ok1(d.spins < 10);
+
+	close(spinfds[1]);
+	close(readfds[1]);
+
+	/* This exits depending on whether all tests passed */
+	return exit_status();
+}
@@ -0,0 +1,129 @@
+#include <ccan/io/io.h>
+/* Include the C files directly. */
+#include <ccan/io/poll.c>
+#include <ccan/io/io.c>
+#include <ccan/tap/tap.h>
+#include <sys/wait.h>
+#include <stdio.h>
+
+static size_t num_polls, max_nfds;
+
+static int mypoll(struct pollfd *fds, nfds_t nfds, int timeout)
+{
+	num_polls++;
+	if (nfds > max_nfds)
+		max_nfds = nfds;
+	return poll(fds, nfds, timeout);
+}
+
+struct data {
+	char buf[4];
+	int done;
+};
+
+static struct io_plan *read_done(struct io_conn *conn, struct data *d)
+{
+	ok1(memcmp(d->buf, "abcd", 4) == 0);
+	d->done++;
+	return io_close(conn);
+}
+
+static struct io_plan *write_done(struct io_conn *conn, struct data *d)
+{
+	d->done++;
+	return io_close(conn);
+}
+
+static struct io_plan *init_read(struct io_conn *conn, struct data *d)
+{
+	return io_read(conn, d->buf, sizeof(d->buf), read_done, d);
+}
+
+static struct io_plan *init_write(struct io_conn *conn, struct data *d)
+{
+	return io_write(conn, "abcd", 4, write_done, d);
+}
+
+static struct io_plan *init_idle(struct io_conn *conn, void *unused)
+{
+	return io_wait(conn, conn, io_never, NULL);
+}
+
+static char wakebuf[4];
+
+static struct io_plan *wake_idle(struct io_conn *conn, struct io_conn *idle)
+{
+	io_close(idle);
+	return io_close(conn);
+}
+
+static struct io_plan *init_waker(struct io_conn *conn, struct io_conn *idle)
+{
+	return io_read(conn, wakebuf, sizeof(wakebuf), wake_idle, idle);
+}
+
+static void write_later(int fd)
+{
+	fflush(stdout);
+	if (!fork()) {
+		usleep(100000);
+		write(fd, "abcd", 4);
+		exit(0);
+	}
+}
+
+int main(void)
+{
+	struct data d;
+	int fds[2], idlefds[2], status;
+	struct io_conn *idle, *conn;
+
+	/* This is how many tests you plan to run */
+	plan_tests(15);
+
+	ok1(io_poll_override(mypoll) == poll);
+	ok1(io_use_epoll(true));
+
+	/* Simple read and write, through epoll. */
+	d.done = 0;
+	ok1(pipe(fds) == 0);
+	io_new_conn(NULL, fds[0], init_read, &d);
+	io_new_conn(NULL, fds[1], init_write, &d);
+	ok1(io_loop(NULL, NULL) == NULL);
+	ok1(d.done == 2);
+	/* We only ever gave poll the epoll fd. */
+	ok1(max_nfds == 1);
+
+	/* Idle conn with a hung-up peer mustn't wake us (unlike poll(),
+	 * epoll always reports hangups).  fd numbers get reused here, too. */
+	num_polls = 0;
+	ok1(pipe(idlefds) == 0);
+	ok1(pipe(fds) == 0);
+	idle = io_new_conn(NULL, idlefds[0], init_idle, NULL);
+	close(idlefds[1]);
+	write_later(fds[1]);
+	io_new_conn(NULL, fds[0], init_waker, idle);
+	ok1(io_loop(NULL, NULL) == NULL);
+	ok1(num_polls < 10);
+	close(fds[1]);
+	wait(&status);
+
+	/* A child touching io mustn't change what the parent watches. */
+	d.done = 0;
+	ok1(pipe(fds) == 0);
+	conn = io_new_conn(NULL, fds[0], init_read, &d);
+	fflush(stdout);
+	if (!fork()) {
+		io_close(conn);
+		exit(0);
+	}
+	wait(&status);
+	write_later(fds[1]);
+	ok1(io_loop(NULL, NULL) == NULL);
+	ok1(d.done == 1);
+	close(fds[1]);
+	wait(&status);
+
+	/* This exits depending on whether all tests passed */
+	return exit_status();
+}
@@ -393,6 +393,9 @@ static const struct test base_tests[] = {
 	{ "HAVE_STATEMENT_EXPR", "statement expression support",
 	  "INSIDE_MAIN", NULL, NULL,
 	  "return ({ int x = argc; x == argc ? 0 : 1; });" },
+	{ "HAVE_SYS_EPOLL_H", "<sys/epoll.h>",
+	  "OUTSIDE_MAIN", NULL, NULL,
+	  "#include <sys/epoll.h>\n" },
 	{ "HAVE_SYS_FILIO_H", "<sys/filio.h>",
 	  "OUTSIDE_MAIN", NULL, NULL, /* Solaris needs this for FIONREAD */
 	  "#include <sys/filio.h>\n" },
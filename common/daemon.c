@@ -153,6 +153,9 @@ void daemon_setup(const char *argv0,
 
 	setup_tmpctx();
 	io_poll_override(daemon_poll);
+	/* With many peers, poll()ing every fd on every loop adds up: this
+	 * quietly does nothing if we don't have epoll. */
+	io_use_epoll(true);
 }
 
 void daemon_shutdown(void)
@@ -94,6 +94,9 @@ static void children_into_htable(const void *exclude1, const void *exclude2,
 			if (strends(name, "struct io_plan *[]") && !tal_parent(i))
 				continue;
 
+			if (strends(name, "struct epoll_slot[]") && !tal_parent(i))
+				continue;
+
 			/* Don't add tmpctx. */
 			if (streq(name, "tmpctx"))
 				continue;
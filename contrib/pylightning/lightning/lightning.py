@@ -601,6 +601,15 @@ class LightningRpc(UnixDomainSocketRpc):
         }
         return self.call("listchannels", payload)
 
+    def listclosedchannels(self, peerid=None):
+        """
+        Show channels closed and archived, only with {peerid} if set
+        """
+        payload = {
+            "id": peerid,
+        }
+        return self.call("listclosedchannels", payload)
+
     def listconfigs(self, config=None):
         """List this node's config
         """
@@ -609,10 +618,38 @@ class LightningRpc(UnixDomainSocketRpc):
         }
         return self.call("listconfigs", payload)
 
-    def listforwards(self):
-        """List all forwarded payments and their information
+    def listforwards(self, status=None, in_channel=None, out_channel=None,
+                     received_since=None, received_before=None, start=None,
+                     limit=None):
+        """List forwarded payments, optionally only those with {status},
+        {in_channel}, {out_channel}, or received in [{received_since},
+        {received_before}) (UNIX seconds); at most {limit} of them,
+        starting at {start} in updated_index order
         """
-        return self.call("listforwards")
+        payload = {
+            "status": status,
+            "in_channel": in_channel,
+            "out_channel": out_channel,
+            "received_since": received_since,
+            "received_before": received_before,
+            "start": start,
+            "limit": limit,
+        }
+        return self.call("listforwards", payload)
+
+    def listforwardstats(self, period=None, since=None, before=None,
+                         per_channel=None):
+        """Show forwarding totals per {period} ('hour', 'day' or 'total'),
+        for forwards received in [{since}, {before}), optionally
+        {per_channel} pair
+        """
+        payload = {
+            "period": period,
+            "since": since,
+            "before": before,
+            "per_channel": per_channel,
+        }
+        return self.call("listforwardstats", payload)
 
     def listfunds(self):
         """
@@ -626,12 +663,22 @@ class LightningRpc(UnixDomainSocketRpc):
         """
         return self.call("listtransactions")
 
-    def listinvoices(self, label=None):
+    def listinvoices(self, label=None, status=None, index=None, start=None,
+                     limit=None, paid_since=None, expires_before=None):
         """
-        Show invoice {label} (or all, if no {label))
+        Show invoice {label} (or all, if no {label)), optionally only
+        {status}, paid since {paid_since} or expiring before
+        {expires_before}, at most {limit} of them, from {start} in {index}
+        order ('created' or 'paid')
         """
         payload = {
-            "label": label
+            "label": label,
+            "status": status,
+            "index": index,
+            "start": start,
+            "limit": limit,
+            "paid_since": paid_since,
+            "expires_before": expires_before,
         }
         return self.call("listinvoices", payload)
 
@@ -667,11 +714,22 @@ class LightningRpc(UnixDomainSocketRpc):
         }
         return self.call("listpeers", payload)
 
-    def listsendpays(self, bolt11=None, payment_hash=None):
-        """Show all sendpays results, or only for `bolt11` or `payment_hash`"""
+    def listsendpays(self, bolt11=None, payment_hash=None, status=None,
+                     created_since=None, created_before=None, start=None,
+                     limit=None):
+        """Show all sendpays results, or only for `bolt11` or `payment_hash`,
+        optionally only those with {status}, or created in
+        [{created_since}, {created_before}) (UNIX seconds); at most {limit}
+        of them, starting at id {start}
+        """
         payload = {
             "bolt11": bolt11,
-            "payment_hash": payment_hash
+            "payment_hash": payment_hash,
+            "status": status,
+            "created_since": created_since,
+            "created_before": created_before,
+            "start": start,
+            "limit": limit,
         }
         return self.call("listsendpays", payload)
 
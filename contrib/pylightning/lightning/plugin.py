@@ -7,6 +7,7 @@ import inspect
 import json
 import os
 import re
+import struct
 import sys
 import traceback
 
@@ -22,6 +23,88 @@ class RequestState(Enum):
     FAILED = 'failed'
 
 
+class BinaryHooks(object):
+    """Compact encodings of hot hooks, as in common/plugin_wire.csv.
+
+    Only used if the plugin asked for binary framing: requests are
+    decoded into the same params as the JSON version, and results are
+    encoded back, so hook handlers don't need to care.
+    """
+    HOOK_CONTINUE = 1000
+    HTLC_ACCEPTED = 1001
+    HTLC_ACCEPTED_REPLY = 1101
+
+    @staticmethod
+    def _scid(v):
+        return "{}x{}x{}".format(v >> 40, (v >> 16) & 0xFFFFFF, v & 0xFFFF)
+
+    @staticmethod
+    def decode_htlc_accepted(msg):
+        off = 0
+
+        def take(fmt):
+            nonlocal off
+            vals = struct.unpack_from(fmt, msg, off)
+            off += struct.calcsize(fmt)
+            return vals[0] if len(vals) == 1 else vals
+
+        def take_bytes(n):
+            nonlocal off
+            off += n
+            return msg[off - n:off]
+
+        payload = take_bytes(take('>H'))
+        realm, scid, fwd_amount, outgoing_cltv = take('>BQQI')
+        next_onion = take_bytes(take('>H'))
+        shared_secret = take_bytes(32)
+        amount, cltv_expiry, blockheight = take('>QII')
+        payment_hash = take_bytes(32)
+
+        onion = {'payload': payload.hex()}
+        if realm == 0:
+            onion['per_hop_v0'] = {
+                'realm': '00',
+                'short_channel_id': BinaryHooks._scid(scid),
+                'forward_amount': '{}msat'.format(fwd_amount),
+                'outgoing_cltv_value': outgoing_cltv,
+            }
+        onion['next_onion'] = next_onion.hex()
+        onion['shared_secret'] = shared_secret.hex()
+        return {
+            'onion': onion,
+            'htlc': {
+                'amount': '{}msat'.format(amount),
+                'cltv_expiry': cltv_expiry,
+                'cltv_expiry_relative': cltv_expiry - blockheight,
+                'payment_hash': payment_hash.hex(),
+            },
+        }
+
+    @staticmethod
+    def encode_htlc_accepted(result):
+        if result['result'] == 'continue':
+            return struct.pack('>H', BinaryHooks.HOOK_CONTINUE)
+        if result['result'] == 'fail':
+            # Default is temporary_node_failure, as in JSON.
+            update = bytes.fromhex(result.get('channel_update', ''))
+            return (struct.pack('>HBHH', BinaryHooks.HTLC_ACCEPTED_REPLY, 1,
+                                result.get('failure_code', 0x2002),
+                                len(update))
+                    + update + bytes(32))
+        if result['result'] == 'resolve':
+            return (struct.pack('>HBHH', BinaryHooks.HTLC_ACCEPTED_REPLY, 2,
+                                0, 0)
+                    + bytes.fromhex(result['payment_key']))
+        raise ValueError("Unknown htlc_accepted result {}".format(result))
+
+    # Message type -> (method, decoder, result encoder)
+    requests = {
+        HTLC_ACCEPTED: ('htlc_accepted',
+                        decode_htlc_accepted.__func__,
+                        encode_htlc_accepted.__func__),
+    }
+
+
 class Method(object):
     """Description of methods that are registered with the plugin.
 
@@ -48,6 +131,8 @@ class Request(dict):
         self.plugin = plugin
         self.state = RequestState.PENDING
         self.id = req_id
+        # Set for binary requests: encodes our result.
+        self.encoder = None
 
     def getattr(self, key):
         if key == "params":
@@ -63,6 +148,10 @@ class Request(dict):
                 "Cannot set the result of a request that is not pending, "
                 "current state is {state}".format(self.state))
         self.result = result
+        if self.encoder:
+            self.plugin._write_frame(b'\x00' + struct.pack('>Q', self.id)
+                                     + self.encoder(result))
+            return
         self._write_result({
             'jsonrpc': '2.0',
             'id': self.id,
@@ -96,7 +185,14 @@ class Plugin(object):
 
     """
 
-    def __init__(self, stdout=None, stdin=None, autopatch=True):
+    def __init__(self, stdout=None, stdin=None, autopatch=True, binary=False):
+        """If @binary, we ask lightningd for length-prefixed frames, with
+        compact encodings for hot hooks like htlc_accepted.
+        """
+        self.binary = binary
+        self.manifest_sent = False
+        # Are we using frames yet? (only after the getmanifest response)
+        self.framed = False
         self.methods = {'init': Method('init', self._init, MethodType.RPCMETHOD)}
         self.options = {}
 
@@ -379,11 +475,20 @@ class Plugin(object):
     def _write_locked(self, obj):
         # ensure_ascii turns UTF-8 into \uXXXX so we need to suppress that,
         # then utf8 ourselves.
-        s = bytes(json.dumps(obj, cls=LightningRpc.LightningJSONEncoder, ensure_ascii=False) + "\n\n", encoding='utf-8')
+        s = json.dumps(obj, cls=LightningRpc.LightningJSONEncoder, ensure_ascii=False)
+        if self.framed:
+            self._write_frame(bytes(s, encoding='utf-8'))
+            return
+        s = bytes(s + "\n\n", encoding='utf-8')
         with self.write_lock:
             self.stdout.buffer.write(s)
             self.stdout.flush()
 
+    def _write_frame(self, body):
+        with self.write_lock:
+            self.stdout.buffer.write(struct.pack('>I', len(body)) + body)
+            self.stdout.flush()
+
     def notify(self, method, params):
         payload = {
             'jsonrpc': '2.0',
@@ -428,7 +533,57 @@ class Plugin(object):
 
         return msgs[-1]
 
+    def _dispatch_frame(self, body):
+        if body[0] != 0:
+            self._multi_dispatch([body, b''])
+            return
+
+        req_id, mtype = struct.unpack_from('>QH', body, 1)
+        if mtype not in BinaryHooks.requests:
+            raise ValueError("Unknown binary message type {}".format(mtype))
+        method, decode, encode = BinaryHooks.requests[mtype]
+        request = Request(
+            plugin=self,
+            req_id=req_id,
+            method=method,
+            params=decode(body[11:]),
+            background=False,
+        )
+        request.encoder = encode
+        self._dispatch_request(request)
+
+    def _run_framed(self):
+        buf = b""
+        while True:
+            data = self.stdin.buffer.read1(65536)
+            if not data:
+                return
+            buf += data
+
+            while not self.framed:
+                msgs = buf.split(b'\n\n', 1)
+                if len(msgs) < 2:
+                    break
+                buf = self._multi_dispatch(msgs)
+                # Everything after our manifest is framed.
+                if self.manifest_sent:
+                    self.framed = True
+
+            while self.framed:
+                # Frame lengths never start with whitespace.
+                buf = buf.lstrip(b' \n')
+                if len(buf) < 4:
+                    break
+                length = struct.unpack_from('>I', buf)[0]
+                if len(buf) < 4 + length:
+                    break
+                body, buf = buf[4:4 + length], buf[4 + length:]
+                self._dispatch_frame(body)
+
     def run(self):
+        if self.binary:
+            return self._run_framed()
+
         partial = b""
         for l in self.stdin.buffer:
             partial += l
@@ -483,12 +638,16 @@ class Plugin(object):
                 'description': doc
             })
 
-        return {
+        manifest = {
             'options': list(self.options.values()),
             'rpcmethods': methods,
             'subscriptions': list(self.subscriptions.keys()),
             'hooks': hooks,
         }
+        if self.binary:
+            manifest['framing'] = 'binary'
+            self.manifest_sent = True
+        return manifest
 
     def _init(self, options, configuration, request):
         self.rpc_filename = configuration['rpc-file']
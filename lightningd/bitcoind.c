@@ -1,13 +1,17 @@
-/* Code for talking to bitcoind.  We use bitcoin-cli. */
+/* Code for talking to bitcoind.  We use JSON-RPC if we know its rpcuser and
+ * rpcpassword, otherwise (or if that fails) bitcoin-cli. */
 #include "bitcoin/base58.h"
 #include "bitcoin/block.h"
 #include "bitcoin/feerate.h"
 #include "bitcoin/shadouble.h"
 #include "bitcoind.h"
+#include "bitcoind_rpc.h"
 #include "lightningd.h"
 #include "log.h"
+#include <ccan/array_size/array_size.h>
 #include <ccan/cast/cast.h>
 #include <ccan/io/io.h>
+#include <ccan/json_escape/json_escape.h>
 #include <ccan/pipecmd/pipecmd.h>
 #include <ccan/str/hex/hex.h>
 #include <ccan/take/take.h>
@@ -29,6 +33,15 @@
  */
 #define BITCOIND_MAX_PARALLEL 4
 
+/* Over JSON-RPC, that's how many connections we use, and each request can
+ * be a batch of this many calls. */
+#define BITCOIND_RPC_MAX_BATCH 16
+
+/* After a failed JSON-RPC call, how long (doubling each time it fails
+ * again) we use bitcoin-cli before trying again. */
+#define BITCOIND_RPC_MIN_BACKOFF 1
+#define BITCOIND_RPC_MAX_BACKOFF 64
+
 /* Add the n'th arg to *args, incrementing n and keeping args of size n+1 */
 static void add_arg(const char ***args, const char *arg)
 {
@@ -80,6 +93,8 @@ struct bitcoin_cli {
 	int *exitstatus;
 	pid_t pid;
 	const char **args;
+	/* The method, then its params, within args. */
+	const char **cmd;
 	struct timeabs start;
 	enum bitcoind_prio prio;
 	char *output;
@@ -165,9 +180,9 @@ static void bcli_failure(struct bitcoind *bitcoind,
 		     retry_bcli, bcli);
 }
 
-static void bcli_finished(struct io_conn *conn UNUSED, struct bitcoin_cli *bcli)
+/* bcli->output is what bitcoin-cli printed, and it exited with exitstatus */
+static void bcli_done(struct bitcoin_cli *bcli, int exitstatus)
 {
-	int ret, status;
 	struct bitcoind *bitcoind = bcli->bitcoind;
 	enum bitcoind_prio prio = bcli->prio;
 	bool ok;
@@ -181,27 +196,16 @@ static void bcli_finished(struct io_conn *conn UNUSED, struct bitcoin_cli *bcli)
 
 	assert(bitcoind->num_requests[prio] > 0);
 
-	/* FIXME: If we waited for SIGCHILD, this could never hang! */
-	while ((ret = waitpid(bcli->pid, &status, 0)) < 0 && errno == EINTR);
-	if (ret != bcli->pid)
-		fatal("%s %s", bcli_args(tmpctx, bcli),
-		      ret == 0 ? "not exited?" : strerror(errno));
-
-	if (!WIFEXITED(status))
-		fatal("%s died with signal %i",
-		      bcli_args(tmpctx, bcli),
-		      WTERMSIG(status));
-
 	if (!bcli->exitstatus) {
-		if (WEXITSTATUS(status) != 0) {
-			bcli_failure(bitcoind, bcli, WEXITSTATUS(status));
+		if (exitstatus != 0) {
+			bcli_failure(bitcoind, bcli, exitstatus);
 			bitcoind->num_requests[prio]--;
 			goto done;
 		}
 	} else
-		*bcli->exitstatus = WEXITSTATUS(status);
+		*bcli->exitstatus = exitstatus;
 
-	if (WEXITSTATUS(status) == 0)
+	if (exitstatus == 0)
 		bitcoind->error_count = 0;
 
 	bitcoind->num_requests[bcli->prio]--;
@@ -215,7 +219,7 @@ static void bcli_finished(struct io_conn *conn UNUSED, struct bitcoin_cli *bcli)
 	db_commit_transaction(bitcoind->ld->wallet->db);
 
 	if (!ok)
-		bcli_failure(bitcoind, bcli, WEXITSTATUS(status));
+		bcli_failure(bitcoind, bcli, exitstatus);
 	else
 		tal_free(bcli);
 
@@ -223,27 +227,184 @@ done:
 	next_bcli(bitcoind, prio);
 }
 
+static void bcli_finished(struct io_conn *conn UNUSED, struct bitcoin_cli *bcli)
+{
+	int ret, status;
+
+	/* FIXME: If we waited for SIGCHILD, this could never hang! */
+	while ((ret = waitpid(bcli->pid, &status, 0)) < 0 && errno == EINTR);
+	if (ret != bcli->pid)
+		fatal("%s %s", bcli_args(tmpctx, bcli),
+		      ret == 0 ? "not exited?" : strerror(errno));
+
+	if (!WIFEXITED(status))
+		fatal("%s died with signal %i",
+		      bcli_args(tmpctx, bcli),
+		      WTERMSIG(status));
+
+	bcli_done(bcli, WEXITSTATUS(status));
+}
+
+/* bitcoin-cli turns these params into JSON (see vRPCConvertParams in
+ * bitcoin/src/rpc/client.cpp); the rest are strings. */
+static const struct {
+	const char *method;
+	size_t param;
+} bcli_json_params[] = {
+	{ "estimatesmartfee", 0 },
+	{ "getblock", 1 },
+	{ "getblockhash", 0 },
+	{ "gettxout", 1 },
+};
+
+static bool bcli_param_is_json(const char *method, size_t param)
+{
+	for (size_t i = 0; i < ARRAY_SIZE(bcli_json_params); i++) {
+		if (streq(bcli_json_params[i].method, method)
+		    && bcli_json_params[i].param == param)
+			return true;
+	}
+	return false;
+}
+
+static const char *bcli_params(const tal_t *ctx, const struct bitcoin_cli *bcli)
+{
+	char *params = tal_strdup(ctx, "[");
+
+	for (size_t i = 1; bcli->cmd[i]; i++) {
+		const char *sep = i > 1 ? "," : "";
+		if (bcli_param_is_json(bcli->cmd[0], i - 1))
+			tal_append_fmt(&params, "%s%s", sep, bcli->cmd[i]);
+		else
+			tal_append_fmt(&params, "%s\"%s\"", sep,
+				       json_escape(tmpctx, bcli->cmd[i])->s);
+	}
+	tal_append_fmt(&params, "]");
+	return params;
+}
+
+static bool bcli_use_rpc(const struct bitcoind *bitcoind)
+{
+	if (!bitcoind->rpc || bitcoind->rpc_failed)
+		return false;
+	return !bitcoind->rpc_backoff
+		|| time_to_sec(timemono_since(bitcoind->rpc_fail_time))
+		>= bitcoind->rpc_backoff;
+}
+
+static void bcli_rpc_failed(struct bitcoind *bitcoind)
+{
+	/* bitcoin-cli may know better (eg. it uses the cookie file) */
+	if (bitcoind_rpc_unusable(bitcoind->rpc)) {
+		if (!bitcoind->rpc_failed)
+			log_unusual(bitcoind->log,
+				    "JSON-RPC to bitcoind failed:"
+				    " using bitcoin-cli from now on");
+		bitcoind->rpc_failed = true;
+		return;
+	}
+
+	/* Calls we sent before backing off don't back us off further. */
+	if (!bcli_use_rpc(bitcoind))
+		return;
+
+	if (!bitcoind->rpc_backoff)
+		bitcoind->rpc_backoff = BITCOIND_RPC_MIN_BACKOFF;
+	else if (bitcoind->rpc_backoff < BITCOIND_RPC_MAX_BACKOFF)
+		bitcoind->rpc_backoff *= 2;
+	bitcoind->rpc_fail_time = time_mono();
+	log_unusual(bitcoind->log,
+		    "JSON-RPC to bitcoind failed:"
+		    " using bitcoin-cli for %u seconds", bitcoind->rpc_backoff);
+}
+
+/* Make it look like bitcoin-cli's output, for the process callbacks. */
+static void bcli_rpc_done(const char *buf,
+			  const jsmntok_t *result,
+			  const jsmntok_t *error,
+			  struct bitcoin_cli *bcli)
+{
+	struct bitcoind *bitcoind = bcli->bitcoind;
+	int exitstatus = 0;
+
+	if (!buf) {
+		bcli_rpc_failed(bitcoind);
+		/* This call goes via bitcoin-cli, at the front of the queue */
+		bitcoind->num_requests[bcli->prio]--;
+		list_add(&bitcoind->pending[bcli->prio], &bcli->list);
+		next_bcli(bitcoind, bcli->prio);
+		return;
+	}
+	bitcoind->rpc_backoff = 0;
+
+	if (error) {
+		const jsmntok_t *codetok, *msgtok;
+		int code;
+
+		codetok = json_get_member(buf, error, "code");
+		msgtok = json_get_member(buf, error, "message");
+		if (!codetok || !json_to_int(buf, codetok, &code))
+			code = -1;
+		/* bitcoin-cli exits with abs(code) */
+		exitstatus = abs(code);
+		bcli->output = tal_fmt(bcli, "error code: %d\n"
+				       "error message:\n%.*s\n",
+				       code,
+				       msgtok ? json_tok_full_len(msgtok)
+				       : json_tok_full_len(error),
+				       msgtok ? json_tok_full(buf, msgtok)
+				       : json_tok_full(buf, error));
+	} else if (json_tok_is_null(buf, result)) {
+		bcli->output = tal_strdup(bcli, "");
+	} else if (result->type == JSMN_STRING) {
+		struct json_escape *esc;
+
+		esc = json_escape_string_(tmpctx, buf + result->start,
+					  result->end - result->start);
+		bcli->output = tal_fmt(bcli, "%s\n",
+				       json_escape_unescape(tmpctx, esc));
+	} else {
+		bcli->output = tal_fmt(bcli, "%.*s\n",
+				       json_tok_full_len(result),
+				       json_tok_full(buf, result));
+	}
+	bcli->output_bytes = strlen(bcli->output);
+	bcli_done(bcli, exitstatus);
+}
+
 static void next_bcli(struct bitcoind *bitcoind, enum bitcoind_prio prio)
 {
 	struct bitcoin_cli *bcli;
 	struct io_conn *conn;
+	size_t max_parallel = BITCOIND_MAX_PARALLEL;
+
+	/* The JSON-RPC client batches up what we give it. */
+	if (bcli_use_rpc(bitcoind))
+		max_parallel *= BITCOIND_RPC_MAX_BATCH;
 
-	if (bitcoind->num_requests[prio] >= BITCOIND_MAX_PARALLEL)
+	if (bitcoind->num_requests[prio] >= max_parallel)
 		return;
 
 	bcli = list_pop(&bitcoind->pending[prio], struct bitcoin_cli, list);
 	if (!bcli)
 		return;
 
+	bcli->start = time_now();
+
+	bitcoind->num_requests[prio]++;
+
+	if (bcli_use_rpc(bitcoind)) {
+		bitcoind_rpc_call(bitcoind->rpc, bcli->cmd[0],
+				  bcli_params(tmpctx, bcli),
+				  bcli_rpc_done, bcli);
+		return;
+	}
+
 	bcli->pid = pipecmdarr(NULL, &bcli->fd, &bcli->fd,
 			       cast_const2(char **, bcli->args));
 	if (bcli->pid < 0)
 		fatal("%s exec failed: %s", bcli->args[0], strerror(errno));
 
-	bcli->start = time_now();
-
-	bitcoind->num_requests[prio]++;
-
 	/* This lifetime is attached to bitcoind command fd */
 	conn = notleak(io_new_conn(bitcoind, bcli->fd, output_init, bcli));
 	io_set_finish(conn, bcli_finished, bcli);
@@ -303,6 +464,10 @@ start_bitcoin_cli(struct bitcoind *bitcoind,
 	va_start(ap, cmd);
 	bcli->args = gather_args(bitcoind, bcli, cmd, ap);
 	va_end(ap);
+	/* gather_args() puts cmd itself in args. */
+	bcli->cmd = bcli->args;
+	while (*bcli->cmd != cmd)
+		bcli->cmd++;
 
 	list_add_tail(&bitcoind->pending[bcli->prio], &bcli->list);
 	next_bcli(bitcoind, bcli->prio);
@@ -856,6 +1021,29 @@ void wait_for_bitcoind(struct bitcoind *bitcoind)
 		sleep(1);
 	}
 	tal_free(cmd);
+
+	/* Knowing its credentials, we can talk to it directly, rather than
+	 * running bitcoin-cli every time. */
+	if (bitcoind->rpcuser && bitcoind->rpcpass) {
+		const char *host, *port;
+
+		host = bitcoind->rpcconnect ? bitcoind->rpcconnect : "127.0.0.1";
+		if (bitcoind->rpcport)
+			port = bitcoind->rpcport;
+		else
+			port = tal_fmt(tmpctx, "%d",
+				       bitcoind->chainparams->rpc_port);
+		bitcoind->rpc = new_bitcoind_rpc(bitcoind, bitcoind->log,
+						 host, port,
+						 bitcoind->rpcuser,
+						 bitcoind->rpcpass,
+						 BITCOIND_MAX_PARALLEL,
+						 BITCOIND_RPC_MAX_BATCH);
+		if (bitcoind->rpc)
+			log_debug(bitcoind->log,
+				  "Using JSON-RPC to bitcoind at %s:%s",
+				  host, port);
+	}
 }
 
 struct bitcoind *new_bitcoind(const tal_t *ctx,
@@ -880,6 +1068,9 @@ struct bitcoind *new_bitcoind(const tal_t *ctx,
 	bitcoind->rpcpass = NULL;
 	bitcoind->rpcconnect = NULL;
 	bitcoind->rpcport = NULL;
+	bitcoind->rpc = NULL;
+	bitcoind->rpc_failed = false;
+	bitcoind->rpc_backoff = 0;
 	tal_add_destructor(bitcoind, destroy_bitcoind);
 
 	return bitcoind;
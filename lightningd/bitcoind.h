@@ -17,6 +17,7 @@ struct lightningd;
 struct ripemd160;
 struct bitcoin_tx;
 struct bitcoin_block;
+struct bitcoind_rpc;
 
 enum bitcoind_mode {
 	BITCOIND_MAINNET = 1,
@@ -61,6 +62,15 @@ struct bitcoind {
 
 	/* Passthrough parameters for bitcoin-cli */
 	char *rpcuser, *rpcpass, *rpcconnect, *rpcport;
+
+	/* If we have rpcuser and rpcpass, we talk to it directly... */
+	struct bitcoind_rpc *rpc;
+	/* ...unless it turned us away, and we went back to bitcoin-cli... */
+	bool rpc_failed;
+	/* ...or a call failed lately: then we use bitcoin-cli until
+	 * rpc_backoff seconds after rpc_fail_time (0 if all is well). */
+	struct timemono rpc_fail_time;
+	u32 rpc_backoff;
 };
 
 struct bitcoind *new_bitcoind(const tal_t *ctx,
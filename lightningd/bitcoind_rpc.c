@@ -0,0 +1,489 @@
+/* A JSON-RPC client for bitcoind, over HTTP/1.1 keep-alive connections.
+ *
+ * bitcoind's HTTP server (libevent's) handles one request at a time on each
+ * connection, so we keep a few open, and whatever calls queue up while
+ * they're busy go out together as a single batch request.  That's also
+ * kinder to its work queue, which counts HTTP requests, not calls. */
+#include "bitcoind_rpc.h"
+#include "log.h"
+#include <ccan/io/io.h>
+#include <ccan/list/list.h>
+#include <ccan/mem/mem.h>
+#include <ccan/str/str.h>
+#include <ccan/tal/str/str.h>
+#include <common/utils.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <netdb.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+struct rpc_call {
+	/* In bitcoind_rpc->pending until it's sent. */
+	struct list_node list;
+	u64 id;
+	const char *method, *params;
+	void (*cb)(const char *buf,
+		   const jsmntok_t *result,
+		   const jsmntok_t *error,
+		   void *arg);
+	void *arg;
+};
+
+struct rpc_conn {
+	/* In bitcoind_rpc->idle while idle. */
+	struct list_node list;
+	bool idle;
+	struct bitcoind_rpc *rpc;
+
+	/* Has it already answered a request?  Then bitcoind may have timed
+	 * it out while idle, and we simply try again on a new one. */
+	bool reused;
+
+	/* The calls in the request we're doing, and the request itself. */
+	struct rpc_call **calls;
+	char *request;
+
+	/* The response so far: we've read len bytes into buf. */
+	char *buf;
+	size_t len, len_read;
+	/* Once we have the headers, where the body starts, and its length */
+	size_t body_off, body_len;
+	int status;
+	bool keepalive;
+};
+
+struct bitcoind_rpc {
+	struct log *log;
+	struct addrinfo *addrinfo;
+	const char *host;
+	/* base64 of "user:pass" */
+	const char *auth;
+	size_t max_conns, max_batch;
+	size_t num_conns;
+
+	/* Calls not sent yet. */
+	struct list_head pending;
+	/* Connections waiting for something to send. */
+	struct list_head idle;
+
+	u64 next_id;
+
+	/* Being freed: don't call back as connections close. */
+	bool shutdown;
+
+	/* Wrong credentials: no point trying again. */
+	bool unusable;
+};
+
+static void rpc_dispatch(struct bitcoind_rpc *rpc);
+
+static char *base64(const tal_t *ctx, const char *str)
+{
+	static const char chars[]
+		= "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	const u8 *in = (const u8 *)str;
+	size_t len = strlen(str);
+	char *out = tal_arr(ctx, char, (len + 2) / 3 * 4 + 1), *p = out;
+
+	for (size_t i = 0; i < len; i += 3) {
+		u32 v = (u32)in[i] << 16;
+
+		if (i + 1 < len)
+			v |= (u32)in[i+1] << 8;
+		if (i + 2 < len)
+			v |= in[i+2];
+		*(p++) = chars[(v >> 18) & 0x3F];
+		*(p++) = chars[(v >> 12) & 0x3F];
+		*(p++) = i + 1 < len ? chars[(v >> 6) & 0x3F] : '=';
+		*(p++) = i + 2 < len ? chars[v & 0x3F] : '=';
+	}
+	*p = '\0';
+	return out;
+}
+
+static void fail_calls(struct bitcoind_rpc *rpc, struct rpc_call **calls)
+{
+	for (size_t i = 0; i < tal_count(calls); i++)
+		calls[i]->cb(NULL, NULL, NULL, calls[i]->arg);
+}
+
+static void rpc_conn_take_calls(struct rpc_conn *rc)
+{
+	struct bitcoind_rpc *rpc = rc->rpc;
+	struct rpc_call *call;
+	char *body;
+	size_t n;
+
+	rc->calls = tal_arr(rc, struct rpc_call *, 0);
+	while (tal_count(rc->calls) < rpc->max_batch
+	       && (call = list_pop(&rpc->pending, struct rpc_call, list))) {
+		tal_steal(rc->calls, call);
+		tal_arr_expand(&rc->calls, call);
+	}
+
+	/* A batch of one is just a call. */
+	n = tal_count(rc->calls);
+	body = tal_strdup(tmpctx, n > 1 ? "[" : "");
+	for (size_t i = 0; i < n; i++)
+		tal_append_fmt(&body,
+			       "%s{\"jsonrpc\":\"1.0\",\"id\":%"PRIu64","
+			       "\"method\":\"%s\",\"params\":%s}",
+			       i ? "," : "",
+			       rc->calls[i]->id,
+			       rc->calls[i]->method,
+			       rc->calls[i]->params);
+	if (n > 1)
+		tal_append_fmt(&body, "]");
+
+	tal_free(rc->request);
+	rc->request = tal_fmt(rc,
+			      "POST / HTTP/1.1\r\n"
+			      "Host: %s\r\n"
+			      "Authorization: Basic %s\r\n"
+			      "Content-Type: application/json\r\n"
+			      "Content-Length: %zu\r\n"
+			      "\r\n"
+			      "%s",
+			      rpc->host, rpc->auth, strlen(body), body);
+}
+
+/* We don't do chunked encoding: bitcoind always gives Content-Length. */
+static bool parse_headers(struct rpc_conn *rc, size_t hdrlen)
+{
+	char **lines = tal_strsplit(tmpctx,
+				    tal_strndup(tmpctx, rc->buf, hdrlen),
+				    "\r\n", STR_NO_EMPTY);
+	bool have_len = false;
+
+	/* HTTP/1.1 200 OK */
+	if (!lines[0] || !strstarts(lines[0], "HTTP/1.")
+	    || strlen(lines[0]) < strlen("HTTP/1.x 200"))
+		return false;
+	rc->keepalive = (lines[0][7] == '1');
+	rc->status = atoi(lines[0] + strlen("HTTP/1.x "));
+
+	for (size_t i = 1; lines[i]; i++) {
+		char *val = strchr(lines[i], ':');
+
+		if (!val)
+			return false;
+		*(val++) = '\0';
+		val += strspn(val, " \t");
+		if (strcasecmp(lines[i], "Content-Length") == 0) {
+			char *end;
+			rc->body_len = strtoul(val, &end, 10);
+			if (end == val)
+				return false;
+			have_len = true;
+		} else if (strcasecmp(lines[i], "Connection") == 0)
+			rc->keepalive = (strcasecmp(val, "close") != 0);
+		else if (strcasecmp(lines[i], "Transfer-Encoding") == 0)
+			return false;
+	}
+
+	rc->body_off = hdrlen;
+	return have_len;
+}
+
+static void deliver(struct bitcoind_rpc *rpc, struct rpc_call *call,
+		    const char *buf, const jsmntok_t *tok)
+{
+	const jsmntok_t *result, *error;
+
+	result = json_get_member(buf, tok, "result");
+	error = json_get_member(buf, tok, "error");
+	if (error && json_tok_is_null(buf, error))
+		error = NULL;
+
+	if (error)
+		call->cb(buf, NULL, error, call->arg);
+	else if (result)
+		call->cb(buf, result, NULL, call->arg);
+	else {
+		log_unusual(rpc->log, "%s: response without result or error",
+			    call->method);
+		call->cb(NULL, NULL, NULL, call->arg);
+	}
+}
+
+static struct io_plan *send_request(struct io_conn *conn, struct rpc_conn *rc);
+
+static struct io_plan *response_done(struct io_conn *conn, struct rpc_conn *rc)
+{
+	struct bitcoind_rpc *rpc = rc->rpc;
+	struct rpc_call **calls = tal_steal(tmpctx, rc->calls);
+	/* Steal buffer too: rc may be gone (or busy again) by the time we
+	 * call back. */
+	const char *buf = tal_steal(tmpctx, rc->buf) + rc->body_off;
+	int status = rc->status;
+	const jsmntok_t *toks;
+	struct io_plan *plan;
+	bool valid;
+
+	rc->calls = NULL;
+	rc->buf = NULL;
+	rc->len = 0;
+	rc->reused = true;
+	toks = json_parse_input(tmpctx, buf, rc->body_len, &valid);
+
+	if (rc->keepalive) {
+		/* Wait first, so rpc_dispatch() can wake us. */
+		plan = io_wait(conn, rc, send_request, rc);
+		rc->idle = true;
+		list_add_tail(&rpc->idle, &rc->list);
+	} else
+		plan = io_close(conn);
+
+	/* It only gives a JSON-RPC response (whatever the status) if
+	 * it's happy with our request. */
+	if (!toks) {
+		log_unusual(rpc->log, "bitcoind gave HTTP status %i (%s body)",
+			    status, valid ? "incomplete" : "invalid");
+		/* Unauthorized or Forbidden: rpcuser/rpcpassword are wrong. */
+		if (status == 401 || status == 403)
+			rpc->unusable = true;
+		fail_calls(rpc, calls);
+	} else if (toks[0].type == JSMN_OBJECT && tal_count(calls) == 1) {
+		deliver(rpc, calls[0], buf, toks);
+	} else if (toks[0].type == JSMN_ARRAY) {
+		for (size_t i = 0; i < tal_count(calls); i++) {
+			const jsmntok_t *t, *idtok;
+			size_t j;
+			u64 id;
+
+			json_for_each_arr(j, t, toks) {
+				idtok = json_get_member(buf, t, "id");
+				if (idtok && json_to_u64(buf, idtok, &id)
+				    && id == calls[i]->id)
+					break;
+			}
+			if (j < toks[0].size)
+				deliver(rpc, calls[i], buf, t);
+			else {
+				log_unusual(rpc->log, "%s: no response in batch",
+					    calls[i]->method);
+				calls[i]->cb(NULL, NULL, NULL, calls[i]->arg);
+			}
+		}
+	} else {
+		log_unusual(rpc->log, "bitcoind gave unexpected %s",
+			    jsmntype_to_string(toks[0].type));
+		fail_calls(rpc, calls);
+	}
+
+	rpc_dispatch(rpc);
+	return plan;
+}
+
+static struct io_plan *read_more(struct io_conn *conn, struct rpc_conn *rc)
+{
+	rc->len += rc->len_read;
+
+	if (!rc->body_off) {
+		const char *end = memmem(rc->buf, rc->len, "\r\n\r\n", 4);
+		if (end && !parse_headers(rc, end + 4 - rc->buf)) {
+			log_unusual(rc->rpc->log, "Bad HTTP response '%.*s'",
+				    (int)(end - rc->buf), rc->buf);
+			errno = EPROTO;
+			return io_close(conn);
+		}
+	}
+
+	if (rc->body_off) {
+		if (rc->len >= rc->body_off + rc->body_len)
+			return response_done(conn, rc);
+		/* Make room for exactly what's left. */
+		if (tal_count(rc->buf) < rc->body_off + rc->body_len)
+			tal_resize(&rc->buf, rc->body_off + rc->body_len);
+	} else if (rc->len == tal_count(rc->buf))
+		tal_resize(&rc->buf, rc->len * 2);
+
+	return io_read_partial(conn, rc->buf + rc->len,
+			       tal_count(rc->buf) - rc->len,
+			       &rc->len_read, read_more, rc);
+}
+
+static struct io_plan *read_response(struct io_conn *conn, struct rpc_conn *rc)
+{
+	rc->buf = tal_arr(rc, char, 1024);
+	rc->len = rc->len_read = 0;
+	rc->body_off = rc->body_len = 0;
+	return read_more(conn, rc);
+}
+
+static struct io_plan *send_request(struct io_conn *conn, struct rpc_conn *rc)
+{
+	return io_write(conn, rc->request, strlen(rc->request),
+			read_response, rc);
+}
+
+static struct io_plan *conn_init(struct io_conn *conn, struct rpc_conn *rc)
+{
+	return io_connect(conn, rc->rpc->addrinfo, send_request, rc);
+}
+
+static void rpc_conn_finished(struct io_conn *conn UNUSED, struct rpc_conn *rc)
+{
+	struct bitcoind_rpc *rpc = rc->rpc;
+	struct rpc_call **calls = rc->calls;
+
+	if (rpc->shutdown)
+		return;
+
+	rpc->num_conns--;
+	if (rc->idle)
+		list_del_from(&rpc->idle, &rc->list);
+
+	if (calls) {
+		if (rc->reused && rc->len == 0) {
+			/* It closed while idle: put them back in order. */
+			for (size_t i = tal_count(calls); i > 0; i--) {
+				tal_steal(rpc, calls[i-1]);
+				list_add(&rpc->pending, &calls[i-1]->list);
+			}
+		} else {
+			log_unusual(rpc->log, "Talking to bitcoind: %s",
+				    errno ? strerror(errno) : "connection closed");
+			tal_steal(tmpctx, calls);
+			fail_calls(rpc, calls);
+		}
+	}
+	rpc_dispatch(rpc);
+}
+
+static bool new_rpc_conn(struct bitcoind_rpc *rpc)
+{
+	struct rpc_conn *rc;
+	struct io_conn *conn;
+	int fd;
+
+	fd = socket(rpc->addrinfo->ai_family, rpc->addrinfo->ai_socktype,
+		    rpc->addrinfo->ai_protocol);
+	if (fd < 0) {
+		log_broken(rpc->log, "Creating socket: %s", strerror(errno));
+		return false;
+	}
+
+	rc = tal(rpc, struct rpc_conn);
+	rc->rpc = rpc;
+	rc->idle = false;
+	rc->reused = false;
+	rc->calls = NULL;
+	rc->request = NULL;
+	rc->buf = NULL;
+	rc->len = 0;
+
+	/* This fails if connect() does immediately (it closes fd) */
+	conn = io_new_conn(rpc, fd, conn_init, rc);
+	if (!conn) {
+		log_unusual(rpc->log, "Connecting to bitcoind: %s",
+			    strerror(errno));
+		tal_free(rc);
+		return false;
+	}
+
+	/* It lives as long as the connection */
+	tal_steal(conn, rc);
+	io_set_finish(conn, rpc_conn_finished, rc);
+	rpc->num_conns++;
+	/* We don't write until connected, so there's time to fill it. */
+	rpc_conn_take_calls(rc);
+	return true;
+}
+
+static void rpc_dispatch(struct bitcoind_rpc *rpc)
+{
+	while (!list_empty(&rpc->pending)) {
+		struct rpc_conn *rc = list_pop(&rpc->idle, struct rpc_conn,
+					       list);
+		if (rc) {
+			rc->idle = false;
+			rpc_conn_take_calls(rc);
+			io_wake(rc);
+			continue;
+		}
+
+		if (rpc->num_conns == rpc->max_conns)
+			return;
+
+		if (!new_rpc_conn(rpc)) {
+			struct rpc_call **calls = tal_arr(tmpctx,
+							  struct rpc_call *, 0);
+			struct rpc_call *call;
+
+			while ((call = list_pop(&rpc->pending,
+						struct rpc_call, list)))
+				tal_arr_expand(&calls, tal_steal(calls, call));
+			fail_calls(rpc, calls);
+			return;
+		}
+	}
+}
+
+void bitcoind_rpc_call_(struct bitcoind_rpc *rpc,
+			const char *method, const char *params,
+			void (*cb)(const char *buf,
+				   const jsmntok_t *result,
+				   const jsmntok_t *error,
+				   void *arg),
+			void *arg)
+{
+	struct rpc_call *call = tal(rpc, struct rpc_call);
+
+	call->id = rpc->next_id++;
+	call->method = tal_strdup(call, method);
+	call->params = tal_strdup(call, params);
+	call->cb = cb;
+	call->arg = arg;
+	list_add_tail(&rpc->pending, &call->list);
+	rpc_dispatch(rpc);
+}
+
+bool bitcoind_rpc_unusable(const struct bitcoind_rpc *rpc)
+{
+	return rpc->unusable;
+}
+
+static void destroy_bitcoind_rpc(struct bitcoind_rpc *rpc)
+{
+	rpc->shutdown = true;
+	freeaddrinfo(rpc->addrinfo);
+}
+
+struct bitcoind_rpc *new_bitcoind_rpc(const tal_t *ctx, struct log *log,
+				      const char *host, const char *port,
+				      const char *user, const char *pass,
+				      size_t max_conns, size_t max_batch)
+{
+	struct bitcoind_rpc *rpc = tal(ctx, struct bitcoind_rpc);
+	struct addrinfo hints;
+	int err;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	err = getaddrinfo(host, port, &hints, &rpc->addrinfo);
+	if (err != 0) {
+		log_unusual(log, "Resolving bitcoind %s:%s: %s",
+			    host, port, gai_strerror(err));
+		return tal_free(rpc);
+	}
+
+	rpc->log = log;
+	rpc->host = tal_fmt(rpc, "%s:%s", host, port);
+	rpc->auth = base64(rpc, tal_fmt(tmpctx, "%s:%s", user, pass));
+	rpc->max_conns = max_conns;
+	rpc->max_batch = max_batch;
+	rpc->num_conns = 0;
+	list_head_init(&rpc->pending);
+	list_head_init(&rpc->idle);
+	rpc->next_id = 0;
+	rpc->shutdown = false;
+	rpc->unusable = false;
+	tal_add_destructor(rpc, destroy_bitcoind_rpc);
+
+	return rpc;
+}
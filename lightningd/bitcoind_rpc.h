@@ -0,0 +1,65 @@
+#ifndef LIGHTNING_LIGHTNINGD_BITCOIND_RPC_H
+#define LIGHTNING_LIGHTNINGD_BITCOIND_RPC_H
+#include "config.h"
+#include <ccan/tal/tal.h>
+#include <ccan/typesafe_cb/typesafe_cb.h>
+#include <common/json.h>
+
+struct bitcoind_rpc;
+struct log;
+
+/**
+ * new_bitcoind_rpc - Create a JSON-RPC client for bitcoind's HTTP server
+ * @ctx: tal context to allocate from
+ * @log: where to log
+ * @host, @port: where bitcoind is listening (resolved now)
+ * @user, @pass: its rpcuser and rpcpassword
+ * @max_conns: most connections to keep open at once
+ * @max_batch: most calls to send in one request
+ *
+ * Connections are kept open between requests, and calls which queue up
+ * while they're all busy go out together as a JSON-RPC batch.
+ *
+ * Returns NULL (and logs why) if @host can't be resolved.
+ */
+struct bitcoind_rpc *new_bitcoind_rpc(const tal_t *ctx, struct log *log,
+				      const char *host, const char *port,
+				      const char *user, const char *pass,
+				      size_t max_conns, size_t max_batch);
+
+/**
+ * bitcoind_rpc_call - Queue a call to bitcoind
+ * @rpc: the client
+ * @method: the method name
+ * @params: the params, as a JSON array (eg. "[\"abcd\",1]")
+ * @cb: called with the "result" or the "error" (the other is NULL), or with
+ *      @buf NULL if we couldn't get a response at all.
+ * @arg: argument for @cb
+ */
+#define bitcoind_rpc_call(rpc, method, params, cb, arg)			\
+	bitcoind_rpc_call_((rpc), (method), (params),			\
+			   typesafe_cb_preargs(void, void *, (cb), (arg), \
+					       const char *,		\
+					       const jsmntok_t *,	\
+					       const jsmntok_t *),	\
+			   (arg))
+
+void bitcoind_rpc_call_(struct bitcoind_rpc *rpc,
+			const char *method, const char *params,
+			void (*cb)(const char *buf,
+				   const jsmntok_t *result,
+				   const jsmntok_t *error,
+				   void *arg),
+			void *arg);
+
+/**
+ * bitcoind_rpc_unusable - Has bitcoind turned us away for good?
+ * @rpc: the client
+ *
+ * True once it rejected our rpcuser and rpcpassword.  Other failures (not
+ * being able to connect, a dropped connection, an odd response) may not
+ * happen next time.
+ */
+bool bitcoind_rpc_unusable(const struct bitcoind_rpc *rpc);
+
+#endif /* LIGHTNING_LIGHTNINGD_BITCOIND_RPC_H */
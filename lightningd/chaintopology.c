@@ -24,6 +24,35 @@
 #include <lightningd/channel_control.h>
 #include <lightningd/gossip_control.h>
 #include <lightningd/io_loop_with_timers.h>
+#include <lightningd/plugin_hook.h>
+
+/* While catching up, we fetch up to this many blocks past our tip at once
+ * (starting with one, since usually there's nothing new, and doubling each
+ * time one arrives)... */
+#define PREFETCH_BLOCKS 16
+
+/* ...but stop asking for more while those waiting to be added weigh this
+ * much (eight full blocks). */
+#define PREFETCH_MAX_WEIGHT (8 * 4000000)
+
+/* A block we're fetching before we're ready to add it. */
+struct prefetch {
+	/* In topo->prefetches, unless stale. */
+	struct list_node list;
+	struct chain_topology *topo;
+	u32 height;
+
+	/* Waiting for bitcoind to answer. */
+	bool inflight;
+	/* Once it answers: is there a block at this height? */
+	bool exists;
+	/* The block itself, and its weight. */
+	struct bitcoin_block *blk;
+	size_t weight;
+
+	/* No longer wanted (reorg, or end of chain): free when it answers. */
+	bool stale;
+};
 
 /* Mutual recursion via timer. */
 static void try_extend_tip(struct chain_topology *topo);
@@ -217,6 +246,12 @@ static void broadcast_done(struct bitcoind *bitcoind,
 	}
 }
 
+/* We only tell bitcoind once what led to this is safely saved. */
+static void broadcast_saved(struct outgoing_tx *otx)
+{
+	bitcoind_sendrawtx(otx->topo->bitcoind, otx->hextx, broadcast_done, otx);
+}
+
 void broadcast_tx(struct chain_topology *topo,
 		  struct channel *channel, const struct bitcoin_tx *tx,
 		  void (*failed_or_success)(struct channel *channel,
@@ -226,6 +261,7 @@ void broadcast_tx(struct chain_topology *topo,
 	struct outgoing_tx *otx = tal(topo, struct outgoing_tx);
 	const u8 *rawtx = linearize_tx(otx, tx);
 
+	otx->topo = topo;
 	otx->channel = channel;
 	bitcoin_txid(tx, &otx->txid);
 	otx->hextx = tal_hex(otx, rawtx);
@@ -237,7 +273,7 @@ void broadcast_tx(struct chain_topology *topo,
 		type_to_string(tmpctx, struct bitcoin_txid, &otx->txid));
 
 	wallet_transaction_add(topo->ld->wallet, tx, 0, 0);
-	bitcoind_sendrawtx(topo->bitcoind, otx->hextx, broadcast_done, otx);
+	db_after_saved(topo->ld->wallet->db, otx, broadcast_saved, otx);
 }
 
 static enum watch_result closeinfo_txid_confirmed(struct lightningd *ld,
@@ -611,22 +647,35 @@ static void topo_update_spends(struct chain_topology *topo, struct block *b)
 
 static void topo_add_utxos(struct chain_topology *topo, struct block *b)
 {
+	struct outpoint *outpoints = tal_arr(tmpctx, struct outpoint, 0);
+
 	for (size_t i = 0; i < tal_count(b->full_txs); i++) {
 		const struct bitcoin_tx *tx = b->full_txs[i];
+		struct bitcoin_txid txid;
+
+		bitcoin_txid(tx, &txid);
 		for (size_t j = 0; j < tx->wtx->num_outputs; j++) {
 			if (tx->wtx->outputs[j].features & WALLY_TX_IS_COINBASE)
 				continue;
 
 			const u8 *script = bitcoin_tx_output_get_script(tmpctx, tx, j);
-			struct amount_sat amt = bitcoin_tx_output_get_amount(tx, j);
 
 			if (is_p2wsh(script, NULL)) {
-				wallet_utxoset_add(topo->ld->wallet, tx, j,
-						   b->height, i, script,
-						   amt);
+				struct outpoint op;
+				op.txid = txid;
+				op.blockheight = b->height;
+				op.txindex = i;
+				op.outnum = j;
+				op.sat = bitcoin_tx_output_get_amount(tx, j);
+				op.scriptpubkey = cast_const(u8 *, script);
+				op.spendheight = 0;
+				tal_arr_expand(&outpoints, op);
 			}
 		}
 	}
+
+	/* All in one go */
+	wallet_utxoset_add(topo->ld->wallet, outpoints);
 }
 
 static void add_tip(struct chain_topology *topo, struct block *b)
@@ -704,36 +753,139 @@ static void remove_tip(struct chain_topology *topo)
 	tal_free(b);
 }
 
-static void have_new_block(struct bitcoind *bitcoind UNUSED,
-			   struct bitcoin_block *blk,
-			   struct chain_topology *topo)
+/* Forget the window: anything bitcoind is still fetching gets freed when
+ * it answers. */
+static void prefetch_discard(struct chain_topology *topo)
 {
-	/* Unexpected predecessor?  Free predecessor, refetch it. */
-	if (!bitcoin_blkid_eq(&topo->tip->blkid, &blk->hdr.prev_hash))
-		remove_tip(topo);
-	else
-		add_tip(topo, new_block(topo, blk, topo->tip->height + 1));
+	struct prefetch *p;
 
-	/* Try for next one. */
-	try_extend_tip(topo);
+	while ((p = list_pop(&topo->prefetches, struct prefetch, list))) {
+		if (p->inflight)
+			p->stale = true;
+		else
+			tal_free(p);
+	}
+	topo->prefetch_weight = 0;
+	topo->prefetch_end = false;
 }
 
-static void get_new_block(struct bitcoind *bitcoind,
-			  const struct bitcoin_blkid *blkid,
-			  struct chain_topology *topo)
+static size_t block_weight(const struct bitcoin_block *blk)
 {
-	if (!blkid) {
+	size_t weight = 0;
+
+	for (size_t i = 0; i < tal_count(blk->tx); i++)
+		weight += bitcoin_tx_weight(blk->tx[i]);
+	return weight;
+}
+
+static void prefetch_more(struct chain_topology *topo);
+
+/* Add what we can from the front of the window, in order. */
+static void process_prefetched(struct chain_topology *topo)
+{
+	struct prefetch *p;
+
+	while ((p = list_top(&topo->prefetches, struct prefetch, list))
+	       && !p->inflight) {
+		list_del_from(&topo->prefetches, &p->list);
+		assert(p->height == topo->tip->height + 1);
+
 		/* No such block, we're done. */
-		updates_complete(topo);
+		if (!p->exists) {
+			tal_free(p);
+			prefetch_discard(topo);
+			updates_complete(topo);
+			return;
+		}
+		topo->prefetch_weight -= p->weight;
+
+		/* Unexpected predecessor?  Free predecessor, refetch it (and
+		 * everything after it, which may be on the wrong chain too). */
+		if (!bitcoin_blkid_eq(&topo->tip->blkid, &p->blk->hdr.prev_hash)) {
+			tal_free(p);
+			prefetch_discard(topo);
+			remove_tip(topo);
+			try_extend_tip(topo);
+			return;
+		}
+
+		add_tip(topo, new_block(topo, p->blk, p->height));
+		tal_free(p);
+
+		/* Blocks keep coming: we're catching up, so fetch further. */
+		if (topo->prefetch_window < PREFETCH_BLOCKS)
+			topo->prefetch_window *= 2;
+	}
+
+	/* That made room for more. */
+	prefetch_more(topo);
+}
+
+static void prefetch_got_block(struct bitcoind *bitcoind UNUSED,
+			       struct bitcoin_block *blk,
+			       struct prefetch *p)
+{
+	p->inflight = false;
+	if (p->stale) {
+		tal_free(p);
+		return;
+	}
+
+	/* blk belongs to the bitcoin-cli call, which is about to go. */
+	p->blk = tal_steal(p, blk);
+	p->weight = block_weight(blk);
+	p->topo->prefetch_weight += p->weight;
+	process_prefetched(p->topo);
+}
+
+static void prefetch_got_blkid(struct bitcoind *bitcoind,
+			       const struct bitcoin_blkid *blkid,
+			       struct prefetch *p)
+{
+	if (p->stale) {
+		tal_free(p);
+		return;
+	}
+
+	if (!blkid) {
+		/* Nothing above this either: we'll catch those next poll. */
+		p->inflight = false;
+		p->topo->prefetch_end = true;
+		process_prefetched(p->topo);
 		return;
 	}
-	bitcoind_getrawblock(bitcoind, blkid, have_new_block, topo);
+
+	p->exists = true;
+	bitcoind_getrawblock(bitcoind, blkid, prefetch_got_block, p);
+}
+
+/* Fetch ahead, so we're not waiting on bitcoind for each block in turn. */
+static void prefetch_more(struct chain_topology *topo)
+{
+	while (!topo->prefetch_end
+	       && topo->prefetch_height <= topo->tip->height + topo->prefetch_window
+	       && topo->prefetch_weight < PREFETCH_MAX_WEIGHT) {
+		struct prefetch *p = tal(topo, struct prefetch);
+
+		p->topo = topo;
+		p->height = topo->prefetch_height++;
+		p->inflight = true;
+		p->exists = false;
+		p->blk = NULL;
+		p->weight = 0;
+		p->stale = false;
+		list_add_tail(&topo->prefetches, &p->list);
+		bitcoind_getblockhash(topo->bitcoind, p->height,
+				      prefetch_got_blkid, p);
+	}
 }
 
 static void try_extend_tip(struct chain_topology *topo)
 {
-	bitcoind_getblockhash(topo->bitcoind, topo->tip->height + 1,
-			      get_new_block, topo);
+	assert(list_empty(&topo->prefetches));
+	topo->prefetch_height = topo->tip->height + 1;
+	topo->prefetch_window = 1;
+	prefetch_more(topo);
 }
 
 static void init_topo(struct bitcoind *bitcoind UNUSED,
@@ -896,6 +1048,10 @@ struct chain_topology *new_topology(struct lightningd *ld, struct log *log)
 	topo->poll_seconds = 30;
 	topo->feerate_uninitialized = true;
 	topo->root = NULL;
+	list_head_init(&topo->prefetches);
+	topo->prefetch_end = false;
+	topo->prefetch_window = 1;
+	topo->prefetch_weight = 0;
 	return topo;
 }
 
@@ -34,6 +34,7 @@ enum feerate {
 /* Off topology->outgoing_txs */
 struct outgoing_tx {
 	struct list_node list;
+	struct chain_topology *topo;
 	struct channel *channel;
 	const char *hextx;
 	struct bitcoin_txid txid;
@@ -112,6 +113,16 @@ struct chain_topology {
 	/* Transactions/txos we are watching. */
 	struct txwatch_hash txwatches;
 	struct txowatch_hash txowatches;
+
+	/* Blocks we're fetching past our tip, in height order. */
+	struct list_head prefetches;
+	/* Next height to fetch, and whether we've hit the end of the chain. */
+	u32 prefetch_height;
+	bool prefetch_end;
+	/* How far past the tip to fetch: grows as blocks arrive. */
+	u32 prefetch_window;
+	/* Total weight of those fetched, but not yet added. */
+	size_t prefetch_weight;
 };
 
 /* Information relevant to locating a TX in a blockchain. */
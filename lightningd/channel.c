@@ -193,6 +193,7 @@ struct channel *new_channel(struct peer *peer, u64 dbid,
 	channel->dbid = dbid;
 	channel->error = NULL;
 	channel->htlc_timeout = NULL;
+	channel->db_image = NULL;
 	if (their_shachain)
 		channel->their_shachain = *their_shachain;
 	else {
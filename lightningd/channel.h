@@ -117,6 +117,9 @@ struct channel {
 
 	/* If they used option_upfront_shutdown_script. */
 	const u8 *remote_upfront_shutdown_script;
+
+	/* What wallet_channel_save() last wrote (NULL: don't know) */
+	u8 **db_image;
 };
 
 struct channel *new_channel(struct peer *peer, u64 dbid,
@@ -65,6 +65,7 @@ static void json_add_invoice(struct json_stream *response,
 		json_add_string(response, "description", inv->description);
 
 	json_add_u64(response, "expires_at", inv->expiry_time);
+	json_add_u64(response, "created_index", inv->created_index);
 }
 
 static struct command_result *tell_waiter(struct command *cmd,
@@ -205,7 +206,7 @@ invoice_payment_hook_cb(struct invoice_payment_hook_payload *payload,
 	fulfill_htlc(payload->hin, &payload->preimage);
 }
 
-REGISTER_PLUGIN_HOOK(invoice_payment,
+REGISTER_PLUGIN_HOOK(invoice_payment, PLUGIN_HOOK_CHAIN,
 		     invoice_payment_hook_cb,
 		     struct invoice_payment_hook_payload *,
 		     invoice_payment_serialize,
@@ -795,7 +796,8 @@ AUTODATA(json_command, &invoice_command);
 
 static void json_add_invoices(struct json_stream *response,
 			      struct wallet *wallet,
-			      const struct json_escape *label)
+			      const struct json_escape *label,
+			      const struct invoice_filter *filter)
 {
 	struct invoice_iterator it;
 	const struct invoice_details *details;
@@ -813,7 +815,7 @@ static void json_add_invoices(struct json_stream *response,
 	}
 
 	memset(&it, 0, sizeof(it));
-	while (wallet_invoice_iterate(wallet, &it)) {
+	while (wallet_invoice_iterate(wallet, &it, filter)) {
 		details = wallet_invoice_iterator_deref(response, wallet, &it);
 		json_object_start(response, NULL);
 		json_add_invoice(response, details);
@@ -821,6 +823,53 @@ static void json_add_invoices(struct json_stream *response,
 	}
 }
 
+static struct command_result *param_invoice_status(struct command *cmd,
+						   const char *name,
+						   const char *buffer,
+						   const jsmntok_t *tok,
+						   enum invoice_status **status)
+{
+	*status = tal(cmd, enum invoice_status);
+	if (json_tok_streq(buffer, tok, "unpaid")) {
+		**status = UNPAID;
+		return NULL;
+	} else if (json_tok_streq(buffer, tok, "paid")) {
+		**status = PAID;
+		return NULL;
+	} else if (json_tok_streq(buffer, tok, "expired")) {
+		**status = EXPIRED;
+		return NULL;
+	}
+
+	return command_fail(cmd, JSONRPC2_INVALID_PARAMS,
+			    "'%s' should be 'unpaid', 'paid' or 'expired',"
+			    " not '%.*s'",
+			    name, json_tok_full_len(tok),
+			    json_tok_full(buffer, tok));
+}
+
+/* Is it "paid" (pay_index order) or "created" (the default)? */
+static struct command_result *param_invoice_index(struct command *cmd,
+						  const char *name,
+						  const char *buffer,
+						  const jsmntok_t *tok,
+						  bool **by_pay_index)
+{
+	*by_pay_index = tal(cmd, bool);
+	if (json_tok_streq(buffer, tok, "created")) {
+		**by_pay_index = false;
+		return NULL;
+	} else if (json_tok_streq(buffer, tok, "paid")) {
+		**by_pay_index = true;
+		return NULL;
+	}
+
+	return command_fail(cmd, JSONRPC2_INVALID_PARAMS,
+			    "'%s' should be 'created' or 'paid', not '%.*s'",
+			    name, json_tok_full_len(tok),
+			    json_tok_full(buffer, tok));
+}
+
 static struct command_result *json_listinvoices(struct command *cmd,
 						const char *buffer,
 						const jsmntok_t *obj UNNEEDED,
@@ -829,13 +878,33 @@ static struct command_result *json_listinvoices(struct command *cmd,
 	struct json_escape *label;
 	struct json_stream *response;
 	struct wallet *wallet = cmd->ld->wallet;
+	struct invoice_filter *filter = tal(cmd, struct invoice_filter);
+	enum invoice_status *status;
+	bool *by_pay_index;
+	u64 *start, *limit, *paid_since, *expires_before;
+
 	if (!param(cmd, buffer, params,
 		   p_opt("label", param_label, &label),
+		   p_opt("status", param_invoice_status, &status),
+		   p_opt_def("index", param_invoice_index, &by_pay_index,
+			     false),
+		   p_opt_def("start", param_u64, &start, 0),
+		   p_opt_def("limit", param_u64, &limit, 0),
+		   p_opt("paid_since", param_u64, &paid_since),
+		   p_opt("expires_before", param_u64, &expires_before),
 		   NULL))
 		return command_param_failed();
+
+	filter->status = status;
+	filter->by_pay_index = *by_pay_index;
+	filter->start = *start;
+	filter->paid_since = paid_since;
+	filter->expires_before = expires_before;
+	filter->limit = *limit;
+
 	response = json_stream_success(cmd);
 	json_array_start(response, "invoices");
-	json_add_invoices(response, wallet, label);
+	json_add_invoices(response, wallet, label, filter);
 	json_array_end(response);
 	return command_success(cmd, response);
 }
@@ -844,7 +913,10 @@ static const struct json_command listinvoices_command = {
 	"listinvoices",
 	"payment",
 	json_listinvoices,
-	"Show invoice {label} (or all, if no {label})"
+	"Show invoice {label} (or all, if no {label}), optionally only"
+	" {status}, paid since {paid_since} or expiring before"
+	" {expires_before}, at most {limit} of them, from {start} in {index}"
+	" order ('created' or 'paid')"
 };
 AUTODATA(json_command, &listinvoices_command);
 
@@ -102,6 +102,33 @@ void json_stream_append(struct json_stream *js,
 	memcpy(dest, str, len);
 }
 
+void json_stream_splice(struct json_stream *js,
+			const char *fieldname,
+			const struct json_stream *src)
+{
+	if (!js->jout)
+		return;
+	if (!src->jout || !json_out_add_splice(js->jout, fieldname, src->jout))
+		js_oom(js);
+}
+
+const char *json_stream_contents(const struct json_stream *js, size_t *len)
+{
+	if (!js->jout) {
+		*len = 0;
+		return NULL;
+	}
+	return json_out_contents(js->jout, len);
+}
+
+size_t json_stream_len(const struct json_stream *js)
+{
+	size_t len;
+
+	json_stream_contents(js, &len);
+	return len;
+}
+
 void json_stream_close(struct json_stream *js, struct command *writer)
 {
 	/* FIXME: We use writer == NULL for malformed: make writer a void *?
@@ -80,6 +80,34 @@ void json_object_compat_end(struct json_stream *js);
  */
 void json_stream_append(struct json_stream *js, const char *str, size_t len);
 
+/**
+ * json_stream_splice - copy a finished JSON stream in as a member.
+ * @js: the json_stream.
+ * @fieldname: fieldname (if in object), otherwise must be NULL.
+ * @src: the (complete, unconsumed) json_stream to copy from.
+ *
+ * Useful for building a payload once and sending it to several
+ * recipients in different wrappers.
+ */
+void json_stream_splice(struct json_stream *js,
+			const char *fieldname,
+			const struct json_stream *src);
+
+/**
+ * json_stream_contents - what's waiting to be output?
+ * @js: the json_stream.
+ * @len: set to the number of bytes.
+ *
+ * Returns NULL (and @len 0) if there's nothing.
+ */
+const char *json_stream_contents(const struct json_stream *js, size_t *len);
+
+/**
+ * json_stream_len - how many bytes are waiting to be output?
+ * @js: the json_stream.
+ */
+size_t json_stream_len(const struct json_stream *js);
+
 /**
  * json_add_member - add a generic member.
  * @js: the json_stream.
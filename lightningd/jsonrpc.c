@@ -756,10 +756,11 @@ static struct io_plan *read_json(struct io_conn *conn,
 		tal_count(jcon->buffer) - toks[0].end);
 	jcon->used -= toks[0].end;
 
-	/* If we have more to process, try again.  FIXME: this still gets
-	 * first priority in io_loop, so can starve others.  Hack would be
-	 * a (non-zero) timer, but better would be to have io_loop avoid
-	 * such livelock */
+	/* If we have more to process, try again.  io_loop only runs each
+	 * io_always once per iteration, and services every ready fd
+	 * (subdaemons, plugins, other jcons) in between, so a client which
+	 * pipelines requests gets one command per loop and can't starve
+	 * others. */
 	if (jcon->used) {
 		tal_free(toks);
 		jcon->len_read = 0;
@@ -1110,6 +1111,7 @@ struct jsonrpc_request *jsonrpc_request_start_(
 	static u64 next_request_id = 0;
 	r->id = next_request_id++;
 	r->response_cb = response_cb;
+	r->wire_response_cb = NULL;
 	r->response_cb_arg = response_cb_arg;
 	r->method = NULL;
 	r->stream = new_json_stream(r, NULL, log);
@@ -73,6 +73,9 @@ struct jsonrpc_request {
 	struct json_stream *stream;
 	void (*response_cb)(const char *buffer, const jsmntok_t *toks,
 			    const jsmntok_t *idtok, void *);
+	/* Optional: for binary replies from plugins (see
+	 * plugin_request_send_wire) */
+	void (*wire_response_cb)(const u8 *msg, void *);
 	void *response_cb_arg;
 };
 
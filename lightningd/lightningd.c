@@ -54,6 +54,7 @@
 #include <ccan/tal/grab_file/grab_file.h>
 #include <ccan/tal/path/path.h>
 #include <ccan/tal/str/str.h>
+#include <ccan/time/time.h>
 
 /*~ This is common code: routines shared by one or more executables
  *  (separate daemons, or the lightning-cli program). */
@@ -65,6 +66,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <gen_header_versions.h>
+#include <inttypes.h>
 #include <lightningd/bitcoind.h>
 #include <lightningd/chaintopology.h>
 #include <lightningd/channel_control.h>
@@ -75,6 +77,7 @@
 #include <lightningd/log.h>
 #include <lightningd/onchain_control.h>
 #include <lightningd/options.h>
+#include <lightningd/plugin_hook.h>
 #include <onchaind/onchain_wire.h>
 #include <signal.h>
 #include <sys/types.h>
@@ -195,6 +198,7 @@ static struct lightningd *new_lightningd(const tal_t *ctx)
 	ld->topology = new_topology(ld, ld->log);
 	ld->daemon = false;
 	ld->config_filename = NULL;
+	ld->wallet_dsn = NULL;
 	ld->pidfile = NULL;
 	ld->proxyaddr = NULL;
 	ld->use_proxy_always = false;
@@ -613,6 +617,19 @@ static void setup_sig_handlers(void)
 	}
 }
 
+/*~ Restarting a node with many channels can take a while, so we note how
+ * long each part of startup takes, to see where it goes. */
+static struct timemono startup_phase_start;
+
+static void startup_phase_done(struct lightningd *ld, const char *phase)
+{
+	struct timemono now = time_mono();
+
+	log_debug(ld->log, "Startup: %s took %"PRIu64" msec", phase,
+		  time_to_msec(timemono_between(now, startup_phase_start)));
+	startup_phase_start = now;
+}
+
 int main(int argc, char *argv[])
 {
 	struct lightningd *ld;
@@ -620,6 +637,7 @@ int main(int argc, char *argv[])
 	int connectd_gossipd_fd, pid_fd;
 	int stop_fd;
 	const char *stop_response;
+	struct timemono startup_start;
 
 	/*~ What happens in strange locales should stay there. */
 	setup_locale();
@@ -674,10 +692,16 @@ int main(int argc, char *argv[])
 	/*~ Make sure we can reach the subdaemons, and versions match. */
 	test_subdaemons(ld);
 
+	/* This has to be known before we first touch the db. */
+	plugin_hook_db_set_pipeline(ld->config.db_write_pipeline);
+
+	startup_start = startup_phase_start = time_mono();
+
 	/*~ Our "wallet" code really wraps the db, which is more than a simple
 	 * bitcoin wallet (though it's that too).  It also stores channel
 	 * states, invoices, payments, blocks and bitcoin transactions. */
 	ld->wallet = wallet_new(ld, ld->log, &ld->timers);
+	startup_phase_done(ld, "opening the wallet");
 
 	/*~ We keep a filter of scriptpubkeys we're interested in. */
 	ld->owned_txfilter = txfilter_new(ld);
@@ -693,6 +717,7 @@ int main(int argc, char *argv[])
 	 * doesn't really make sense, but we can't call it the Badly-named
 	 * Daemon Software Module. */
 	hsm_init(ld);
+	startup_phase_done(ld, "hsmd");
 
 	/*~ Our default color and alias are derived from our node id, so we
 	 * can only set those now (if not set by config options). */
@@ -709,6 +734,7 @@ int main(int argc, char *argv[])
 	 *  channel_announcement, channel_update, node_announcement and gossip
 	 *  queries. */
 	gossip_init(ld, connectd_gossipd_fd);
+	startup_phase_done(ld, "connectd and gossipd");
 
 	/*~ We do every database operation within a transaction; usually this
 	 * is covered by the infrastructure (eg. opening a transaction before
@@ -747,11 +773,13 @@ int main(int argc, char *argv[])
 
 	/*~ That's all of the wallet db operations for now. */
 	db_commit_transaction(ld->wallet->db);
+	startup_phase_done(ld, "wallet checks");
 
 	/*~ Initialize block topology.  This does its own io_loop to
 	 * talk to bitcoind, so does its own db transactions. */
 	setup_topology(ld->topology, &ld->timers,
 		       min_blockheight, max_blockheight);
+	startup_phase_done(ld, "chain topology");
 
 	/*~ Pull peers, channels and HTLCs from db. Needs to happen after the
 	 *  topology is initialized since some decisions rely on being able to
@@ -759,6 +787,7 @@ int main(int argc, char *argv[])
 	db_begin_transaction(ld->wallet->db);
 	load_channels_from_wallet(ld);
 	db_commit_transaction(ld->wallet->db);
+	startup_phase_done(ld, "loading channels");
 
 	/*~ Now create the PID file: this errors out if there's already a
 	 * daemon running, so we call before trying to create an RPC socket. */
@@ -771,6 +800,7 @@ int main(int argc, char *argv[])
 	/*~ Now that the rpc path exists, we can start the plugins and they
 	 * can start talking to us. */
 	plugins_config(ld->plugins);
+	startup_phase_done(ld, "plugins");
 
 	/*~ Setting this (global) activates the crash log: we don't usually need
 	 * a backtrace if we fail during startup.  We do this before daemonize,
@@ -798,6 +828,7 @@ int main(int argc, char *argv[])
 	 * chain events from the database on restart, beginning with the
 	 * "funding transaction spent" event which creates it. */
 	onchaind_replay_channels(ld);
+	startup_phase_done(ld, "replaying onchain channels");
 
 	/*~ Mark ourselves live.
 	 *
@@ -817,6 +848,9 @@ int main(int argc, char *argv[])
 	 * live channels with us, and makes sure we're watching the funding
 	 * tx. */
 	activate_peers(ld);
+	startup_phase_done(ld, "activating peers");
+	log_info(ld->log, "Startup took %"PRIu64" msec",
+		  time_to_msec(timemono_between(time_mono(), startup_start)));
 
 	/*~ Now that all the notifications for transactions are in place, we
 	 *  can start the poll loop which queries bitcoind for new blocks. */
@@ -838,6 +872,9 @@ int main(int argc, char *argv[])
 
 	shutdown_subdaemons(ld);
 
+	/* Make sure backup plugins have everything before they go. */
+	plugin_hook_db_flush();
+
 	/* Remove plugins. */
 	ld->plugins = tal_free(ld->plugins);
 
@@ -70,6 +70,23 @@ struct config {
 
 	/* Minimal amount of effective funding_satoshis for accepting channels */
 	u64 min_capacity_sat;
+
+	/* How many batches of db writes db_write plugins can be behind */
+	u32 db_write_pipeline;
+
+	/* sqlite3 tuning: journal_mode, synchronous, mmap_size (bytes) and
+	 * cache_size (KiB, 0 for the sqlite3 default) */
+	const char *db_journal_mode;
+	const char *db_synchronous;
+	u64 db_mmap_size;
+	u32 db_cache_size;
+
+	/* Sync sqlite3 commits from a separate thread */
+	bool db_writer_thread;
+
+	/* How deep a closed channel's resolutions must be before we archive
+	 * it (at least 100) */
+	u32 archive_depth;
 };
 
 struct lightningd {
@@ -95,6 +112,9 @@ struct lightningd {
 
 	/* Configuration file name */
 	char *config_filename;
+	/* Where the wallet lives (--wallet), NULL for the default sqlite3
+	 * file in the lightning dir. */
+	char *wallet_dsn;
 	/* Configuration settings. */
 	struct config config;
 
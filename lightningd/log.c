@@ -1,6 +1,7 @@
 #include "log.h"
 #include <backtrace-supported.h>
 #include <backtrace.h>
+#include <ccan/alignof/alignof.h>
 #include <ccan/array_size/array_size.h>
 #include <ccan/err/err.h>
 #include <ccan/io/io.h>
@@ -13,7 +14,6 @@
 #include <common/jsonrpc_errors.h>
 #include <common/memleak.h>
 #include <common/param.h>
-#include <common/pseudorand.h>
 #include <common/utils.h>
 #include <errno.h>
 #include <fcntl.h>
@@ -23,7 +23,9 @@
 #include <lightningd/lightningd.h>
 #include <lightningd/notification.h>
 #include <lightningd/options.h>
+#include <pthread.h>
 #include <signal.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -32,14 +34,14 @@
 /* Once we're up and running, this is set up. */
 struct log *crashlog;
 
-static void log_to_file(const char *prefix,
-			enum log_level level,
-			bool continued,
-			const struct timeabs *time,
-			const char *str,
-			const u8 *io,
-			size_t io_len,
-			FILE *logf)
+static char *log_line(const tal_t *ctx,
+		      const char *prefix,
+		      enum log_level level,
+		      bool continued,
+		      const struct timeabs *time,
+		      const char *str,
+		      const u8 *io,
+		      size_t io_len)
 {
 	char iso8601_msec_fmt[sizeof("YYYY-mm-ddTHH:MM:SS.%03dZ")];
 	strftime(iso8601_msec_fmt, sizeof(iso8601_msec_fmt), "%FT%T.%%03dZ", gmtime(&time->ts.tv_sec));
@@ -49,15 +51,31 @@ static void log_to_file(const char *prefix,
 	if (level == LOG_IO_IN || level == LOG_IO_OUT) {
 		const char *dir = level == LOG_IO_IN ? "[IN]" : "[OUT]";
 		char *hex = tal_hexstr(NULL, io, io_len);
-		fprintf(logf, "%s %s%s%s %s\n",
-			iso8601_s, prefix, str, dir, hex);
+		char *line = tal_fmt(ctx, "%s %s%s%s %s\n",
+				     iso8601_s, prefix, str, dir, hex);
 		tal_free(hex);
+		return line;
 	} else 	if (!continued) {
-		fprintf(logf, "%s %s %s\n", iso8601_s, prefix, str);
+		return tal_fmt(ctx, "%s %s %s\n", iso8601_s, prefix, str);
 	} else {
-		fprintf(logf, "%s %s \t%s\n", iso8601_s, prefix, str);
+		return tal_fmt(ctx, "%s %s \t%s\n", iso8601_s, prefix, str);
 	}
+}
+
+static void log_to_file(const char *prefix,
+			enum log_level level,
+			bool continued,
+			const struct timeabs *time,
+			const char *str,
+			const u8 *io,
+			size_t io_len,
+			FILE *logf)
+{
+	char *line = log_line(NULL, prefix, level, continued, time,
+			      str, io, io_len);
+	fputs(line, logf);
 	fflush(logf);
+	tal_free(line);
 }
 
 static void log_to_stdout(const char *prefix,
@@ -71,36 +89,388 @@ static void log_to_stdout(const char *prefix,
 	log_to_file(prefix, level, continued, time, str, io, io_len, stdout);
 }
 
-static size_t mem_used(const struct log_entry *e)
+/* With --log-async, a thread does the actual writes to the log file, so a
+ * slow disk can't stall the daemon.  Lines are passed through a
+ * single-producer, single-consumer ring: only the main thread pushes, and
+ * only the writer thread pops, so neither needs a lock.  The writer thread
+ * never allocates, so forking subdaemons from the main thread stays safe. */
+enum log_async {
+	LOG_ASYNC_OFF,
+	/* Main thread waits if the writer falls too far behind. */
+	LOG_ASYNC_BLOCK,
+	/* Lines are dropped (and counted) if the writer falls behind. */
+	LOG_ASYNC_DROP,
+};
+static enum log_async log_async;
+
+#define LOG_WRITER_BACKLOG (1024 * 1024)
+
+struct log_writer {
+	pthread_t thread;
+	char buf[LOG_WRITER_BACKLOG];
+	/* Total bytes ever pushed (by main thread), and written (by writer) */
+	_Atomic size_t pushed, written;
+	_Atomic int fd;
+	/* Each side sets these before sleeping on its wake pipe. */
+	_Atomic bool writer_sleeping, main_sleeping;
+	int wake_writer[2], wake_main[2];
+	/* Set in a forked child, which doesn't have the thread. */
+	bool forked;
+	/* Lines we couldn't fit, to report once we can. */
+	size_t num_dropped;
+};
+static struct log_writer *log_writer;
+
+static size_t writer_backlog(const struct log_writer *w)
+{
+	return atomic_load(&w->pushed) - atomic_load(&w->written);
+}
+
+static void *log_writer_thread(struct log_writer *w)
+{
+	char c;
+
+	for (;;) {
+		size_t written = atomic_load(&w->written);
+		size_t off = written % LOG_WRITER_BACKLOG, len;
+
+		if (writer_backlog(w) == 0) {
+			atomic_store(&w->writer_sleeping, true);
+			/* Main might have pushed before it saw that. */
+			if (writer_backlog(w) != 0)
+				atomic_store(&w->writer_sleeping, false);
+			else if (read(w->wake_writer[0], &c, 1) != 1)
+				;
+			continue;
+		}
+
+		/* Write everything we have in one go (up to the wrap). */
+		len = atomic_load(&w->pushed) - written;
+		if (len > LOG_WRITER_BACKLOG - off)
+			len = LOG_WRITER_BACKLOG - off;
+		/* Nothing sensible to do if this fails. */
+		write_all(atomic_load(&w->fd), w->buf + off, len);
+
+		atomic_store(&w->written, written + len);
+		if (atomic_exchange(&w->main_sleeping, false)
+		    && write(w->wake_main[1], "", 1) != 1)
+			;
+	}
+	return NULL;
+}
+
+static void start_log_writer(struct log_writer *w)
 {
-	return sizeof(*e) + strlen(e->log) + 1 + tal_count(e->io);
+	sigset_t all, old;
+
+	if (pipe(w->wake_writer) != 0 || pipe(w->wake_main) != 0)
+		err(1, "Creating log writer pipes");
+	atomic_store(&w->writer_sleeping, false);
+	atomic_store(&w->main_sleeping, false);
+
+	/* Signals are for the main thread. */
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	if (pthread_create(&w->thread, NULL,
+			   (void *(*)(void *))log_writer_thread, w) != 0)
+		errx(1, "Creating log writer thread");
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	w->forked = false;
 }
 
-static size_t prune_log(struct log_book *log)
+/* Main thread: wait until there's room for len bytes. */
+static void log_writer_wait(struct log_writer *w, size_t len)
 {
-	struct log_entry *i, *next, *tail;
-	size_t skipped = 0, deleted = 0;
+	char c;
+
+	while (LOG_WRITER_BACKLOG - writer_backlog(w) < len) {
+		atomic_store(&w->main_sleeping, true);
+		/* Writer might have caught up before it saw that. */
+		if (LOG_WRITER_BACKLOG - writer_backlog(w) >= len)
+			atomic_store(&w->main_sleeping, false);
+		else if (read(w->wake_main[0], &c, 1) != 1)
+			;
+	}
+}
 
-	/* Never delete the last one. */
-	tail = list_tail(&log->log, struct log_entry, list);
+static void log_writer_flush(struct log_writer *w)
+{
+	/* A forked child has nothing queued (see writer_child_fork) */
+	if (!w->forked)
+		log_writer_wait(w, LOG_WRITER_BACKLOG);
+}
 
-	list_for_each_safe(&log->log, i, next, list) {
-		/* 50% chance of deleting IO_IN, 25% IO_OUT, 12.5% DEBUG... */
-		if (i == tail || !pseudorand(2 << i->level)) {
-			i->skipped += skipped;
-			skipped = 0;
-			continue;
+static void log_writer_push(struct log_writer *w, const char *p, size_t len)
+{
+	if (w->forked) {
+		/* These are the parent's, and it's still using them. */
+		close(w->wake_writer[0]);
+		close(w->wake_writer[1]);
+		close(w->wake_main[0]);
+		close(w->wake_main[1]);
+		start_log_writer(w);
+	}
+
+	/* Lines bigger than the whole backlog go in pieces. */
+	while (len) {
+		size_t pushed, off, n, first;
+
+		log_writer_wait(w, 1);
+		pushed = atomic_load(&w->pushed);
+		off = pushed % LOG_WRITER_BACKLOG;
+		n = LOG_WRITER_BACKLOG - writer_backlog(w);
+		if (n > len)
+			n = len;
+		first = LOG_WRITER_BACKLOG - off;
+		if (first > n)
+			first = n;
+		memcpy(w->buf + off, p, first);
+		memcpy(w->buf, p + first, n - first);
+		atomic_store(&w->pushed, pushed + n);
+		p += n;
+		len -= n;
+
+		if (atomic_exchange(&w->writer_sleeping, false)
+		    && write(w->wake_writer[1], "", 1) != 1)
+			;
+	}
+}
+
+/* Only the forking thread survives, so the child will need a new writer.
+ * The parent's writer still owns the backlog: the child drops its copy, so
+ * lines aren't written twice (and the parent needn't wait to fork). */
+static void writer_child_fork(void)
+{
+	atomic_store(&log_writer->written, atomic_load(&log_writer->pushed));
+	log_writer->forked = true;
+}
+
+static void flush_log_writer_at_exit(void)
+{
+	log_writer_flush(log_writer);
+}
+
+static void new_log_writer(int fd)
+{
+	log_writer = notleak(tal(NULL, struct log_writer));
+	atomic_init(&log_writer->pushed, 0);
+	atomic_init(&log_writer->written, 0);
+	atomic_init(&log_writer->fd, fd);
+	log_writer->num_dropped = 0;
+	start_log_writer(log_writer);
+
+	pthread_atfork(NULL, NULL, writer_child_fork);
+	atexit(flush_log_writer_at_exit);
+}
+
+/* Switch to a new file once everything queued for the old one is out. */
+static void log_writer_set_fd(struct log_writer *w, int fd)
+{
+	log_writer_flush(w);
+	close(atomic_exchange(&w->fd, fd));
+}
+
+static void log_to_writer(const char *prefix,
+			  enum log_level level,
+			  bool continued,
+			  const struct timeabs *time,
+			  const char *str,
+			  const u8 *io,
+			  size_t io_len,
+			  struct log_writer *w)
+{
+	char *line = log_line(NULL, prefix, level, continued, time,
+			      str, io, io_len);
+
+	if (log_async == LOG_ASYNC_BLOCK)
+		log_writer_push(w, line, strlen(line));
+	else {
+		size_t space = LOG_WRITER_BACKLOG - writer_backlog(w);
+
+		if (w->num_dropped) {
+			char *msg = tal_fmt(NULL, "%zu log lines dropped",
+					    w->num_dropped);
+			char *dropline = log_line(line, "", LOG_UNUSUAL, false,
+						  time, msg, NULL, 0);
+			tal_free(msg);
+			if (space >= strlen(dropline) + strlen(line)) {
+				log_writer_push(w, dropline, strlen(dropline));
+				space -= strlen(dropline);
+				w->num_dropped = 0;
+			}
+		}
+		if (!w->num_dropped && space >= strlen(line))
+			log_writer_push(w, line, strlen(line));
+		else
+			w->num_dropped++;
+	}
+	tal_free(line);
+
+	/* Don't lose the last words before a crash. */
+	if (level == LOG_BROKEN)
+		log_writer_flush(w);
+}
+
+/* Each entry is packed into the ring as one of these, followed by the
+ * nul-terminated log string and then any io data. */
+struct log_record {
+	struct timeabs time;
+	const char *prefix;
+	u32 skipped;
+	u32 len;
+	u32 io_len;
+	u8 level;
+};
+
+static size_t record_size(size_t len, size_t io_len)
+{
+	size_t size = sizeof(struct log_record) + len + 1 + io_len;
+
+	/* Keep the next record aligned. */
+	return (size + ALIGNOF(struct log_record) - 1)
+		& ~(ALIGNOF(struct log_record) - 1);
+}
+
+static struct log_record *record_at(const struct log_book *lr, size_t off)
+{
+	return (struct log_record *)(lr->ring + off);
+}
+
+static char *record_log(const struct log_record *r)
+{
+	return (char *)(r + 1);
+}
+
+static u8 *record_io(const struct log_record *r)
+{
+	return (u8 *)record_log(r) + r->len + 1;
+}
+
+static size_t next_record(const struct log_book *lr, size_t off)
+{
+	const struct log_record *r = record_at(lr, off);
+
+	off += record_size(r->len, r->io_len);
+	if (lr->wrapped && off == lr->wrap)
+		return 0;
+	return off;
+}
+
+static void unpack_record(const struct log_record *r, struct log_entry *l)
+{
+	l->time = r->time;
+	l->level = r->level;
+	l->skipped = r->skipped;
+	l->prefix = r->prefix;
+	l->log = record_log(r);
+	l->io = r->io_len ? record_io(r) : NULL;
+	l->io_len = r->io_len;
+}
+
+/* Drop the oldest entry, counting it as skipped in the next one. */
+static void drop_oldest(struct log_book *lr)
+{
+	const struct log_record *r = record_at(lr, lr->head);
+	unsigned int skipped = r->skipped + 1;
+
+	lr->mem_used -= record_size(r->len, r->io_len);
+	lr->head = next_record(lr, lr->head);
+	if (lr->wrapped && lr->head == 0)
+		lr->wrapped = false;
+
+	if (--lr->num_entries == 0) {
+		lr->head = lr->tail = 0;
+		lr->wrapped = false;
+		lr->dropped += skipped;
+	} else
+		record_at(lr, lr->head)->skipped += skipped;
+}
+
+/* Double the ring (up to max_mem), moving everything to the start.  We
+ * only wrap once it's full size, so it's never wrapped here. */
+static void grow_ring(struct log_book *lr, size_t needed)
+{
+	size_t size = tal_bytelen(lr->ring), used = lr->tail - lr->head;
+	u8 *ring;
+
+	assert(!lr->wrapped);
+	while (size < needed)
+		size *= 2;
+	if (size > lr->max_mem)
+		size = lr->max_mem;
+
+	ring = tal_arr(lr, u8, size);
+	memcpy(ring, lr->ring + lr->head, used);
+	tal_free(lr->ring);
+	lr->ring = ring;
+	lr->last -= lr->head;
+	lr->head = 0;
+	lr->tail = used;
+}
+
+/* Make room for a new record at the tail, dropping old ones if we have to. */
+static struct log_record *add_record(struct log_book *lr, enum log_level level,
+				     const char *prefix,
+				     size_t len, size_t io_len)
+{
+	size_t size = record_size(len, io_len);
+	struct log_record *r;
+
+	for (;;) {
+		if (lr->wrapped) {
+			if (lr->head - lr->tail >= size)
+				break;
+			drop_oldest(lr);
+		} else {
+			if (tal_bytelen(lr->ring) - lr->tail >= size)
+				break;
+			if (tal_bytelen(lr->ring) < lr->max_mem)
+				grow_ring(lr, lr->tail - lr->head + size);
+			else {
+				lr->wrap = lr->tail;
+				lr->tail = 0;
+				lr->wrapped = true;
+			}
 		}
+	}
+
+	r = record_at(lr, lr->tail);
+	r->time = time_now();
+	r->prefix = prefix;
+	r->skipped = lr->dropped;
+	r->len = len;
+	r->io_len = io_len;
+	r->level = level;
+
+	lr->dropped = 0;
+	lr->last = lr->tail;
+	lr->tail += size;
+	lr->mem_used += size;
+	lr->num_entries++;
+	return r;
+}
 
-		list_del_from(&log->log, &i->list);
-		log->mem_used -= mem_used(i);
-		tal_free(i);
-		skipped++;
-		deleted++;
+/* Undo add_record() of the newest entry (which must be at lr->last) */
+static void remove_newest(struct log_book *lr)
+{
+	const struct log_record *r = record_at(lr, lr->last);
+
+	lr->dropped += r->skipped;
+	lr->mem_used -= record_size(r->len, r->io_len);
+	lr->tail = lr->last;
+	if (--lr->num_entries == 0) {
+		lr->head = lr->tail = 0;
+		lr->wrapped = false;
+	} else if (lr->wrapped && lr->tail == 0) {
+		/* Newest is now the last one before the wrap. */
+		lr->tail = lr->wrap;
+		lr->wrapped = false;
 	}
+}
 
-	assert(!skipped);
-	return deleted;
+static void destroy_log_book(struct log_book *lr)
+{
+	strmap_clear(&lr->prefixes);
 }
 
 struct log_book *new_log_book(struct lightningd *ld, size_t max_mem,
@@ -109,18 +479,41 @@ struct log_book *new_log_book(struct lightningd *ld, size_t max_mem,
 	struct log_book *lr = tal_linkable(tal(NULL, struct log_book));
 
 	/* Give a reasonable size for memory limit! */
-	assert(max_mem > sizeof(struct log) * 2);
+	assert(max_mem > sizeof(struct log_record) * 4);
 	lr->mem_used = 0;
 	lr->max_mem = max_mem;
 	lr->print = log_to_stdout;
 	lr->print_level = printlevel;
 	lr->init_time = time_now();
 	lr->ld = ld;
-	list_head_init(&lr->log);
+	/* Most peers' logs never get near max_mem, so start small. */
+	lr->ring = tal_arr(lr, u8, max_mem < 4096 ? max_mem : 4096);
+	lr->head = lr->tail = lr->last = 0;
+	lr->wrapped = false;
+	lr->num_entries = 0;
+	lr->dropped = 0;
+	strmap_init(&lr->prefixes);
+	tal_add_destructor(lr, destroy_log_book);
 
 	return lr;
 }
 
+/* Entries keep a pointer to their prefix, so log->lr owns them all. */
+static const char *intern_prefix(struct log_book *lr, const char *prefix TAKES)
+{
+	const char *p = strmap_get(&lr->prefixes, prefix);
+
+	if (p) {
+		if (taken(prefix))
+			tal_free(prefix);
+		return p;
+	}
+
+	p = notleak(tal_strdup(lr, prefix));
+	strmap_add(&lr->prefixes, p, p);
+	return p;
+}
+
 /* With different entry points */
 struct log *PRINTF_FMT(3,4)
 new_log(const tal_t *ctx, struct log_book *record, const char *fmt, ...)
@@ -130,9 +523,7 @@ new_log(const tal_t *ctx, struct log_book *record, const char *fmt, ...)
 
 	log->lr = tal_link(log, record);
 	va_start(ap, fmt);
-	/* log->lr owns this, since its entries keep a pointer to it. */
-	/* FIXME: Refcount this! */
-	log->prefix = notleak(tal_vfmt(log->lr, fmt, ap));
+	log->prefix = intern_prefix(log->lr, take(tal_vfmt(NULL, fmt, ap)));
 	va_end(ap);
 
 	return log;
@@ -155,8 +546,7 @@ void set_log_level(struct log_book *lr, enum log_level level)
 
 void set_log_prefix(struct log *log, const char *prefix)
 {
-	/* log->lr owns this, since it keeps a pointer to it. */
-	log->prefix = tal_strdup(log->lr, prefix);
+	log->prefix = intern_prefix(log->lr, prefix);
 }
 
 void set_log_outfn_(struct log_book *lr,
@@ -193,62 +583,58 @@ const struct timeabs *log_init_time(const struct log_book *lr)
 	return &lr->init_time;
 }
 
-static void add_entry(struct log *log, struct log_entry *l)
+static void maybe_print(const struct log *log, const struct log_record *r,
+			size_t offset)
 {
-	log->lr->mem_used += mem_used(l);
-	list_add_tail(&log->lr->log, &l->list);
-
-	if (log->lr->mem_used > log->lr->max_mem) {
-		size_t old_mem = log->lr->mem_used, deleted;
-		deleted = prune_log(log->lr);
-		log_debug(log, "Log pruned %zu entries (mem %zu -> %zu)",
-			  deleted, old_mem, log->lr->mem_used);
-	}
+	if (r->level >= log->lr->print_level)
+		log->lr->print(r->prefix, r->level, offset != 0,
+			       &r->time, record_log(r) + offset,
+			       r->io_len ? record_io(r) : NULL, r->io_len,
+			       log->lr->print_arg);
 }
 
-static struct log_entry *new_log_entry(struct log *log, enum log_level level)
+/* Sanitize any non-printable characters, and replace with '?' */
+static void sanitize(char *str, size_t len)
 {
-	struct log_entry *l = tal(log->lr, struct log_entry);
-
-	l->time = time_now();
-	l->level = level;
-	l->skipped = 0;
-	l->prefix = log->prefix;
-	l->io = NULL;
-
-	return l;
+	for (size_t i = 0; i < len; i++)
+		if (str[i] < ' ' || str[i] >= 0x7f)
+			str[i] = '?';
 }
 
-static void maybe_print(const struct log *log, const struct log_entry *l,
-			size_t offset)
+/* Don't let a single entry push out everything else. */
+static size_t max_log_len(const struct log_book *lr)
 {
-	if (l->level >= log->lr->print_level)
-		log->lr->print(log->prefix, l->level, offset != 0,
-			       &l->time, l->log + offset,
-			       l->io, tal_bytelen(l->io), log->lr->print_arg);
+	return lr->max_mem / 4;
 }
 
 void logv(struct log *log, enum log_level level, bool call_notifier,
 			const char *fmt, va_list ap)
 {
 	int save_errno = errno;
-	struct log_entry *l = new_log_entry(log, level);
-
-	l->log = tal_vfmt(l, fmt, ap);
-
-	size_t log_len = strlen(l->log);
-
-	/* Sanitize any non-printable characters, and replace with '?' */
-	for (size_t i=0; i<log_len; i++)
-		if (l->log[i] < ' ' || l->log[i] >= 0x7f)
-			l->log[i] = '?';
-
-	maybe_print(log, l, 0);
-
-	add_entry(log, l);
+	struct log_record *r;
+	va_list ap2;
+	int len;
 
-	if (call_notifier)
-		notify_warning(log->lr->ld, l);
+	/* Format straight into the ring: no allocations. */
+	va_copy(ap2, ap);
+	len = vsnprintf(NULL, 0, fmt, ap2);
+	va_end(ap2);
+	if (len < 0)
+		len = 0;
+	else if ((size_t)len > max_log_len(log->lr))
+		len = max_log_len(log->lr);
+
+	r = add_record(log->lr, level, log->prefix, len, 0);
+	vsnprintf(record_log(r), len + 1, fmt, ap);
+	sanitize(record_log(r), len);
+
+	maybe_print(log, r, 0);
+
+	if (call_notifier) {
+		struct log_entry l;
+		unpack_record(r, &l);
+		notify_warning(log->lr->ld, &l);
+	}
 
 	errno = save_errno;
 }
@@ -258,48 +644,81 @@ void log_io(struct log *log, enum log_level dir,
 	    const void *data TAKES, size_t len)
 {
 	int save_errno = errno;
-	struct log_entry *l = new_log_entry(log, dir);
+	struct log_record *r;
+	size_t slen = strlen(str);
+	struct timeabs now = time_now();
 
 	assert(dir == LOG_IO_IN || dir == LOG_IO_OUT);
 
 	/* Print first, in case we need to truncate. */
-	if (l->level >= log->lr->print_level)
-		log->lr->print(log->prefix, l->level, false,
-			       &l->time, str,
+	if (dir >= log->lr->print_level)
+		log->lr->print(log->prefix, dir, false,
+			       &now, str,
 			       data, len, log->lr->print_arg);
 
-	l->log = tal_strdup(l, str);
+	if (slen > max_log_len(log->lr))
+		slen = max_log_len(log->lr);
 
 	/* Don't immediately fill buffer with giant IOs */
 	if (len > log->lr->max_mem / 64) {
-		l->skipped++;
-		len = log->lr->max_mem / 64;
-	}
-	l->io = tal_dup_arr(l, u8, data, len, 0);
+		r = add_record(log->lr, dir, log->prefix,
+			       slen, log->lr->max_mem / 64);
+		r->skipped++;
+	} else
+		r = add_record(log->lr, dir, log->prefix, slen, len);
+
+	memcpy(record_log(r), str, slen);
+	record_log(r)[slen] = '\0';
+	if (r->io_len)
+		memcpy(record_io(r), data, r->io_len);
 
-	add_entry(log, l);
+	if (taken(str))
+		tal_free(str);
+	if (taken(data))
+		tal_free(data);
 	errno = save_errno;
 }
 
 void logv_add(struct log *log, const char *fmt, va_list ap)
 {
-	struct log_entry *l = list_tail(&log->lr->log, struct log_entry, list);
-	size_t oldlen = strlen(l->log);
-
-	/* Remove from list, so it doesn't get pruned. */
-	log->lr->mem_used -= mem_used(l);
-	list_del_from(&log->lr->log, &l->list);
-
-	tal_append_vfmt(&l->log, fmt, ap);
-
-	/* Sanitize any non-printable characters, and replace with '?' */
-	for (size_t i=oldlen; i<strlen(l->log); i++)
-		if (l->log[i] < ' ' || l->log[i] >= 0x7f)
-			l->log[i] = '?';
+	struct log_book *lr = log->lr;
+	const struct log_record *old;
+	struct log_record *r;
+	struct log_entry l;
+	char *str;
+	u8 *io;
+	size_t oldlen, len;
+
+	if (lr->num_entries == 0) {
+		logv(log, LOG_INFORM, false, fmt, ap);
+		return;
+	}
 
-	add_entry(log, l);
+	/* Take a copy of the newest entry, and rewrite it with the addition */
+	old = record_at(lr, lr->last);
+	unpack_record(old, &l);
+	str = tal_strdup(NULL, l.log);
+	io = l.io_len ? tal_dup_arr(str, u8, l.io, l.io_len, 0) : NULL;
+	oldlen = strlen(str);
+	tal_append_vfmt(&str, fmt, ap);
+	len = strlen(str);
+	if (len > max_log_len(lr))
+		len = max_log_len(lr);
+	sanitize(str + oldlen, len - oldlen);
+
+	remove_newest(lr);
+	r = add_record(lr, l.level, l.prefix, len, l.io_len);
+	/* Same entry as before, just longer.  remove_newest() put its skipped
+	 * count back in lr->dropped, so add_record() already counted it,
+	 * along with anything it dropped to make room. */
+	r->time = l.time;
+	memcpy(record_log(r), str, len);
+	record_log(r)[len] = '\0';
+	if (io)
+		memcpy(record_io(r), io, l.io_len);
+	tal_free(str);
 
-	maybe_print(log, l, oldlen);
+	maybe_print(log, r, oldlen);
 }
 
 void log_(struct log *log, enum log_level level, bool call_notifier,
@@ -328,14 +747,19 @@ void log_each_line_(const struct log_book *lr,
 				 const char *prefix,
 				 const char *log,
 				 const u8 *io,
+				 size_t io_len,
 				 void *arg),
 		    void *arg)
 {
-	const struct log_entry *i;
+	size_t i, off;
+
+	for (i = 0, off = lr->head; i < lr->num_entries;
+	     i++, off = next_record(lr, off)) {
+		struct log_entry l;
 
-	list_for_each(&lr->log, i, list) {
-		func(i->skipped, time_between(i->time, lr->init_time),
-		     i->level, i->prefix, i->log, i->io, arg);
+		unpack_record(record_at(lr, off), &l);
+		func(l.skipped, time_between(l.time, lr->init_time),
+		     l.level, l.prefix, l.log, l.io, l.io_len, arg);
 	}
 }
 
@@ -350,6 +774,7 @@ static void log_one_line(unsigned int skipped,
 			 const char *prefix,
 			 const char *log,
 			 const u8 *io,
+			 size_t io_len,
 			 struct log_data *data)
 {
 	char buf[101];
@@ -376,11 +801,11 @@ static void log_one_line(unsigned int skipped,
 	write_all(data->fd, buf, strlen(buf));
 	write_all(data->fd, log, strlen(log));
 	if (level == LOG_IO_IN || level == LOG_IO_OUT) {
-		size_t off, used, len = tal_count(io);
+		size_t off, used;
 
 		/* No allocations, may be in signal handler. */
-		for (off = 0; off < len; off += used) {
-			used = len - off;
+		for (off = 0; off < io_len; off += used) {
+			used = io_len - off;
 			if (hex_str_size(used) > sizeof(buf))
 				used = hex_data_size(sizeof(buf));
 			hex_encode(io + off, used, buf, hex_str_size(used));
@@ -439,6 +864,29 @@ static void show_log_prefix(char buf[OPT_SHOW_LEN], const struct log *log)
 	strncpy(buf, log->prefix, OPT_SHOW_LEN);
 }
 
+static const char *log_async_names[] = {
+	[LOG_ASYNC_OFF] = "off",
+	[LOG_ASYNC_BLOCK] = "block",
+	[LOG_ASYNC_DROP] = "drop",
+};
+
+static char *arg_log_async(const char *arg, struct lightningd *ld UNUSED)
+{
+	for (size_t i = 0; i < ARRAY_SIZE(log_async_names); i++) {
+		if (streq(arg, log_async_names[i])) {
+			log_async = i;
+			return NULL;
+		}
+	}
+	return tal_fmt(NULL, "log-async must be off, block or drop");
+}
+
+static void show_log_async(char buf[OPT_SHOW_LEN],
+			   const struct lightningd *ld UNUSED)
+{
+	strncpy(buf, log_async_names[log_async], OPT_SHOW_LEN-1);
+}
+
 static int signalfds[2];
 
 static void handle_sighup(int sig)
@@ -452,17 +900,40 @@ static void handle_sighup(int sig)
 /* Mutual recursion */
 static struct io_plan *setup_read(struct io_conn *conn, struct lightningd *ld);
 
+/* Start logging to logf, directly or via the writer thread. */
+static void use_log_file(struct lightningd *ld, FILE *logf)
+{
+	int fd;
+
+	if (log_async == LOG_ASYNC_OFF) {
+		set_log_outfn(ld->log->lr, log_to_file, logf);
+		return;
+	}
+
+	fd = dup(fileno(logf));
+	if (fd < 0)
+		err(1, "Duplicating log file fd");
+	fclose(logf);
+
+	if (!log_writer)
+		new_log_writer(fd);
+	else
+		log_writer_set_fd(log_writer, fd);
+	set_log_outfn(ld->log->lr, log_to_writer, log_writer);
+}
+
 static struct io_plan *rotate_log(struct io_conn *conn, struct lightningd *ld)
 {
 	FILE *logf;
 
 	log_info(ld->log, "Ending log due to SIGHUP");
-	fclose(ld->log->lr->print_arg);
+	if (!log_writer)
+		fclose(ld->log->lr->print_arg);
 
 	logf = fopen(ld->logfile, "a");
 	if (!logf)
 		err(1, "failed to reopen log file %s", ld->logfile);
-	set_log_outfn(ld->log->lr, log_to_file, logf);
+	use_log_file(ld, logf);
 
 	log_info(ld->log, "Started log due to SIGHUP");
 	return setup_read(conn, ld);
@@ -494,12 +965,14 @@ static void setup_log_rotation(struct lightningd *ld)
 
 char *arg_log_to_file(const char *arg, struct lightningd *ld)
 {
-	const struct log_entry *i;
+	struct log_book *lr = ld->log->lr;
+	size_t i, off;
 	FILE *logf;
 	int size;
 
 	if (ld->logfile) {
-		fclose(ld->log->lr->print_arg);
+		if (!log_writer)
+			fclose(ld->log->lr->print_arg);
 		ld->logfile = tal_free(ld->logfile);
 	} else
 		setup_log_rotation(ld);
@@ -508,16 +981,19 @@ char *arg_log_to_file(const char *arg, struct lightningd *ld)
 	logf = fopen(arg, "a");
 	if (!logf)
 		return tal_fmt(NULL, "Failed to open: %s", strerror(errno));
-	set_log_outfn(ld->log->lr, log_to_file, logf);
 
 	/* For convenience make a block of empty lines just like Bitcoin Core */
 	size = ftell(logf);
-	if (size > 0)
+	if (size > 0) {
 		fprintf(logf, "\n\n\n\n");
+		fflush(logf);
+	}
+	use_log_file(ld, logf);
 
 	/* Catch up */
-	list_for_each(&ld->log->lr->log, i, list)
-		maybe_print(ld->log, i, 0);
+	for (i = 0, off = lr->head; i < lr->num_entries;
+	     i++, off = next_record(lr, off))
+		maybe_print(ld->log, record_at(lr, off), 0);
 
 	log_debug(ld->log, "Opened log file %s", arg);
 	return NULL;
@@ -531,6 +1007,11 @@ void opt_register_logging(struct lightningd *ld)
 	opt_register_early_arg("--log-prefix", arg_log_prefix, show_log_prefix,
 			       ld->log,
 			       "log prefix");
+	opt_register_early_arg("--log-async", arg_log_async, show_log_async,
+			       ld,
+			       "write log file from a separate thread: off, block"
+			       " (wait if it falls behind) or drop (discard lines"
+			       " if it falls behind)");
 	/* We want this opened later, once we have moved to lightning dir */
 	opt_register_arg("--log-file=<file>", arg_log_to_file, NULL, ld,
 			 "log to file instead of stdout");
@@ -550,14 +1031,12 @@ void log_backtrace_print(const char *fmt, ...)
 
 static void log_dump_to_file(int fd, const struct log_book *lr)
 {
-	const struct log_entry *i;
 	char buf[100];
 	int len;
 	struct log_data data;
 	time_t start;
 
-	i = list_top(&lr->log, const struct log_entry, list);
-	if (!i) {
+	if (lr->num_entries == 0) {
 		write_all(fd, "0 bytes:\n\n", strlen("0 bytes:\n\n"));
 		return;
 	}
@@ -645,6 +1124,7 @@ static void log_to_json(unsigned int skipped,
 			const char *prefix,
 			const char *log,
 			const u8 *io,
+			size_t io_len,
 			struct log_info *info)
 {
 	info->num_skipped += skipped;
@@ -669,7 +1149,7 @@ static void log_to_json(unsigned int skipped,
 	json_add_string(info->response, "source", prefix);
 	json_add_string(info->response, "log", log);
 	if (io)
-		json_add_hex_talarr(info->response, "data", io);
+		json_add_hex(info->response, "data", io, io_len);
 
 	json_object_end(info->response);
 }
@@ -2,6 +2,7 @@
 #define LIGHTNING_LIGHTNINGD_LOG_H
 #include "config.h"
 #include <ccan/list/list.h>
+#include <ccan/strmap/strmap.h>
 #include <ccan/tal/tal.h>
 #include <ccan/time/time.h>
 #include <ccan/typesafe_cb/typesafe_cb.h>
@@ -15,15 +16,17 @@ struct json_stream;
 struct lightningd;
 struct timerel;
 
+/* An unpacked view of one entry in a log_book's ring buffer: the strings
+ * point into the ring, so they're only valid until the next log call. */
 struct log_entry {
-	struct list_node list;
 	struct timeabs time;
 	enum log_level level;
 	unsigned int skipped;
 	const char *prefix;
-	char *log;
+	const char *log;
 	/* Iff LOG_IO */
 	const u8 *io;
+	size_t io_len;
 };
 
 struct log_book {
@@ -40,7 +43,20 @@ struct log_book {
 	enum log_level print_level;
 	struct timeabs init_time;
 
-	struct list_head log;
+	/* Entries are packed into this ring, which grows up to max_mem. */
+	u8 *ring;
+	/* Offsets of oldest entry, next free space, and newest entry. */
+	size_t head, tail, last;
+	/* If wrapped, entries run from head to wrap, then 0 to tail. */
+	bool wrapped;
+	size_t wrap;
+	size_t num_entries;
+	/* Entries dropped when the ring was emptied. */
+	unsigned int dropped;
+
+	/* Each distinct prefix is only stored once. */
+	STRMAP(const char *) prefixes;
+
 	/* Although log_book will copy log entries to parent log_book
 	 * (the log_book belongs to lightningd), a pointer to lightningd
 	 *  is more directly because the notification needs ld->plugins.
@@ -114,7 +130,8 @@ const struct timeabs *log_init_time(const struct log_book *lr);
 					   enum log_level,		\
 					   const char *,		\
 					   const char *,		\
-					   const u8 *), (arg))
+					   const u8 *,			\
+					   size_t), (arg))
 
 void log_each_line_(const struct log_book *lr,
 		    void (*func)(unsigned int skipped,
@@ -123,6 +140,7 @@ void log_each_line_(const struct log_book *lr,
 				 const char *prefix,
 				 const char *log,
 				 const u8 *io,
+				 size_t io_len,
 				 void *arg),
 		    void *arg);
 
@@ -21,6 +21,7 @@
 #include <lightningd/opening_control.h>
 #include <lightningd/peer_control.h>
 #include <lightningd/subd.h>
+#include <wallet/wallet.h>
 #include <stdio.h>
 #include <wire/wire_sync.h>
 
@@ -155,6 +156,7 @@ static void scan_mem(struct command *cmd,
 	memleak_remove_htable(memtable, &ld->topology->txowatches.raw);
 	memleak_remove_htable(memtable, &ld->htlcs_in.raw);
 	memleak_remove_htable(memtable, &ld->htlcs_out.raw);
+	memleak_remove_strmap(memtable, &ld->wallet->db->stmt_cache);
 	jsonrpc_remove_memleak(memtable, ld->jsonrpc);
 
 	/* Now delete ld and those which it has pointers to. */
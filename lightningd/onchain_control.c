@@ -274,6 +274,8 @@ static void handle_irrevocably_resolved(struct channel *channel, const u8 *msg U
 
 	log_info(channel->log, "onchaind complete, forgetting peer");
 
+	wallet_channel_archive(channel->peer->ld->wallet, channel->dbid,
+			       get_block_height(channel->peer->ld->topology));
 	/* This will also free onchaind. */
 	delete_channel(channel);
 }
@@ -507,6 +509,12 @@ enum watch_result onchaind_funding_spent(struct channel *channel,
 			feerate = feerate_floor();
 	}
 
+	/* Channels are loaded from the db without these. */
+	if (!channel->last_htlc_sigs)
+		channel->last_htlc_sigs
+			= wallet_htlc_sigs_load(channel, ld->wallet,
+						channel->dbid);
+
 	msg = towire_onchain_init(channel,
 				  &channel->their_shachain.chain,
 				  is_elements,
@@ -535,6 +543,7 @@ enum watch_result onchaind_funding_spent(struct channel *channel,
 				  blockheight,
 				  /* FIXME: config for 'reasonable depth' */
 				  3,
+				  ld->config.archive_depth,
 				  channel->last_htlc_sigs,
 				  tal_count(stubs),
 				  channel->min_possible_feerate,
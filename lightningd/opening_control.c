@@ -920,7 +920,7 @@ static void openchannel_hook_cb(struct openchannel_hook_payload *payload,
 		      take(towire_opening_got_offer_reply(NULL, errmsg)));
 }
 
-REGISTER_PLUGIN_HOOK(openchannel,
+REGISTER_PLUGIN_HOOK(openchannel, PLUGIN_HOOK_CHAIN,
 		     openchannel_hook_cb,
 		     struct openchannel_hook_payload *,
 		     openchannel_hook_serialize,
@@ -935,19 +935,52 @@ static const struct json_command waitsendpay_command = {
 };
 AUTODATA(json_command, &waitsendpay_command);
 
+static struct command_result *param_payment_status(struct command *cmd,
+						   const char *name,
+						   const char *buffer,
+						   const jsmntok_t *tok,
+						   enum wallet_payment_status **status)
+{
+	*status = tal(cmd, enum wallet_payment_status);
+	if (json_tok_streq(buffer, tok, "pending")) {
+		**status = PAYMENT_PENDING;
+		return NULL;
+	} else if (json_tok_streq(buffer, tok, "complete")) {
+		**status = PAYMENT_COMPLETE;
+		return NULL;
+	} else if (json_tok_streq(buffer, tok, "failed")) {
+		**status = PAYMENT_FAILED;
+		return NULL;
+	}
+
+	return command_fail(cmd, JSONRPC2_INVALID_PARAMS,
+			    "'%s' should be 'pending', 'complete' or 'failed',"
+			    " not '%.*s'",
+			    name, json_tok_full_len(tok),
+			    json_tok_full(buffer, tok));
+}
+
 static struct command_result *json_listsendpays(struct command *cmd,
 						const char *buffer,
 						const jsmntok_t *obj UNNEEDED,
 						const jsmntok_t *params)
 {
-	const struct wallet_payment **payments;
 	struct json_stream *response;
+	struct payment_filter *filter = tal(cmd, struct payment_filter);
+	struct payment_iterator it;
 	struct sha256 *rhash;
 	const char *b11str;
+	enum wallet_payment_status *status;
+	u64 *created_since, *created_before, *start, *limit;
 
 	if (!param(cmd, buffer, params,
 		   p_opt("bolt11", param_string, &b11str),
 		   p_opt("payment_hash", param_sha256, &rhash),
+		   p_opt("status", param_payment_status, &status),
+		   p_opt("created_since", param_u64, &created_since),
+		   p_opt("created_before", param_u64, &created_before),
+		   p_opt_def("start", param_u64, &start, 0),
+		   p_opt_def("limit", param_u64, &limit, 0),
 		   NULL))
 		return command_param_failed();
 
@@ -969,15 +1002,25 @@ static struct command_result *json_listsendpays(struct command *cmd,
 		rhash = &b11->payment_hash;
 	}
 
-	payments = wallet_payment_list(cmd, cmd->ld->wallet, rhash);
+	filter->payment_hash = rhash;
+	filter->status = status;
+	filter->created_since = created_since;
+	filter->created_before = created_before;
+	filter->start = *start;
+	filter->limit = *limit;
 
 	response = json_stream_success(cmd);
 
+	memset(&it, 0, sizeof(it));
 	json_array_start(response, "payments");
-	for (size_t i = 0; i < tal_count(payments); i++) {
+	while (wallet_payments_iterate(cmd->ld->wallet, &it, filter)) {
+		const tal_t *ctx = tal(NULL, char);
+		const struct wallet_payment *p
+			= wallet_payments_deref(ctx, cmd->ld->wallet, &it);
 		json_object_start(response, NULL);
-		json_add_payment_fields(response, payments[i]);
+		json_add_payment_fields(response, p);
 		json_object_end(response);
+		tal_free(ctx);
 	}
 	json_array_end(response);
 
@@ -997,6 +1040,11 @@ static const struct json_command listsendpays_command = {
 	"listsendpays",
 	"payment",
 	json_listsendpays,
-	"Show sendpay, old and current, optionally limiting to {bolt11} or {payment_hash}."
+	"Show sendpay, old and current, optionally limiting to {bolt11} or {payment_hash}.",
+	false,
+	"Show sendpay, old and current, optionally only {bolt11} or"
+	" {payment_hash}, with {status}, or created in [{created_since},"
+	" {created_before}) (UNIX seconds); at most {limit} of them,"
+	" starting at id {start}"
 };
 AUTODATA(json_command, &listsendpays_command);
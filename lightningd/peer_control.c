@@ -891,7 +891,8 @@ send_error:
 	tal_free(payload);
 }
 
-REGISTER_PLUGIN_HOOK(peer_connected, peer_connected_hook_cb,
+REGISTER_PLUGIN_HOOK(peer_connected, PLUGIN_HOOK_PARALLEL,
+		     peer_connected_hook_cb,
 		     struct peer_connected_hook_payload *,
 		     peer_connected_serialize,
 		     struct peer_connected_hook_payload *);
@@ -1155,6 +1156,62 @@ static const struct json_command listpeers_command = {
 };
 AUTODATA(json_command, &listpeers_command);
 
+static struct command_result *json_listclosedchannels(struct command *cmd,
+						      const char *buffer,
+						      const jsmntok_t *obj UNNEEDED,
+						      const jsmntok_t *params)
+{
+	struct node_id *peer_id;
+	const struct closed_channel *chans;
+	struct json_stream *response;
+
+	if (!param(cmd, buffer, params,
+		   p_opt("id", param_node_id, &peer_id),
+		   NULL))
+		return command_param_failed();
+
+	chans = wallet_closed_channels_get(cmd, cmd->ld->wallet, peer_id);
+
+	response = json_stream_success(cmd);
+	json_array_start(response, "closedchannels");
+	for (size_t i = 0; i < tal_count(chans); i++) {
+		struct channel_id cid;
+
+		json_object_start(response, NULL);
+		json_add_node_id(response, "peer_id", &chans[i].peer_id);
+		if (chans[i].scid)
+			json_add_short_channel_id(response, "short_channel_id",
+						  chans[i].scid);
+		derive_channel_id(&cid, &chans[i].funding_txid,
+				  chans[i].funding_outnum);
+		json_add_string(response, "channel_id",
+				type_to_string(tmpctx, struct channel_id, &cid));
+		json_add_txid(response, "funding_txid", &chans[i].funding_txid);
+		json_add_num(response, "funding_outnum",
+			     chans[i].funding_outnum);
+		json_add_string(response, "funder",
+				chans[i].funder == LOCAL ? "local" : "remote");
+		json_add_amount_sat_only(response, "total_msat",
+					 chans[i].funding);
+		json_add_amount_msat_only(response, "to_us_msat",
+					  chans[i].our_msat);
+		json_add_num(response, "archived_height",
+			     chans[i].archived_height);
+		json_object_end(response);
+	}
+	json_array_end(response);
+
+	return command_success(cmd, response);
+}
+
+static const struct json_command listclosedchannels_command = {
+	"listclosedchannels",
+	"network",
+	json_listclosedchannels,
+	"Show channels closed and archived, optionally only those with peer {id}"
+};
+AUTODATA(json_command, &listclosedchannels_command);
+
 static struct command_result *
 command_find_channel(struct command *cmd,
 		     const char *buffer, const jsmntok_t *tok,
@@ -1324,25 +1381,12 @@ void activate_peers(struct lightningd *ld)
 /* Pull peers, channels and HTLCs from db, and wire them up. */
 void load_channels_from_wallet(struct lightningd *ld)
 {
-	struct peer *peer;
-
 	/* Load peers from database */
 	if (!wallet_channels_load_active(ld->wallet))
 		fatal("Could not load channels from the database");
 
-	/* This is a poor-man's db join :( */
-	list_for_each(&ld->peers, peer, list) {
-		struct channel *channel;
-
-		list_for_each(&peer->channels, channel, list) {
-			if (!wallet_htlcs_load_for_channel(ld->wallet,
-							   channel,
-							   &ld->htlcs_in,
-							   &ld->htlcs_out)) {
-				fatal("could not load htlcs for channel");
-			}
-		}
-	}
+	if (!wallet_htlcs_load_all(ld->wallet, &ld->htlcs_in, &ld->htlcs_out))
+		fatal("could not load htlcs for channels");
 
 	/* Now connect HTLC pointers together */
 	htlcs_reconnect(ld, &ld->htlcs_in, &ld->htlcs_out);
@@ -1,11 +1,13 @@
 #include <bitcoin/preimage.h>
 #include <bitcoin/tx.h>
+#include <ccan/array_size/array_size.h>
 #include <ccan/build_assert/build_assert.h>
 #include <ccan/cast/cast.h>
 #include <ccan/crypto/ripemd160/ripemd160.h>
 #include <ccan/mem/mem.h>
 #include <ccan/tal/str/str.h>
 #include <channeld/gen_channel_wire.h>
+#include <common/gen_plugin_wire.h>
 #include <common/json_command.h>
 #include <common/jsonrpc_errors.h>
 #include <common/overflows.h>
@@ -731,23 +733,36 @@ static void htlc_accepted_hook_serialize(struct htlc_accepted_hook_payload *p,
 	json_object_end(s);
 }
 
-/**
- * Callback when a plugin answers to the htlc_accepted hook
- */
+static u8 *htlc_accepted_hook_serialize_wire(const tal_t *ctx,
+					     struct htlc_accepted_hook_payload *p)
+{
+	const struct route_step *rs = p->route_step;
+	const struct htlc_in *hin = p->hin;
+
+	return towire_plugin_htlc_accepted(ctx, rs->raw_payload,
+					   rs->hop_data.realm,
+					   &rs->hop_data.channel_id,
+					   rs->hop_data.amt_forward,
+					   rs->hop_data.outgoing_cltv,
+					   p->next_onion,
+					   hin->shared_secret,
+					   hin->msat,
+					   hin->cltv_expiry,
+					   p->ld->topology->tip->height,
+					   &hin->payment_hash);
+}
+
 static void
-htlc_accepted_hook_callback(struct htlc_accepted_hook_payload *request,
-			    const char *buffer, const jsmntok_t *toks)
+htlc_accepted_hook_resolve(struct htlc_accepted_hook_payload *request,
+			   enum htlc_accepted_result result,
+			   const struct preimage *payment_preimage,
+			   enum onion_type failure_code)
 {
 	struct route_step *rs = request->route_step;
 	struct htlc_in *hin = request->hin;
 	struct channel *channel = request->channel;
 	struct lightningd *ld = request->ld;
-	struct preimage payment_preimage;
 	u8 *req;
-	enum htlc_accepted_result result;
-	enum onion_type failure_code;
-	u8 *channel_update;
-	result = htlc_accepted_hook_deserialize(buffer, toks, &payment_preimage, &failure_code, &channel_update);
 
 	switch (result) {
 	case htlc_accepted_continue:
@@ -783,17 +798,62 @@ htlc_accepted_hook_callback(struct htlc_accepted_hook_payload *request,
 		fail_in_htlc(hin, failure_code, NULL, NULL);
 		break;
 	case htlc_accepted_resolve:
-		fulfill_htlc(hin, &payment_preimage);
+		fulfill_htlc(hin, payment_preimage);
 		break;
 	}
 
 	tal_free(request);
 }
 
-REGISTER_PLUGIN_HOOK(htlc_accepted, htlc_accepted_hook_callback,
-		     struct htlc_accepted_hook_payload *,
-		     htlc_accepted_hook_serialize,
-		     struct htlc_accepted_hook_payload *);
+/**
+ * Callback when a plugin answers to the htlc_accepted hook
+ */
+static void
+htlc_accepted_hook_callback(struct htlc_accepted_hook_payload *request,
+			    const char *buffer, const jsmntok_t *toks)
+{
+	struct preimage payment_preimage;
+	enum htlc_accepted_result result;
+	enum onion_type failure_code;
+	u8 *channel_update;
+	result = htlc_accepted_hook_deserialize(buffer, toks, &payment_preimage, &failure_code, &channel_update);
+
+	htlc_accepted_hook_resolve(request, result, &payment_preimage,
+				   failure_code);
+}
+
+/* Same, for plugins which answer in binary (continue is handled for us). */
+static void
+htlc_accepted_hook_wire_callback(struct htlc_accepted_hook_payload *request,
+				 const u8 *msg)
+{
+	struct preimage payment_preimage;
+	u8 result;
+	u16 failure_code;
+	u8 *channel_update;
+
+	if (!fromwire_plugin_htlc_accepted_reply(tmpctx, msg, &result,
+						 &failure_code,
+						 &channel_update,
+						 &payment_preimage))
+		fatal("Plugin sent an invalid binary htlc_accepted reply: %s",
+		      tal_hex(tmpctx, msg));
+
+	if (result != htlc_accepted_fail && result != htlc_accepted_resolve)
+		fatal("Plugin sent an unknown binary htlc_accepted result %u",
+		      result);
+
+	htlc_accepted_hook_resolve(request, result, &payment_preimage,
+				   failure_code);
+}
+
+REGISTER_PLUGIN_HOOK_WIRE(htlc_accepted, PLUGIN_HOOK_PARALLEL,
+			  htlc_accepted_hook_callback,
+			  struct htlc_accepted_hook_payload *,
+			  htlc_accepted_hook_serialize,
+			  struct htlc_accepted_hook_payload *,
+			  htlc_accepted_hook_serialize_wire,
+			  htlc_accepted_hook_wire_callback);
 
 /**
  * Everyone is committed to this htlc of theirs
@@ -1263,10 +1323,9 @@ static bool peer_save_commitsig_received(struct channel *channel, u64 commitnum,
 	return true;
 }
 
+/* Our caller saves the channel. */
 static bool peer_save_commitsig_sent(struct channel *channel, u64 commitnum)
 {
-	struct lightningd *ld = channel->peer->ld;
-
 	if (commitnum != channel->next_index[REMOTE]) {
 		channel_internal_error(channel,
 			   "channel_sent_commitsig: expected commitnum %"PRIu64
@@ -1276,13 +1335,10 @@ static bool peer_save_commitsig_sent(struct channel *channel, u64 commitnum)
 	}
 
 	channel->next_index[REMOTE]++;
-
-	/* FIXME: Save to database, with sig and HTLCs. */
-	wallet_channel_save(ld->wallet, channel);
 	return true;
 }
 
-void peer_sending_commitsig(struct channel *channel, const u8 *msg)
+static void sending_commitsig(struct channel *channel, const u8 *msg)
 {
 	u64 commitnum;
 	u32 feerate;
@@ -1441,7 +1497,7 @@ static bool peer_sending_revocation(struct channel *channel,
 }
 
 /* This also implies we're sending revocation */
-void peer_got_commitsig(struct channel *channel, const u8 *msg)
+static void got_commitsig(struct channel *channel, const u8 *msg)
 {
 	u64 commitnum;
 	u32 feerate;
@@ -1543,7 +1599,7 @@ void update_per_commit_point(struct channel *channel,
 	ci->remote_per_commit = *per_commitment_point;
 }
 
-void peer_got_revoke(struct channel *channel, const u8 *msg)
+static void got_revoke(struct channel *channel, const u8 *msg)
 {
 	u64 revokenum;
 	struct secret per_commitment_secret;
@@ -1648,6 +1704,35 @@ void peer_got_revoke(struct channel *channel, const u8 *msg)
 	wallet_channel_save(ld->wallet, channel);
 }
 
+/* Each of these can move dozens of HTLCs, some more than once: write them
+ * out together at the end. */
+void peer_sending_commitsig(struct channel *channel, const u8 *msg)
+{
+	struct wallet *w = channel->peer->ld->wallet;
+
+	wallet_htlc_batch_start(w);
+	sending_commitsig(channel, msg);
+	wallet_htlc_batch_end(w);
+}
+
+void peer_got_commitsig(struct channel *channel, const u8 *msg)
+{
+	struct wallet *w = channel->peer->ld->wallet;
+
+	wallet_htlc_batch_start(w);
+	got_commitsig(channel, msg);
+	wallet_htlc_batch_end(w);
+}
+
+void peer_got_revoke(struct channel *channel, const u8 *msg)
+{
+	struct wallet *w = channel->peer->ld->wallet;
+
+	wallet_htlc_batch_start(w);
+	got_revoke(channel, msg);
+	wallet_htlc_batch_end(w);
+}
+
 static void add_htlc(struct added_htlc **htlcs,
 		     enum htlc_state **htlc_states,
 		     u64 id,
@@ -2107,14 +2192,17 @@ static const struct json_command dev_ignore_htlcs = {
 AUTODATA(json_command, &dev_ignore_htlcs);
 #endif /* DEVELOPER */
 
-static void listforwardings_add_forwardings(struct json_stream *response, struct wallet *wallet)
+static void listforwardings_add_forwardings(struct json_stream *response,
+					    struct wallet *wallet,
+					    const struct forwarding_filter *filter)
 {
-	const struct forwarding *forwardings;
-	forwardings = wallet_forwarded_payments_get(wallet, tmpctx);
+	struct forwarding_iterator it;
 
+	memset(&it, 0, sizeof(it));
 	json_array_start(response, "forwards");
-	for (size_t i=0; i<tal_count(forwardings); i++) {
-		const struct forwarding *cur = &forwardings[i];
+	while (wallet_forwarded_payments_iterate(wallet, &it, filter)) {
+		const struct forwarding *cur
+			= wallet_forwarded_payments_deref(tmpctx, wallet, &it);
 		json_object_start(response, NULL);
 
 		json_add_short_channel_id(response, "in_channel", &cur->channel_in);
@@ -2129,6 +2217,10 @@ static void listforwardings_add_forwardings(struct json_stream *response, struct
 					    cur->fee,
 					    "fee", "fee_msat");
 		json_add_string(response, "status", forward_status_name(cur->status));
+		if (cur->payment_hash)
+			json_add_hex(response, "payment_hash",
+				     cur->payment_hash,
+				     sizeof(*cur->payment_hash));
 
 		if(cur->failcode != 0) {
 			json_add_num(response, "failcode", cur->failcode);
@@ -2149,11 +2241,46 @@ static void listforwardings_add_forwardings(struct json_stream *response, struct
 		if (cur->resolved_time)
 			json_add_timeabs(response, "resolved_time", *cur->resolved_time);
 #endif
+		json_add_u64(response, "updated_index", cur->updated_index);
 		json_object_end(response);
+		tal_free(cur);
 	}
 	json_array_end(response);
+}
+
+static struct command_result *param_forward_status(struct command *cmd,
+						   const char *name,
+						   const char *buffer,
+						   const jsmntok_t *tok,
+						   enum forward_status **status)
+{
+	enum forward_status s[] = { FORWARD_OFFERED, FORWARD_SETTLED,
+				    FORWARD_FAILED, FORWARD_LOCAL_FAILED };
 
-	tal_free(forwardings);
+	for (size_t i = 0; i < ARRAY_SIZE(s); i++) {
+		if (json_tok_streq(buffer, tok, forward_status_name(s[i]))) {
+			*status = tal_dup(cmd, enum forward_status, &s[i]);
+			return NULL;
+		}
+	}
+
+	return command_fail(cmd, JSONRPC2_INVALID_PARAMS,
+			    "'%s' should be 'offered', 'settled', 'failed'"
+			    " or 'local_failed', not '%.*s'",
+			    name, json_tok_full_len(tok),
+			    json_tok_full(buffer, tok));
+}
+
+static struct timeabs *timeabs_from_secs(const tal_t *ctx, const u64 *secs)
+{
+	struct timeabs *t;
+
+	if (!secs)
+		return NULL;
+	t = tal(ctx, struct timeabs);
+	t->ts.tv_sec = *secs;
+	t->ts.tv_nsec = 0;
+	return t;
 }
 
 static struct command_result *json_listforwards(struct command *cmd,
@@ -2162,12 +2289,32 @@ static struct command_result *json_listforwards(struct command *cmd,
 						const jsmntok_t *params)
 {
 	struct json_stream *response;
+	struct forwarding_filter *filter = tal(cmd, struct forwarding_filter);
+	enum forward_status *status;
+	struct short_channel_id *in_channel, *out_channel;
+	u64 *received_since, *received_before, *start, *limit;
 
-	if (!param(cmd, buffer, params, NULL))
+	if (!param(cmd, buffer, params,
+		   p_opt("status", param_forward_status, &status),
+		   p_opt("in_channel", param_short_channel_id, &in_channel),
+		   p_opt("out_channel", param_short_channel_id, &out_channel),
+		   p_opt("received_since", param_u64, &received_since),
+		   p_opt("received_before", param_u64, &received_before),
+		   p_opt_def("start", param_u64, &start, 0),
+		   p_opt_def("limit", param_u64, &limit, 0),
+		   NULL))
 		return command_param_failed();
 
+	filter->status = status;
+	filter->in_channel = in_channel;
+	filter->out_channel = out_channel;
+	filter->received_since = timeabs_from_secs(filter, received_since);
+	filter->received_before = timeabs_from_secs(filter, received_before);
+	filter->start = *start;
+	filter->limit = *limit;
+
 	response = json_stream_success(cmd);
-	listforwardings_add_forwardings(response, cmd->ld->wallet);
+	listforwardings_add_forwardings(response, cmd->ld->wallet, filter);
 
 	return command_success(cmd, response);
 }
@@ -2177,6 +2324,99 @@ static const struct json_command listforwards_command = {
 	"channels",
 	json_listforwards,
 	"List all forwarded payments and their information", false,
-	"List all forwarded payments and their information"
+	"List forwarded payments, optionally only those with {status},"
+	" {in_channel}, {out_channel}, or received in [{received_since},"
+	" {received_before}) (UNIX seconds); at most {limit} of them,"
+	" starting at {start} in updated_index order"
 };
 AUTODATA(json_command, &listforwards_command);
+
+static struct command_result *param_stats_period(struct command *cmd,
+						 const char *name,
+						 const char *buffer,
+						 const jsmntok_t *tok,
+						 u64 **period)
+{
+	*period = tal(cmd, u64);
+	if (json_tok_streq(buffer, tok, "hour")) {
+		**period = 3600;
+		return NULL;
+	} else if (json_tok_streq(buffer, tok, "day")) {
+		**period = 24 * 3600;
+		return NULL;
+	} else if (json_tok_streq(buffer, tok, "total")) {
+		**period = 0;
+		return NULL;
+	}
+
+	return command_fail(cmd, JSONRPC2_INVALID_PARAMS,
+			    "'%s' should be 'hour', 'day' or 'total', not '%.*s'",
+			    name, json_tok_full_len(tok),
+			    json_tok_full(buffer, tok));
+}
+
+static struct command_result *json_listforwardstats(struct command *cmd,
+						    const char *buffer,
+						    const jsmntok_t *obj UNNEEDED,
+						    const jsmntok_t *params)
+{
+	struct json_stream *response;
+	const struct forwarding_stats *stats;
+	u64 *period, *since, *before;
+	bool *per_channel;
+
+	if (!param(cmd, buffer, params,
+		   p_opt_def("period", param_stats_period, &period, 24 * 3600),
+		   p_opt_def("since", param_u64, &since, 0),
+		   p_opt_def("before", param_u64, &before, INT64_MAX),
+		   p_opt_def("per_channel", param_bool, &per_channel, false),
+		   NULL))
+		return command_param_failed();
+
+	stats = wallet_forwarding_stats_get(cmd, cmd->ld->wallet,
+					    *period, *since, *before,
+					    *per_channel);
+
+	response = json_stream_success(cmd);
+	json_array_start(response, "stats");
+	for (size_t i = 0; i < tal_count(stats); i++) {
+		const struct forwarding_stats *s = &stats[i];
+
+		json_object_start(response, NULL);
+		if (*period)
+			json_add_u64(response, "start", s->bucket);
+		if (*per_channel) {
+			json_add_short_channel_id(response, "in_channel",
+						  &s->channel_in);
+			if (s->channel_out.u64)
+				json_add_short_channel_id(response,
+							  "out_channel",
+							  &s->channel_out);
+		}
+		json_add_u64(response, "offered", s->count[FORWARD_OFFERED]);
+		json_add_u64(response, "settled", s->count[FORWARD_SETTLED]);
+		json_add_u64(response, "failed", s->count[FORWARD_FAILED]);
+		json_add_u64(response, "local_failed",
+			     s->count[FORWARD_LOCAL_FAILED]);
+		json_add_amount_msat_compat(response, s->msat_in,
+					    "in_msatoshi", "in_msat");
+		json_add_amount_msat_compat(response, s->msat_out,
+					    "out_msatoshi", "out_msat");
+		json_add_amount_msat_compat(response, s->fee,
+					    "fee", "fee_msat");
+		json_object_end(response);
+	}
+	json_array_end(response);
+
+	return command_success(cmd, response);
+}
+
+static const struct json_command listforwardstats_command = {
+	"listforwardstats",
+	"channels",
+	json_listforwardstats,
+	"Show forwarding totals per {period} ('hour', 'day' or 'total'),"
+	" for forwards received in [{since}, {before}), optionally"
+	" {per_channel} pair"
+};
+AUTODATA(json_command, &listforwardstats_command);
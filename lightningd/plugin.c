@@ -1,11 +1,13 @@
 #include "lightningd/plugin.h"
 
 #include <ccan/array_size/array_size.h>
+#include <ccan/endian/endian.h>
 #include <ccan/intmap/intmap.h>
 #include <ccan/io/io.h>
 #include <ccan/list/list.h>
 #include <ccan/opt/opt.h>
 #include <ccan/pipecmd/pipecmd.h>
+#include <ccan/str/str.h>
 #include <ccan/tal/path/path.h>
 #include <ccan/tal/str/str.h>
 #include <ccan/utf8/utf8.h>
@@ -34,6 +36,36 @@
  * `getmanifest` call anyway, that's what `init `is for. */
 #define PLUGIN_MANIFEST_TIMEOUT 60
 
+/* Once a plugin asks for "binary" framing in its manifest, every message in
+ * either direction is preceded by a 4-byte big-endian length.  A frame body
+ * starting with '{' is JSON; one starting with 0 is followed by a big-endian
+ * u64 request id and a message from common/plugin_wire.csv.  Frames are
+ * limited in size, so a length never starts with whitespace: we skip any
+ * between frames (eg. the "\n\n" after the getmanifest response). */
+#define PLUGIN_MAX_FRAME (16 * 1024 * 1024)
+#define PLUGIN_FRAME_WIRE 0
+
+/* How many notifications can wait for a plugin to read them?  After this we
+ * drop them for that plugin, rather than grow without bound. */
+#define PLUGIN_MAX_QUEUED_NOTIFICATIONS 1000
+
+/* A notification, serialized once and shared by every subscriber. */
+struct plugin_notification {
+	/* How many plugins' queues it's in. */
+	size_t refs;
+	/* Owns the contents, which nobody changes. */
+	struct json_stream *stream;
+	const char *data;
+	size_t len;
+};
+
+/* Something waiting to be written to the plugin: either a stream of its
+ * own, or a shared notification. */
+struct plugin_out {
+	struct json_stream *js;
+	struct plugin_notification *n;
+};
+
 struct plugin {
 	struct list_node list;
 
@@ -48,10 +80,18 @@ struct plugin {
 	char *buffer;
 	size_t used, len_read;
 
-	/* Our json_streams. Since multiple streams could start
-	 * returning data at once, we always service these in order,
+	/* Did it ask for binary framing? */
+	bool framed;
+	/* Length prefix of the frame we're writing out. */
+	be32 frame_len;
+
+	/* Our json_streams and notifications. Since multiple streams could
+	 * start returning data at once, we always service these in order,
 	 * freeing once empty. */
-	struct json_stream **js_arr;
+	struct plugin_out *out;
+	size_t num_notifications;
+	/* How many notifications have we dropped because it's too slow? */
+	size_t notifications_dropped;
 
 	struct log *log;
 
@@ -112,9 +152,19 @@ struct plugins *plugins_new(const tal_t *ctx, struct log_book *log_book,
 	return p;
 }
 
+static void plugin_notification_unref(struct plugin_notification *n)
+{
+	if (--n->refs == 0)
+		tal_free(n);
+}
+
 static void destroy_plugin(struct plugin *p)
 {
 	list_del(&p->list);
+
+	for (size_t i = 0; i < tal_count(p->out); i++)
+		if (p->out[i].n)
+			plugin_notification_unref(p->out[i].n);
 }
 
 void plugin_register(struct plugins *plugins, const char* path TAKES)
@@ -124,8 +174,10 @@ void plugin_register(struct plugins *plugins, const char* path TAKES)
 	list_add_tail(&plugins->plugins, &p->list);
 	p->plugins = plugins;
 	p->cmd = tal_strdup(p, path);
-	p->js_arr = tal_arr(p, struct json_stream *, 0);
+	p->out = tal_arr(p, struct plugin_out, 0);
+	p->num_notifications = p->notifications_dropped = 0;
 	p->used = 0;
+	p->framed = false;
 
 	p->log = new_log(p, plugins->log_book, "plugin-%s",
 			 path_basename(tmpctx, p->cmd));
@@ -193,8 +245,33 @@ static void PRINTF_FMT(2,3) plugin_kill(struct plugin *plugin, char *fmt, ...)
  */
 static void plugin_send(struct plugin *plugin, struct json_stream *stream)
 {
-	tal_steal(plugin->js_arr, stream);
-	tal_arr_expand(&plugin->js_arr, stream);
+	struct plugin_out out;
+
+	out.js = tal_steal(plugin->out, stream);
+	out.n = NULL;
+	tal_arr_expand(&plugin->out, out);
+	io_wake(plugin);
+}
+
+/* Queue a shared notification: drop it if the plugin isn't keeping up. */
+static void plugin_send_notification(struct plugin *plugin,
+				     struct plugin_notification *n)
+{
+	struct plugin_out out;
+
+	if (plugin->num_notifications >= PLUGIN_MAX_QUEUED_NOTIFICATIONS) {
+		if (plugin->notifications_dropped++ == 0)
+			log_unusual(plugin->log,
+				    "Plugin is not reading notifications:"
+				    " dropping them");
+		return;
+	}
+
+	out.js = NULL;
+	out.n = n;
+	n->refs++;
+	plugin->num_notifications++;
+	tal_arr_expand(&plugin->out, out);
 	io_wake(plugin);
 }
 
@@ -294,38 +371,46 @@ static void plugin_response_handle(struct plugin *plugin,
 	tal_free(request);
 }
 
-/**
- * Try to parse a complete message from the plugin's buffer.
- *
- * Internally calls the handler if it was able to fully parse a JSON message,
- * and returns true in that case.
- */
-static bool plugin_read_json_one(struct plugin *plugin)
+static void plugin_wire_response_handle(struct plugin *plugin,
+					const u8 *body, size_t len)
 {
-	bool valid;
-	const jsmntok_t *toks, *jrtok, *idtok;
+	struct jsonrpc_request *request;
+	const u8 *msg;
+	be64 beid;
+	u64 id;
 
-	/* FIXME: This could be done more efficiently by storing the
-	 * toks and doing an incremental parse, like lightning-cli
-	 * does. */
-	toks = json_parse_input(plugin->buffer, plugin->buffer, plugin->used,
-				&valid);
-	if (!toks) {
-		if (!valid) {
-			plugin_kill(plugin, "Failed to parse JSON response '%.*s'",
-				    (int)plugin->used, plugin->buffer);
-			return false;
-		}
-		/* We need more. */
-		return false;
+	if (len < 1 + sizeof(beid)) {
+		plugin_kill(plugin, "Binary frame too short for an id");
+		return;
 	}
+	memcpy(&beid, body + 1, sizeof(beid));
+	id = be64_to_cpu(beid);
+	request = uintmap_get(&plugin->plugins->pending_requests, id);
 
-	/* Empty buffer? (eg. just whitespace). */
-	if (tal_count(toks) == 1) {
-		plugin->used = 0;
-		return false;
+	if (!request) {
+		plugin_kill(plugin,
+			    "Received a binary response for non-existent request");
+		return;
+	}
+	if (!request->wire_response_cb) {
+		plugin_kill(plugin,
+			    "Received a binary response to a JSON request");
+		return;
 	}
 
+	msg = tal_dup_arr(tmpctx, u8, body + 1 + sizeof(beid),
+			  len - 1 - sizeof(beid), 0);
+	request->wire_response_cb(msg, request->response_cb_arg);
+
+	uintmap_del(&plugin->plugins->pending_requests, id);
+	tal_free(request);
+}
+
+/* Dispatch a complete JSON message at the start of plugin->buffer */
+static void plugin_json_handle(struct plugin *plugin, const jsmntok_t *toks)
+{
+	const jsmntok_t *jrtok, *idtok;
+
 	jrtok = json_get_member(plugin->buffer, toks, "jsonrpc");
 	idtok = json_get_member(plugin->buffer, toks, "id");
 
@@ -333,7 +418,7 @@ static bool plugin_read_json_one(struct plugin *plugin)
 		plugin_kill(
 		    plugin,
 		    "JSON-RPC message does not contain \"jsonrpc\" field");
-		return false;
+		return;
 	}
 
 	if (!idtok) {
@@ -380,15 +465,99 @@ static bool plugin_read_json_one(struct plugin *plugin)
 		 */
 		plugin_response_handle(plugin, toks, idtok);
 	}
+}
+
+/* Move the first @len bytes out of the buffer */
+static void plugin_consume(struct plugin *plugin, size_t len)
+{
+	memmove(plugin->buffer, plugin->buffer + len, plugin->used - len);
+	plugin->used -= len;
+}
+
+/**
+ * Try to parse a complete message from the plugin's buffer.
+ *
+ * Internally calls the handler if it was able to fully parse a JSON message,
+ * and returns true in that case.
+ */
+static bool plugin_read_json_one(struct plugin *plugin)
+{
+	bool valid;
+	const jsmntok_t *toks;
+
+	/* FIXME: This could be done more efficiently by storing the
+	 * toks and doing an incremental parse, like lightning-cli
+	 * does. */
+	toks = json_parse_input(plugin->buffer, plugin->buffer, plugin->used,
+				&valid);
+	if (!toks) {
+		if (!valid) {
+			plugin_kill(plugin, "Failed to parse JSON response '%.*s'",
+				    (int)plugin->used, plugin->buffer);
+			return false;
+		}
+		/* We need more. */
+		return false;
+	}
+
+	/* Empty buffer? (eg. just whitespace). */
+	if (tal_count(toks) == 1) {
+		plugin->used = 0;
+		return false;
+	}
+
+	plugin_json_handle(plugin, toks);
 
 	/* Move this object out of the buffer */
-	memmove(plugin->buffer, plugin->buffer + toks[0].end,
-		tal_count(plugin->buffer) - toks[0].end);
-	plugin->used -= toks[0].end;
+	plugin_consume(plugin, toks[0].end);
 	tal_free(toks);
 	return true;
 }
 
+/* Same, once it's using binary framing. */
+static bool plugin_read_frame_one(struct plugin *plugin)
+{
+	size_t skip = 0;
+	be32 belen;
+	u32 len;
+
+	while (skip < plugin->used && cisspace(plugin->buffer[skip]))
+		skip++;
+	plugin_consume(plugin, skip);
+
+	if (plugin->used < sizeof(belen))
+		return false;
+	memcpy(&belen, plugin->buffer, sizeof(belen));
+	len = be32_to_cpu(belen);
+	if (len == 0 || len > PLUGIN_MAX_FRAME) {
+		plugin_kill(plugin, "Invalid frame length %u", len);
+		return false;
+	}
+	if (plugin->used < sizeof(belen) + len)
+		return false;
+
+	/* Now the frame body is at the start of the buffer. */
+	plugin_consume(plugin, sizeof(belen));
+	if (plugin->buffer[0] == PLUGIN_FRAME_WIRE)
+		plugin_wire_response_handle(plugin, (const u8 *)plugin->buffer,
+					    len);
+	else {
+		bool valid;
+		const jsmntok_t *toks;
+
+		toks = json_parse_input(tmpctx, plugin->buffer, len, &valid);
+		if (!toks || tal_count(toks) == 1) {
+			plugin_kill(plugin, "Frame is not a JSON object '%.*s'",
+				    (int)len, plugin->buffer);
+			return false;
+		}
+		plugin_json_handle(plugin, toks);
+	}
+
+	plugin_consume(plugin, len);
+	return true;
+}
+
 static struct io_plan *plugin_read_json(struct io_conn *conn UNUSED,
 					struct plugin *plugin)
 {
@@ -403,7 +572,10 @@ static struct io_plan *plugin_read_json(struct io_conn *conn UNUSED,
 
 	/* Read and process all messages from the connection */
 	do {
-		success = plugin_read_json_one(plugin);
+		if (plugin->framed)
+			success = plugin_read_frame_one(plugin);
+		else
+			success = plugin_read_json_one(plugin);
 
 		/* Processing the message from the plugin might have
 		 * resulted in it stopping, so let's check. */
@@ -422,23 +594,69 @@ static struct io_plan *plugin_read_json(struct io_conn *conn UNUSED,
 static struct io_plan *plugin_write_json(struct io_conn *conn,
 					 struct plugin *plugin);
 
-static struct io_plan *plugin_stream_complete(struct io_conn *conn, struct json_stream *js, struct plugin *plugin)
+/* The first thing in the queue has been written out. */
+static struct io_plan *plugin_out_complete(struct io_conn *conn,
+					   struct plugin *plugin)
 {
-	assert(tal_count(plugin->js_arr) > 0);
-	/* Remove js and shift all remainig over */
-	tal_arr_remove(&plugin->js_arr, 0);
+	struct plugin_out out;
+
+	assert(tal_count(plugin->out) > 0);
+	out = plugin->out[0];
+	/* Remove it and shift all remainig over */
+	tal_arr_remove(&plugin->out, 0);
 
 	/* It got dropped off the queue, free it. */
-	tal_free(js);
+	if (out.n) {
+		plugin_notification_unref(out.n);
+		if (--plugin->num_notifications == 0
+		    && plugin->notifications_dropped) {
+			log_unusual(plugin->log,
+				    "Plugin caught up: %zu notifications"
+				    " were dropped",
+				    plugin->notifications_dropped);
+			plugin->notifications_dropped = 0;
+		}
+	} else
+		tal_free(out.js);
 
 	return plugin_write_json(conn, plugin);
 }
 
+static struct io_plan *plugin_stream_complete(struct io_conn *conn,
+					      struct json_stream *js UNUSED,
+					      struct plugin *plugin)
+{
+	return plugin_out_complete(conn, plugin);
+}
+
+static struct io_plan *plugin_write_out(struct io_conn *conn,
+					struct plugin *plugin)
+{
+	const struct plugin_out *out = &plugin->out[0];
+
+	if (out->js)
+		return json_stream_output(out->js, conn,
+					  plugin_stream_complete, plugin);
+
+	log_io(plugin->log, LOG_IO_OUT, "", out->n->data, out->n->len);
+	return io_write(conn, out->n->data, out->n->len,
+			plugin_out_complete, plugin);
+}
+
 static struct io_plan *plugin_write_json(struct io_conn *conn,
 					 struct plugin *plugin)
 {
-	if (tal_count(plugin->js_arr)) {
-		return json_stream_output(plugin->js_arr[0], plugin->stdin_conn, plugin_stream_complete, plugin);
+	if (tal_count(plugin->out)) {
+		if (plugin->framed) {
+			const struct plugin_out *out = &plugin->out[0];
+			size_t len = out->js ? json_stream_len(out->js)
+				: out->n->len;
+			plugin->frame_len = cpu_to_be32(len);
+			return io_write(conn, &plugin->frame_len,
+					sizeof(plugin->frame_len),
+					plugin_write_out, plugin);
+		}
+		return plugin_write_out(conn, plugin);
 	} else if (plugin->stop) {
 		return io_close(conn);
 	}
@@ -824,8 +1042,8 @@ static bool plugin_hooks_add(struct plugin *plugin, const char *buffer,
 		if (!plugin_hook_register(plugin, name)) {
 			plugin_kill(plugin,
 				    "could not register hook '%s', either the "
-				    "name doesn't exist or another plugin "
-				    "already registered it.",
+				    "name doesn't exist or it was listed "
+				    "twice.",
 				    name);
 			tal_free(name);
 			return false;
@@ -835,6 +1053,26 @@ static bool plugin_hooks_add(struct plugin *plugin, const char *buffer,
 	return true;
 }
 
+static bool plugin_framing_set(struct plugin *plugin, const char *buffer,
+			       const jsmntok_t *resulttok)
+{
+	const jsmntok_t *framingtok = json_get_member(buffer, resulttok,
+						      "framing");
+	if (!framingtok || json_tok_streq(buffer, framingtok, "json"))
+		return true;
+
+	if (!json_tok_streq(buffer, framingtok, "binary")) {
+		plugin_kill(plugin, "Unknown framing '%.*s'",
+			    json_tok_full_len(framingtok),
+			    json_tok_full(buffer, framingtok));
+		return false;
+	}
+
+	/* Everything after this response is framed, both ways */
+	plugin->framed = true;
+	return true;
+}
+
 static void plugin_manifest_timeout(struct plugin *plugin)
 {
 	log_broken(plugin->log, "The plugin failed to respond to \"getmanifest\" in time, terminating.");
@@ -869,7 +1107,8 @@ static void plugin_manifest_cb(const char *buffer,
 	if (!plugin_opts_add(plugin, buffer, resulttok) ||
 	    !plugin_rpcmethods_add(plugin, buffer, resulttok) ||
 	    !plugin_subscriptions_add(plugin, buffer, resulttok) ||
-	    !plugin_hooks_add(plugin, buffer, resulttok))
+	    !plugin_hooks_add(plugin, buffer, resulttok) ||
+	    !plugin_framing_set(plugin, buffer, resulttok))
 		plugin_kill(
 		    plugin,
 		    "Failed to register options, methods, hooks, or subscriptions.");
@@ -1099,15 +1338,30 @@ void plugins_notify(struct plugins *plugins,
 		    const struct jsonrpc_notification *n TAKES)
 {
 	struct plugin *p;
+	struct plugin_notification *shared;
 
 	/* If we're shutting down, ld->plugins will be NULL */
-	if (plugins) {
-		list_for_each(&plugins->plugins, p, list) {
-			if (plugin_subscriptions_contains(p, n->method))
-				plugin_send(p, json_stream_dup(p, n->stream,
-							       p->log));
-		}
+	if (!plugins)
+		goto out;
+
+	/* Every subscriber writes from the same copy. */
+	shared = tal(NULL, struct plugin_notification);
+	shared->refs = 0;
+	if (taken(n))
+		shared->stream = tal_steal(shared, n->stream);
+	else
+		shared->stream = json_stream_dup(shared, n->stream, NULL);
+	shared->data = json_stream_contents(shared->stream, &shared->len);
+
+	list_for_each(&plugins->plugins, p, list) {
+		if (plugin_subscriptions_contains(p, n->method))
+			plugin_send_notification(p, shared);
 	}
+
+	/* Nobody wanted it? */
+	if (shared->refs == 0)
+		tal_free(shared);
+out:
 	if (taken(n))
 		tal_free(n);
 }
@@ -1124,6 +1378,26 @@ void plugin_request_send(struct plugin *plugin,
 	req->stream = NULL;
 }
 
+void plugin_request_send_wire(struct plugin *plugin,
+			      struct jsonrpc_request *req TAKES,
+			      const u8 *msg)
+{
+	u8 kind = PLUGIN_FRAME_WIRE;
+	be64 id = cpu_to_be64(req->id);
+
+	assert(plugin->framed);
+	assert(req->wire_response_cb);
+	json_stream_append(req->stream, (const char *)&kind, sizeof(kind));
+	json_stream_append(req->stream, (const char *)&id, sizeof(id));
+	json_stream_append(req->stream, (const char *)msg, tal_bytelen(msg));
+	plugin_request_send(plugin, req);
+}
+
+bool plugin_binary_framing(const struct plugin *plugin)
+{
+	return plugin->framed;
+}
+
 void *plugin_exclusive_loop(struct plugin *plugin)
 {
 	void *ret;
@@ -1146,3 +1420,8 @@ struct log *plugin_get_log(struct plugin *plugin)
 {
 	return plugin->log;
 }
+
+const char *plugin_get_cmd(const struct plugin *plugin)
+{
+	return plugin->cmd;
+}
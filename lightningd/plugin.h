@@ -125,4 +125,24 @@ char *plugin_opt_set(const char *arg, struct plugin_opt *popt);
 */
 struct log *plugin_get_log(struct plugin *plugin);
 
+/**
+ * Send a binary request to a plugin which asked for binary framing.
+ *
+ * @msg goes out in place of @req's JSON: a binary reply goes to
+ * @req->wire_response_cb, but the plugin can still reply in JSON.
+ */
+void plugin_request_send_wire(struct plugin *plugin,
+			      struct jsonrpc_request *req TAKES,
+			      const u8 *msg);
+
+/**
+ * Did this plugin ask for binary framing in its manifest?
+ */
+bool plugin_binary_framing(const struct plugin *plugin);
+
+/**
+ * The command we ran this plugin with, for humans.
+ */
+const char *plugin_get_cmd(const struct plugin *plugin);
+
 #endif /* LIGHTNING_LIGHTNINGD_PLUGIN_H */
@@ -1,5 +1,10 @@
 #include <ccan/io/io.h>
+#include <ccan/tal/str/str.h>
+#include <common/gen_plugin_wire.h>
+#include <common/json.h>
 #include <common/memleak.h>
+#include <common/param.h>
+#include <common/timeout.h>
 #include <lightningd/jsonrpc.h>
 #include <lightningd/plugin_hook.h>
 #include <wallet/db.h>
@@ -8,8 +13,50 @@
  * dispatch an eventual plugin_hook response. */
 struct plugin_hook_request {
 	const struct plugin_hook *hook;
+	void *payload;
 	void *cb_arg;
 	struct db *db;
+	struct lightningd *ld;
+
+	/* The params, serialized once: the payload may not outlive a chain.
+	 * The binary form is only made if someone wants it. */
+	struct json_stream *params;
+	const u8 *wire;
+
+	/* The plugins registered when we were called, in order: NULL once
+	 * one goes away.  hook->instances shifts when that happens. */
+	struct hook_instance **instances;
+	/* In a chain, the index in instances of the next one to send to. */
+	size_t next_instance;
+
+	/* One per plugin we've sent to so far, in order. */
+	struct hook_plugin_request **reqs;
+	/* Next one whose response we're waiting to examine. */
+	size_t next;
+	/* Requests sent but not yet answered (or timed out) */
+	size_t num_pending;
+	/* Have we called response_cb? */
+	bool done;
+};
+
+/* The part of a plugin_hook_request sent to one plugin. */
+struct hook_plugin_request {
+	struct plugin_hook_request *ph_req;
+	/* NULL if the plugin went away. */
+	struct hook_instance *instance;
+	/* Owned by the plugin: NULL once it's answered or gone. */
+	struct jsonrpc_request *req;
+	struct timemono sent;
+	struct oneshot *timer;
+
+	/* Has it responded (or timed out)? */
+	bool responded;
+	/* If it responded with something other than continue, but we weren't
+	 * ready for it yet, this is a copy of the response. */
+	const char *buffer;
+	const jsmntok_t *toks;
+	/* Or if it was a binary response */
+	const u8 *msg;
 };
 
 static struct plugin_hook *plugin_hook_by_name(const char *name)
@@ -25,20 +72,308 @@ static struct plugin_hook *plugin_hook_by_name(const char *name)
 	return NULL;
 }
 
+static void destroy_hook_instance(struct hook_instance *instance,
+				  struct plugin_hook *hook)
+{
+	for (size_t i = 0; i < tal_count(hook->instances); i++) {
+		if (hook->instances[i] == instance) {
+			tal_arr_remove(&hook->instances, i);
+			return;
+		}
+	}
+	abort();
+}
+
 bool plugin_hook_register(struct plugin *plugin, const char *method)
 {
 	struct plugin_hook *hook = plugin_hook_by_name(method);
+	struct hook_instance *instance;
+
 	if (!hook) {
 		/* No such hook name registered */
 		return false;
-	} else if (hook->plugin != NULL) {
-		/* Another plugin already registered for this name */
-		return false;
 	}
-	hook->plugin = plugin;
+
+	for (size_t i = 0; i < tal_count(hook->instances); i++) {
+		/* This plugin already registered for this name */
+		if (hook->instances[i]->plugin == plugin)
+			return false;
+	}
+
+	if (!hook->instances)
+		hook->instances = notleak(tal_arr(NULL, struct hook_instance *, 0));
+
+	instance = tal(plugin, struct hook_instance);
+	instance->plugin = plugin;
+	instance->num_calls = instance->num_timeouts = 0;
+	instance->total_latency = instance->max_latency = time_from_sec(0);
+	tal_arr_expand(&hook->instances, instance);
+	tal_add_destructor2(instance, destroy_hook_instance, hook);
+	return true;
+}
+
+bool plugin_hook_set_timeout(const char *name, u32 timeout)
+{
+	struct plugin_hook *hook = plugin_hook_by_name(name);
+
+	if (!hook)
+		return false;
+	hook->timeout = timeout;
 	return true;
 }
 
+/* Only the first response which doesn't continue counts. */
+static bool hook_response_continues(const char *buffer,
+				    const jsmntok_t *resulttok)
+{
+	const jsmntok_t *t = json_get_member(buffer, resulttok, "result");
+
+	if (t)
+		return json_tok_streq(buffer, t, "continue");
+	/* Hooks without a "result" field use an empty object. */
+	return resulttok->type == JSMN_OBJECT && resulttok->size == 0;
+}
+
+static void hook_instance_gone(struct hook_instance *instance,
+			       struct plugin_hook_request *ph_req)
+{
+	for (size_t i = 0; i < tal_count(ph_req->instances); i++) {
+		if (ph_req->instances[i] == instance)
+			ph_req->instances[i] = NULL;
+	}
+}
+
+static void destroy_plugin_hook_request(struct plugin_hook_request *ph_req)
+{
+	for (size_t i = 0; i < tal_count(ph_req->instances); i++) {
+		if (ph_req->instances[i])
+			tal_del_destructor2(ph_req->instances[i],
+					    hook_instance_gone, ph_req);
+	}
+}
+
+/* Next plugin in a chain which is still around, if any. */
+static struct hook_instance *
+next_chain_instance(struct plugin_hook_request *ph_req)
+{
+	while (ph_req->next_instance < tal_count(ph_req->instances)) {
+		struct hook_instance *instance
+			= ph_req->instances[ph_req->next_instance++];
+		if (instance)
+			return instance;
+	}
+	return NULL;
+}
+
+static void hook_finish(struct plugin_hook_request *ph_req,
+			const char *buffer, const jsmntok_t *resulttok,
+			const u8 *msg)
+{
+	ph_req->done = true;
+	db_begin_transaction(ph_req->db);
+	if (msg)
+		ph_req->hook->wire_response_cb(ph_req->cb_arg, msg);
+	else
+		ph_req->hook->response_cb(ph_req->cb_arg, buffer, resulttok);
+	db_commit_transaction(ph_req->db);
+
+	/* Others can still respond: we free once they have. */
+	if (ph_req->num_pending == 0)
+		tal_free(ph_req);
+}
+
+static void hook_plugin_timeout(struct hook_plugin_request *r);
+
+static void plugin_hook_callback(const char *buffer, const jsmntok_t *toks,
+				 const jsmntok_t *idtok,
+				 struct hook_plugin_request *r);
+
+static void plugin_hook_wire_callback(const u8 *msg, void *arg);
+
+static void hook_advance(struct plugin_hook_request *ph_req,
+			 const char *buffer, const jsmntok_t *toks);
+
+/* The plugin died (and took the request with it): treat as continue. */
+static void destroy_hook_request(struct jsonrpc_request *req,
+				 struct hook_plugin_request *r)
+{
+	struct plugin_hook_request *ph_req = r->ph_req;
+
+	r->req = NULL;
+	r->instance = NULL;
+	ph_req->num_pending--;
+
+	if (r->responded || ph_req->done) {
+		r->responded = true;
+		if (ph_req->done && ph_req->num_pending == 0)
+			tal_free(ph_req);
+		return;
+	}
+
+	r->responded = true;
+	r->timer = tal_free(r->timer);
+	hook_advance(ph_req, NULL, NULL);
+}
+
+static void hook_send(struct plugin_hook_request *ph_req,
+		      struct hook_instance *instance)
+{
+	struct hook_plugin_request *r;
+	struct plugin *plugin = instance->plugin;
+
+	r = tal(ph_req, struct hook_plugin_request);
+	r->ph_req = ph_req;
+	r->instance = instance;
+	r->responded = false;
+	r->buffer = NULL;
+	r->toks = NULL;
+	r->msg = NULL;
+	r->sent = time_mono();
+	if (ph_req->hook->timeout)
+		r->timer = new_reltimer(&ph_req->ld->timers, r,
+					time_from_sec(ph_req->hook->timeout),
+					hook_plugin_timeout, r);
+	else
+		r->timer = NULL;
+	tal_arr_expand(&ph_req->reqs, r);
+
+	/* We build the request ourselves, so we can splice in the params */
+	r->req = jsonrpc_request_start(NULL, NULL, plugin_get_log(plugin),
+				       plugin_hook_callback, r);
+	tal_add_destructor2(r->req, destroy_hook_request, r);
+	ph_req->num_pending++;
+
+	if (ph_req->wire && plugin_binary_framing(plugin)) {
+		r->req->wire_response_cb = plugin_hook_wire_callback;
+		plugin_request_send_wire(plugin, r->req, ph_req->wire);
+		return;
+	}
+
+	json_object_start(r->req->stream, NULL);
+	json_add_string(r->req->stream, "jsonrpc", "2.0");
+	json_add_u64(r->req->stream, "id", r->req->id);
+	json_add_string(r->req->stream, "method", ph_req->hook->name);
+	json_stream_splice(r->req->stream, "params", ph_req->params);
+	json_object_end(r->req->stream);
+	json_stream_append(r->req->stream, "\n\n", strlen("\n\n"));
+	plugin_request_send(plugin, r->req);
+}
+
+/* Walk through responses in order, as far as we can: @buffer/@toks is the
+ * response which just arrived (or NULL), which we don't need to copy. */
+static void hook_advance(struct plugin_hook_request *ph_req,
+			 const char *buffer, const jsmntok_t *toks)
+{
+	while (ph_req->next < tal_count(ph_req->reqs)) {
+		struct hook_plugin_request *r = ph_req->reqs[ph_req->next];
+
+		/* Still waiting for this one? */
+		if (!r->responded)
+			return;
+
+		/* Did this one decide it? */
+		if (r->buffer) {
+			hook_finish(ph_req, r->buffer,
+				    json_get_member(r->buffer, r->toks,
+						    "result"), NULL);
+			return;
+		}
+		if (r->msg) {
+			hook_finish(ph_req, NULL, NULL, r->msg);
+			return;
+		}
+
+		/* In a chain, we only ask the next one once this continues
+		 * (skipping any which died meanwhile). */
+		if (++ph_req->next == tal_count(ph_req->reqs)
+		    && ph_req->hook->type == PLUGIN_HOOK_CHAIN) {
+			struct hook_instance *instance
+				= next_chain_instance(ph_req);
+			if (instance)
+				hook_send(ph_req, instance);
+		}
+	}
+
+	/* Everyone continued (or timed out): all continues are the same, so
+	 * hand over the last one we got. */
+	hook_finish(ph_req, buffer,
+		    buffer ? json_get_member(buffer, toks, "result") : NULL,
+		    NULL);
+}
+
+static void hook_plugin_responded(struct hook_plugin_request *r)
+{
+	struct timerel latency = timemono_since(r->sent);
+
+	r->responded = true;
+	r->timer = tal_free(r->timer);
+
+	r->instance->num_calls++;
+	r->instance->total_latency = timerel_add(r->instance->total_latency,
+						 latency);
+	if (time_greater(latency, r->instance->max_latency))
+		r->instance->max_latency = latency;
+}
+
+static void hook_plugin_timeout(struct hook_plugin_request *r)
+{
+	struct plugin_hook_request *ph_req = r->ph_req;
+
+	log_unusual(plugin_get_log(r->instance->plugin),
+		    "%s hook didn't respond in %u seconds: continuing",
+		    ph_req->hook->name, ph_req->hook->timeout);
+	/* Freed by hook_plugin_responded */
+	r->timer = NULL;
+	hook_plugin_responded(r);
+	r->instance->num_timeouts++;
+	hook_advance(ph_req, NULL, NULL);
+}
+
+/* A plugin answered, in JSON (@buffer/@toks) or binary (@msg). */
+static void hook_plugin_reply(struct hook_plugin_request *r, bool continues,
+			      const char *buffer, const jsmntok_t *toks,
+			      const u8 *msg)
+{
+	struct plugin_hook_request *ph_req = r->ph_req;
+
+	tal_del_destructor2(r->req, destroy_hook_request, r);
+	r->req = NULL;
+	ph_req->num_pending--;
+
+	/* Too late: we've moved on without it. */
+	if (r->responded || ph_req->done) {
+		if (!r->responded)
+			hook_plugin_responded(r);
+		if (ph_req->done && ph_req->num_pending == 0)
+			tal_free(ph_req);
+		return;
+	}
+
+	hook_plugin_responded(r);
+	if (!continues) {
+		/* If it's not our turn, we need to keep it. */
+		if (r != ph_req->reqs[ph_req->next]) {
+			if (msg)
+				r->msg = tal_dup_arr(r, u8, msg,
+						    tal_count(msg), 0);
+			else {
+				r->buffer = tal_strndup(r, buffer, toks->end);
+				r->toks = json_tok_copy(r, toks);
+			}
+			return;
+		}
+		if (msg)
+			hook_finish(ph_req, NULL, NULL, msg);
+		else
+			hook_finish(ph_req, buffer,
+				    json_get_member(buffer, toks, "result"),
+				    NULL);
+		return;
+	}
+
+	hook_advance(ph_req, buffer, toks);
+}
+
 /**
  * Callback to be passed to the jsonrpc_request.
  *
@@ -47,62 +382,208 @@ bool plugin_hook_register(struct plugin *plugin, const char *method)
  */
 static void plugin_hook_callback(const char *buffer, const jsmntok_t *toks,
 				 const jsmntok_t *idtok,
-				 struct plugin_hook_request *r)
+				 struct hook_plugin_request *r)
 {
 	const jsmntok_t *resulttok = json_get_member(buffer, toks, "result");
 
 	if (!resulttok)
 		fatal("Plugin for %s returned non-result response %.*s",
-		      r->hook->name,
+		      r->ph_req->hook->name,
 		      toks->end - toks->start, buffer + toks->start);
 
-	db_begin_transaction(r->db);
-	r->hook->response_cb(r->cb_arg, buffer, resulttok);
-	db_commit_transaction(r->db);
-	tal_free(r);
+	hook_plugin_reply(r, hook_response_continues(buffer, resulttok),
+			  buffer, toks, NULL);
+}
+
+/* Same, for a binary reply. */
+static void plugin_hook_wire_callback(const u8 *msg, void *arg)
+{
+	struct hook_plugin_request *r = arg;
+
+	hook_plugin_reply(r, fromwire_peektype(msg) == WIRE_PLUGIN_HOOK_CONTINUE,
+			  NULL, NULL, msg);
 }
 
 void plugin_hook_call_(struct lightningd *ld, const struct plugin_hook *hook,
 		       void *payload, void *cb_arg)
 {
-	struct jsonrpc_request *req;
 	struct plugin_hook_request *ph_req;
-	if (hook->plugin) {
-		/* If we have a plugin that has registered for this
-		 * hook, serialize and call it */
-		/* FIXME: technically this is a leak, but we don't
-		 * currently have a list to store these. We might want
-		 * to eventually to inspect in-flight requests. */
-		ph_req = notleak(tal(hook->plugin, struct plugin_hook_request));
-		req = jsonrpc_request_start(NULL, hook->name,
-					    plugin_get_log(hook->plugin),
-					    plugin_hook_callback, ph_req);
-		ph_req->hook = hook;
-		ph_req->cb_arg = cb_arg;
-		ph_req->db = ld->wallet->db;
-		hook->serialize_payload(payload, req->stream);
-		jsonrpc_request_end(req);
-		plugin_request_send(hook->plugin, req);
-	} else {
+	size_t num = tal_count(hook->instances);
+
+	if (num == 0) {
 		/* If no plugin has registered for this hook, just
 		 * call the callback with a NULL result. Saves us the
 		 * roundtrip to the serializer and deserializer. If we
 		 * were expecting a default response it should have
 		 * been part of the `cb_arg`. */
 		hook->response_cb(cb_arg, NULL, NULL);
+		return;
+	}
+
+	/* FIXME: technically this is a leak, but we don't
+	 * currently have a list to store these. We might want
+	 * to eventually to inspect in-flight requests. */
+	ph_req = notleak(tal(ld, struct plugin_hook_request));
+	ph_req->hook = hook;
+	ph_req->payload = payload;
+	ph_req->cb_arg = cb_arg;
+	ph_req->db = ld->wallet->db;
+	ph_req->ld = ld;
+	ph_req->reqs = tal_arr(ph_req, struct hook_plugin_request *, 0);
+	ph_req->next = 0;
+	ph_req->num_pending = 0;
+	ph_req->done = false;
+
+	/* Plugins can come and go while we're working through them. */
+	ph_req->instances = tal_dup_arr(ph_req, struct hook_instance *,
+					hook->instances, num, 0);
+	ph_req->next_instance = 0;
+	for (size_t i = 0; i < num; i++)
+		tal_add_destructor2(ph_req->instances[i], hook_instance_gone,
+				    ph_req);
+	tal_add_destructor(ph_req, destroy_plugin_hook_request);
+
+	ph_req->params = new_json_stream(ph_req, NULL, NULL);
+	json_object_start(ph_req->params, NULL);
+	hook->serialize_payload(payload, ph_req->params);
+	json_object_end(ph_req->params);
+
+	ph_req->wire = NULL;
+	for (size_t i = 0; i < num && hook->serialize_wire; i++) {
+		if (plugin_binary_framing(ph_req->instances[i]->plugin)) {
+			ph_req->wire = hook->serialize_wire(ph_req, payload);
+			break;
+		}
+	}
+
+	if (hook->type == PLUGIN_HOOK_CHAIN)
+		hook_send(ph_req, next_chain_instance(ph_req));
+	else {
+		for (size_t i = 0; i < num; i++)
+			hook_send(ph_req, ph_req->instances[i]);
 	}
 }
 
+static void json_add_hook_instance(struct json_stream *response,
+				   const struct hook_instance *instance)
+{
+	json_object_start(response, NULL);
+	json_add_string(response, "plugin", plugin_get_cmd(instance->plugin));
+	json_add_u64(response, "calls", instance->num_calls);
+	json_add_u64(response, "timeouts", instance->num_timeouts);
+	json_add_u64(response, "total_msec",
+		     time_to_msec(instance->total_latency));
+	json_add_u64(response, "max_msec",
+		     time_to_msec(instance->max_latency));
+	json_object_end(response);
+}
+
+static struct command_result *json_listhooks(struct command *cmd,
+					     const char *buffer,
+					     const jsmntok_t *obj UNNEEDED,
+					     const jsmntok_t *params)
+{
+	static struct plugin_hook **hooks = NULL;
+	static size_t num_hooks;
+	struct json_stream *response;
+
+	if (!param(cmd, buffer, params, NULL))
+		return command_param_failed();
+
+	if (!hooks)
+		hooks = autodata_get(hooks, &num_hooks);
+
+	response = json_stream_success(cmd);
+	json_array_start(response, "hooks");
+	for (size_t i = 0; i < num_hooks; i++) {
+		json_object_start(response, NULL);
+		json_add_string(response, "name", hooks[i]->name);
+		json_add_string(response, "type",
+				hooks[i]->type == PLUGIN_HOOK_CHAIN
+				? "chain" : "parallel");
+		if (hooks[i]->timeout)
+			json_add_num(response, "timeout", hooks[i]->timeout);
+		json_array_start(response, "plugins");
+		for (size_t j = 0; j < tal_count(hooks[i]->instances); j++)
+			json_add_hook_instance(response,
+					       hooks[i]->instances[j]);
+		json_array_end(response);
+		json_object_end(response);
+	}
+	json_array_end(response);
+	return command_success(cmd, response);
+}
+
+static const struct json_command listhooks_command = {
+	"listhooks",
+	"plugin",
+	json_listhooks,
+	"Show plugin hooks, which plugins registered them, and how long they take"
+};
+AUTODATA(json_command, &listhooks_command);
+
 /* We open-code this, because it's just different and special enough to be
  * annoying, and to make it clear that it's totally synchronous. */
 
 /* Special synchronous hook for db */
-static struct plugin_hook db_write_hook = { "db_write", NULL, NULL, NULL };
+static struct plugin_hook db_write_hook = { "db_write", PLUGIN_HOOK_CHAIN,
+					    NULL, NULL, NULL, NULL, NULL, 0 };
 AUTODATA(hooks, &db_write_hook);
 
-static void db_hook_response(const char *buffer, const jsmntok_t *toks,
-			     const jsmntok_t *idtok,
-			     struct plugin_hook_request *ph_req)
+/* If we've queued up this many writes waiting for a slot, we stop and wait
+ * for the plugins to catch up. */
+#define DB_WRITE_MAX_QUEUED 10000
+
+/* Unless --db-write-pipeline is set, every commit waits for the db_write
+ * plugins.  Otherwise, we commit immediately and stream the writes to them,
+ * and anything which must not be seen by a peer until the backup has it
+ * waits in plugin_hook_db_after_sync(). */
+static struct db_write_pipeline {
+	/* Maximum batches sent and not yet confirmed (0 == synchronous). */
+	u32 max_inflight;
+	/* Transactions committed so far, and those all plugins have. */
+	u64 seq, synced;
+	/* Batches sent, oldest first. */
+	struct db_write_batch **inflight;
+	/* Writes waiting for a free slot. */
+	const char **queued;
+	/* Waiting for the transaction in progress to be confirmed. */
+	struct list_head txn_waiters;
+	/* Waiting for an earlier transaction to be confirmed, in order. */
+	struct list_head waiters;
+} pipeline = {
+	.txn_waiters = LIST_HEAD_INIT(pipeline.txn_waiters),
+	.waiters = LIST_HEAD_INIT(pipeline.waiters),
+};
+
+/* One or more transactions worth of writes, sent to each plugin. */
+struct db_write_batch {
+	/* The last transaction in this batch */
+	u64 seq;
+	/* One per plugin. */
+	struct db_write_req **reqs;
+	/* How many plugins still have to confirm it. */
+	size_t num_pending;
+};
+
+struct db_write_req {
+	struct db_write_batch *batch;
+	struct plugin *plugin;
+	/* Owned by the plugin: NULL once it's answered. */
+	struct jsonrpc_request *req;
+	/* Are we in plugin_exclusive_loop() for this? */
+	bool waiting;
+};
+
+struct db_sync_waiter {
+	struct list_node list;
+	u64 seq;
+	void (*cb)(void *arg);
+	void *arg;
+};
+
+/* We expect result: True.  Anything else we abort. */
+static void db_hook_check_response(const char *buffer, const jsmntok_t *toks)
 {
 	const jsmntok_t *resulttok;
 	bool resp;
@@ -112,7 +593,6 @@ static void db_hook_response(const char *buffer, const jsmntok_t *toks,
 		fatal("Plugin returned an invalid response to the db_write "
 		      "hook: %s", buffer);
 
-	/* We expect result: True.  Anything else we abort. */
 	if (!json_to_bool(buffer, resulttok, &resp))
 		fatal("Plugin returned an invalid result to the db_write "
 		      "hook: %s", buffer);
@@ -120,28 +600,31 @@ static void db_hook_response(const char *buffer, const jsmntok_t *toks,
 	/* If it fails, we must not commit to our db. */
 	if (!resp)
 		fatal("Plugin returned failed db_write: %s.", buffer);
+}
+
+static void db_hook_response(const char *buffer, const jsmntok_t *toks,
+			     const jsmntok_t *idtok,
+			     struct plugin_hook_request *ph_req)
+{
+	db_hook_check_response(buffer, toks);
 
 	/* We're done, exit exclusive loop. */
 	io_break(ph_req);
 }
 
-void plugin_hook_db_sync(struct db *db, const char **changes, const char *final)
+static struct jsonrpc_request *db_hook_request(const char **changes,
+					       const char *final,
+					       void (*response_cb)(const char *,
+								   const jsmntok_t *,
+								   const jsmntok_t *,
+								   void *),
+					       void *arg)
 {
-	const struct plugin_hook *hook = &db_write_hook;
 	struct jsonrpc_request *req;
-	struct plugin_hook_request *ph_req;
-	void *ret;
-
-	if (!hook->plugin)
-		return;
 
-	ph_req = notleak(tal(hook->plugin, struct plugin_hook_request));
 	/* FIXME: do IO logging for this! */
-	req = jsonrpc_request_start(NULL, hook->name, NULL, db_hook_response,
-				    ph_req);
-
-	ph_req->hook = hook;
-	ph_req->db = db;
+	req = jsonrpc_request_start(NULL, db_write_hook.name, NULL,
+				    response_cb, arg);
 
 	json_array_start(req->stream, "writes");
 	for (size_t i = 0; i < tal_count(changes); i++)
@@ -150,16 +633,291 @@ void plugin_hook_db_sync(struct db *db, const char **changes, const char *final)
 		json_add_string(req->stream, NULL, final);
 	json_array_end(req->stream);
 	jsonrpc_request_end(req);
+	return req;
+}
 
-	plugin_request_send(hook->plugin, req);
+/* We can be called on way out of an io_loop, which is already breaking.
+ * That will make this immediately return; save the break value and call
+ * again, then hand it onwards. */
+static void db_hook_wait(struct plugin *plugin, const void *expect)
+{
+	void *ret;
 
-	/* We can be called on way out of an io_loop, which is already breaking.
-	 * That will make this immediately return; save the break value and call
-	 * again, then hand it onwards. */
-	ret = plugin_exclusive_loop(hook->plugin);
-	if (ret != ph_req) {
-		void *ret2 = plugin_exclusive_loop(hook->plugin);
-		assert(ret2 == ph_req);
+	ret = plugin_exclusive_loop(plugin);
+	if (ret != expect) {
+		void *ret2 = plugin_exclusive_loop(plugin);
+		assert(ret2 == expect);
 		io_break(ret);
 	}
 }
+
+static void db_hook_call(struct plugin *plugin, struct db *db,
+			 const char **changes, const char *final)
+{
+	struct jsonrpc_request *req;
+	struct plugin_hook_request *ph_req;
+
+	ph_req = notleak(tal(plugin, struct plugin_hook_request));
+	req = db_hook_request(changes, final,
+			      (void (*)(const char *, const jsmntok_t *,
+					const jsmntok_t *, void *))
+			      db_hook_response, ph_req);
+
+	ph_req->hook = &db_write_hook;
+	ph_req->db = db;
+
+	plugin_request_send(plugin, req);
+	db_hook_wait(plugin, ph_req);
+}
+
+static void db_write_send_queued(void);
+
+static void destroy_db_sync_waiter(struct db_sync_waiter *w)
+{
+	list_del(&w->list);
+}
+
+/* Release everyone waiting for transactions which all plugins now have. */
+static void db_write_release_waiters(void)
+{
+	struct db_sync_waiter *w;
+
+	while ((w = list_top(&pipeline.waiters, struct db_sync_waiter, list))
+	       != NULL) {
+		if (w->seq > pipeline.synced)
+			break;
+		list_del_from(&pipeline.waiters, &w->list);
+		/* The callback may free w's parent, so take it first. */
+		tal_del_destructor(w, destroy_db_sync_waiter);
+		tal_steal(tmpctx, w);
+		w->cb(w->arg);
+		tal_free(w);
+	}
+}
+
+/* Batches can only complete in order, since each plugin answers in order. */
+static void db_write_batches_done(void)
+{
+	while (tal_count(pipeline.inflight)
+	       && pipeline.inflight[0]->num_pending == 0) {
+		pipeline.synced = pipeline.inflight[0]->seq;
+		tal_free(pipeline.inflight[0]);
+		tal_arr_remove(&pipeline.inflight, 0);
+	}
+
+	db_write_release_waiters();
+	db_write_send_queued();
+}
+
+static void db_write_req_response(const char *buffer, const jsmntok_t *toks,
+				  const jsmntok_t *idtok,
+				  struct db_write_req *r);
+
+/* The plugin can't confirm what it's been sent now: our backup is missing
+ * writes we've already committed. */
+static void destroy_db_write_req(struct jsonrpc_request *req,
+				 struct db_write_req *r)
+{
+	fatal("Plugin %s died with unconfirmed db_write of transaction %"PRIu64,
+	      plugin_get_cmd(r->plugin), r->batch->seq);
+}
+
+static void db_write_req_response(const char *buffer, const jsmntok_t *toks,
+				  const jsmntok_t *idtok,
+				  struct db_write_req *r)
+{
+	db_hook_check_response(buffer, toks);
+
+	tal_del_destructor2(r->req, destroy_db_write_req, r);
+	r->req = NULL;
+	r->batch->num_pending--;
+
+	/* We're done, exit exclusive loop. */
+	if (r->waiting)
+		io_break(r);
+
+	db_write_batches_done();
+}
+
+static void db_write_send_queued(void)
+{
+	struct db_write_batch *batch;
+
+	if (!tal_count(pipeline.queued)
+	    || tal_count(pipeline.inflight) >= pipeline.max_inflight)
+		return;
+
+	batch = notleak(tal(NULL, struct db_write_batch));
+	batch->seq = pipeline.seq;
+	batch->reqs = tal_arr(batch, struct db_write_req *, 0);
+	batch->num_pending = 0;
+	tal_arr_expand(&pipeline.inflight, batch);
+
+	for (size_t i = 0; i < tal_count(db_write_hook.instances); i++) {
+		struct db_write_req *r = tal(batch, struct db_write_req);
+
+		r->batch = batch;
+		r->plugin = db_write_hook.instances[i]->plugin;
+		r->waiting = false;
+		r->req = db_hook_request(pipeline.queued, NULL,
+					 (void (*)(const char *,
+						   const jsmntok_t *,
+						   const jsmntok_t *, void *))
+					 db_write_req_response, r);
+		tal_add_destructor2(r->req, destroy_db_write_req, r);
+		tal_arr_expand(&batch->reqs, r);
+		batch->num_pending++;
+		plugin_request_send(r->plugin, r->req);
+	}
+
+	tal_free(pipeline.queued);
+	pipeline.queued = notleak(tal_arr(NULL, const char *, 0));
+
+	/* No plugins at all?  That was easy. */
+	if (batch->num_pending == 0)
+		db_write_batches_done();
+}
+
+/* Wait until every plugin has confirmed the oldest batch. */
+static void db_write_wait_oldest(void)
+{
+	struct db_write_batch *batch = pipeline.inflight[0];
+
+	for (size_t i = 0; i < tal_count(batch->reqs); i++) {
+		struct db_write_req *r = batch->reqs[i];
+		bool last;
+
+		if (!r->req)
+			continue;
+		/* This frees batch once it's done, so don't touch it then */
+		last = (batch->num_pending == 1);
+		r->waiting = true;
+		db_hook_wait(r->plugin, r);
+		if (last)
+			return;
+		r->waiting = false;
+	}
+}
+
+void plugin_hook_db_set_pipeline(u32 max_inflight)
+{
+	pipeline.max_inflight = max_inflight;
+	if (!pipeline.inflight) {
+		pipeline.inflight
+			= notleak(tal_arr(NULL, struct db_write_batch *, 0));
+		pipeline.queued = notleak(tal_arr(NULL, const char *, 0));
+	}
+}
+
+/* Every plugin must have the writes before we commit, so we ask each in
+ * turn (or, if pipelined, before we let anyone tell a peer about them). */
+void plugin_hook_db_sync(struct db *db, const char **changes, const char *final)
+{
+	struct db_sync_waiter *w;
+
+	if (!pipeline.max_inflight) {
+		if (!changes)
+			return;
+		for (size_t i = 0; i < tal_count(db_write_hook.instances); i++)
+			db_hook_call(db_write_hook.instances[i]->plugin, db,
+				     changes, final);
+		return;
+	}
+
+	if (changes) {
+		/* The changes are freed after this: we need our own copy. */
+		pipeline.seq++;
+		for (size_t i = 0; i < tal_count(changes); i++)
+			tal_arr_expand(&pipeline.queued,
+				       tal_strdup(pipeline.queued, changes[i]));
+		if (final)
+			tal_arr_expand(&pipeline.queued,
+				       tal_strdup(pipeline.queued, final));
+	}
+
+	/* Whatever was done in this transaction is now in pipeline.seq. */
+	while ((w = list_pop(&pipeline.txn_waiters, struct db_sync_waiter,
+			     list)) != NULL) {
+		w->seq = pipeline.seq;
+		list_add_tail(&pipeline.waiters, &w->list);
+	}
+
+	db_write_send_queued();
+	if (tal_count(pipeline.queued) > DB_WRITE_MAX_QUEUED)
+		db_write_wait_oldest();
+	db_write_release_waiters();
+}
+
+void plugin_hook_db_after_sync_(struct db *db, const tal_t *ctx,
+				void (*cb)(void *arg), void *arg)
+{
+	struct db_sync_waiter *w;
+
+	/* Outside a transaction, it's the last one committed: no new
+	 * transaction may come along to release us. */
+	if (!pipeline.max_inflight
+	    || (!db->in_transaction && pipeline.synced == pipeline.seq)) {
+		cb(arg);
+		return;
+	}
+
+	w = tal(ctx, struct db_sync_waiter);
+	w->cb = cb;
+	w->arg = arg;
+	if (db->in_transaction)
+		list_add_tail(&pipeline.txn_waiters, &w->list);
+	else {
+		w->seq = pipeline.seq;
+		list_add_tail(&pipeline.waiters, &w->list);
+	}
+	tal_add_destructor(w, destroy_db_sync_waiter);
+}
+
+struct saved_waiter {
+	struct db *db;
+	void (*cb)(void *arg);
+	void *arg;
+};
+
+static void saved_waiter_durable(struct saved_waiter *sw)
+{
+	/* The callback may free sw's parent, so take it first. */
+	tal_steal(tmpctx, sw);
+	sw->cb(sw->arg);
+	tal_free(sw);
+}
+
+static void saved_waiter_synced(struct saved_waiter *sw)
+{
+	/* We're in order, and so is this: anything committed later than
+	 * what we're waiting for only makes it wait longer. */
+	db_after_durable(sw->db, sw, saved_waiter_durable, sw);
+}
+
+void db_after_saved_(struct db *db, const tal_t *ctx,
+		     void (*cb)(void *arg), void *arg)
+{
+	struct saved_waiter *sw;
+
+	if (!pipeline.max_inflight) {
+		db_after_durable_(db, ctx, cb, arg);
+		return;
+	}
+
+	sw = tal(ctx, struct saved_waiter);
+	sw->db = db;
+	sw->cb = cb;
+	sw->arg = arg;
+	plugin_hook_db_after_sync(db, sw, saved_waiter_synced, sw);
+}
+
+bool plugin_hook_db_has_plugins(void)
+{
+	return tal_count(db_write_hook.instances) != 0;
+}
+
+void plugin_hook_db_flush(void)
+{
+	while (tal_count(pipeline.inflight))
+		db_write_wait_oldest();
+}
@@ -4,6 +4,7 @@
 #include "config.h"
 #include <ccan/autodata/autodata.h>
 #include <ccan/tal/tal.h>
+#include <ccan/time/time.h>
 #include <ccan/typesafe_cb/typesafe_cb.h>
 #include <lightningd/json_stream.h>
 #include <lightningd/lightningd.h>
@@ -37,6 +38,21 @@
  *   that may contain any additional context necessary.
  *
  *
+ * Several plugins can register the same hook: they're asked in the
+ * order they registered, and the first response which isn't
+ * `{"result": "continue"}` (or `{}`) is the one handed to `response_cb`.
+ * How they're asked depends on the hook's `type`:
+ *
+ * - `PLUGIN_HOOK_CHAIN`: one at a time, stopping at the first plugin
+ *   which doesn't continue.  Later plugins never see the call.
+ *
+ * - `PLUGIN_HOOK_PARALLEL`: all at once, so the latency is that of the
+ *   slowest plugin rather than the sum of them.  Every plugin sees every
+ *   call, even if an earlier plugin's response ends up deciding it.
+ *
+ * If a plugin doesn't respond within the hook's `timeout` (set with
+ * `--plugin-hook-timeout`), it's treated as if it said continue.
+ *
  * To make hook invocations easier, each hook registered with
  * `REGISTER_PLUGIN_HOOK` provides a `plugin_hook_call_hookname`
  * function that performs typechecking at compile time, and makes sure
@@ -44,13 +60,36 @@
  * and callback have the correct type.
  */
 
+enum plugin_hook_type {
+	PLUGIN_HOOK_CHAIN,
+	PLUGIN_HOOK_PARALLEL,
+};
+
+/* One plugin's registration for a hook. */
+struct hook_instance {
+	struct plugin *plugin;
+
+	/* Latency accounting */
+	u64 num_calls, num_timeouts;
+	struct timerel total_latency, max_latency;
+};
+
 struct plugin_hook {
 	const char *name;
+	enum plugin_hook_type type;
 	void (*response_cb)(void *arg, const char *buffer, const jsmntok_t *toks);
 	void (*serialize_payload)(void *src, struct json_stream *dest);
 
-	/* Which plugin has registered this hook? */
-	struct plugin *plugin;
+	/* Optional compact forms, for plugins using binary framing: a
+	 * plugin_hook_continue reply is handled for you. */
+	u8 *(*serialize_wire)(const tal_t *ctx, void *src);
+	void (*wire_response_cb)(void *arg, const u8 *msg);
+
+	/* Which plugins have registered this hook, in order? */
+	struct hook_instance **instances;
+
+	/* Seconds to wait for each plugin, or 0 to wait forever. */
+	u32 timeout;
 };
 AUTODATA_TYPE(hooks, struct plugin_hook);
 
@@ -84,10 +123,34 @@ void plugin_hook_call_(struct lightningd *ld, const struct plugin_hook *hook,
  * response_cb function accepts the deserialized response format and
  * an arbitrary extra argument used to maintain context.
  */
-#define REGISTER_PLUGIN_HOOK(name, response_cb, response_cb_arg_type,          \
+#define REGISTER_PLUGIN_HOOK(name, type, response_cb, response_cb_arg_type,    \
 			     serialize_payload, payload_type)                  \
+	REGISTER_PLUGIN_HOOK_(name, type, response_cb, response_cb_arg_type,   \
+			      serialize_payload, payload_type, NULL, NULL)
+
+/* Same, but also with a binary form from common/plugin_wire.csv:
+ * serialize_wire turns the payload into a message, and wire_response_cb
+ * takes a (non-continue) reply message instead of JSON. */
+#define REGISTER_PLUGIN_HOOK_WIRE(name, type, response_cb,                     \
+				  response_cb_arg_type, serialize_payload,     \
+				  payload_type, serialize_wire,                \
+				  wire_response_cb)                            \
+	REGISTER_PLUGIN_HOOK_(                                                 \
+	    name, type, response_cb, response_cb_arg_type, serialize_payload,  \
+	    payload_type,                                                      \
+	    typesafe_cb_cast(u8 *(*)(const tal_t *, void *),                   \
+			     u8 *(*)(const tal_t *, payload_type),             \
+			     serialize_wire),                                  \
+	    typesafe_cb_cast(void (*)(void *, const u8 *),                     \
+			     void (*)(response_cb_arg_type, const u8 *),       \
+			     wire_response_cb))
+
+#define REGISTER_PLUGIN_HOOK_(name, type, response_cb, response_cb_arg_type,   \
+			      serialize_payload, payload_type, serialize_wire, \
+			      wire_response_cb)                                \
 	struct plugin_hook name##_hook_gen = {                                 \
 	    stringify(name),                                                   \
+	    type,                                                              \
 	    typesafe_cb_cast(void (*)(void *, const char *, const jsmntok_t *),\
 			     void (*)(response_cb_arg_type,		       \
 				      const char *, const jsmntok_t *),	       \
@@ -95,15 +158,69 @@ void plugin_hook_call_(struct lightningd *ld, const struct plugin_hook *hook,
 	    typesafe_cb_cast(void (*)(void *, struct json_stream *),           \
 			     void (*)(payload_type, struct json_stream *),     \
 			     serialize_payload),                               \
-	    NULL, /* .plugin */                                                \
+	    serialize_wire,                                                    \
+	    wire_response_cb,                                                  \
+	    NULL, /* .instances */                                             \
+	    0, /* .timeout */                                                  \
 	};                                                                     \
 	AUTODATA(hooks, &name##_hook_gen);                                     \
 	PLUGIN_HOOK_CALL_DEF(name, payload_type, response_cb_arg_type);
 
 bool plugin_hook_register(struct plugin *plugin, const char *method);
 
+/* Set the timeout for hook @name: returns false if there's no such hook. */
+bool plugin_hook_set_timeout(const char *name, u32 timeout);
+
 /* Special sync plugin hook for db: changes[] are SQL statements, with optional
- * final command appended. */
+ * final command appended.  changes is NULL if a transaction changed nothing. */
 void plugin_hook_db_sync(struct db *db, const char **changes, const char *final);
 
+/* Let up to @max_inflight batches of db writes be unconfirmed by the
+ * db_write plugins at once (0 means wait for them on every commit). */
+void plugin_hook_db_set_pipeline(u32 max_inflight);
+
+/**
+ * plugin_hook_db_after_sync - call once db_write plugins have our changes
+ * @db: the database
+ * @ctx: freeing this cancels the callback.
+ * @cb: the callback
+ * @arg: the argument to @cb
+ *
+ * Anything which commits us to the changes made by the current transaction
+ * (eg. acknowledging a peer's commitment) must wait for the plugins to
+ * confirm them, which is only immediate if the writes aren't pipelined.
+ * Outside a transaction, waits for the last one committed.
+ */
+#define plugin_hook_db_after_sync(db, ctx, cb, arg)			\
+	plugin_hook_db_after_sync_((db), (ctx),				\
+				   typesafe_cb(void, void *, (cb), (arg)), \
+				   (arg))
+void plugin_hook_db_after_sync_(struct db *db, const tal_t *ctx,
+				void (*cb)(void *arg), void *arg);
+
+/**
+ * db_after_saved - call once the current transaction is safe
+ * @db: the database
+ * @ctx: freeing this cancels the callback.
+ * @cb: the callback
+ * @arg: the argument to @cb
+ *
+ * That is, once the db_write plugins have it (plugin_hook_db_after_sync)
+ * and it's on disk (db_after_durable).  Anything the outside world sees
+ * (messages to a peer's subdaemon, transactions we broadcast) waits here,
+ * so a crash can't lose state we've already acted on.
+ */
+#define db_after_saved(db, ctx, cb, arg)				\
+	db_after_saved_((db), (ctx),					\
+			typesafe_cb(void, void *, (cb), (arg)),		\
+			(arg))
+void db_after_saved_(struct db *db, const tal_t *ctx,
+		     void (*cb)(void *arg), void *arg);
+
+/* Wait for db_write plugins to confirm all the writes we've sent. */
+void plugin_hook_db_flush(void);
+
+/* Is anyone keeping a copy of the db via the db_write hook? */
+bool plugin_hook_db_has_plugins(void);
+
 #endif /* LIGHTNING_LIGHTNINGD_PLUGIN_HOOK_H */
@@ -18,6 +18,7 @@
 #include <lightningd/log.h>
 #include <lightningd/log_status.h>
 #include <lightningd/peer_control.h>
+#include <lightningd/plugin_hook.h>
 #include <lightningd/subd.h>
 #include <signal.h>
 #include <stdarg.h>
@@ -655,6 +656,7 @@ static struct subd *new_subd(struct lightningd *ld,
 	sd->billboardcb = billboardcb;
 	sd->fds_in = NULL;
 	sd->outq = msg_queue_new(sd);
+	list_head_init(&sd->held);
 	tal_add_destructor(sd, destroy_subd);
 	list_head_init(&sd->reqs);
 	sd->channel = channel;
@@ -716,17 +718,76 @@ struct subd *new_channel_subd_(struct lightningd *ld,
 	return sd;
 }
 
+/* A message (or fd) for a channel's subdaemon, waiting for the db. */
+struct held_msg {
+	struct list_node list;
+	struct subd *sd;
+	const u8 *msg;
+	int fd;
+	bool saved;
+};
+
+static void destroy_held_msg(struct held_msg *h)
+{
+	if (h->fd >= 0)
+		close(h->fd);
+}
+
+static void held_msg_saved(struct held_msg *h)
+{
+	struct subd *sd = h->sd;
+
+	h->saved = true;
+
+	/* They're saved in order, but this one may have been immediate. */
+	while ((h = list_top(&sd->held, struct held_msg, list)) != NULL
+	       && h->saved) {
+		list_del_from(&sd->held, &h->list);
+		if (h->msg)
+			msg_enqueue(sd->outq, take(h->msg));
+		else {
+			msg_enqueue_fd(sd->outq, h->fd);
+			h->fd = -1;
+		}
+		tal_free(h);
+	}
+}
+
+/* What we tell a channel's subdaemon, it can tell the peer (or act on), so
+ * it waits until whatever we've done so far is safely saved. */
+static void subd_enqueue(struct subd *sd, const u8 *msg TAKES, int fd)
+{
+	struct held_msg *h;
+
+	if (!sd->channel) {
+		if (msg)
+			msg_enqueue(sd->outq, msg);
+		else
+			msg_enqueue_fd(sd->outq, fd);
+		return;
+	}
+
+	h = tal(sd, struct held_msg);
+	h->sd = sd;
+	h->msg = msg ? tal_dup_arr(h, u8, msg, tal_count(msg), 0) : NULL;
+	h->fd = fd;
+	h->saved = false;
+	tal_add_destructor(h, destroy_held_msg);
+	list_add_tail(&sd->held, &h->list);
+	db_after_saved(sd->ld->wallet->db, h, held_msg_saved, h);
+}
+
 void subd_send_msg(struct subd *sd, const u8 *msg_out)
 {
 	/* FIXME: We should use unique upper bits for each daemon, then
 	 * have generate-wire.py add them, just assert here. */
 	assert(!strstarts(sd->msgname(fromwire_peektype(msg_out)), "INVALID"));
-	msg_enqueue(sd->outq, msg_out);
+	subd_enqueue(sd, msg_out, -1);
 }
 
 void subd_send_fd(struct subd *sd, int fd)
 {
-	msg_enqueue_fd(sd->outq, fd);
+	subd_enqueue(sd, NULL, fd);
 }
 
 void subd_req_(const tal_t *ctx,
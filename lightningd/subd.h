@@ -66,6 +66,8 @@ struct subd {
 
 	/* Messages queue up here. */
 	struct msg_queue *outq;
+	/* Messages for a channel's daemon wait here for the db to be saved. */
+	struct list_head held;
 
 	/* Callbacks for replies. */
 	struct list_head reqs;
@@ -143,6 +145,9 @@ struct subd *new_channel_subd_(struct lightningd *ld,
  * subd_send_msg - queue a message to the subdaemon.
  * @sd: subdaemon to request
  * @msg_out: message (can be take)
+ *
+ * For a channel's subdaemon, this is only sent once the changes we've made
+ * to the db so far are saved (see db_after_saved()).
  */
 void subd_send_msg(struct subd *sd, const u8 *msg_out);
 
@@ -39,6 +39,10 @@ void daemon_setup(const char *argv0 UNNEEDED,
 /* Generated stub for daemon_shutdown */
 void daemon_shutdown(void)
 { fprintf(stderr, "daemon_shutdown called!\n"); abort(); }
+/* Generated stub for db_after_saved_ */
+void db_after_saved_(struct db *db UNNEEDED, const tal_t *ctx UNNEEDED,
+		     void (*cb)(void *arg) UNNEEDED, void *arg UNNEEDED)
+{ fprintf(stderr, "db_after_saved_ called!\n"); abort(); }
 /* Generated stub for db_assert_no_outstanding_statements */
 void db_assert_no_outstanding_statements(void)
 { fprintf(stderr, "db_assert_no_outstanding_statements called!\n"); abort(); }
@@ -137,6 +141,12 @@ void onchaind_replay_channels(struct lightningd *ld UNNEEDED)
 /* Generated stub for per_peer_state_set_fds_arr */
 void per_peer_state_set_fds_arr(struct per_peer_state *pps UNNEEDED, const int *fds UNNEEDED)
 { fprintf(stderr, "per_peer_state_set_fds_arr called!\n"); abort(); }
+/* Generated stub for plugin_hook_db_flush */
+void plugin_hook_db_flush(void)
+{ fprintf(stderr, "plugin_hook_db_flush called!\n"); abort(); }
+/* Generated stub for plugin_hook_db_set_pipeline */
+void plugin_hook_db_set_pipeline(u32 max_inflight UNNEEDED)
+{ fprintf(stderr, "plugin_hook_db_set_pipeline called!\n"); abort(); }
 /* Generated stub for plugins_config */
 void plugins_config(struct plugins *plugins UNNEEDED)
 { fprintf(stderr, "plugins_config called!\n"); abort(); }
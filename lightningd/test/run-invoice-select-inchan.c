@@ -478,12 +478,16 @@ void wallet_channeltxs_add(struct wallet *w UNNEEDED, struct channel *chan UNNEE
 			    const int type UNNEEDED, const struct bitcoin_txid *txid UNNEEDED,
 			   const u32 input_num UNNEEDED, const u32 blockheight UNNEEDED)
 { fprintf(stderr, "wallet_channeltxs_add called!\n"); abort(); }
-/* Generated stub for wallet_htlcs_load_for_channel */
-bool wallet_htlcs_load_for_channel(struct wallet *wallet UNNEEDED,
-				   struct channel *chan UNNEEDED,
-				   struct htlc_in_map *htlcs_in UNNEEDED,
-				   struct htlc_out_map *htlcs_out UNNEEDED)
-{ fprintf(stderr, "wallet_htlcs_load_for_channel called!\n"); abort(); }
+/* Generated stub for wallet_closed_channels_get */
+const struct closed_channel *wallet_closed_channels_get(const tal_t *ctx UNNEEDED,
+							struct wallet *w UNNEEDED,
+							const struct node_id *peer_id UNNEEDED)
+{ fprintf(stderr, "wallet_closed_channels_get called!\n"); abort(); }
+/* Generated stub for wallet_htlcs_load_all */
+bool wallet_htlcs_load_all(struct wallet *wallet UNNEEDED,
+			   struct htlc_in_map *htlcs_in UNNEEDED,
+			   struct htlc_out_map *htlcs_out UNNEEDED)
+{ fprintf(stderr, "wallet_htlcs_load_all called!\n"); abort(); }
 /* Generated stub for wallet_invoice_create */
 bool wallet_invoice_create(struct wallet *wallet UNNEEDED,
 			   struct invoice *pinvoice UNNEEDED,
@@ -525,7 +529,8 @@ bool wallet_invoice_find_unpaid(struct wallet *wallet UNNEEDED,
 { fprintf(stderr, "wallet_invoice_find_unpaid called!\n"); abort(); }
 /* Generated stub for wallet_invoice_iterate */
 bool wallet_invoice_iterate(struct wallet *wallet UNNEEDED,
-			    struct invoice_iterator *it UNNEEDED)
+			    struct invoice_iterator *it UNNEEDED,
+			    const struct invoice_filter *filter UNNEEDED)
 { fprintf(stderr, "wallet_invoice_iterate called!\n"); abort(); }
 /* Generated stub for wallet_invoice_iterator_deref */
 const struct invoice_details *wallet_invoice_iterator_deref(const tal_t *ctx UNNEEDED,
@@ -0,0 +1,188 @@
+#include "../log.c"
+#include <common/utils.h>
+#include <stdio.h>
+
+/* AUTOGENERATED MOCKS START */
+/* Generated stub for command_fail */
+struct command_result *command_fail(struct command *cmd UNNEEDED, int code UNNEEDED,
+				    const char *fmt UNNEEDED, ...)
+
+{ fprintf(stderr, "command_fail called!\n"); abort(); }
+/* Generated stub for command_param_failed */
+struct command_result *command_param_failed(void)
+
+{ fprintf(stderr, "command_param_failed called!\n"); abort(); }
+/* Generated stub for command_success */
+struct command_result *command_success(struct command *cmd UNNEEDED,
+				       struct json_stream *response UNNEEDED)
+
+{ fprintf(stderr, "command_success called!\n"); abort(); }
+/* Generated stub for json_add_hex */
+void json_add_hex(struct json_stream *result UNNEEDED, const char *fieldname UNNEEDED,
+		  const void *data UNNEEDED, size_t len UNNEEDED)
+{ fprintf(stderr, "json_add_hex called!\n"); abort(); }
+/* Generated stub for json_add_num */
+void json_add_num(struct json_stream *result UNNEEDED, const char *fieldname UNNEEDED,
+		  unsigned int value UNNEEDED)
+{ fprintf(stderr, "json_add_num called!\n"); abort(); }
+/* Generated stub for json_add_string */
+void json_add_string(struct json_stream *result UNNEEDED, const char *fieldname UNNEEDED, const char *value UNNEEDED)
+{ fprintf(stderr, "json_add_string called!\n"); abort(); }
+/* Generated stub for json_add_time */
+void json_add_time(struct json_stream *result UNNEEDED, const char *fieldname UNNEEDED,
+			  struct timespec ts UNNEEDED)
+{ fprintf(stderr, "json_add_time called!\n"); abort(); }
+/* Generated stub for json_array_end */
+void json_array_end(struct json_stream *js UNNEEDED)
+{ fprintf(stderr, "json_array_end called!\n"); abort(); }
+/* Generated stub for json_array_start */
+void json_array_start(struct json_stream *js UNNEEDED, const char *fieldname UNNEEDED)
+{ fprintf(stderr, "json_array_start called!\n"); abort(); }
+/* Generated stub for json_object_end */
+void json_object_end(struct json_stream *js UNNEEDED)
+{ fprintf(stderr, "json_object_end called!\n"); abort(); }
+/* Generated stub for json_object_start */
+void json_object_start(struct json_stream *ks UNNEEDED, const char *fieldname UNNEEDED)
+{ fprintf(stderr, "json_object_start called!\n"); abort(); }
+/* Generated stub for json_stream_log_suppress_for_cmd */
+void json_stream_log_suppress_for_cmd(struct json_stream *js UNNEEDED,
+					    const struct command *cmd UNNEEDED)
+{ fprintf(stderr, "json_stream_log_suppress_for_cmd called!\n"); abort(); }
+/* Generated stub for json_stream_success */
+struct json_stream *json_stream_success(struct command *cmd UNNEEDED)
+{ fprintf(stderr, "json_stream_success called!\n"); abort(); }
+/* Generated stub for notify_warning */
+void notify_warning(struct lightningd *ld UNNEEDED, struct log_entry *l UNNEEDED)
+{ fprintf(stderr, "notify_warning called!\n"); abort(); }
+/* Generated stub for param */
+bool param(struct command *cmd UNNEEDED, const char *buffer UNNEEDED,
+	   const jsmntok_t params[] UNNEEDED, ...)
+{ fprintf(stderr, "param called!\n"); abort(); }
+/* AUTOGENERATED MOCKS END */
+
+static size_t num_printed;
+
+static void count_print(const char *prefix UNUSED,
+			enum log_level level UNUSED,
+			bool continued UNUSED,
+			const struct timeabs *time UNUSED,
+			const char *str UNUSED,
+			const u8 *io UNUSED, size_t io_len UNUSED,
+			void *unused UNUSED)
+{
+	num_printed++;
+}
+
+struct check_state {
+	size_t num, total_skipped;
+	int last_index;
+	const char *last_log;
+	size_t last_io_len;
+};
+
+static void check_line(unsigned int skipped,
+		       struct timerel diff UNUSED,
+		       enum log_level level UNUSED,
+		       const char *prefix,
+		       const char *log,
+		       const u8 *io UNUSED,
+		       size_t io_len,
+		       struct check_state *state)
+{
+	int index;
+
+	assert(streq(prefix, "test:"));
+	state->num++;
+	state->total_skipped += skipped;
+	state->last_log = log;
+	state->last_io_len = io_len;
+
+	/* Entries are kept in order, and skipped counts any gap. */
+	if (sscanf(log, "entry %i", &index) == 1) {
+		assert(index == state->last_index + 1 + (int)skipped);
+		state->last_index = index;
+	}
+}
+
+int main(void)
+{
+	struct log_book *lr;
+	struct log *log, *log2;
+	struct check_state state;
+	u8 *io;
+	/* log_books are tal_linkable: freeing their last log frees them. */
+	const tal_t *ctx = tal(NULL, char);
+
+	setup_locale();
+	setup_tmpctx();
+
+	lr = new_log_book(NULL, 64 * 1024, LOG_INFORM);
+	set_log_outfn(lr, count_print, NULL);
+	log = new_log(ctx, lr, "test%s", ":");
+	log2 = new_log(ctx, lr, "test:");
+
+	/* Same prefix is only stored once. */
+	assert(log_prefix(log) == log_prefix(log2));
+
+	/* Ring starts small, and grows up to the limit. */
+	assert(tal_bytelen(lr->ring) < log_max_mem(lr));
+	for (int i = 0; i < 100000; i++)
+		log_debug(log, "entry %i", i);
+	assert(tal_bytelen(lr->ring) == log_max_mem(lr));
+	assert(log_used(lr) <= log_max_mem(lr));
+	assert(num_printed == 0);
+
+	/* We always keep the latest, and account for everything else */
+	memset(&state, 0, sizeof(state));
+	state.last_index = -1;
+	log_each_line(lr, check_line, &state);
+	assert(state.num == lr->num_entries);
+	assert(state.num + state.total_skipped == 100000);
+	assert(state.last_index == 99999);
+
+	/* log_add extends the latest entry. */
+	log_add(log2, " and more");
+	memset(&state, 0, sizeof(state));
+	state.last_index = -1;
+	log_each_line(lr, check_line, &state);
+	assert(streq(state.last_log, "entry 99999 and more"));
+	assert(state.num + state.total_skipped == 100000);
+
+	/* Non-printable characters are replaced. */
+	log_info(log, "bad\nchar");
+	memset(&state, 0, sizeof(state));
+	state.last_index = -1;
+	log_each_line(lr, check_line, &state);
+	assert(streq(state.last_log, "bad?char"));
+	assert(num_printed == 1);
+
+	/* Giant IOs are truncated. */
+	io = tal_arrz(tmpctx, u8, log_max_mem(lr));
+	log_io(log, LOG_IO_OUT, "giant", io, tal_bytelen(io));
+	memset(&state, 0, sizeof(state));
+	state.last_index = -1;
+	log_each_line(lr, check_line, &state);
+	assert(streq(state.last_log, "giant"));
+	assert(state.last_io_len == log_max_mem(lr) / 64);
+	assert(log_used(lr) <= log_max_mem(lr));
+
+	/* Extending the latest entry drops older ones to make room: they
+	 * still count as skipped. */
+	tal_free(log);
+	tal_free(log2);
+	lr = new_log_book(NULL, 64 * 1024, LOG_INFORM);
+	log = new_log(ctx, lr, "test:");
+	for (int i = 0; i < 1000; i++) {
+		log_debug(log, "entry %i", i);
+		log_add(log, "%*s", (i * 7919) % (16 * 1024), "");
+		memset(&state, 0, sizeof(state));
+		state.last_index = -1;
+		log_each_line(lr, check_line, &state);
+		assert(state.num + state.total_skipped == i + 1);
+		assert(state.last_index == i);
+	}
+
+	tal_free(ctx);
+	tal_free(tmpctx);
+	return 0;
+}
@@ -64,6 +64,9 @@ static const u8 ONE = 0x1;
 /* When to tell master about HTLCs which are missing/timed out */
 static u32 reasonable_depth;
 
+/* When we tell master we're done, so it can archive the channel. */
+static u32 archive_depth;
+
 /* The messages to send at that depth. */
 static u8 **missing_htlc_msgs;
 
@@ -745,12 +748,14 @@ static bool is_local_commitment(const struct bitcoin_txid *txid,
  * once the remote's *resolving* transaction is included in a block at least 100
  * deep, on the most-work blockchain.
  */
+/* archive_depth is at least 100: we may keep watching longer than that. */
 static size_t num_not_irrevocably_resolved(struct tracked_output **outs)
 {
 	size_t i, num = 0;
 
 	for (i = 0; i < tal_count(outs); i++) {
-		if (!outs[i]->resolved || outs[i]->resolved->depth < 100)
+		if (!outs[i]->resolved
+		    || outs[i]->resolved->depth < archive_depth)
 			num++;
 	}
 	return num;
@@ -812,8 +817,8 @@ static void billboard_update(struct tracked_output **outs)
 			       "All outputs resolved:"
 			       " waiting %u more blocks before forgetting"
 			       " channel",
-			       best->resolved->depth < 100
-			       ? 100 - best->resolved->depth : 0);
+			       best->resolved->depth < archive_depth
+			       ? archive_depth - best->resolved->depth : 0);
 		return;
 	}
 
@@ -2575,6 +2580,7 @@ int main(int argc, char *argv[])
 				   &tx,
 				   &tx_blockheight,
 				   &reasonable_depth,
+				   &archive_depth,
 				   &remote_htlc_sigs,
 				   &num_htlcs,
 				   &min_possible_feerate,
@@ -1,4 +1,5 @@
 #include <ccan/array_size/array_size.h>
+#include <ccan/asort/asort.h>
 #include <ccan/cast/cast.h>
 #include <ccan/intmap/intmap.h>
 #include <ccan/json_out/json_out.h>
@@ -1180,31 +1181,141 @@ static struct command_result *json_paystatus(struct command *cmd,
 	return command_success(cmd, ret);
 }
 
+static bool ps_attempt_ongoing(const struct pay_status *ps)
+{
+	const struct pay_attempt *attempt;
+
+	if (tal_count(ps->attempts) == 0)
+		return false;
+	attempt = &ps->attempts[tal_count(ps->attempts)-1];
+	return attempt->result == NULL && attempt->failure == NULL;
+}
+
 static bool attempt_ongoing(const char *buf, const jsmntok_t *b11)
 {
 	struct pay_status *ps;
-	struct pay_attempt *attempt;
 
 	list_for_each(&pay_status, ps, list) {
 		if (!json_tok_streq(buf, b11, ps->bolt11))
 			continue;
-		attempt = &ps->attempts[tal_count(ps->attempts)-1];
-		return attempt->result == NULL && attempt->failure == NULL;
+		return ps_attempt_ongoing(ps);
 	}
 	return false;
 }
 
+/* A pending payment, from one of several listsendpays calls */
+struct listpays_entry {
+	u64 id;
+	const char *json;
+};
+
+struct listpays_args {
+	const char *b11str;
+	/* What they asked for, which may not be what listsendpays says */
+	const char *status;
+	u64 *created_since, *created_before, *start, *limit;
+	/* Asked for pending while we're retrying: listsendpays calls those
+	 * failed, so we ask for each of them too, and merge. */
+	const char **retrying;
+	struct listpays_entry *entries;
+};
+
+static void json_out_add_opt_u64(struct json_out *jout, const char *name,
+				 const u64 *val)
+{
+	if (val)
+		json_out_add(jout, name, false, "%"PRIu64, *val);
+}
+
+static struct json_out *listsendpays_params(const struct listpays_args *args,
+					    const char *b11str,
+					    const char *status,
+					    const u64 *limit)
+{
+	struct json_out *req = json_out_new(NULL);
+
+	json_out_start(req, NULL, '{');
+	if (b11str)
+		json_out_addstr(req, "bolt11", b11str);
+	if (status)
+		json_out_addstr(req, "status", status);
+	json_out_add_opt_u64(req, "created_since", args->created_since);
+	json_out_add_opt_u64(req, "created_before", args->created_before);
+	json_out_add_opt_u64(req, "start", args->start);
+	json_out_add_opt_u64(req, "limit", limit);
+	json_out_end(req, '}');
+	json_out_finished(req);
+	return req;
+}
+
+/* Is this payment failed in the db, but we're still retrying? */
+static bool listsendpays_retrying(const char *buf, const jsmntok_t *t)
+{
+	const jsmntok_t *status, *b11;
+
+	status = json_get_member(buf, t, "status");
+	b11 = json_get_member(buf, t, "bolt11");
+	return status && json_tok_streq(buf, status, "failed")
+		&& b11 && attempt_ongoing(buf, b11);
+}
+
+static void add_listpay(struct json_out *ret,
+			const char *buf, const jsmntok_t *t,
+			const struct listpays_args *args)
+{
+	const jsmntok_t *status, *b11;
+
+	status = json_get_member(buf, t, "status");
+	json_out_start(ret, NULL, '{');
+	/* Old payments didn't have bolt11 field */
+	b11 = copy_member(ret, buf, t, "bolt11");
+	if (!b11) {
+		if (args->b11str) {
+			/* If it's a single query, we can fake it */
+			json_out_addstr(ret, "bolt11", args->b11str);
+		} else {
+			copy_member(ret, buf, t, "payment_hash");
+			copy_member(ret, buf, t, "destination");
+			copy_member(ret, buf, t, "amount_msat");
+		}
+	}
+
+	if (listsendpays_retrying(buf, t))
+		json_out_addstr(ret, "status", "pending");
+	else if (status) {
+		copy_member(ret, buf, t, "status");
+		if (json_tok_streq(buf, status, "complete"))
+			copy_member(ret, buf, t, "payment_preimage");
+	}
+	copy_member(ret, buf, t, "label");
+	copy_member(ret, buf, t, "amount_sent_msat");
+	/* For paging with start */
+	copy_member(ret, buf, t, "id");
+	copy_member(ret, buf, t, "created_at");
+	json_out_end(ret, '}');
+}
+
+static const jsmntok_t *listsendpays_payments(const char *buf,
+					      const jsmntok_t *result)
+{
+	const jsmntok_t *arr = json_get_member(buf, result, "payments");
+
+	if (!arr || arr->type != JSMN_ARRAY)
+		return NULL;
+	return arr;
+}
+
 static struct command_result *listsendpays_done(struct command *cmd,
 						const char *buf,
 						const jsmntok_t *result,
-						char *b11str)
+						struct listpays_args *args)
 {
 	size_t i;
 	const jsmntok_t *t, *arr;
 	struct json_out *ret;
 
-	arr = json_get_member(buf, result, "payments");
-	if (!arr || arr->type != JSMN_ARRAY)
+	arr = listsendpays_payments(buf, result);
+	if (!arr)
 		return command_fail(cmd, LIGHTNINGD,
 				    "Unexpected non-array result from listsendpays");
 
@@ -1212,61 +1323,148 @@ static struct command_result *listsendpays_done(struct command *cmd,
 	json_out_start(ret, NULL, '{');
 	json_out_start(ret, "pays", '[');
 	json_for_each_arr(i, t, arr) {
-		const jsmntok_t *status, *b11;
+		/* Between attempts: not what they asked for */
+		if (args->status && listsendpays_retrying(buf, t))
+			continue;
+		add_listpay(ret, buf, t, args);
+	}
+	json_out_end(ret, ']');
+	json_out_end(ret, '}');
+	return command_success(cmd, ret);
+}
 
-		json_out_start(ret, NULL, '{');
-		/* Old payments didn't have bolt11 field */
-		b11 = copy_member(ret, buf, t, "bolt11");
-		if (!b11) {
-			if (b11str) {
-				/* If it's a single query, we can fake it */
-				json_out_addstr(ret, "bolt11", b11str);
-			} else {
-				copy_member(ret, buf, t, "payment_hash");
-				copy_member(ret, buf, t, "destination");
-				copy_member(ret, buf, t, "amount_msat");
-			}
-		}
+static int listpays_entry_cmp(const struct listpays_entry *a,
+			      const struct listpays_entry *b,
+			      void *unused UNUSED)
+{
+	if (a->id < b->id)
+		return -1;
+	return a->id > b->id;
+}
 
-		/* listsendpays might say it failed, but we're still retrying */
-		status = json_get_member(buf, t, "status");
-		if (status) {
-			if (json_tok_streq(buf, status, "failed")
-			    && attempt_ongoing(buf, b11)) {
-				json_out_addstr(ret, "status", "pending");
-			} else {
-				copy_member(ret, buf, t, "status");
-				if (json_tok_streq(buf, status, "complete"))
-					copy_member(ret, buf, t,
-						    "payment_preimage");
-			}
-		}
-		copy_member(ret, buf, t, "label");
-		copy_member(ret, buf, t, "amount_sent_msat");
-		json_out_end(ret, '}');
+static struct command_result *listpays_merged(struct command *cmd,
+					      struct listpays_args *args)
+{
+	struct json_out *ret;
+	size_t n = tal_count(args->entries);
+
+	asort(args->entries, n, listpays_entry_cmp, NULL);
+	if (args->limit && n > *args->limit)
+		n = *args->limit;
+
+	ret = json_out_new(NULL);
+	json_out_start(ret, NULL, '{');
+	json_out_start(ret, "pays", '[');
+	for (size_t i = 0; i < n; i++) {
+		const char *json = args->entries[i].json;
+		const jsmntok_t *toks;
+		bool valid;
+
+		toks = json_parse_input(tmpctx, json, strlen(json), &valid);
+		assert(toks && valid);
+		add_listpay(ret, json, toks, args);
 	}
 	json_out_end(ret, ']');
 	json_out_end(ret, '}');
 	return command_success(cmd, ret);
 }
 
+/* Collect pending payments: the ones listsendpays calls pending (with the
+ * limit), then those we're retrying, one at a time. */
+static struct command_result *listsendpays_pending(struct command *cmd,
+						   const char *buf,
+						   const jsmntok_t *result,
+						   struct listpays_args *args)
+{
+	size_t i, n;
+	const jsmntok_t *t, *arr;
+
+	arr = listsendpays_payments(buf, result);
+	if (!arr)
+		return command_fail(cmd, LIGHTNINGD,
+				    "Unexpected non-array result from listsendpays");
+
+	json_for_each_arr(i, t, arr) {
+		const jsmntok_t *status, *idtok;
+		struct listpays_entry e;
+		bool dup = false;
+
+		status = json_get_member(buf, t, "status");
+		if (!(status && json_tok_streq(buf, status, "pending"))
+		    && !listsendpays_retrying(buf, t))
+			continue;
+
+		idtok = json_get_member(buf, t, "id");
+		if (!idtok || !json_to_u64(buf, idtok, &e.id))
+			return command_fail(cmd, LIGHTNINGD,
+					    "listsendpays payment without id");
+		for (size_t j = 0; j < tal_count(args->entries); j++)
+			dup |= (args->entries[j].id == e.id);
+		if (dup)
+			continue;
+		e.json = json_strdup(args, buf, t);
+		tal_arr_expand(&args->entries, e);
+	}
+
+	n = tal_count(args->retrying);
+	if (n) {
+		const char *b11 = args->retrying[n-1];
+
+		tal_resize(&args->retrying, n-1);
+		return send_outreq(cmd, "listsendpays",
+				   listsendpays_pending, forward_error, args,
+				   take(listsendpays_params(args, b11,
+							    NULL, NULL)));
+	}
+	return listpays_merged(cmd, args);
+}
+
 static struct command_result *json_listpays(struct command *cmd,
 					    const char *buf,
 					    const jsmntok_t *params)
 {
-	const char *b11str;
+	struct listpays_args *args = tal(cmd, struct listpays_args);
+	struct pay_status *ps;
 
 	/* FIXME: would be nice to parse as a bolt11 so check worked in future */
 	if (!param(cmd, buf, params,
-		   p_opt("bolt11", param_string, &b11str),
+		   p_opt("bolt11", param_string, &args->b11str),
+		   p_opt("status", param_string, &args->status),
+		   p_opt("created_since", param_u64, &args->created_since),
+		   p_opt("created_before", param_u64, &args->created_before),
+		   p_opt("start", param_u64, &args->start),
+		   p_opt("limit", param_u64, &args->limit),
 		   NULL))
 		return NULL;
 
+	/* A payment we're between attempts on is failed in the db, so
+	 * pending ones have to be asked for separately. */
+	args->retrying = tal_arr(args, const char *, 0);
+	args->entries = tal_arr(args, struct listpays_entry, 0);
+	if (args->status && streq(args->status, "pending")) {
+		list_for_each(&pay_status, ps, list) {
+			if (!ps_attempt_ongoing(ps))
+				continue;
+			if (args->b11str && !streq(args->b11str, ps->bolt11))
+				continue;
+			tal_arr_expand(&args->retrying,
+				       tal_strdup(args, ps->bolt11));
+		}
+	}
+
+	if (tal_count(args->retrying))
+		return send_outreq(cmd, "listsendpays",
+				   listsendpays_pending, forward_error, args,
+				   take(listsendpays_params(args, args->b11str,
+							    args->status,
+							    args->limit)));
+
+	/* Otherwise listsendpays does the filtering (and checks the status) */
 	return send_outreq(cmd, "listsendpays",
-			   listsendpays_done, forward_error,
-			   cast_const(char *, b11str),
-			   /* Neatly returns empty object if b11str is NULL */
-			   take(json_out_obj(NULL, "bolt11", b11str)));
+			   listsendpays_done, forward_error, args,
+			   take(listsendpays_params(args, args->b11str,
+						    args->status,
+						    args->limit)));
 }
 
 static void init(struct plugin_conn *rpc)
@@ -1301,7 +1499,10 @@ static const struct plugin_command commands[] = { {
 		"listpays",
 		"payment",
 		"List result of payment {bolt11}, or all",
-		"Covers old payments (failed and succeeded) and current ones.",
+		"Covers old payments (failed and succeeded) and current ones."
+		" Optionally only those with {status}, or created in"
+		" [{created_since}, {created_before}) (UNIX seconds); at most"
+		" {limit} of them, starting at id {start}.",
 		json_listpays
 	}
 };
@@ -4,6 +4,7 @@ from time import time
 from tqdm import tqdm
 
 
+import os
 import pytest
 import random
 
@@ -51,6 +52,56 @@ def test_single_hop(node_factory, executor):
     print("Done. %d payments performed in %f seconds (%f payments per second)" % (num_payments, diff, num_payments / diff))
 
 
+@pytest.mark.parametrize("plugin", ["continue_htlcs.py",
+                                    "continue_htlcs_binary.py"])
+def test_htlc_accepted_framing(node_factory, executor, plugin):
+    """Forwarding throughput with an htlc_accepted plugin on the way.
+    """
+    num = 1000
+    l1, l2, l3 = node_factory.line_graph(3, opts=[
+        {}, {'plugin': os.path.join('tests/plugins', plugin)}, {}
+    ], wait_for_announce=True)
+
+    invoices = [l3.rpc.invoice(1000, 'invoice-%d' % i, 'desc')['payment_hash']
+                for i in range(num)]
+    route = l1.rpc.getroute(l3.rpc.getinfo()['id'], 1000, 1)['route']
+
+    def do_pay(h):
+        l1.rpc.sendpay(route, h)
+        return l1.rpc.waitsendpay(h)
+
+    start_time = time()
+    for f in futures.as_completed([executor.submit(do_pay, h) for h in invoices]):
+        f.result()
+    diff = time() - start_time
+    print("%s: %d forwards in %f seconds (%f per second)" % (plugin, num, diff, num / diff))
+
+
+@pytest.mark.parametrize("journal,sync", [("delete", "full"),
+                                          ("wal", "full"),
+                                          ("wal", "normal")])
+def test_db_tuning(node_factory, executor, journal, sync):
+    """HTLC throughput (db commit bound) under each sqlite3 setting.
+    """
+    num = 1000
+    opts = {'db-journal-mode': journal, 'db-synchronous': sync}
+    l1, l2 = node_factory.line_graph(2, opts=opts)
+
+    invoices = [l2.rpc.invoice(1000, 'invoice-%d' % i, 'desc')['payment_hash']
+                for i in range(num)]
+    route = l1.rpc.getroute(l2.rpc.getinfo()['id'], 1000, 1)['route']
+
+    def do_pay(h):
+        l1.rpc.sendpay(route, h)
+        return l1.rpc.waitsendpay(h)
+
+    start_time = time()
+    for f in futures.as_completed([executor.submit(do_pay, h) for h in invoices]):
+        f.result()
+    diff = time() - start_time
+    print("%s/%s: %d payments in %f seconds (%f per second)" % (journal, sync, num, diff, num / diff))
+
+
 def test_single_payment(node_factory, benchmark):
     l1, l2 = node_factory.line_graph(2)
 
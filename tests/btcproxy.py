@@ -31,6 +31,9 @@ class BitcoinRpcProxy(object):
         self.mock_counts = {}
         self.bitcoind = bitcoind
         self.request_count = 0
+        # One entry per HTTP request: see proxy()
+        self.requests = []
+        self.fail_status = None
 
     def _handle_request(self, r):
         brpc = BitcoinProxy(btc_conf_file=self.bitcoind.conf_file)
@@ -63,6 +66,18 @@ class BitcoinRpcProxy(object):
     def proxy(self):
         r = json.loads(request.data.decode('ASCII'))
 
+        # bitcoin-cli asks for the connection to be closed every time;
+        # lightningd's own JSON-RPC client keeps it open.
+        keepalive = request.headers.get('Connection', '').lower() != 'close'
+        self.requests.append({
+            'conn': request.environ.get('REMOTE_PORT'),
+            'batch': len(r) if isinstance(r, list) else 1,
+            'keepalive': keepalive,
+        })
+
+        if keepalive and self.fail_status is not None:
+            return flask.Response('', status=self.fail_status)
+
         if isinstance(r, list):
             reply = [self._handle_request(subreq) for subreq in r]
         else:
@@ -92,6 +107,15 @@ class BitcoinRpcProxy(object):
         self.proxy_thread.join()
         logging.debug("BitcoinRpcProxy shut down after processing {} requests".format(self.request_count))
 
+    def fail_requests(self, status=None):
+        """Answer lightningd's JSON-RPC requests with a bare HTTP @status
+
+        bitcoin-cli still gets through, so lightningd can fall back to it.
+        If status is None, requests are passed through again.
+
+        """
+        self.fail_status = status
+
     def mock_rpc(self, method, response=None):
         """Mock the response to a future RPC call of @method
 
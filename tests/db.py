@@ -0,0 +1,171 @@
+from ephemeral_port_reserve import reserve
+
+import logging
+import os
+import shutil
+import sqlite3
+import subprocess
+import threading
+import time
+
+
+class Sqlite3Db(object):
+    """The default: lightningd's own sqlite3 file in its lightning-dir.
+    """
+    def __init__(self, path):
+        self.path = path
+
+    def get_dsn(self):
+        """The --wallet option, or None for the default"""
+        return None
+
+    def query(self, query, use_copy=True):
+        if use_copy:
+            copy = self.path[:-len('.sqlite3')] + '-copy.sqlite3'
+            shutil.copyfile(self.path, copy)
+            db = sqlite3.connect(copy)
+        else:
+            db = sqlite3.connect(self.path)
+
+        db.row_factory = sqlite3.Row
+        c = db.cursor()
+        c.execute(query)
+        rows = c.fetchall()
+
+        result = []
+        for row in rows:
+            result.append(dict(zip(row.keys(), row)))
+
+        db.commit()
+        c.close()
+        db.close()
+        return result
+
+    def execute(self, query):
+        db = sqlite3.connect(self.path)
+        c = db.cursor()
+        c.execute(query)
+        db.commit()
+        c.close()
+        db.close()
+
+
+class PostgresDb(object):
+    """A database of its own on the PostgresDbProvider's server.
+    """
+    def __init__(self, dbname, port):
+        self.dbname = dbname
+        self.port = port
+
+    def get_dsn(self):
+        return 'postgres://postgres@localhost:{}/{}'.format(self.port, self.dbname)
+
+    def _connect(self):
+        import psycopg2
+        conn = psycopg2.connect(host='localhost', port=self.port,
+                                user='postgres', dbname=self.dbname)
+        conn.autocommit = True
+        return conn
+
+    def query(self, query, use_copy=True):
+        """The server handles concurrent readers, so we never need a copy"""
+        import psycopg2.extras
+        conn = self._connect()
+        cur = conn.cursor(cursor_factory=psycopg2.extras.RealDictCursor)
+        cur.execute(query)
+        rows = cur.fetchall() if cur.description else []
+        cur.close()
+        conn.close()
+
+        # BYTEA comes back as a memoryview; sqlite3 gives us bytes.
+        return [{k: bytes(v) if isinstance(v, memoryview) else v
+                 for k, v in row.items()} for row in rows]
+
+    def execute(self, query):
+        conn = self._connect()
+        cur = conn.cursor()
+        cur.execute(query)
+        cur.close()
+        conn.close()
+
+
+class SqliteDbProvider(object):
+    def __init__(self, directory):
+        self.directory = directory
+
+    def start(self):
+        pass
+
+    def get_db(self, node_directory, node_id):
+        return Sqlite3Db(os.path.join(node_directory, 'lightningd.sqlite3'))
+
+    def stop(self):
+        pass
+
+
+class PostgresDbProvider(object):
+    """Runs a throwaway postgres server, with a database for each node.
+
+    Needs initdb and pg_ctl (from `pg_config --bindir`, or in $PATH), and
+    the psycopg2 module.  lightningd must be configured with
+    --enable-postgres.
+    """
+    def __init__(self, directory):
+        self.directory = os.path.join(directory, 'pgsql')
+        self.port = None
+        self.next_db = 0
+        self.lock = threading.Lock()
+
+    def _bin(self, name):
+        try:
+            bindir = subprocess.check_output(['pg_config', '--bindir']).decode('ASCII').strip()
+            if os.path.exists(os.path.join(bindir, name)):
+                return os.path.join(bindir, name)
+        except (OSError, subprocess.CalledProcessError):
+            pass
+        path = shutil.which(name)
+        if path is None:
+            raise ValueError("Could not find {}: is postgres installed?".format(name))
+        return path
+
+    def start(self):
+        self.port = reserve()
+        logging.info("Starting postgres in {} on port {}".format(self.directory, self.port))
+        subprocess.check_call([self._bin('initdb'), '--pgdata', self.directory,
+                               '--username', 'postgres', '--auth', 'trust',
+                               '--nosync'],
+                              stdout=subprocess.DEVNULL)
+        # No fsync: we throw it all away afterwards.
+        subprocess.check_call([self._bin('pg_ctl'), '--pgdata', self.directory,
+                               '--log', os.path.join(self.directory, 'postgres.log'),
+                               '--wait', 'start', '-o',
+                               "-F -p {} -k {} -c listen_addresses=localhost"
+                               .format(self.port, self.directory)],
+                              stdout=subprocess.DEVNULL)
+        # It takes a moment before it accepts connections on TCP as well.
+        for _ in range(50):
+            try:
+                PostgresDb('postgres', self.port).query('SELECT 1;')
+                break
+            except Exception:
+                time.sleep(0.1)
+
+    def get_db(self, node_directory, node_id):
+        # Nodes are numbered afresh for every test, so number them here.
+        with self.lock:
+            self.next_db += 1
+            dbname = 'ltest{}_{}'.format(self.next_db, node_id)
+        PostgresDb('postgres', self.port).execute('CREATE DATABASE {};'.format(dbname))
+        return PostgresDb(dbname, self.port)
+
+    def stop(self):
+        subprocess.check_call([self._bin('pg_ctl'), '--pgdata', self.directory,
+                               '--mode', 'fast', '--wait', 'stop'],
+                              stdout=subprocess.DEVNULL)
+        shutil.rmtree(self.directory)
+
+
+providers = {
+    'sqlite3': SqliteDbProvider,
+    'postgres': PostgresDbProvider,
+}
@@ -1,4 +1,5 @@
 from concurrent import futures
+from db import providers
 from utils import NodeFactory, BitcoinD, ElementsD
 
 import logging
@@ -17,6 +18,7 @@ VALGRIND = os.getenv("VALGRIND", config['VALGRIND']) == "1"
 TEST_NETWORK = os.getenv("TEST_NETWORK", config['TEST_NETWORK'])
 DEVELOPER = os.getenv("DEVELOPER", config['DEVELOPER']) == "1"
 TEST_DEBUG = os.getenv("TEST_DEBUG", "0") == "1"
+TEST_DB_PROVIDER = os.getenv("TEST_DB_PROVIDER", "sqlite3")
 
 
 if TEST_DEBUG:
@@ -113,9 +115,22 @@ def bitcoind(directory):
     bitcoind.proc.wait()
 
 
+@pytest.fixture(scope="session")
+def db_provider(test_base_dir):
+    """Where the nodes keep their wallets: TEST_DB_PROVIDER=postgres runs a
+    postgres server for the session, with a database for each node.
+
+    """
+    provider = providers[TEST_DB_PROVIDER](test_base_dir)
+    provider.start()
+    yield provider
+    provider.stop()
+
+
 @pytest.fixture
-def node_factory(request, directory, test_name, bitcoind, executor):
-    nf = NodeFactory(test_name, bitcoind, executor, directory=directory)
+def node_factory(request, directory, test_name, bitcoind, executor, db_provider):
+    nf = NodeFactory(test_name, bitcoind, executor, directory=directory,
+                     db_provider=db_provider)
     yield nf
     err_count = 0
     ok = nf.killall([not n.may_fail for n in nf.nodes])
@@ -0,0 +1,24 @@
+#!/usr/bin/env python3
+"""Plugin using binary framing for htlc_accepted.
+
+Fails 1000msat HTLCs, resolves 3000msat ones with the all-zero preimage,
+and lets everything else through.
+"""
+
+from lightning import Plugin
+
+plugin = Plugin(binary=True)
+
+
+@plugin.hook("htlc_accepted")
+def on_htlc_accepted(onion, htlc, plugin):
+    plugin.log("Binary htlc_accepted: {} expiring in {} blocks".format(
+        htlc['amount'], htlc['cltv_expiry_relative']))
+    if htlc['amount'] == '1000msat':
+        return {"result": "fail", "failure_code": 16399}
+    if htlc['amount'] == '3000msat':
+        return {"result": "resolve", "payment_key": "00" * 32}
+    return {"result": "continue"}
+
+
+plugin.run()
@@ -0,0 +1,16 @@
+#!/usr/bin/env python3
+"""Plugin which lets every HTLC through: for benchmarking hook overhead,
+using binary framing.
+"""
+
+from lightning import Plugin
+
+plugin = Plugin(binary=True)
+
+
+@plugin.hook("htlc_accepted")
+def on_htlc_accepted(onion, htlc, plugin):
+    return {"result": "continue"}
+
+
+plugin.run()
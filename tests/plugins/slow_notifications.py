@@ -0,0 +1,19 @@
+#!/usr/bin/env python3
+"""Plugin which stops reading notifications for a while.
+"""
+from lightning import Plugin
+import time
+
+plugin = Plugin()
+
+
+@plugin.subscribe("warning")
+def notify_warning(plugin, warning):
+    if not plugin.slept:
+        plugin.slept = True
+        plugin.log("Sleeping on a warning")
+        time.sleep(10)
+
+
+plugin.slept = False
+plugin.run()
@@ -1,6 +1,6 @@
 from fixtures import *  # noqa: F401,F403
 from flaky import flaky
-from lightning import RpcError
+from lightning import RpcError, Millisatoshi
 from utils import only_one, sync_blockheight, wait_for, DEVELOPER, TIMEOUT, VALGRIND, SLOW_MACHINE
 
 
@@ -92,6 +92,60 @@ def test_closing(node_factory, bitcoind):
     wait_for(lambda: len(l1.rpc.listchannels()['channels']) == 0)
     wait_for(lambda: len(l2.rpc.listchannels()['channels']) == 0)
 
+    # But they keep it in the archive.
+    wait_for(lambda: l1.rpc.listpeers()['peers'] == [])
+    wait_for(lambda: l2.rpc.listpeers()['peers'] == [])
+    closed = only_one(l1.rpc.listclosedchannels()['closedchannels'])
+    assert closed['peer_id'] == l2.info['id']
+    assert closed['short_channel_id'] == chan
+    assert closed['funder'] == 'local'
+    assert closed['total_msat'] == Millisatoshi(10**9)
+    assert closed['to_us_msat'] == Millisatoshi(10**9 - 200000000)
+    assert closed['archived_height'] <= bitcoind.rpc.getblockcount()
+    closed = only_one(l2.rpc.listclosedchannels(l1.info['id'])['closedchannels'])
+    assert closed['funder'] == 'remote'
+    assert closed['to_us_msat'] == Millisatoshi(200000000)
+    assert l2.rpc.listclosedchannels(l2.info['id'])['closedchannels'] == []
+
+
+@unittest.skipIf(not DEVELOPER, "Too slow without --dev-bitcoind-poll")
+def test_closing_archives_forwards(node_factory, bitcoind):
+    """Forgetting the incoming channel must not lose what we forwarded"""
+    l1, l2, l3 = node_factory.line_graph(3, wait_for_announce=True)
+    scid12 = l1.get_channel_scid(l2)
+
+    inv = l3.rpc.invoice(100000, 'test_closing_archives_forwards', 'desc')
+    l1.rpc.pay(inv['bolt11'])
+    payment_hash = inv['payment_hash']
+    wait_for(lambda: [f['status'] for f in l2.rpc.listforwards()['forwards']] == ['settled'])
+
+    l2.rpc.close(scid12)
+    l2.daemon.wait_for_log('sendrawtx exit 0')
+    bitcoind.generate_block(1, wait_for_mempool=1)
+
+    # Mine past --archive-depth, so l2 archives the channel with l1.
+    bitcoind.generate_block(100)
+    l2.daemon.wait_for_log('onchaind complete, forgetting peer')
+    wait_for(lambda: only_one(l2.rpc.listclosedchannels()['closedchannels'])['short_channel_id'] == scid12)
+
+    # The incoming HTLC is gone, so the forward keeps its own copy.
+    row = only_one(l2.db_query('SELECT in_htlc_id, payment_hash FROM forwarded_payments;'))
+    assert row['in_htlc_id'] is None
+    assert row['payment_hash'].hex() == payment_hash
+
+    fwd = only_one(l2.rpc.listforwards()['forwards'])
+    assert fwd['payment_hash'] == payment_hash
+    assert fwd['in_channel'] == scid12
+    assert fwd['out_channel'] == l2.get_channel_scid(l3)
+    assert fwd['status'] == 'settled'
+
+    # And the incoming HTLC itself went into the archive.
+    archived = only_one(l2.db_query('SELECT direction, payment_hash FROM channel_htlcs_archive;'))
+    assert archived['direction'] == 0
+    assert archived['payment_hash'].hex() == payment_hash
+    assert l2.db_query('SELECT id FROM channel_htlcs WHERE channel_id NOT IN'
+                       ' (SELECT id FROM channels);') == []
+
 
 def test_closing_while_disconnected(node_factory, bitcoind):
     l1, l2 = node_factory.line_graph(2, opts={'may_reconnect': True})
@@ -1,9 +1,10 @@
 from fixtures import *  # noqa: F401,F403
-from fixtures import TEST_NETWORK
+from fixtures import TEST_NETWORK, TEST_DB_PROVIDER
 import unittest
 
 
 @unittest.skipIf(TEST_NETWORK != 'regtest', "The DB migration is network specific due to the chain var.")
+@unittest.skipIf(TEST_DB_PROVIDER != 'sqlite3', "This test is based on a sqlite3 snapshot")
 def test_db_dangling_peer_fix(node_factory):
     # This was taken from test_fail_unconfirmed() node.
     l1 = node_factory.get_node(dbfile='dangling-peer.sqlite3.xz')
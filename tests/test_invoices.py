@@ -34,7 +34,7 @@ def test_invoice(node_factory, chainparams):
     assert 'warning_capacity' in inv
 
     # Check pay_index is null
-    outputs = l1.db_query('SELECT pay_index IS NULL AS q FROM invoices WHERE label="label";')
+    outputs = l1.db_query("SELECT pay_index IS NULL AS q FROM invoices WHERE label='label';")
     assert len(outputs) == 1 and outputs[0]['q'] != 0
 
     # Check any-amount invoice
@@ -330,6 +330,71 @@ def test_invoice_expiry(node_factory, executor):
 
 
 @unittest.skipIf(not DEVELOPER, "Too slow without --dev-bitcoind-poll")
+def test_invoice_expiry_restart(node_factory, executor):
+    """Expiries survive a restart, and deleted invoices don't fire."""
+    l1 = node_factory.get_node()
+
+    l1.rpc.invoice('any', 'inv1', 'description', 4)
+    l1.rpc.invoice('any', 'inv2', 'description', 6)
+    l1.rpc.invoice('any', 'inv3', 'description', 3600)
+    l1.rpc.delinvoice('inv1', 'unpaid')
+    # Same label, new invoice: the old expiry must not touch it.
+    l1.rpc.invoice('any', 'inv1', 'description', 3600)
+
+    l1.restart()
+    w2 = executor.submit(l1.rpc.waitinvoice, 'inv2')
+    with pytest.raises(RpcError):
+        w2.result(timeout=20)
+
+    time.sleep(1)
+    assert only_one(l1.rpc.listinvoices('inv1')['invoices'])['status'] == 'unpaid'
+    assert only_one(l1.rpc.listinvoices('inv2')['invoices'])['status'] == 'expired'
+    assert only_one(l1.rpc.listinvoices('inv3')['invoices'])['status'] == 'unpaid'
+
+
+def test_listinvoices_filter(node_factory):
+    l1, l2 = node_factory.line_graph(2, fundchannel=True)
+
+    for i in range(5):
+        l2.rpc.invoice(1000 + i, 'inv{}'.format(i), 'description', 3600 + i)
+    l1.rpc.pay(only_one(l2.rpc.listinvoices('inv3')['invoices'])['bolt11'])
+    l1.rpc.pay(only_one(l2.rpc.listinvoices('inv1')['invoices'])['bolt11'])
+
+    invs = l2.rpc.listinvoices()['invoices']
+    assert [i['label'] for i in invs] == ['inv0', 'inv1', 'inv2', 'inv3', 'inv4']
+    created = [i['created_index'] for i in invs]
+    assert created == sorted(created)
+
+    # Page through in creation order.
+    page = l2.rpc.listinvoices(limit=2)['invoices']
+    assert [i['label'] for i in page] == ['inv0', 'inv1']
+    page = l2.rpc.listinvoices(start=page[-1]['created_index'] + 1, limit=2)['invoices']
+    assert [i['label'] for i in page] == ['inv2', 'inv3']
+    page = l2.rpc.listinvoices(start=page[-1]['created_index'] + 1, limit=2)['invoices']
+    assert [i['label'] for i in page] == ['inv4']
+
+    # Paid order.
+    paid = l2.rpc.listinvoices(index='paid')['invoices']
+    assert [i['label'] for i in paid] == ['inv3', 'inv1']
+    page = l2.rpc.listinvoices(index='paid', start=paid[0]['pay_index'] + 1)['invoices']
+    assert [i['label'] for i in page] == ['inv1']
+    since = l2.rpc.listinvoices(index='paid', paid_since=paid[0]['paid_at'])['invoices']
+    assert [i['label'] for i in since] == ['inv3', 'inv1']
+    assert l2.rpc.listinvoices(paid_since=paid[1]['paid_at'] + 1)['invoices'] == []
+
+    unpaid = l2.rpc.listinvoices(status='unpaid')['invoices']
+    assert [i['label'] for i in unpaid] == ['inv0', 'inv2', 'inv4']
+    unpaid = l2.rpc.listinvoices(status='unpaid', limit=1, start=created[1])['invoices']
+    assert [i['label'] for i in unpaid] == ['inv2']
+    expiring = l2.rpc.listinvoices(status='unpaid', expires_before=invs[4]['expires_at'])['invoices']
+    assert [i['label'] for i in expiring] == ['inv0', 'inv2']
+
+    with pytest.raises(RpcError, match=r"'status' should be 'unpaid', 'paid' or 'expired'"):
+        l2.rpc.listinvoices(status='bogus')
+    with pytest.raises(RpcError, match=r"'index' should be 'created' or 'paid'"):
+        l2.rpc.listinvoices(index='bogus')
+
+
 def test_waitinvoice(node_factory, executor):
     """Test waiting for one invoice will not return if another invoice is paid.
     """
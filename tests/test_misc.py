@@ -2,7 +2,7 @@ from decimal import Decimal
 from fixtures import *  # noqa: F401,F403
 from flaky import flaky  # noqa: F401
 from lightning import RpcError
-from utils import DEVELOPER, VALGRIND, sync_blockheight, only_one, wait_for, TailableProc
+from utils import DEVELOPER, VALGRIND, sync_blockheight, only_one, wait_for, TailableProc, TEST_DB_PROVIDER
 from ephemeral_port_reserve import reserve
 
 import json
@@ -60,6 +60,7 @@ def test_names(node_factory):
                                   .format(key, alias, color))
 
 
+@unittest.skipIf(TEST_DB_PROVIDER != 'sqlite3', "Uses the sqlite3 file directly")
 def test_db_upgrade(node_factory):
     l1 = node_factory.get_node()
     l1.stop()
@@ -113,6 +114,135 @@ def test_bitcoin_failure(node_factory, bitcoind):
     sync_blockheight(bitcoind, [l1])
 
 
+def test_bitcoind_jsonrpc(node_factory, bitcoind):
+    """We have rpcuser and rpcpassword, so we don't need bitcoin-cli"""
+    l1 = node_factory.get_node()
+    l1.daemon.wait_for_log('Using JSON-RPC to bitcoind at 127.0.0.1:')
+
+    # Several blocks at once get fetched together.
+    bitcoind.generate_block(20)
+    sync_blockheight(bitcoind, [l1])
+    assert not l1.daemon.is_in_log('JSON-RPC to bitcoind failed')
+
+
+def test_bitcoind_jsonrpc_batch(node_factory, bitcoind):
+    """Calls queued while every connection is busy go in one request, and
+    connections are kept open for the next ones"""
+    l1 = node_factory.get_node()
+    proxy = l1.daemon.rpcproxy
+
+    # Catching up fetches several blocks at once.
+    l1.stop()
+    bitcoind.generate_block(50)
+    proxy.requests = []
+    l1.start()
+    sync_blockheight(bitcoind, [l1])
+
+    # (bitcoin-cli still checks bitcoind is up at startup)
+    reqs = [r for r in proxy.requests if r['keepalive']]
+    assert max(r['batch'] for r in reqs) > 1
+    assert len(set(r['conn'] for r in reqs)) < len(reqs)
+    assert not l1.daemon.is_in_log('JSON-RPC to bitcoind failed')
+
+
+def test_bitcoind_jsonrpc_idle_close(node_factory, bitcoind):
+    """If bitcoind closes a connection while it's idle, we quietly send the
+    request on another one"""
+    l1 = node_factory.get_node(start=False)
+    proxy = l1.daemon.rpcproxy
+    # Like bitcoind's -rpcservertimeout, only much shorter.
+    proxy.server.timeout = 1
+    l1.start()
+
+    time.sleep(5)
+    bitcoind.generate_block(5)
+    sync_blockheight(bitcoind, [l1])
+
+    # We only keep 4 open at once.
+    reqs = [r for r in proxy.requests if r['keepalive']]
+    assert len(set(r['conn'] for r in reqs)) > 4
+    assert not l1.daemon.is_in_log('Talking to bitcoind')
+    assert not l1.daemon.is_in_log('JSON-RPC to bitcoind failed')
+
+
+def test_bitcoind_jsonrpc_error(node_factory, bitcoind):
+    """An error from bitcoind looks like bitcoin-cli exiting with that
+    status"""
+    l1 = node_factory.get_node()
+    sync_blockheight(bitcoind, [l1])
+
+    def loading(r):
+        return {'result': None,
+                'error': {'code': -28, 'message': 'Loading block index...'},
+                'id': r['id']}
+
+    l1.daemon.rpcproxy.mock_rpc('getblockhash', loading)
+    l1.daemon.wait_for_log(r'getblockhash .* exited with status 28')
+    l1.daemon.rpcproxy.mock_rpc('getblockhash', None)
+
+    bitcoind.generate_block(1)
+    sync_blockheight(bitcoind, [l1])
+    # bitcoind answered: that's not a failure to talk to it.
+    assert not l1.daemon.is_in_log('JSON-RPC to bitcoind failed')
+
+
+def test_bitcoind_jsonrpc_backoff(node_factory, bitcoind):
+    """While JSON-RPC fails we use bitcoin-cli, for longer each time"""
+    l1 = node_factory.get_node()
+    proxy = l1.daemon.rpcproxy
+    sync_blockheight(bitcoind, [l1])
+
+    num = len(proxy.requests)
+    proxy.fail_requests(500)
+    l1.daemon.wait_for_logs([r'JSON-RPC to bitcoind failed: using bitcoin-cli for 1 seconds',
+                             r'JSON-RPC to bitcoind failed: using bitcoin-cli for 2 seconds'])
+    # Meanwhile, bitcoin-cli does the work.
+    bitcoind.generate_block(1)
+    sync_blockheight(bitcoind, [l1])
+    assert any(not r['keepalive'] for r in proxy.requests[num:])
+
+    # Once it works again, we go back to JSON-RPC.
+    proxy.fail_requests(None)
+    num = len(proxy.requests)
+    wait_for(lambda: any(r['keepalive'] for r in proxy.requests[num:]))
+    bitcoind.generate_block(1)
+    sync_blockheight(bitcoind, [l1])
+    assert not l1.daemon.is_in_log('from now on')
+
+
+def test_bitcoind_jsonrpc_unauthorized(node_factory, bitcoind):
+    """If bitcoind rejects our password, we use bitcoin-cli from then on"""
+    l1 = node_factory.get_node()
+    proxy = l1.daemon.rpcproxy
+    sync_blockheight(bitcoind, [l1])
+
+    proxy.fail_requests(401)
+    l1.daemon.wait_for_log(r'JSON-RPC to bitcoind failed: using bitcoin-cli from now on')
+    proxy.fail_requests(None)
+
+    num = len(proxy.requests)
+    bitcoind.generate_block(5)
+    sync_blockheight(bitcoind, [l1])
+    assert len(proxy.requests) > num
+    assert not any(r['keepalive'] for r in proxy.requests[num:])
+
+
+def test_catchup_prefetch(node_factory, bitcoind):
+    """Blocks get fetched ahead while catching up, but added in order"""
+    l1 = node_factory.get_node()
+    height = bitcoind.rpc.getblockcount()
+
+    l1.stop()
+    bitcoind.generate_block(50)
+    l1.start()
+    sync_blockheight(bitcoind, [l1])
+
+    added = [int(re.search(r'Adding block (\d+):', l).group(1))
+             for l in l1.daemon.logs if 'Adding block' in l]
+    added = added[added.index(height + 1):]
+    assert added == list(range(height + 1, height + 51))
+
+
 def test_ping(node_factory):
     l1, l2 = node_factory.line_graph(2, fundchannel=False)
 
@@ -1223,6 +1353,34 @@ def test_logging(node_factory):
     wait_for(check_new_log)
 
 
+def test_logging_async(node_factory):
+    # Since we redirect, node.start() will fail: do manually.
+    l1 = node_factory.get_node(options={'log-file': 'logfile',
+                                        'log-async': 'block'},
+                               may_fail=True, start=False)
+    logpath = os.path.join(l1.daemon.lightning_dir, 'logfile')
+    logpath_moved = os.path.join(l1.daemon.lightning_dir, 'logfile_moved')
+
+    l1.daemon.rpcproxy.start()
+    l1.daemon.opts['bitcoin-rpcport'] = l1.daemon.rpcproxy.rpcport
+    TailableProc.start(l1.daemon)
+    wait_for(lambda: os.path.exists(logpath))
+    wait_for(lambda: 'Server started with public key' in open(logpath).read())
+
+    # Everything queued for the old file is written before we switch.
+    shutil.move(logpath, logpath_moved)
+    l1.daemon.proc.send_signal(signal.SIGHUP)
+    wait_for(lambda: os.path.exists(logpath))
+
+    log1 = open(logpath_moved).readlines()
+    assert log1[-1].endswith("Ending log due to SIGHUP\n")
+
+    def check_new_log():
+        log2 = open(logpath).readlines()
+        return len(log2) > 0 and log2[0].endswith("Started log due to SIGHUP\n")
+    wait_for(check_new_log)
+
+
 @unittest.skipIf(VALGRIND,
                  "Valgrind sometimes fails assert on injected SEGV")
 def test_crashlog(node_factory):
@@ -42,7 +42,7 @@ def test_pay(node_factory):
         l1.rpc.pay(inv, 122000)
 
     # Check pay_index is not null
-    outputs = l2.db_query('SELECT pay_index IS NOT NULL AS q FROM invoices WHERE label="label";')
+    outputs = l2.db_query("SELECT pay_index IS NOT NULL AS q FROM invoices WHERE label='label';")
     assert len(outputs) == 1 and outputs[0]['q'] != 0
 
     # Check payment of any-amount invoice.
@@ -61,6 +61,22 @@ def test_pay(node_factory):
     payments = l1.rpc.listsendpays(inv)['payments']
     assert len(payments) == 1 and payments[0]['payment_preimage'] == preimage
 
+    # Filtering and paging.
+    payments = l1.rpc.listsendpays()['payments']
+    assert l1.rpc.listsendpays(status='complete')['payments'] == payments
+    assert l1.rpc.listsendpays(status='failed')['payments'] == []
+    page = l1.rpc.listsendpays(limit=4)['payments']
+    assert page == payments[:4]
+    page = l1.rpc.listsendpays(start=page[-1]['id'] + 1, limit=4)['payments']
+    assert page == payments[4:]
+    assert l1.rpc.listsendpays(created_since=after + 1000)['payments'] == []
+    assert l1.rpc.listsendpays(created_before=before)['payments'] == []
+    with pytest.raises(RpcError, match=r'should be'):
+        l1.rpc.listsendpays(status='paid')
+
+    pays = l1.rpc.listpays(status='complete', limit=2)['pays']
+    assert [p['id'] for p in pays] == [p['id'] for p in payments[:2]]
+
 
 def test_pay_amounts(node_factory):
     l1, l2 = node_factory.line_graph(2)
@@ -1118,6 +1134,32 @@ def test_forward_stats(node_factory, bitcoind):
     assert stats['forwards'][1]['received_time'] <= stats['forwards'][1]['resolved_time']
     assert 'received_time' in stats['forwards'][2] and 'resolved_time' not in stats['forwards'][2]
 
+    # Filtering and paging.
+    fwds = stats['forwards']
+    assert [f['status'] for f in l2.rpc.listforwards(status='failed')['forwards']] == ['failed']
+    assert len(l2.rpc.listforwards(in_channel=inchan['short_channel_id'])['forwards']) == 3
+    assert len(l2.rpc.listforwards(out_channel=inchan['short_channel_id'])['forwards']) == 0
+    page = l2.rpc.listforwards(limit=2)['forwards']
+    assert page == fwds[:2]
+    page = l2.rpc.listforwards(start=page[-1]['updated_index'] + 1, limit=2)['forwards']
+    assert page == fwds[2:]
+    since = int(fwds[1]['received_time'])
+    assert l2.rpc.listforwards(received_since=since + 1000)['forwards'] == []
+    assert l2.rpc.listforwards(received_before=since - 1000)['forwards'] == []
+    assert l2.rpc.listforwards(received_since=since - 1000)['forwards'] == fwds
+
+    # The rollups agree.
+    total = only_one(l2.rpc.listforwardstats(period='total')['stats'])
+    assert (total['offered'], total['settled'], total['failed'], total['local_failed']) == (1, 1, 1, 0)
+    assert total['fee'] == l2.rpc.getinfo()['msatoshi_fees_collected']
+    assert total['in_msatoshi'] == fwds[0]['in_msatoshi']
+    hourly = l2.rpc.listforwardstats(period='hour', per_channel=True)['stats']
+    assert sum(h['settled'] + h['failed'] + h['offered'] for h in hourly) == 3
+    assert all(h['in_channel'] == inchan['short_channel_id'] for h in hourly)
+    assert l2.rpc.listforwardstats(since=since + 7200)['stats'] == []
+    # since is rounded down to the hour, so its own hour counts.
+    assert l2.rpc.listforwardstats(since=since)['stats'] != []
+
 
 @unittest.skipIf(not DEVELOPER, "needs DEVELOPER=1")
 def test_forward_local_failed_stats(node_factory, bitcoind, executor):
@@ -1468,6 +1510,12 @@ def test_pay_retry(node_factory, bitcoind):
                 if only_one(pays)['status'] == 'complete':
                     return
                 assert only_one(pays)['status'] != 'failed'
+                # Filtering for pending finds it even between attempts
+                # (unless it just completed), and limit still applies.
+                pending = l1.rpc.listpays(status='pending', limit=1)['pays']
+                assert len(pending) <= 1
+                if b11 not in [p['bolt11'] for p in pending]:
+                    assert only_one(l1.rpc.listpays(b11)['pays'])['status'] == 'complete'
 
     inv = l5.rpc.invoice(10**8, 'test_retry', 'test_retry')
 
@@ -2,13 +2,15 @@ from collections import OrderedDict
 from fixtures import *  # noqa: F401,F403
 from flaky import flaky  # noqa: F401
 from lightning import RpcError, Millisatoshi
-from utils import only_one, wait_for, TIMEOUT
+from utils import only_one, wait_for, TIMEOUT, TEST_DB_PROVIDER
 
 import os
 import pytest
+import re
 import sqlite3
 import subprocess
 import time
+import unittest
 
 
 def test_option_passthrough(node_factory):
@@ -223,6 +225,7 @@ def test_async_rpcmethod(node_factory, executor):
     assert [r.result() for r in results] == [42] * len(results)
 
 
+@unittest.skipIf(TEST_DB_PROVIDER != 'sqlite3', "Uses the sqlite3 file directly")
 def test_db_hook(node_factory, executor):
     """This tests the db hook."""
     dbfile = os.path.join(node_factory.directory, "dblog.sqlite3")
@@ -248,6 +251,28 @@ def test_db_hook(node_factory, executor):
     assert [x for x in db1.iterdump()] == [x for x in db2.iterdump()]
 
 
+@unittest.skipIf(TEST_DB_PROVIDER != 'sqlite3', "Uses the sqlite3 file directly")
+def test_db_hook_pipelined(node_factory):
+    """db_write plugins can lag behind, but must catch up"""
+    dbfile = os.path.join(node_factory.directory, "dblog.sqlite3")
+    l1, l2 = node_factory.line_graph(2, opts=[{'plugin': 'tests/plugins/dblog.py',
+                                               'dblog-file': dbfile,
+                                               'db-write-pipeline': 4},
+                                              {}])
+
+    # Commitments can't complete unless we release the replies to channeld.
+    for i in range(10):
+        l1.pay(l2, 1000)
+
+    l1.stop()
+
+    # Databases should be identical.
+    db1 = sqlite3.connect(os.path.join(l1.daemon.lightning_dir, 'lightningd.sqlite3'))
+    db2 = sqlite3.connect(dbfile)
+
+    assert [x for x in db1.iterdump()] == [x for x in db2.iterdump()]
+
+
 def test_utf8_passthrough(node_factory, executor):
     l1 = node_factory.get_node(options={'plugin': 'tests/plugins/utf8.py',
                                         'log-level': 'io'})
@@ -432,6 +457,97 @@ def test_htlc_accepted_hook_forward_restart(node_factory, executor):
     f1.result()
 
 
+def test_htlc_accepted_hook_multiple(node_factory):
+    """l2 has two plugins on htlc_accepted: both get asked at once, but the
+    first one registered still decides, even though it answers last.
+    """
+    l1, l2 = node_factory.line_graph(2, opts=[
+        {},
+        {'plugin': ['tests/plugins/hold_htlcs.py',
+                    'tests/plugins/fail_htlcs.py']}
+    ])
+
+    inv = l2.rpc.invoice(1000, "lbl", "desc")['bolt11']
+    with pytest.raises(RpcError) as excinfo:
+        l1.rpc.pay(inv)
+    assert excinfo.value.error['data']['failcode'] == 16399
+    l2.daemon.wait_for_logs([r'Failing htlc on purpose',
+                             r'htlc_accepted hook called'])
+
+    def log_index(regex):
+        return next(i for i, line in enumerate(l2.daemon.logs)
+                    if re.search(regex, line))
+
+    # Both plugins were asked before hold_htlcs replied: fail_htlcs didn't
+    # wait the 10 seconds for it.
+    replied = log_index(r'htlc_accepted hook called')
+    assert log_index(r'Holding onto an incoming htlc') < replied
+    assert log_index(r'Failing htlc on purpose') < replied
+
+    hooks = {h['name']: h for h in l2.rpc.listhooks()['hooks']}
+    assert hooks['htlc_accepted']['type'] == 'parallel'
+    assert hooks['invoice_payment']['type'] == 'chain'
+    plugins = hooks['htlc_accepted']['plugins']
+    assert [p['plugin'].split('/')[-1] for p in plugins] == ['hold_htlcs.py',
+                                                             'fail_htlcs.py']
+    assert plugins[0]['calls'] == 1
+    assert plugins[0]['max_msec'] >= 10000
+
+
+def test_htlc_accepted_hook_binary(node_factory):
+    """l2's plugin uses binary framing: fail, resolve and continue must all
+    work just as they do in JSON.
+    """
+    l1, l2 = node_factory.line_graph(2, opts=[
+        {},
+        {'plugin': 'tests/plugins/binary_htlcs.py'}
+    ])
+
+    inv = l2.rpc.invoice(1000, "fail", "desc")['bolt11']
+    with pytest.raises(RpcError) as excinfo:
+        l1.rpc.pay(inv)
+    assert excinfo.value.error['data']['failcode'] == 16399
+    l2.daemon.wait_for_log(r'Binary htlc_accepted: 1000msat expiring in')
+
+    inv = l2.rpc.invoice(2000, "continue", "desc")['bolt11']
+    l1.rpc.pay(inv)
+    assert l2.rpc.listinvoices("continue")['invoices'][0]['status'] == 'paid'
+
+    # The plugin resolves it with the invoice's own preimage, so l2's
+    # invoice handling never runs and the invoice stays unpaid.
+    inv = l2.rpc.invoice(3000, "resolve", "desc", preimage="00" * 32)['bolt11']
+    l1.rpc.pay(inv)
+    assert l2.rpc.listinvoices("resolve")['invoices'][0]['status'] == 'unpaid'
+
+    hook = [h for h in l2.rpc.listhooks()['hooks']
+            if h['name'] == 'htlc_accepted'][0]
+    assert hook['plugins'][0]['calls'] == 3
+
+
+def test_plugin_hook_timeout(node_factory):
+    """A hook which takes too long is treated as if it said continue"""
+    l1, l2 = node_factory.line_graph(2, opts=[
+        {},
+        {'plugin': 'tests/plugins/hold_htlcs.py',
+         'plugin-hook-timeout': 'htlc_accepted:2'}
+    ])
+
+    inv = l2.rpc.invoice(1000, "lbl", "desc")['bolt11']
+    start = time.time()
+    l1.rpc.pay(inv)
+    assert time.time() - start < 10
+    l2.daemon.wait_for_log(r"htlc_accepted hook didn't respond in 2 seconds")
+
+    hook = [h for h in l2.rpc.listhooks()['hooks']
+            if h['name'] == 'htlc_accepted'][0]
+    assert hook['timeout'] == 2
+    assert hook['plugins'][0]['timeouts'] == 1
+
+    # The late reply is ignored.
+    l2.daemon.wait_for_log(r'htlc_accepted hook called')
+    assert l2.rpc.listinvoices("lbl")['invoices'][0]['status'] == 'paid'
+
+
 def test_warning_notification(node_factory):
     """ test 'warning' notifications
     """
@@ -461,3 +577,26 @@ def test_warning_notification(node_factory):
     l1.daemon.wait_for_log('plugin-pretend_badlog.py time: *')
     l1.daemon.wait_for_log('plugin-pretend_badlog.py source: plugin-pretend_badlog.py')
     l1.daemon.wait_for_log('plugin-pretend_badlog.py log: Test warning notification\\(for broken event\\)')
+
+
+def test_notification_backpressure(node_factory):
+    """A plugin which stops reading notifications doesn't hold up others,
+    and we don't queue them forever.
+    """
+    l1 = node_factory.get_node(options={
+        'plugin': ['tests/plugins/pretend_badlog.py',
+                   'tests/plugins/slow_notifications.py']
+    })
+
+    # Every one of these is a warning notification for both plugins.
+    for i in range(2000):
+        l1.rpc.call('pretendbad', {'event': 'warning {}'.format(i),
+                                   'level': 'warn'})
+
+    l1.daemon.wait_for_log(r'plugin-slow_notifications.py Plugin is not '
+                           r'reading notifications: dropping them')
+    # The other one still got all of them.
+    l1.daemon.wait_for_log(r'plugin-pretend_badlog.py log: warning 1999')
+    # Once it wakes up, it catches up.
+    l1.daemon.wait_for_log(r'plugin-slow_notifications.py Plugin caught up: '
+                           r'[0-9]* notifications were dropped')
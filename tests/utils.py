@@ -12,7 +12,6 @@ import os
 import random
 import re
 import shutil
-import sqlite3
 import string
 import subprocess
 import threading
@@ -42,6 +41,7 @@ EXPERIMENTAL_FEATURES = os.getenv("EXPERIMENTAL_FEATURES", config['EXPERIMENTAL_
 TIMEOUT = int(os.getenv("TIMEOUT", "60"))
 VALGRIND = os.getenv("VALGRIND", config['VALGRIND']) == "1"
 SLOW_MACHINE = os.getenv("SLOW_MACHINE", "0") == "1"
+TEST_DB_PROVIDER = os.getenv("TEST_DB_PROVIDER", "sqlite3")
 
 
 def wait_for(success, timeout=TIMEOUT):
@@ -503,13 +503,14 @@ class LightningD(TailableProc):
 
 
 class LightningNode(object):
-    def __init__(self, daemon, rpc, btc, executor, may_fail=False, may_reconnect=False):
+    def __init__(self, daemon, rpc, btc, executor, may_fail=False, may_reconnect=False, db=None):
         self.rpc = rpc
         self.daemon = daemon
         self.bitcoin = btc
         self.executor = executor
         self.may_fail = may_fail
         self.may_reconnect = may_reconnect
+        self.db = db
 
     def connect(self, remote_node):
             self.rpc.connect(remote_node.info['id'], '127.0.0.1', remote_node.daemon.port)
@@ -550,37 +551,11 @@ class LightningNode(object):
         return [c for c in self.rpc.listchannels()['channels'] if c['active']]
 
     def db_query(self, query, use_copy=True):
-        orig = os.path.join(self.daemon.lightning_dir, "lightningd.sqlite3")
-        if use_copy:
-            copy = os.path.join(self.daemon.lightning_dir, "lightningd-copy.sqlite3")
-            shutil.copyfile(orig, copy)
-            db = sqlite3.connect(copy)
-        else:
-            db = sqlite3.connect(orig)
-
-        db.row_factory = sqlite3.Row
-        c = db.cursor()
-        c.execute(query)
-        rows = c.fetchall()
-
-        result = []
-        for row in rows:
-            result.append(dict(zip(row.keys(), row)))
-
-        db.commit()
-        c.close()
-        db.close()
-        return result
+        return self.db.query(query, use_copy)
 
     # Assumes node is stopped!
     def db_manip(self, query):
-        db = sqlite3.connect(os.path.join(self.daemon.lightning_dir, "lightningd.sqlite3"))
-        db.row_factory = sqlite3.Row
-        c = db.cursor()
-        c.execute(query)
-        db.commit()
-        c.close()
-        db.close()
+        self.db.execute(query)
 
     def start(self):
         self.daemon.start()
@@ -803,7 +778,7 @@ class LightningNode(object):
 class NodeFactory(object):
     """A factory to setup and start `lightningd` daemons.
     """
-    def __init__(self, testname, bitcoind, executor, directory):
+    def __init__(self, testname, bitcoind, executor, directory, db_provider):
         self.testname = testname
         self.next_id = 1
         self.nodes = []
@@ -811,6 +786,7 @@ class NodeFactory(object):
         self.bitcoind = bitcoind
         self.directory = directory
         self.lock = threading.Lock()
+        self.db_provider = db_provider
 
     def split_options(self, opts):
         """Split node options from cli options
@@ -905,13 +881,17 @@ class NodeFactory(object):
             if not may_reconnect:
                 daemon.opts["dev-no-reconnect"] = None
 
+        db = self.db_provider.get_db(lightning_dir, node_id)
+        if db.get_dsn() is not None:
+            daemon.opts['wallet'] = db.get_dsn()
+
         if options is not None:
             daemon.opts.update(options)
 
         rpc = LightningRpc(socket_path, self.executor)
 
         node = LightningNode(daemon, rpc, self.bitcoind, self.executor, may_fail=may_fail,
-                             may_reconnect=may_reconnect)
+                             may_reconnect=may_reconnect, db=db)
 
         # Regtest estimatefee are unusable, so override.
         node.set_feerates(feerates, False)
@@ -928,6 +908,7 @@ class NodeFactory(object):
             ]
 
         if dbfile:
+            assert TEST_DB_PROVIDER == 'sqlite3', "dbfile is a sqlite3 snapshot"
             out = open(os.path.join(node.daemon.lightning_dir, 'lightningd.sqlite3'), 'xb')
             with lzma.open(os.path.join('tests/data', dbfile), 'rb') as f:
                 out.write(f.read())
@@ -1,23 +1,26 @@
 #include "db.h"
+#include "db_common.h"
 
 #include <ccan/array_size/array_size.h>
+#include <ccan/io/io.h>
 #include <ccan/json_escape/json_escape.h>
 #include <ccan/tal/str/str.h>
 #include <common/node_id.h>
 #include <common/version.h>
+#include <errno.h>
 #include <inttypes.h>
 #include <lightningd/lightningd.h>
 #include <lightningd/log.h>
 #include <lightningd/plugin_hook.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <unistd.h>
 
 #define DB_FILE "lightningd.sqlite3"
 #define NSEC_IN_SEC 1000000000
 
-/* For testing, we want to catch fatal messages. */
-#ifndef db_fatal
-#define db_fatal fatal
-#endif
-
 struct migration {
 	const char *sql;
 	void (*func)(struct lightningd *ld, struct db *db);
@@ -52,7 +55,16 @@ static struct migration dbmigrations[] = {
        idx INTEGER,							\
        hash BLOB,							\
        PRIMARY KEY (shachain_id, pos));", NULL },
-	{ "CREATE TABLE channels ("
+	/* channels refers to peers, so create that first (postgres insists).
+	 * A db at this version already has channels, so the next migration
+	 * catches it up. */
+	{ "CREATE TABLE peers ("
+	  "  id INTEGER,"
+	  "  node_id BLOB UNIQUE," /* pubkey */
+	  "  address TEXT,"
+	  "  PRIMARY KEY (id)"
+	  ");"
+	  "CREATE TABLE channels ("
 	  "  id INTEGER," /* chan->id */
 	  "  peer_id INTEGER REFERENCES peers(id) ON DELETE CASCADE,"
 	  "  short_channel_id BLOB,"
@@ -93,7 +105,7 @@ static struct migration dbmigrations[] = {
 	  "  closing_sig_received BLOB,"
 	  "  PRIMARY KEY (id)"
 	  ");", NULL },
-	{ "CREATE TABLE peers ("
+	{ "CREATE TABLE IF NOT EXISTS peers ("
 	  "  id INTEGER,"
 	  "  node_id BLOB UNIQUE," /* pubkey */
 	  "  address TEXT,"
@@ -158,7 +170,8 @@ static struct migration dbmigrations[] = {
 	  "  ON invoices(pay_index);", NULL },
 	{ "UPDATE invoices SET pay_index=id WHERE state=1;", NULL }, /* only paid invoice */
 	/* Create next_pay_index variable (highest pay_index). */
-	{ "INSERT OR REPLACE INTO vars(name, val)"
+	{ "DELETE FROM vars WHERE name='next_pay_index';"
+	  "INSERT INTO vars(name, val)"
 	  "  VALUES('next_pay_index', "
 	  "    COALESCE((SELECT MAX(pay_index) FROM invoices WHERE state=1), 0) + 1"
 	  "  );", NULL },
@@ -392,6 +405,105 @@ static struct migration dbmigrations[] = {
 	 * in the list view anyway, e.g., show all close and htlc transactions
 	 * as a single bundle. */
 	{ "ALTER TABLE transactions ADD channel_id INTEGER;", NULL},
+	/* listinvoices filters: status (paging by id), status with
+	 * expires_before (also used for expiry), and paid_since. */
+	{ "CREATE INDEX invoices_state_idx ON invoices (state);", NULL },
+	{ "CREATE INDEX invoices_state_expiry_idx ON invoices (state, expiry_time);", NULL },
+	{ "CREATE INDEX invoices_paid_timestamp_idx ON invoices (paid_timestamp);", NULL },
+	/* listforwards filters: each pages in rowid order. */
+	{ "CREATE INDEX forwarded_payments_state_idx ON forwarded_payments (state);", NULL },
+	{ "CREATE INDEX forwarded_payments_in_scid_idx ON forwarded_payments (in_channel_scid);", NULL },
+	{ "CREATE INDEX forwarded_payments_out_scid_idx ON forwarded_payments (out_channel_scid);", NULL },
+	{ "CREATE INDEX forwarded_payments_received_time_idx ON forwarded_payments (received_time);", NULL },
+	/* Hourly totals of forwarded_payments, kept up to date by
+	 * wallet_forwarded_payment_add.  out_channel_scid is 0 if unknown. */
+	{ "CREATE TABLE forward_stats ("
+	  "  bucket INTEGER"
+	  ", in_channel_scid INTEGER"
+	  ", out_channel_scid INTEGER"
+	  ", state INTEGER"
+	  ", count INTEGER"
+	  ", in_msatoshi INTEGER"
+	  ", out_msatoshi INTEGER"
+	  ", PRIMARY KEY (bucket, in_channel_scid, out_channel_scid, state)"
+	  ");", NULL },
+	{ "INSERT INTO forward_stats"
+	  " SELECT COALESCE(received_time, 0) / 3600000000000 * 3600"
+	  ", in_channel_scid"
+	  ", COALESCE(out_channel_scid, 0)"
+	  ", state"
+	  ", COUNT(*)"
+	  ", SUM(in_msatoshi)"
+	  ", SUM(COALESCE(out_msatoshi, 0))"
+	  " FROM forwarded_payments"
+	  " GROUP BY 1, 2, 3, 4;", NULL },
+	/* utxoset keyed by short_channel_id (blockheight << 40 | txindex << 16
+	 * | outnum), which is also the rowid.  wallet.c undoes rolled back
+	 * blocks itself, instead of foreign keys needing more indexes. */
+	{ "CREATE TABLE utxoset_new ("
+	  "  scid INTEGER PRIMARY KEY"
+	  ", txid BLOB"
+	  ", spendheight INTEGER"
+	  ", scriptpubkey BLOB"
+	  ", satoshis INTEGER"
+	  ");", NULL },
+	{ "INSERT INTO utxoset_new"
+	  " SELECT (blockheight << 40) | (txindex << 16) | outnum"
+	  ", txid, spendheight, scriptpubkey, satoshis"
+	  " FROM utxoset;", NULL },
+	{ "DROP TABLE utxoset;", NULL },
+	{ "ALTER TABLE utxoset_new RENAME TO utxoset;", NULL },
+	{ "CREATE INDEX utxoset_txid ON utxoset (txid);", NULL },
+	{ "CREATE INDEX utxoset_spend ON utxoset (spendheight)"
+	  " WHERE spendheight IS NOT NULL;", NULL },
+	/* listsendpays filters: each pages in id order. */
+	{ "CREATE INDEX payments_status_idx ON payments (status);", NULL },
+	{ "CREATE INDEX payments_timestamp_idx ON payments (timestamp);", NULL },
+	/* The HTLCs we load at startup: most are long resolved.  Incoming
+	 * ones are done at SENT_REMOVE_ACK_REVOCATION (19), outgoing ones at
+	 * RCVD_REMOVE_ACK_REVOCATION (9). */
+	{ "CREATE INDEX channel_htlcs_live_in_idx ON channel_htlcs (channel_id)"
+	  " WHERE direction=0 AND hstate != 19;", NULL },
+	{ "CREATE INDEX channel_htlcs_live_out_idx ON channel_htlcs (channel_id)"
+	  " WHERE direction=1 AND hstate != 9;", NULL },
+	/* Closed channels, once onchaind is done with them: what's needed for
+	 * accounting, without the keys and signatures we only needed to close
+	 * it.  Not foreign keys: the originals are gone. */
+	{ "CREATE TABLE channels_archive ("
+	  "  id INTEGER"
+	  ", peer_node_id BLOB"
+	  ", short_channel_id TEXT"
+	  ", funder INTEGER"
+	  ", funding_tx_id BLOB"
+	  ", funding_tx_outnum INTEGER"
+	  ", funding_satoshi INTEGER"
+	  ", msatoshi_local INTEGER"
+	  ", archived_height INTEGER"
+	  ", PRIMARY KEY (id)"
+	  ");", NULL },
+	{ "CREATE TABLE channel_htlcs_archive ("
+	  "  id INTEGER"
+	  ", channel_id INTEGER"
+	  ", channel_htlc_id INTEGER"
+	  ", direction INTEGER"
+	  ", msatoshi INTEGER"
+	  ", payment_hash BLOB"
+	  ", payment_key BLOB"
+	  ", hstate INTEGER"
+	  ", received_time INTEGER"
+	  ", PRIMARY KEY (id)"
+	  ");", NULL },
+	{ "CREATE INDEX channel_htlcs_archive_channel_idx"
+	  " ON channel_htlcs_archive (channel_id);", NULL },
+	/* in_htlc_id is set NULL when the HTLC is archived, so keep the
+	 * payment_hash listforwards shows. */
+	{ "ALTER TABLE forwarded_payments ADD payment_hash BLOB;", NULL },
+	/* Deleted channels used to leave these behind. */
+	{ "DELETE FROM shachains WHERE id NOT IN"
+	  " (SELECT shachain_remote_id FROM channels);", NULL },
+	{ "DELETE FROM channel_configs WHERE id NOT IN"
+	  " (SELECT channel_config_local FROM channels"
+	  "  UNION SELECT channel_config_remote FROM channels);", NULL },
 };
 
 /* Leak tracking. */
@@ -401,11 +513,11 @@ static struct list_head db_statements = LIST_HEAD_INIT(db_statements);
 
 struct db_statement {
 	struct list_node list;
-	sqlite3_stmt *stmt;
+	struct db_stmt *stmt;
 	const char *origin;
 };
 
-static struct db_statement *find_statement(sqlite3_stmt *stmt)
+static struct db_statement *find_statement(struct db_stmt *stmt)
 {
 	struct db_statement *i;
 
@@ -425,7 +537,7 @@ void db_assert_no_outstanding_statements(void)
 		db_fatal("Unfinalized statement %s", dbstat->origin);
 }
 
-static void dev_statement_start(sqlite3_stmt *stmt, const char *origin)
+static void dev_statement_start(struct db_stmt *stmt, const char *origin)
 {
 	struct db_statement *dbstat = tal(NULL, struct db_statement);
 	dbstat->stmt = stmt;
@@ -433,18 +545,18 @@ static void dev_statement_start(sqlite3_stmt *stmt, const char *origin)
 	list_add(&db_statements, &dbstat->list);
 }
 
-static void dev_statement_end(sqlite3_stmt *stmt)
+static void dev_statement_end(struct db_stmt *stmt)
 {
 	struct db_statement *dbstat = find_statement(stmt);
 	list_del_from(&db_statements, &dbstat->list);
 	tal_free(dbstat);
 }
 #else
-static void dev_statement_start(sqlite3_stmt *stmt, const char *origin)
+static void dev_statement_start(struct db_stmt *stmt, const char *origin)
 {
 }
 
-static void dev_statement_end(sqlite3_stmt *stmt)
+static void dev_statement_end(struct db_stmt *stmt)
 {
 }
 
@@ -453,106 +565,183 @@ void db_assert_no_outstanding_statements(void)
 }
 #endif
 
-#if !HAVE_SQLITE3_EXPANDED_SQL
-/* Prior to sqlite3 v3.14, we have to use tracing to dump statements */
-static void trace_sqlite3(void *dbv, const char *stmt)
+/* The drivers we know, by --wallet scheme.  The first is the default. */
+static const struct db_config *db_configs[] = {
+	&db_sqlite3_config,
+#if HAVE_POSTGRES
+	&db_postgres_config,
+#endif
+};
+
+void db_changes_add(struct db *db, const char *sql)
 {
-	struct db *db = dbv;
+	tal_arr_expand(&db->changes, tal_strdup(db->changes, sql));
+}
 
-	/* We get a "COMMIT;" after we've sent our changes. */
-	if (!db->changes) {
-		assert(streq(stmt, "COMMIT;"));
-		return;
+static void destroy_db_stmt(struct db_stmt *stmt)
+{
+	stmt->db->config->finalize_fn(stmt);
+}
+
+/* Compile @query: NULL if the driver doesn't like it. */
+static struct db_stmt *db_stmt_new(const char *location, struct db *db,
+				   const char *query)
+{
+	struct db_stmt *stmt = tal(db, struct db_stmt);
+
+	stmt->db = db;
+	stmt->query = tal_strdup(stmt, query);
+	stmt->location = location;
+	stmt->inner_stmt = NULL;
+	stmt->cached = false;
+	stmt->in_use = true;
+
+	if (!db->config->prepare_fn(stmt))
+		return tal_free(stmt);
+	tal_add_destructor(stmt, destroy_db_stmt);
+	dev_statement_start(stmt, location);
+	return stmt;
+}
+
+/* Some queries are built at runtime (eg. listinvoices filters), so we can't
+ * keep every statement we ever compiled. */
+#define DB_STMT_CACHE_MAX 256
+
+/* Drop the least recently used statement nobody is using: false if they're
+ * all in use. */
+static bool db_stmt_cache_evict(struct db *db)
+{
+	struct db_stmt *stmt;
+
+	list_for_each_rev(&db->stmt_lru, stmt, lru) {
+		if (stmt->in_use)
+			continue;
+		strmap_del(&db->stmt_cache, stmt->query, NULL);
+		list_del_from(&db->stmt_lru, &stmt->lru);
+		db->num_cached--;
+		tal_free(stmt);
+		return true;
+	}
+	return false;
+}
+
+/* Statements are cheap to reset and rebind, but expensive to compile, and
+ * the same few are used for every HTLC.  So we keep one of each: if someone
+ * has it already, the next caller compiles (and later frees) another. */
+static struct db_stmt *db_prepare_cached(const char *location, struct db *db,
+					 const char *query)
+{
+	struct db_stmt *stmt;
+
+	stmt = strmap_get(&db->stmt_cache, query);
+	if (stmt) {
+		list_del_from(&db->stmt_lru, &stmt->lru);
+		list_add(&db->stmt_lru, &stmt->lru);
+		if (!stmt->in_use) {
+			stmt->in_use = true;
+			stmt->location = location;
+			dev_statement_start(stmt, location);
+			return stmt;
+		}
+	}
+
+	stmt = db_stmt_new(location, db, query);
+	if (!stmt)
+		db_fatal("%s: %s: %s", location, query,
+			 db->config->errmsg_fn(db));
+
+	if (!strmap_get(&db->stmt_cache, query)
+	    && (db->num_cached < DB_STMT_CACHE_MAX || db_stmt_cache_evict(db))) {
+		stmt->cached = true;
+		strmap_add(&db->stmt_cache, stmt->query, stmt);
+		list_add(&db->stmt_lru, &stmt->lru);
+		db->num_cached++;
 	}
+	return stmt;
+}
 
-	tal_arr_expand(&db->changes, tal_strdup(db->changes, stmt));
+static bool free_cached_stmt(const char *member UNUSED,
+			     struct db_stmt *stmt, void *unused UNUSED)
+{
+	assert(!stmt->in_use);
+	tal_free(stmt);
+	return true;
 }
-#endif
 
-void db_stmt_done(sqlite3_stmt *stmt)
+/* Drivers can't close with statements still around. */
+static void db_stmt_cache_clear(struct db *db)
+{
+	strmap_iterate(&db->stmt_cache, free_cached_stmt, NULL);
+	strmap_clear(&db->stmt_cache);
+	list_head_init(&db->stmt_lru);
+	db->num_cached = 0;
+}
+
+void db_stmt_done(struct db_stmt *stmt)
 {
 	dev_statement_end(stmt);
-	sqlite3_finalize(stmt);
+	if (stmt->cached) {
+		assert(stmt->in_use);
+		stmt->db->config->reset_fn(stmt);
+		stmt->in_use = false;
+	} else
+		tal_free(stmt);
 }
 
-sqlite3_stmt *db_select_prepare_(const char *location, struct db *db, const char *query)
+struct db_stmt *db_select_prepare_(const char *location, struct db *db,
+				   const char *query)
 {
-	int err;
-	sqlite3_stmt *stmt;
+	struct db_stmt *stmt;
 	const char *full_query = tal_fmt(db, "SELECT %s", query);
 
 	assert(db->in_transaction);
 
-	err = sqlite3_prepare_v2(db->sql, full_query, -1, &stmt, NULL);
-
-	if (err != SQLITE_OK)
-		db_fatal("%s: %s: %s", location, full_query, sqlite3_errmsg(db->sql));
-
-	dev_statement_start(stmt, location);
+	stmt = db_prepare_cached(location, db, full_query);
 	tal_free(full_query);
 	return stmt;
 }
 
-bool db_select_step_(const char *location, struct db *db, struct sqlite3_stmt *stmt)
+bool db_select_step_(const char *location, struct db *db,
+		     struct db_stmt *stmt)
 {
 	int ret;
 
-	ret = sqlite3_step(stmt);
-	if (ret == SQLITE_ROW)
+	ret = db->config->step_fn(stmt);
+	if (ret > 0)
 		return true;
-	if (ret != SQLITE_DONE)
-		db_fatal("%s: %s", location, sqlite3_errmsg(db->sql));
+	if (ret < 0)
+		db_fatal("%s: %s", location, db->config->errmsg_fn(db));
 	db_stmt_done(stmt);
 	return false;
 }
-sqlite3_stmt *db_prepare_(const char *location, struct db *db, const char *query)
-{
-	int err;
-	sqlite3_stmt *stmt;
 
+struct db_stmt *db_prepare_(const char *location, struct db *db,
+			    const char *query)
+{
 	assert(db->in_transaction);
 
-	err = sqlite3_prepare_v2(db->sql, query, -1, &stmt, NULL);
-
-	if (err != SQLITE_OK)
-		db_fatal("%s: %s: %s", location, query, sqlite3_errmsg(db->sql));
-
-	dev_statement_start(stmt, location);
-	return stmt;
+	return db_prepare_cached(location, db, query);
 }
 
-void db_exec_prepared_(const char *caller, struct db *db, sqlite3_stmt *stmt)
+void db_exec_prepared_(const char *caller, struct db *db, struct db_stmt *stmt)
 {
 	assert(db->in_transaction);
 
-	if (sqlite3_step(stmt) !=  SQLITE_DONE)
-		db_fatal("%s: %s", caller, sqlite3_errmsg(db->sql));
+	if (db->config->step_fn(stmt) != 0)
+		db_fatal("%s: %s", caller, db->config->errmsg_fn(db));
 
-#if HAVE_SQLITE3_EXPANDED_SQL
-	char *expanded_sql;
-	expanded_sql = sqlite3_expanded_sql(stmt);
-	tal_arr_expand(&db->changes,
-		       tal_strdup(db->changes, expanded_sql));
-	sqlite3_free(expanded_sql);
-#endif
+	if (db->config->expand_fn)
+		db_changes_add(db, take(db->config->expand_fn(NULL, stmt)));
 	db_stmt_done(stmt);
 }
 
 /* This one doesn't check if we're in a transaction. */
 static void db_do_exec(const char *caller, struct db *db, const char *cmd)
 {
-	char *errmsg;
-	int err;
-
-	err = sqlite3_exec(db->sql, cmd, NULL, NULL, &errmsg);
-	if (err != SQLITE_OK) {
-		db_fatal("%s:%s:%s:%s", caller, sqlite3_errstr(err), cmd, errmsg);
-		/* Only reached in testing */
-		sqlite3_free(errmsg);
-	}
-#if HAVE_SQLITE3_EXPANDED_SQL
-	tal_arr_expand(&db->changes, tal_strdup(db->changes, cmd));
-#endif
+	if (!db->config->exec_fn(db, cmd))
+		db_fatal("%s:%s:%s", caller, cmd, db->config->errmsg_fn(db));
+	if (db->config->expand_fn)
+		db_changes_add(db, cmd);
 }
 
 static void PRINTF_FMT(3, 4)
@@ -572,26 +761,20 @@ static void PRINTF_FMT(3, 4)
 }
 
 /* This one can fail: returns NULL if so */
-static sqlite3_stmt *db_query(const char *location,
-			      struct db *db, const char *query)
+static struct db_stmt *db_query(const char *location,
+				struct db *db, const char *query)
 {
-	sqlite3_stmt *stmt;
-
 	assert(db->in_transaction);
 
-	/* Sets stmt to NULL if not SQLITE_OK */
-	sqlite3_prepare_v2(db->sql, query, -1, &stmt, NULL);
-	if (stmt)
-		dev_statement_start(stmt, location);
-	return stmt;
+	return db_stmt_new(location, db, query);
 }
 
-sqlite3_stmt *PRINTF_FMT(3, 4)
+struct db_stmt *PRINTF_FMT(3, 4)
     db_select_(const char *location, struct db *db, const char *fmt, ...)
 {
 	va_list ap;
 	char *query = tal_strdup(db, "SELECT ");
-	sqlite3_stmt *stmt;
+	struct db_stmt *stmt;
 
 	assert(db->in_transaction);
 
@@ -601,20 +784,323 @@ sqlite3_stmt *PRINTF_FMT(3, 4)
 
 	stmt = db_query(location, db, query);
 	if (!stmt)
-		db_fatal("%s:%s:%s", location, query, sqlite3_errmsg(db->sql));
+		db_fatal("%s:%s:%s", location, query,
+			 db->config->errmsg_fn(db));
 	tal_free(query);
 
 	return stmt;
 }
 
+size_t db_changes(struct db *db)
+{
+	return db->config->changes_fn(db);
+}
+
+u64 db_last_insert_id(struct db *db)
+{
+	return db->config->last_insert_id_fn(db);
+}
+
+void db_bind_null(struct db_stmt *stmt, int pos)
+{
+	stmt->db->config->bind_null_fn(stmt, pos);
+}
+
+void db_bind_int(struct db_stmt *stmt, int pos, int val)
+{
+	stmt->db->config->bind_int64_fn(stmt, pos, val);
+}
+
+void db_bind_int64(struct db_stmt *stmt, int pos, s64 val)
+{
+	stmt->db->config->bind_int64_fn(stmt, pos, val);
+}
+
+void db_bind_blob(struct db_stmt *stmt, int pos, const void *val, size_t len)
+{
+	stmt->db->config->bind_blob_fn(stmt, pos, val, len);
+}
+
+void db_bind_text(struct db_stmt *stmt, int pos, const char *val)
+{
+	stmt->db->config->bind_text_fn(stmt, pos, val, strlen(val));
+}
+
+bool db_column_is_null(struct db_stmt *stmt, int col)
+{
+	return stmt->db->config->column_is_null_fn(stmt, col);
+}
+
+int db_column_int(struct db_stmt *stmt, int col)
+{
+	return stmt->db->config->column_int64_fn(stmt, col);
+}
+
+s64 db_column_int64(struct db_stmt *stmt, int col)
+{
+	return stmt->db->config->column_int64_fn(stmt, col);
+}
+
+const void *db_column_blob(struct db_stmt *stmt, int col)
+{
+	return stmt->db->config->column_blob_fn(stmt, col);
+}
+
+size_t db_column_bytes(struct db_stmt *stmt, int col)
+{
+	return stmt->db->config->column_bytes_fn(stmt, col);
+}
+
+const unsigned char *db_column_text(struct db_stmt *stmt, int col)
+{
+	return (const unsigned char *)stmt->db->config->column_text_fn(stmt,
+								       col);
+}
+
+/* With --db-writer-thread, sqlite3 commits without waiting for the disk,
+ * and this thread syncs behind us.  The main thread only bumps `committed`,
+ * the writer only bumps `durable`, so neither needs a lock; like the log
+ * writer, it never allocates, so forking subdaemons stays safe.  Anything
+ * which mustn't happen until a commit is on disk waits in
+ * db_after_durable(), and is released in order from the main loop. */
+struct db_writer {
+	pthread_t thread;
+	/* The writer only looks at these, never at the db itself. */
+	bool (*sync_fn)(const char *filename);
+	const char *filename;
+	/* Transactions committed (by main thread), and synced (by writer) */
+	_Atomic u64 committed, durable;
+	/* Set by writer before sleeping on its wake pipe. */
+	_Atomic bool writer_sleeping;
+	/* Set by main to make the writer exit once it's caught up. */
+	_Atomic bool stop;
+	/* errno of a failed sync, for the main thread to report. */
+	_Atomic int sync_errno;
+	/* Writer writes a byte to wake_main after every sync. */
+	int wake_writer[2], wake_main[2];
+	struct io_conn *conn;
+	char buf[64];
+	size_t len;
+	/* Waiting for a transaction to be synced, in order. */
+	struct list_head waiters;
+};
+
+struct db_durable_waiter {
+	struct list_node list;
+	u64 seq;
+	void (*cb)(void *arg);
+	void *arg;
+};
+
+static void *db_writer_thread(struct db_writer *w)
+{
+	char c;
+
+	for (;;) {
+		u64 committed = atomic_load(&w->committed);
+
+		if (committed == atomic_load(&w->durable)) {
+			if (atomic_load(&w->stop))
+				break;
+			atomic_store(&w->writer_sleeping, true);
+			/* Main might have committed before it saw that. */
+			if (committed != atomic_load(&w->committed)
+			    || atomic_load(&w->stop))
+				atomic_store(&w->writer_sleeping, false);
+			else if (read(w->wake_writer[0], &c, 1) != 1)
+				;
+			continue;
+		}
+
+		/* One sync covers every commit made before it started. */
+		if (!w->sync_fn(w->filename)) {
+			atomic_store(&w->sync_errno, errno ? errno : EIO);
+			break;
+		}
+		atomic_store(&w->durable, committed);
+		/* If the pipe is full, main has a wakeup pending anyway. */
+		if (write(w->wake_main[1], "", 1) != 1)
+			;
+	}
+
+	/* Make sure main notices we're gone. */
+	if (write(w->wake_main[1], "", 1) != 1)
+		;
+	return NULL;
+}
+
+static void destroy_db_durable_waiter(struct db_durable_waiter *w)
+{
+	list_del(&w->list);
+}
+
+/* Release everyone waiting for transactions which are now on disk. */
+static void db_writer_release(struct db_writer *w)
+{
+	struct db_durable_waiter *dw;
+	u64 durable = atomic_load(&w->durable);
+
+	if (atomic_load(&w->sync_errno))
+		db_fatal("Syncing database %s: %s", w->filename,
+			 strerror(atomic_load(&w->sync_errno)));
+
+	while ((dw = list_top(&w->waiters, struct db_durable_waiter, list))
+	       != NULL) {
+		if (dw->seq > durable)
+			break;
+		list_del_from(&w->waiters, &dw->list);
+		/* The callback may free dw's parent, so take it first. */
+		tal_del_destructor(dw, destroy_db_durable_waiter);
+		tal_steal(tmpctx, dw);
+		dw->cb(dw->arg);
+		tal_free(dw);
+	}
+}
+
+static struct io_plan *db_writer_woken(struct io_conn *conn,
+				       struct db_writer *w)
+{
+	db_writer_release(w);
+	return io_read_partial(conn, w->buf, sizeof(w->buf), &w->len,
+			       db_writer_woken, w);
+}
+
+static void db_writer_wake(struct db_writer *w)
+{
+	if (atomic_exchange(&w->writer_sleeping, false)
+	    && write(w->wake_writer[1], "", 1) != 1)
+		;
+}
+
+/* Main thread: wait for the writer to sync everything committed so far
+ * (or to give up).  Waiters are released later, from the main loop. */
+static void db_writer_flush(struct db_writer *w)
+{
+	struct pollfd pfd;
+	char c;
+
+	pfd.fd = w->wake_main[0];
+	pfd.events = POLLIN;
+	while (atomic_load(&w->durable) != atomic_load(&w->committed)
+	       && !atomic_load(&w->sync_errno)) {
+		db_writer_wake(w);
+		/* The io_conn owns it, so it's non-blocking: poll first. */
+		if (poll(&pfd, 1, -1) == 1
+		    && read(w->wake_main[0], &c, 1) != 1)
+			;
+	}
+}
+
+static void db_writer_start(struct db_writer *w)
+{
+	sigset_t all, old;
+
+	if (pipe(w->wake_writer) != 0 || pipe(w->wake_main) != 0)
+		db_fatal("Creating db writer pipes: %s", strerror(errno));
+	/* The writer must never block telling us about progress. */
+	io_fd_block(w->wake_main[1], false);
+	atomic_store(&w->writer_sleeping, false);
+	atomic_store(&w->stop, false);
+
+	/* Signals are for the main thread. */
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	if (pthread_create(&w->thread, NULL,
+			   (void *(*)(void *))db_writer_thread, w) != 0)
+		db_fatal("Creating db writer thread");
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	w->conn = io_new_conn(w, w->wake_main[0], db_writer_woken, w);
+}
+
+/* Sync everything, then join the thread and close its pipes. */
+static void db_writer_stop(struct db_writer *w)
+{
+	db_writer_flush(w);
+	atomic_store(&w->stop, true);
+	if (write(w->wake_writer[1], "", 1) != 1)
+		;
+	pthread_join(w->thread, NULL);
+
+	/* This closes wake_main[0] */
+	w->conn = tal_free(w->conn);
+	close(w->wake_main[1]);
+	close(w->wake_writer[0]);
+	close(w->wake_writer[1]);
+}
+
+static void destroy_db_writer(struct db_writer *w)
+{
+	struct db_durable_waiter *dw;
+
+	/* Nothing will call them now: stop them touching our list. */
+	while ((dw = list_pop(&w->waiters, struct db_durable_waiter, list))
+	       != NULL)
+		tal_del_destructor(dw, destroy_db_durable_waiter);
+}
+
+static void db_start_writer(struct db *db)
+{
+	struct db_writer *w;
+
+	if (!db->config->sync_fn)
+		db_fatal("--db-writer-thread is not supported by %s databases",
+			 db->config->name);
+
+	w = db->writer = tal(db, struct db_writer);
+	w->sync_fn = db->config->sync_fn;
+	w->filename = db->filename;
+	atomic_init(&w->committed, 0);
+	atomic_init(&w->durable, 0);
+	atomic_init(&w->sync_errno, 0);
+	list_head_init(&w->waiters);
+	tal_add_destructor(w, destroy_db_writer);
+	db_writer_start(w);
+}
+
+void db_after_durable_(struct db *db, const tal_t *ctx,
+		       void (*cb)(void *arg), void *arg)
+{
+	struct db_durable_waiter *dw;
+	u64 seq;
+
+	if (!db->writer) {
+		cb(arg);
+		return;
+	}
+
+	/* Inside a transaction, it's the commit to come we need. */
+	seq = atomic_load(&db->writer->committed);
+	if (db->in_transaction)
+		seq++;
+	/* Earlier waiters may be synced but not released yet: don't pass them */
+	else if (seq == atomic_load(&db->writer->durable)
+		 && list_empty(&db->writer->waiters)) {
+		cb(arg);
+		return;
+	}
+
+	dw = tal(ctx, struct db_durable_waiter);
+	dw->seq = seq;
+	dw->cb = cb;
+	dw->arg = arg;
+	list_add_tail(&db->writer->waiters, &dw->list);
+	tal_add_destructor(dw, destroy_db_durable_waiter);
+}
+
 static void destroy_db(struct db *db)
 {
 	db_assert_no_outstanding_statements();
-	sqlite3_close(db->sql);
+	if (db->writer)
+		db_writer_stop(db->writer);
+	db_stmt_cache_clear(db);
+	if (db->conn)
+		db->config->teardown_fn(db);
 }
 
-/* We expect min changes (ie. BEGIN TRANSACTION): report if more.
- * Optionally add "final" at the end (ie. COMMIT). */
+/* We expect min changes (ie. BEGIN TRANSACTION): report if more, otherwise
+ * report that nothing changed.  Optionally add "final" at the end
+ * (ie. COMMIT). */
 static void db_report_changes(struct db *db, const char *final, size_t min)
 {
 	assert(db->changes);
@@ -622,6 +1108,8 @@ static void db_report_changes(struct db *db, const char *final, size_t min)
 
 	if (tal_count(db->changes) > min)
 		plugin_hook_db_sync(db, db->changes, final);
+	else
+		plugin_hook_db_sync(db, NULL, NULL);
 	db->changes = tal_free(db->changes);
 }
 
@@ -643,8 +1131,6 @@ void db_begin_transaction_(struct db *db, const char *location)
 
 void db_commit_transaction(struct db *db)
 {
-	int err;
-	char *errmsg;
 	const char *cmd = "COMMIT;";
 
 	assert(db->in_transaction);
@@ -653,50 +1139,94 @@ void db_commit_transaction(struct db *db)
 	/* We expect at least the BEGIN TRANSACTION */
 	db_report_changes(db, cmd, 1);
 
-	err = sqlite3_exec(db->sql, cmd, NULL, NULL, &errmsg);
-	if (err != SQLITE_OK)
-		db_fatal("%s:%s:%s:%s", __func__, sqlite3_errstr(err), cmd, errmsg);
+	if (!db->config->exec_fn(db, cmd))
+		db_fatal("%s:%s:%s", __func__, cmd, db->config->errmsg_fn(db));
 
 	db->in_transaction = NULL;
+
+	if (db->writer) {
+		atomic_fetch_add(&db->writer->committed, 1);
+		db_writer_wake(db->writer);
+	}
 }
 
-static void setup_open_db(struct db *db)
+/* These are about how we store things, not what we store, so db_write
+ * plugins don't see them. */
+static void db_tune(struct db *db)
 {
-#if !HAVE_SQLITE3_EXPANDED_SQL
-	sqlite3_trace(db->sql, trace_sqlite3, db);
-#endif
+	if (!db->tuning || !db->config->tune_fn)
+		return;
+
+	db_prepare_for_changes(db);
+	db->config->tune_fn(db);
+	db->changes = tal_free(db->changes);
+}
 
+static void setup_open_db(struct db *db)
+{
 	/* This must be outside a transaction, so catch it */
 	assert(!db->in_transaction);
 
-	db_prepare_for_changes(db);
-	db_do_exec(__func__, db, "PRAGMA foreign_keys = ON;");
-	db_report_changes(db, NULL, 0);
+	if (!db->config->setup_fn(db))
+		db_fatal("failed to open database %s: %s", db->filename,
+			 db->config->errmsg_fn(db));
+
+	if (db->config->open_sql) {
+		db_prepare_for_changes(db);
+		db_do_exec(__func__, db, db->config->open_sql);
+		db_report_changes(db, NULL, 0);
+	}
+
+	db_tune(db);
 }
 
-/**
- * db_open - Open or create a sqlite3 database
- */
-static struct db *db_open(const tal_t *ctx, char *filename)
+/* "<scheme>://<rest>" picks the driver, otherwise it's a sqlite3 file. */
+static const struct db_config *db_config_for(const char *dsn,
+					     const char **filename)
 {
-	int err;
-	struct db *db;
-	sqlite3 *sql;
+	const char *sep = strstr(dsn, "://");
 
-	int flags = SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE;
-	err = sqlite3_open_v2(filename, &sql, flags, NULL);
+	*filename = dsn;
+	if (!sep)
+		return db_configs[0];
 
-	if (err != SQLITE_OK) {
-		db_fatal("failed to open database %s: %s", filename,
-			 sqlite3_errstr(err));
+	for (size_t i = 0; i < ARRAY_SIZE(db_configs); i++) {
+		if (strlen(db_configs[i]->name) == sep - dsn
+		    && strstarts(dsn, db_configs[i]->name)) {
+			*filename = sep + strlen("://");
+			return db_configs[i];
+		}
 	}
+	/* Postgres users often spell it this way */
+	if (strstarts(dsn, "postgresql://"))
+		return db_config_for(tal_fmt(tmpctx, "postgres://%s",
+					     sep + strlen("://")),
+				     filename);
+	db_fatal("Unsupported database %s", dsn);
+	/* Only reached in testing */
+	return db_configs[0];
+}
+
+/**
+ * db_open - Open or create a database
+ */
+static struct db *db_open(const tal_t *ctx, const char *dsn)
+{
+	struct db *db;
+	const char *filename;
 
 	db = tal(ctx, struct db);
+	db->config = db_config_for(dsn, &filename);
 	db->filename = tal_strdup(db, filename);
-	db->sql = sql;
-	tal_add_destructor(db, destroy_db);
+	db->conn = NULL;
 	db->in_transaction = NULL;
 	db->changes = NULL;
+	db->tuning = NULL;
+	db->writer = NULL;
+	strmap_init(&db->stmt_cache);
+	list_head_init(&db->stmt_lru);
+	db->num_cached = 0;
+	tal_add_destructor(db, destroy_db);
 
 	setup_open_db(db);
 
@@ -714,8 +1244,8 @@ static struct db *db_open(const tal_t *ctx, char *filename)
 static int db_get_version(struct db *db)
 {
 	int res;
-	sqlite3_stmt *stmt = db_query(__func__,
-				      db, "SELECT version FROM version LIMIT 1");
+	struct db_stmt *stmt = db_query(__func__,
+					db, "SELECT version FROM version LIMIT 1");
 
 	if (!stmt)
 		return -1;
@@ -723,7 +1253,7 @@ static int db_get_version(struct db *db)
 	if (!db_select_step(db, stmt))
 		return -1;
 
-	res = sqlite3_column_int64(stmt, 0);
+	res = db_column_int64(stmt, 0);
 	db_stmt_done(stmt);
 	return res;
 }
@@ -772,7 +1302,19 @@ static void db_migrate(struct lightningd *ld, struct db *db, struct log *log)
 
 struct db *db_setup(const tal_t *ctx, struct lightningd *ld, struct log *log)
 {
-	struct db *db = db_open(ctx, DB_FILE);
+	struct db *db = db_open(ctx, ld->wallet_dsn ? ld->wallet_dsn : DB_FILE);
+
+	db->tuning = tal(db, struct db_tuning);
+	db->tuning->journal_mode = ld->config.db_journal_mode;
+	db->tuning->synchronous = ld->config.db_synchronous;
+	db->tuning->mmap_size = ld->config.db_mmap_size;
+	db->tuning->cache_size = ld->config.db_cache_size;
+	/* The writer thread does the syncing COMMIT would do. */
+	if (ld->config.db_writer_thread)
+		db->tuning->synchronous = "normal";
+	db_tune(db);
+	if (ld->config.db_writer_thread)
+		db_start_writer(db);
 
 	db_migrate(ld, db, log);
 	return db;
@@ -783,28 +1325,25 @@ void db_close_for_fork(struct db *db)
 	/* https://www.sqlite.org/faq.html#q6
 	 *
 	 * Under Unix, you should not carry an open SQLite database across a
-	 * fork() system call into the child process. */
-	if (sqlite3_close(db->sql) != SQLITE_OK)
-		db_fatal("sqlite3_close: %s", sqlite3_errmsg(db->sql));
-	db->sql = NULL;
+	 * fork() system call into the child process.  Nor a thread. */
+	if (db->writer)
+		db_writer_stop(db->writer);
+	db_stmt_cache_clear(db);
+	db->config->teardown_fn(db);
+	db->conn = NULL;
 }
 
 void db_reopen_after_fork(struct db *db)
 {
-	int err = sqlite3_open_v2(db->filename, &db->sql,
-				  SQLITE_OPEN_READWRITE, NULL);
-
-	if (err != SQLITE_OK) {
-		db_fatal("failed to re-open database %s: %s", db->filename,
-			 sqlite3_errstr(err));
-	}
 	setup_open_db(db);
+	if (db->writer)
+		db_writer_start(db->writer);
 }
 
 s64 db_get_intvar(struct db *db, char *varname, s64 defval)
 {
 	s64 res;
-	sqlite3_stmt *stmt;
+	struct db_stmt *stmt;
 	const char *query;
 
 	query = tal_fmt(db, "SELECT val FROM vars WHERE name='%s' LIMIT 1", varname);
@@ -815,7 +1354,7 @@ s64 db_get_intvar(struct db *db, char *varname, s64 defval)
 		return defval;
 
 	if (db_select_step(db, stmt)) {
-		const unsigned char *stringvar = sqlite3_column_text(stmt, 0);
+		const unsigned char *stringvar = db_column_text(stmt, 0);
 		res = atol((const char *)stringvar);
 		db_stmt_done(stmt);
 	} else
@@ -830,7 +1369,7 @@ void db_set_intvar(struct db *db, char *varname, s64 val)
 	db_exec(__func__, db,
 		"UPDATE vars SET val='%" PRId64 "' WHERE name='%s';", val,
 		varname);
-	if (sqlite3_changes(db->sql) == 0)
+	if (db_changes(db) == 0)
 		db_exec(
 		    __func__, db,
 		    "INSERT INTO vars (name, val) VALUES ('%s', '%" PRId64
@@ -838,13 +1377,13 @@ void db_set_intvar(struct db *db, char *varname, s64 val)
 		    varname, val);
 }
 
-void *sqlite3_column_arr_(const tal_t *ctx, sqlite3_stmt *stmt, int col,
-			  size_t bytes, const char *label, const char *caller)
+void *db_column_arr_(const tal_t *ctx, struct db_stmt *stmt, int col,
+		     size_t bytes, const char *label, const char *caller)
 {
-	size_t sourcelen = sqlite3_column_bytes(stmt, col);
+	size_t sourcelen = db_column_bytes(stmt, col);
 	void *p;
 
-	if (sqlite3_column_type(stmt, col) == SQLITE_NULL)
+	if (db_column_is_null(stmt, col))
 		return NULL;
 
 	if (sourcelen % bytes != 0)
@@ -852,28 +1391,28 @@ void *sqlite3_column_arr_(const tal_t *ctx, sqlite3_stmt *stmt, int col,
 			 caller, sourcelen, label, bytes);
 
 	p = tal_arr_label(ctx, char, sourcelen, label);
-	memcpy(p, sqlite3_column_blob(stmt, col), sourcelen);
+	memcpy(p, db_column_blob(stmt, col), sourcelen);
 	return p;
 }
 
-bool sqlite3_bind_short_channel_id(sqlite3_stmt *stmt, int col,
-				   const struct short_channel_id *id)
+bool db_bind_short_channel_id(struct db_stmt *stmt, int col,
+			      const struct short_channel_id *id)
 {
 	char *ser = short_channel_id_to_str(id, id);
-	int err = sqlite3_bind_blob(stmt, col, ser, strlen(ser), SQLITE_TRANSIENT);
+	db_bind_blob(stmt, col, ser, strlen(ser));
 	tal_free(ser);
-	return err == SQLITE_OK;
+	return true;
 }
 
-bool sqlite3_column_short_channel_id(sqlite3_stmt *stmt, int col,
-				     struct short_channel_id *dest)
+bool db_column_short_channel_id(struct db_stmt *stmt, int col,
+				struct short_channel_id *dest)
 {
-	const char *source = sqlite3_column_blob(stmt, col);
-	size_t sourcelen = sqlite3_column_bytes(stmt, col);
+	const char *source = db_column_blob(stmt, col);
+	size_t sourcelen = db_column_bytes(stmt, col);
 	return short_channel_id_from_str(source, sourcelen, dest, true);
 }
-bool sqlite3_bind_short_channel_id_array(sqlite3_stmt *stmt, int col,
-					 const struct short_channel_id *id)
+bool db_bind_short_channel_id_array(struct db_stmt *stmt, int col,
+				    const struct short_channel_id *id)
 {
 	u8 *ser;
 	size_t num;
@@ -881,8 +1420,8 @@ bool sqlite3_bind_short_channel_id_array(sqlite3_stmt *stmt, int col,
 
 	/* Handle nulls early. */
 	if (!id) {
-		int err = sqlite3_bind_null(stmt, col);
-		return err == SQLITE_OK;
+		db_bind_null(stmt, col);
+		return true;
 	}
 
 	ser = tal_arr(NULL, u8, 0);
@@ -891,25 +1430,25 @@ bool sqlite3_bind_short_channel_id_array(sqlite3_stmt *stmt, int col,
 	for (i = 0; i < num; ++i)
 		towire_short_channel_id(&ser, &id[i]);
 
-	int err = sqlite3_bind_blob(stmt, col, ser, tal_count(ser), SQLITE_TRANSIENT);
+	db_bind_blob(stmt, col, ser, tal_count(ser));
 
 	tal_free(ser);
-	return err == SQLITE_OK;
+	return true;
 }
 struct short_channel_id *
-sqlite3_column_short_channel_id_array(const tal_t *ctx,
-				      sqlite3_stmt *stmt, int col)
+db_column_short_channel_id_array(const tal_t *ctx,
+				 struct db_stmt *stmt, int col)
 {
 	const u8 *ser;
 	size_t len;
 	struct short_channel_id *ret;
 
 	/* Handle nulls early. */
-	if (sqlite3_column_type(stmt, col) == SQLITE_NULL)
+	if (db_column_is_null(stmt, col))
 		return NULL;
 
-	ser = sqlite3_column_blob(stmt, col);
-	len = sqlite3_column_bytes(stmt, col);
+	ser = db_column_blob(stmt, col);
+	len = db_column_bytes(stmt, col);
 	ret = tal_arr(ctx, struct short_channel_id, 0);
 
 	while (len != 0) {
@@ -921,78 +1460,78 @@ sqlite3_column_short_channel_id_array(const tal_t *ctx,
 	return ret;
 }
 
-bool sqlite3_bind_tx(sqlite3_stmt *stmt, int col, const struct bitcoin_tx *tx)
+bool db_bind_tx(struct db_stmt *stmt, int col, const struct bitcoin_tx *tx)
 {
 	u8 *ser = linearize_tx(NULL, tx);
-	int err = sqlite3_bind_blob(stmt, col, ser, tal_count(ser), SQLITE_TRANSIENT);
+	db_bind_blob(stmt, col, ser, tal_count(ser));
 	tal_free(ser);
-	return err == SQLITE_OK;
+	return true;
 }
 
-struct bitcoin_tx *sqlite3_column_tx(const tal_t *ctx, sqlite3_stmt *stmt,
-				     int col)
+struct bitcoin_tx *db_column_tx(const tal_t *ctx, struct db_stmt *stmt,
+				int col)
 {
-	const u8 *src = sqlite3_column_blob(stmt, col);
-	size_t len = sqlite3_column_bytes(stmt, col);
+	const u8 *src = db_column_blob(stmt, col);
+	size_t len = db_column_bytes(stmt, col);
 	return pull_bitcoin_tx(ctx, &src, &len);
 }
-bool sqlite3_bind_signature(sqlite3_stmt *stmt, int col,
-			    const secp256k1_ecdsa_signature *sig)
+bool db_bind_signature(struct db_stmt *stmt, int col,
+		       const secp256k1_ecdsa_signature *sig)
 {
 	bool ok;
 	u8 buf[64];
 	ok = secp256k1_ecdsa_signature_serialize_compact(secp256k1_ctx, buf,
 							 sig) == 1;
-	int err = sqlite3_bind_blob(stmt, col, buf, sizeof(buf), SQLITE_TRANSIENT);
-	return ok && err == SQLITE_OK;
+	db_bind_blob(stmt, col, buf, sizeof(buf));
+	return ok;
 }
 
-bool sqlite3_column_signature(sqlite3_stmt *stmt, int col,
-			      secp256k1_ecdsa_signature *sig)
+bool db_column_signature(struct db_stmt *stmt, int col,
+			 secp256k1_ecdsa_signature *sig)
 {
-	assert(sqlite3_column_bytes(stmt, col) == 64);
+	assert(db_column_bytes(stmt, col) == 64);
 	return secp256k1_ecdsa_signature_parse_compact(
-		   secp256k1_ctx, sig, sqlite3_column_blob(stmt, col)) == 1;
+		   secp256k1_ctx, sig, db_column_blob(stmt, col)) == 1;
 }
 
-bool sqlite3_column_pubkey(sqlite3_stmt *stmt, int col,  struct pubkey *dest)
+bool db_column_pubkey(struct db_stmt *stmt, int col,  struct pubkey *dest)
 {
-	assert(sqlite3_column_bytes(stmt, col) == PUBKEY_CMPR_LEN);
-	return pubkey_from_der(sqlite3_column_blob(stmt, col), PUBKEY_CMPR_LEN, dest);
+	assert(db_column_bytes(stmt, col) == PUBKEY_CMPR_LEN);
+	return pubkey_from_der(db_column_blob(stmt, col), PUBKEY_CMPR_LEN, dest);
 }
 
-bool sqlite3_bind_pubkey(sqlite3_stmt *stmt, int col, const struct pubkey *pk)
+bool db_bind_pubkey(struct db_stmt *stmt, int col, const struct pubkey *pk)
 {
 	u8 der[PUBKEY_CMPR_LEN];
 	pubkey_to_der(der, pk);
-	int err = sqlite3_bind_blob(stmt, col, der, sizeof(der), SQLITE_TRANSIENT);
-	return err == SQLITE_OK;
+	db_bind_blob(stmt, col, der, sizeof(der));
+	return true;
 }
 
-bool sqlite3_column_node_id(sqlite3_stmt *stmt, int col, struct node_id *dest)
+bool db_column_node_id(struct db_stmt *stmt, int col, struct node_id *dest)
 {
-	assert(sqlite3_column_bytes(stmt, col) == sizeof(dest->k));
-	memcpy(dest->k, sqlite3_column_blob(stmt, col), sizeof(dest->k));
+	assert(db_column_bytes(stmt, col) == sizeof(dest->k));
+	memcpy(dest->k, db_column_blob(stmt, col), sizeof(dest->k));
 	return node_id_valid(dest);
 }
 
-bool sqlite3_bind_node_id(sqlite3_stmt *stmt, int col, const struct node_id *id)
+bool db_bind_node_id(struct db_stmt *stmt, int col, const struct node_id *id)
 {
 	assert(node_id_valid(id));
-	int err = sqlite3_bind_blob(stmt, col, id->k, sizeof(id->k), SQLITE_TRANSIENT);
-	return err == SQLITE_OK;
+	db_bind_blob(stmt, col, id->k, sizeof(id->k));
+	return true;
 }
 
-bool sqlite3_bind_pubkey_array(sqlite3_stmt *stmt, int col,
-			       const struct pubkey *pks)
+bool db_bind_pubkey_array(struct db_stmt *stmt, int col,
+			  const struct pubkey *pks)
 {
 	size_t n;
 	size_t i;
 	u8 *ders;
 
 	if (!pks) {
-		int err = sqlite3_bind_null(stmt, col);
-		return err == SQLITE_OK;
+		db_bind_null(stmt, col);
+		return true;
 	}
 
 	n = tal_count(pks);
@@ -1000,26 +1539,26 @@ bool sqlite3_bind_pubkey_array(sqlite3_stmt *stmt, int col,
 
 	for (i = 0; i < n; ++i)
 		pubkey_to_der(&ders[i * PUBKEY_CMPR_LEN], &pks[i]);
-	int err = sqlite3_bind_blob(stmt, col, ders, tal_count(ders), SQLITE_TRANSIENT);
+	db_bind_blob(stmt, col, ders, tal_count(ders));
 
 	tal_free(ders);
-	return err == SQLITE_OK;
+	return true;
 }
-struct pubkey *sqlite3_column_pubkey_array(const tal_t *ctx,
-					   sqlite3_stmt *stmt, int col)
+struct pubkey *db_column_pubkey_array(const tal_t *ctx,
+				      struct db_stmt *stmt, int col)
 {
 	size_t i;
 	size_t n;
 	struct pubkey *ret;
 	const u8 *ders;
 
-	if (sqlite3_column_type(stmt, col) == SQLITE_NULL)
+	if (db_column_is_null(stmt, col))
 		return NULL;
 
-	n = sqlite3_column_bytes(stmt, col) / PUBKEY_CMPR_LEN;
-	assert(n * PUBKEY_CMPR_LEN == (size_t)sqlite3_column_bytes(stmt, col));
+	n = db_column_bytes(stmt, col) / PUBKEY_CMPR_LEN;
+	assert(n * PUBKEY_CMPR_LEN == (size_t)db_column_bytes(stmt, col));
 	ret = tal_arr(ctx, struct pubkey, n);
-	ders = sqlite3_column_blob(stmt, col);
+	ders = db_column_blob(stmt, col);
 
 	for (i = 0; i < n; ++i) {
 		if (!pubkey_from_der(&ders[i * PUBKEY_CMPR_LEN], PUBKEY_CMPR_LEN, &ret[i]))
@@ -1029,15 +1568,15 @@ struct pubkey *sqlite3_column_pubkey_array(const tal_t *ctx,
 	return ret;
 }
 
-bool sqlite3_bind_node_id_array(sqlite3_stmt *stmt, int col,
-				const struct node_id *ids)
+bool db_bind_node_id_array(struct db_stmt *stmt, int col,
+			   const struct node_id *ids)
 {
 	size_t n;
 	u8 *arr;
 
 	if (!ids) {
-		int err = sqlite3_bind_null(stmt, col);
-		return err == SQLITE_OK;
+		db_bind_null(stmt, col);
+		return true;
 	}
 
 	/* Copy into contiguous array: ARM will add padding to struct node_id! */
@@ -1049,26 +1588,26 @@ bool sqlite3_bind_node_id_array(sqlite3_stmt *stmt, int col,
 		       ids[i].k,
 		       sizeof(ids[i].k));
 	}
-	int err = sqlite3_bind_blob(stmt, col, arr, tal_count(arr), SQLITE_TRANSIENT);
+	db_bind_blob(stmt, col, arr, tal_count(arr));
 
 	tal_free(arr);
-	return err == SQLITE_OK;
+	return true;
 }
 
-struct node_id *sqlite3_column_node_id_array(const tal_t *ctx,
-					     sqlite3_stmt *stmt, int col)
+struct node_id *db_column_node_id_array(const tal_t *ctx,
+					struct db_stmt *stmt, int col)
 {
 	size_t n;
 	struct node_id *ret;
 	const u8 *arr;
 
-	if (sqlite3_column_type(stmt, col) == SQLITE_NULL)
+	if (db_column_is_null(stmt, col))
 		return NULL;
 
-	n = sqlite3_column_bytes(stmt, col) / sizeof(ret->k);
-	assert(n * sizeof(ret->k) == (size_t)sqlite3_column_bytes(stmt, col));
+	n = db_column_bytes(stmt, col) / sizeof(ret->k);
+	assert(n * sizeof(ret->k) == (size_t)db_column_bytes(stmt, col));
 	ret = tal_arr(ctx, struct node_id, n);
-	arr = sqlite3_column_blob(stmt, col);
+	arr = db_column_blob(stmt, col);
 
 	for (size_t i = 0; i < n; i++) {
 		memcpy(ret[i].k, arr + i * sizeof(ret[i].k), sizeof(ret[i].k));
@@ -1079,89 +1618,89 @@ struct node_id *sqlite3_column_node_id_array(const tal_t *ctx,
 	return ret;
 }
 
-bool sqlite3_column_preimage(sqlite3_stmt *stmt, int col,  struct preimage *dest)
+bool db_column_preimage(struct db_stmt *stmt, int col,  struct preimage *dest)
 {
-	assert(sqlite3_column_bytes(stmt, col) == sizeof(struct preimage));
-	return memcpy(dest, sqlite3_column_blob(stmt, col), sizeof(struct preimage));
+	assert(db_column_bytes(stmt, col) == sizeof(struct preimage));
+	return memcpy(dest, db_column_blob(stmt, col), sizeof(struct preimage));
 }
 
-bool sqlite3_bind_preimage(sqlite3_stmt *stmt, int col, const struct preimage *p)
+bool db_bind_preimage(struct db_stmt *stmt, int col, const struct preimage *p)
 {
-	int err = sqlite3_bind_blob(stmt, col, p, sizeof(struct preimage), SQLITE_TRANSIENT);
-	return err == SQLITE_OK;
+	db_bind_blob(stmt, col, p, sizeof(struct preimage));
+	return true;
 }
 
-bool sqlite3_column_sha256(sqlite3_stmt *stmt, int col,  struct sha256 *dest)
+bool db_column_sha256(struct db_stmt *stmt, int col,  struct sha256 *dest)
 {
-	assert(sqlite3_column_bytes(stmt, col) == sizeof(struct sha256));
-	return memcpy(dest, sqlite3_column_blob(stmt, col), sizeof(struct sha256));
+	assert(db_column_bytes(stmt, col) == sizeof(struct sha256));
+	return memcpy(dest, db_column_blob(stmt, col), sizeof(struct sha256));
 }
 
-bool sqlite3_bind_sha256(sqlite3_stmt *stmt, int col, const struct sha256 *p)
+bool db_bind_sha256(struct db_stmt *stmt, int col, const struct sha256 *p)
 {
-	int err = sqlite3_bind_blob(stmt, col, p, sizeof(struct sha256), SQLITE_TRANSIENT);
-	return err == SQLITE_OK;
+	db_bind_blob(stmt, col, p, sizeof(struct sha256));
+	return true;
 }
 
-bool sqlite3_column_sha256_double(sqlite3_stmt *stmt, int col,  struct sha256_double *dest)
+bool db_column_sha256_double(struct db_stmt *stmt, int col,  struct sha256_double *dest)
 {
-	assert(sqlite3_column_bytes(stmt, col) == sizeof(struct sha256_double));
-	return memcpy(dest, sqlite3_column_blob(stmt, col), sizeof(struct sha256_double));
+	assert(db_column_bytes(stmt, col) == sizeof(struct sha256_double));
+	return memcpy(dest, db_column_blob(stmt, col), sizeof(struct sha256_double));
 }
 
-struct secret *sqlite3_column_secrets(const tal_t *ctx,
-				      sqlite3_stmt *stmt, int col)
+struct secret *db_column_secrets(const tal_t *ctx,
+				 struct db_stmt *stmt, int col)
 {
-	return sqlite3_column_arr(ctx, stmt, col, struct secret);
+	return db_column_arr(ctx, stmt, col, struct secret);
 }
 
-bool sqlite3_bind_sha256_double(sqlite3_stmt *stmt, int col, const struct sha256_double *p)
+bool db_bind_sha256_double(struct db_stmt *stmt, int col, const struct sha256_double *p)
 {
-	int err = sqlite3_bind_blob(stmt, col, p, sizeof(struct sha256_double), SQLITE_TRANSIENT);
-	return err == SQLITE_OK;
+	db_bind_blob(stmt, col, p, sizeof(struct sha256_double));
+	return true;
 }
 
-struct json_escape *sqlite3_column_json_escape(const tal_t *ctx,
-					       sqlite3_stmt *stmt, int col)
+struct json_escape *db_column_json_escape(const tal_t *ctx,
+					  struct db_stmt *stmt, int col)
 {
 	return json_escape_string_(ctx,
-				   sqlite3_column_blob(stmt, col),
-				   sqlite3_column_bytes(stmt, col));
+				   db_column_blob(stmt, col),
+				   db_column_bytes(stmt, col));
 }
 
-bool sqlite3_bind_json_escape(sqlite3_stmt *stmt, int col,
-			      const struct json_escape *esc)
+bool db_bind_json_escape(struct db_stmt *stmt, int col,
+			 const struct json_escape *esc)
 {
-	int err = sqlite3_bind_text(stmt, col, esc->s, strlen(esc->s), SQLITE_TRANSIENT);
-	return err == SQLITE_OK;
+	db_bind_text(stmt, col, esc->s);
+	return true;
 }
 
-struct amount_msat sqlite3_column_amount_msat(sqlite3_stmt *stmt, int col)
+struct amount_msat db_column_amount_msat(struct db_stmt *stmt, int col)
 {
 	struct amount_msat msat;
 
-	msat.millisatoshis = sqlite3_column_int64(stmt, col); /* Raw: low level function */
+	msat.millisatoshis = db_column_int64(stmt, col); /* Raw: low level function */
 	return msat;
 }
 
-struct amount_sat sqlite3_column_amount_sat(sqlite3_stmt *stmt, int col)
+struct amount_sat db_column_amount_sat(struct db_stmt *stmt, int col)
 {
 	struct amount_sat sat;
 
-	sat.satoshis = sqlite3_column_int64(stmt, col); /* Raw: low level function */
+	sat.satoshis = db_column_int64(stmt, col); /* Raw: low level function */
 	return sat;
 }
 
-void sqlite3_bind_amount_msat(sqlite3_stmt *stmt, int col,
-			      struct amount_msat msat)
+void db_bind_amount_msat(struct db_stmt *stmt, int col,
+			 struct amount_msat msat)
 {
-	sqlite3_bind_int64(stmt, col, msat.millisatoshis); /* Raw: low level function */
+	db_bind_int64(stmt, col, msat.millisatoshis); /* Raw: low level function */
 }
 
-void sqlite3_bind_amount_sat(sqlite3_stmt *stmt, int col,
-			     struct amount_sat sat)
+void db_bind_amount_sat(struct db_stmt *stmt, int col,
+			struct amount_sat sat)
 {
-	sqlite3_bind_int64(stmt, col, sat.satoshis); /* Raw: low level function */
+	db_bind_int64(stmt, col, sat.satoshis); /* Raw: low level function */
 }
 
 /* Will apply the current config fee settings to all channels */
@@ -1173,16 +1712,16 @@ void migrate_pr2342_feerate_per_channel(struct lightningd *ld, struct db *db)
 			ld->config.fee_per_satoshi);
 }
 
-void sqlite3_bind_timeabs(sqlite3_stmt *stmt, int col, struct timeabs t)
+void db_bind_timeabs(struct db_stmt *stmt, int col, struct timeabs t)
 {
 	u64 timestamp =  t.ts.tv_nsec + (((u64) t.ts.tv_sec) * ((u64) NSEC_IN_SEC));
-	sqlite3_bind_int64(stmt, col, timestamp);
+	db_bind_int64(stmt, col, timestamp);
 }
 
-struct timeabs sqlite3_column_timeabs(sqlite3_stmt *stmt, int col)
+struct timeabs db_column_timeabs(struct db_stmt *stmt, int col)
 {
 	struct timeabs t;
-	u64 timestamp = sqlite3_column_int64(stmt, col);
+	u64 timestamp = db_column_int64(stmt, col);
 	t.ts.tv_sec = timestamp / NSEC_IN_SEC;
 	t.ts.tv_nsec = timestamp % NSEC_IN_SEC;
 	return t;
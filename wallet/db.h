@@ -6,23 +6,53 @@
 #include <bitcoin/pubkey.h>
 #include <bitcoin/short_channel_id.h>
 #include <bitcoin/tx.h>
+#include <ccan/list/list.h>
 #include <ccan/short_types/short_types.h>
+#include <ccan/strmap/strmap.h>
 #include <ccan/tal/tal.h>
 #include <ccan/time/time.h>
+#include <ccan/typesafe_cb/typesafe_cb.h>
 #include <common/amount.h>
 #include <secp256k1_ecdh.h>
-#include <sqlite3.h>
 #include <stdbool.h>
 
+struct db_config;
+struct db_stmt;
+struct db_writer;
 struct lightningd;
 struct log;
 struct node_id;
 
+/* PRAGMAs we (re-)apply whenever we open the db */
+struct db_tuning {
+	const char *journal_mode;
+	const char *synchronous;
+	u64 mmap_size;
+	/* In KiB, 0 to leave sqlite3's default */
+	u32 cache_size;
+};
+
 struct db {
+	/* What the driver opens: a filename for sqlite3, a connection
+	 * string for postgres. */
 	char *filename;
 	const char *in_transaction;
-	sqlite3 *sql;
+	const struct db_config *config;
+	/* The driver's connection handle */
+	void *conn;
 	const char **changes;
+
+	/* Compiled statements from db_prepare and db_select_prepare, by SQL */
+	STRMAP(struct db_stmt *) stmt_cache;
+	/* The same statements, so we can evict the least recently used. */
+	struct list_head stmt_lru;
+	size_t num_cached;
+
+	/* NULL to leave sqlite3's defaults. */
+	struct db_tuning *tuning;
+
+	/* If --db-writer-thread, the thread which syncs our commits. */
+	struct db_writer *writer;
 };
 
 /**
@@ -39,12 +69,31 @@ struct db {
  */
 struct db *db_setup(const tal_t *ctx, struct lightningd *ld, struct log *log);
 
+/**
+ * db_after_durable - call once the current transaction is on disk
+ * @db: the database
+ * @ctx: freeing this cancels the callback.
+ * @cb: the callback
+ * @arg: the argument to @cb
+ *
+ * Outside a transaction, waits for the last one committed.  This is
+ * immediate unless commits are synced by a writer thread
+ * (--db-writer-thread), in which case @cb is called from the main loop.
+ * Either way, callbacks are called in the order they were added.
+ */
+#define db_after_durable(db, ctx, cb, arg)				\
+	db_after_durable_((db), (ctx),					\
+			  typesafe_cb(void, void *, (cb), (arg)),	\
+			  (arg))
+void db_after_durable_(struct db *db, const tal_t *ctx,
+		       void (*cb)(void *arg), void *arg);
+
 /**
  * db_select - Prepare and execute a SELECT, and return the result
  *
  * A simpler version of db_select_prepare.
  */
-sqlite3_stmt *PRINTF_FMT(3, 4)
+struct db_stmt *PRINTF_FMT(3, 4)
 	db_select_(const char *location, struct db *db, const char *fmt, ...);
 #define db_select(db, ...) \
 	db_select_(__FILE__ ":" stringify(__LINE__), db, __VA_ARGS__)
@@ -85,9 +134,8 @@ s64 db_get_intvar(struct db *db, char *varname, s64 defval);
 /**
  * db_select_prepare -- Prepare a DB select statement (read-only!)
  *
- * Tiny wrapper around `sqlite3_prepare_v2` that checks and sets
- * errors like `db_query` and `db_exec` do.  It calls fatal if
- * the stmt is not valid.
+ * Compiles the statement with the database driver (or reuses the one
+ * compiled last time).  It calls fatal if the stmt is not valid.
  *
  * Call db_select_step() until it returns false (which will also consume
  * the stmt).
@@ -97,43 +145,40 @@ s64 db_get_intvar(struct db *db, char *varname, s64 defval);
  */
 #define db_select_prepare(db, query) \
 	db_select_prepare_(__FILE__ ":" stringify(__LINE__), db, query)
-sqlite3_stmt *db_select_prepare_(const char *location,
-				 struct db *db, const char *query);
+struct db_stmt *db_select_prepare_(const char *location,
+				   struct db *db, const char *query);
 
 /**
  * db_select_step -- iterate through db results.
  *
  * Returns false and frees stmt if we've reached end, otherwise
- * it means sqlite3_step has returned SQLITE_ROW.
+ * the db_column_* functions give the current row.
  */
 #define db_select_step(db, stmt)					\
 	db_select_step_(__FILE__ ":" stringify(__LINE__), db, stmt)
 bool db_select_step_(const char *location,
-		     struct db *db, struct sqlite3_stmt *stmt);
+		     struct db *db, struct db_stmt *stmt);
 
 /**
  * db_prepare -- Prepare a DB query/command
  *
- * Tiny wrapper around `sqlite3_prepare_v2` that checks and sets
- * errors like `db_query` and `db_exec` do. It returns a statement
- * `stmt` if the given query/command was successfully compiled into a
- * statement, `NULL` otherwise. On failure `db->err` will be set with
- * the human readable error.
+ * Compiles the statement with the database driver (or reuses the one
+ * compiled last time).  It calls fatal if the stmt is not valid.
  *
  * @db: Database to query/exec
  * @query: The SQL statement to compile
  */
 #define db_prepare(db,query) \
 	db_prepare_(__FILE__ ":" stringify(__LINE__), db, query)
-sqlite3_stmt *db_prepare_(const char *location, struct db *db, const char *query);
+struct db_stmt *db_prepare_(const char *location, struct db *db, const char *query);
 
 /**
  * db_exec_prepared -- Execute a prepared statement
  *
  * After preparing a statement using `db_prepare`, and after binding
- * all non-null variables using the `sqlite3_bind_*` functions, it can
+ * all non-null variables using the `db_bind_*` functions, it can
  * be executed with this function. It is a small, transaction-aware,
- * wrapper around `sqlite3_step`, that calls fatal() if the execution
+ * wrapper around the driver's step, that calls fatal() if the execution
  * fails. This will take ownership of `stmt` and will free
  * it before returning.
  *
@@ -141,10 +186,32 @@ sqlite3_stmt *db_prepare_(const char *location, struct db *db, const char *query
  * @stmt: The prepared statement to execute
  */
 #define db_exec_prepared(db,stmt) db_exec_prepared_(__func__,db,stmt)
-void db_exec_prepared_(const char *caller, struct db *db, sqlite3_stmt *stmt);
+void db_exec_prepared_(const char *caller, struct db *db, struct db_stmt *stmt);
+
+/* Finish with a statement, for tracking statements.  Statements from
+ * db_prepare and db_select_prepare are reset and kept for reuse. */
+void db_stmt_done(struct db_stmt *stmt);
+
+/* Rows changed by the last statement we executed */
+size_t db_changes(struct db *db);
+
+/* The id the last INSERT gave its row */
+u64 db_last_insert_id(struct db *db);
 
-/* Wrapper around sqlite3_finalize(), for tracking statements. */
-void db_stmt_done(sqlite3_stmt *stmt);
+/* Bind positions start at 1 */
+void db_bind_null(struct db_stmt *stmt, int pos);
+void db_bind_int(struct db_stmt *stmt, int pos, int val);
+void db_bind_int64(struct db_stmt *stmt, int pos, s64 val);
+void db_bind_blob(struct db_stmt *stmt, int pos, const void *val, size_t len);
+void db_bind_text(struct db_stmt *stmt, int pos, const char *val);
+
+/* Column numbers start at 0 */
+bool db_column_is_null(struct db_stmt *stmt, int col);
+int db_column_int(struct db_stmt *stmt, int col);
+s64 db_column_int64(struct db_stmt *stmt, int col);
+const void *db_column_blob(struct db_stmt *stmt, int col);
+size_t db_column_bytes(struct db_stmt *stmt, int col);
+const unsigned char *db_column_text(struct db_stmt *stmt, int col);
 
 /* Call when you know there should be no outstanding db statements. */
 void db_assert_no_outstanding_statements(void);
@@ -153,69 +220,69 @@ void db_assert_no_outstanding_statements(void);
 void db_close_for_fork(struct db *db);
 void db_reopen_after_fork(struct db *db);
 
-#define sqlite3_column_arr(ctx, stmt, col, type)			\
-	((type *)sqlite3_column_arr_((ctx), (stmt), (col),		\
-				     sizeof(type), TAL_LABEL(type, "[]"), \
-				     __func__))
-void *sqlite3_column_arr_(const tal_t *ctx, sqlite3_stmt *stmt, int col,
-			  size_t bytes, const char *label, const char *caller);
-
-bool sqlite3_bind_short_channel_id(sqlite3_stmt *stmt, int col,
-				   const struct short_channel_id *id);
-WARN_UNUSED_RESULT bool sqlite3_column_short_channel_id(sqlite3_stmt *stmt, int col,
-							struct short_channel_id *dest);
-bool sqlite3_bind_short_channel_id_array(sqlite3_stmt *stmt, int col,
-					 const struct short_channel_id *id);
+#define db_column_arr(ctx, stmt, col, type)			\
+	((type *)db_column_arr_((ctx), (stmt), (col),		\
+				sizeof(type), TAL_LABEL(type, "[]"), \
+				__func__))
+void *db_column_arr_(const tal_t *ctx, struct db_stmt *stmt, int col,
+		     size_t bytes, const char *label, const char *caller);
+
+bool db_bind_short_channel_id(struct db_stmt *stmt, int col,
+			      const struct short_channel_id *id);
+WARN_UNUSED_RESULT bool db_column_short_channel_id(struct db_stmt *stmt, int col,
+						   struct short_channel_id *dest);
+bool db_bind_short_channel_id_array(struct db_stmt *stmt, int col,
+				    const struct short_channel_id *id);
 struct short_channel_id *
-sqlite3_column_short_channel_id_array(const tal_t *ctx,
-				      sqlite3_stmt *stmt, int col);
-bool sqlite3_bind_tx(sqlite3_stmt *stmt, int col, const struct bitcoin_tx *tx);
-struct bitcoin_tx *sqlite3_column_tx(const tal_t *ctx, sqlite3_stmt *stmt,
-				     int col);
-bool sqlite3_bind_signature(sqlite3_stmt *stmt, int col, const secp256k1_ecdsa_signature *sig);
-bool sqlite3_column_signature(sqlite3_stmt *stmt, int col, secp256k1_ecdsa_signature *sig);
-
-bool sqlite3_column_pubkey(sqlite3_stmt *stmt, int col,  struct pubkey *dest);
-bool sqlite3_bind_pubkey(sqlite3_stmt *stmt, int col, const struct pubkey *pk);
-
-bool sqlite3_column_node_id(sqlite3_stmt *stmt, int col, struct node_id *dest);
-bool sqlite3_bind_node_id(sqlite3_stmt *stmt, int col, const struct node_id *id);
-
-bool sqlite3_bind_pubkey_array(sqlite3_stmt *stmt, int col,
-			       const struct pubkey *pks);
-struct pubkey *sqlite3_column_pubkey_array(const tal_t *ctx,
-					   sqlite3_stmt *stmt, int col);
-
-bool sqlite3_bind_node_id_array(sqlite3_stmt *stmt, int col,
-				const struct node_id *ids);
-struct node_id *sqlite3_column_node_id_array(const tal_t *ctx,
-					     sqlite3_stmt *stmt, int col);
-
-bool sqlite3_column_preimage(sqlite3_stmt *stmt, int col,  struct preimage *dest);
-bool sqlite3_bind_preimage(sqlite3_stmt *stmt, int col, const struct preimage *p);
-
-bool sqlite3_column_sha256(sqlite3_stmt *stmt, int col,  struct sha256 *dest);
-bool sqlite3_bind_sha256(sqlite3_stmt *stmt, int col, const struct sha256 *p);
-
-bool sqlite3_column_sha256_double(sqlite3_stmt *stmt, int col,  struct sha256_double *dest);
-bool sqlite3_bind_sha256_double(sqlite3_stmt *stmt, int col, const struct sha256_double *p);
-struct secret *sqlite3_column_secrets(const tal_t *ctx,
-				      sqlite3_stmt *stmt, int col);
-
-struct json_escape *sqlite3_column_json_escape(const tal_t *ctx,
-					       sqlite3_stmt *stmt, int col);
-bool sqlite3_bind_json_escape(sqlite3_stmt *stmt, int col,
-			      const struct json_escape *esc);
-
-struct amount_msat sqlite3_column_amount_msat(sqlite3_stmt *stmt, int col);
-struct amount_sat sqlite3_column_amount_sat(sqlite3_stmt *stmt, int col);
-void sqlite3_bind_amount_msat(sqlite3_stmt *stmt, int col,
-			      struct amount_msat msat);
-void sqlite3_bind_amount_sat(sqlite3_stmt *stmt, int col,
-			     struct amount_sat sat);
+db_column_short_channel_id_array(const tal_t *ctx,
+				 struct db_stmt *stmt, int col);
+bool db_bind_tx(struct db_stmt *stmt, int col, const struct bitcoin_tx *tx);
+struct bitcoin_tx *db_column_tx(const tal_t *ctx, struct db_stmt *stmt,
+				int col);
+bool db_bind_signature(struct db_stmt *stmt, int col, const secp256k1_ecdsa_signature *sig);
+bool db_column_signature(struct db_stmt *stmt, int col, secp256k1_ecdsa_signature *sig);
+
+bool db_column_pubkey(struct db_stmt *stmt, int col,  struct pubkey *dest);
+bool db_bind_pubkey(struct db_stmt *stmt, int col, const struct pubkey *pk);
+
+bool db_column_node_id(struct db_stmt *stmt, int col, struct node_id *dest);
+bool db_bind_node_id(struct db_stmt *stmt, int col, const struct node_id *id);
+
+bool db_bind_pubkey_array(struct db_stmt *stmt, int col,
+			  const struct pubkey *pks);
+struct pubkey *db_column_pubkey_array(const tal_t *ctx,
+				      struct db_stmt *stmt, int col);
+
+bool db_bind_node_id_array(struct db_stmt *stmt, int col,
+			   const struct node_id *ids);
+struct node_id *db_column_node_id_array(const tal_t *ctx,
+					struct db_stmt *stmt, int col);
+
+bool db_column_preimage(struct db_stmt *stmt, int col,  struct preimage *dest);
+bool db_bind_preimage(struct db_stmt *stmt, int col, const struct preimage *p);
+
+bool db_column_sha256(struct db_stmt *stmt, int col,  struct sha256 *dest);
+bool db_bind_sha256(struct db_stmt *stmt, int col, const struct sha256 *p);
+
+bool db_column_sha256_double(struct db_stmt *stmt, int col,  struct sha256_double *dest);
+bool db_bind_sha256_double(struct db_stmt *stmt, int col, const struct sha256_double *p);
+struct secret *db_column_secrets(const tal_t *ctx,
+				 struct db_stmt *stmt, int col);
+
+struct json_escape *db_column_json_escape(const tal_t *ctx,
+					  struct db_stmt *stmt, int col);
+bool db_bind_json_escape(struct db_stmt *stmt, int col,
+			 const struct json_escape *esc);
+
+struct amount_msat db_column_amount_msat(struct db_stmt *stmt, int col);
+struct amount_sat db_column_amount_sat(struct db_stmt *stmt, int col);
+void db_bind_amount_msat(struct db_stmt *stmt, int col,
+			 struct amount_msat msat);
+void db_bind_amount_sat(struct db_stmt *stmt, int col,
+			struct amount_sat sat);
 
 /* Helpers to read and write absolute times from and to the database. */
-void sqlite3_bind_timeabs(sqlite3_stmt *stmt, int col, struct timeabs t);
-struct timeabs sqlite3_column_timeabs(sqlite3_stmt *stmt, int col);
+void db_bind_timeabs(struct db_stmt *stmt, int col, struct timeabs t);
+struct timeabs db_column_timeabs(struct db_stmt *stmt, int col);
 
 #endif /* LIGHTNING_WALLET_DB_H */
@@ -0,0 +1,111 @@
+#ifndef LIGHTNING_WALLET_DB_COMMON_H
+#define LIGHTNING_WALLET_DB_COMMON_H
+#include "config.h"
+#include <ccan/list/list.h>
+#include <ccan/short_types/short_types.h>
+#include <ccan/tal/tal.h>
+#include <stdbool.h>
+
+struct db;
+
+/* For testing, we want to catch fatal messages. */
+#ifndef db_fatal
+#define db_fatal fatal
+#endif
+
+/* A compiled statement: db_prepare() and friends hand these out. */
+struct db_stmt {
+	struct db *db;
+
+	/* The query as we were given it (before any driver rewriting) */
+	const char *query;
+
+	/* Where it was prepared, for error and leak reports. */
+	const char *location;
+
+	/* The driver's own handle */
+	void *inner_stmt;
+
+	/* Does it live in db->stmt_cache?  Then db_stmt_done() resets it
+	 * for the next user, instead of freeing it. */
+	bool cached;
+	bool in_use;
+	/* If cached: in db->stmt_lru, most recently used first. */
+	struct list_node lru;
+};
+
+/**
+ * struct db_config - What a database driver provides.
+ *
+ * Statements are compiled once and reused (see db_prepare), so drivers
+ * must support resetting and rebinding them.  Bind positions start at 1,
+ * column numbers at 0, as in sqlite3.  Errors are reported by returning
+ * false, after which @errmsg_fn describes what went wrong.
+ */
+struct db_config {
+	/* Scheme used in --wallet, eg. "sqlite3" */
+	const char *name;
+
+	/* Open db->filename, setting db->conn. */
+	bool (*setup_fn)(struct db *db);
+	void (*teardown_fn)(struct db *db);
+
+	/* Run (and shown to db_write plugins) each time we open the db */
+	const char *open_sql;
+
+	/* Apply db->tuning: NULL if not applicable. */
+	void (*tune_fn)(struct db *db);
+
+	/* Run some SQL without parameters or results. */
+	bool (*exec_fn)(struct db *db, const char *sql);
+
+	/* Compile stmt->query into stmt->inner_stmt */
+	bool (*prepare_fn)(struct db_stmt *stmt);
+	/* Drop results and bindings, so it can be used again */
+	void (*reset_fn)(struct db_stmt *stmt);
+	void (*finalize_fn)(struct db_stmt *stmt);
+
+	void (*bind_null_fn)(struct db_stmt *stmt, int pos);
+	void (*bind_int64_fn)(struct db_stmt *stmt, int pos, s64 val);
+	void (*bind_blob_fn)(struct db_stmt *stmt, int pos,
+			     const void *val, size_t len);
+	void (*bind_text_fn)(struct db_stmt *stmt, int pos,
+			     const char *val, size_t len);
+
+	/* Returns 1 if there's a row, 0 when done, -1 on error. */
+	int (*step_fn)(struct db_stmt *stmt);
+
+	bool (*column_is_null_fn)(struct db_stmt *stmt, int col);
+	s64 (*column_int64_fn)(struct db_stmt *stmt, int col);
+	const void *(*column_blob_fn)(struct db_stmt *stmt, int col);
+	size_t (*column_bytes_fn)(struct db_stmt *stmt, int col);
+	/* nul-terminated */
+	const char *(*column_text_fn)(struct db_stmt *stmt, int col);
+
+	/* Rows changed by the last statement executed */
+	size_t (*changes_fn)(struct db *db);
+	/* Id of the row the last INSERT created */
+	u64 (*last_insert_id_fn)(struct db *db);
+
+	const char *(*errmsg_fn)(struct db *db);
+
+	/* The SQL which was executed, with parameters filled in, for
+	 * db_write plugins.  NULL if the driver records changes itself. */
+	char *(*expand_fn)(const tal_t *ctx, struct db_stmt *stmt);
+
+	/* Make everything committed to db->filename so far durable, for
+	 * --db-writer-thread: NULL if not supported.  This runs in the writer
+	 * thread, so it mustn't allocate or touch db->conn; on failure it
+	 * returns false with errno set. */
+	bool (*sync_fn)(const char *filename);
+};
+
+/* Used by drivers to record SQL for the db_write hook */
+void db_changes_add(struct db *db, const char *sql);
+
+extern const struct db_config db_sqlite3_config;
+#if HAVE_POSTGRES
+extern const struct db_config db_postgres_config;
+#endif
+
+#endif /* LIGHTNING_WALLET_DB_COMMON_H */
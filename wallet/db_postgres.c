@@ -0,0 +1,588 @@
+#include "db.h"
+#include "db_common.h"
+#include <ccan/array_size/array_size.h>
+#include <ccan/str/hex/hex.h>
+#include <ccan/tal/str/str.h>
+#include <inttypes.h>
+#if HAVE_POSTGRES
+#include <libpq-fe.h>
+#endif
+#include <lightningd/log.h>
+#include <stdlib.h>
+
+#if HAVE_POSTGRES
+
+/* From postgres' catalog/pg_type.h, which isn't meant for clients */
+#define BYTEAOID 17
+
+struct db_postgres {
+	PGconn *conn;
+	/* For db_changes() */
+	size_t changes;
+	/* Prepared statements need unique names */
+	u64 next_stmt;
+	/* Copy of the last error */
+	char *errmsg;
+};
+
+struct db_postgres_stmt {
+	char *name;
+	/* Parameters, in text format (except blobs) */
+	char **values;
+	int *lengths, *formats;
+
+	/* The results, and where we're up to */
+	PGresult *res;
+	int row;
+	/* Unescaped bytea columns of this row, decoded on demand */
+	unsigned char **blobs;
+	size_t *bloblens;
+};
+
+static struct db_postgres *pg(struct db *db)
+{
+	return db->conn;
+}
+
+static void pg_seterr(struct db *db, const char *msg)
+{
+	tal_free(pg(db)->errmsg);
+	pg(db)->errmsg = tal_strdup(pg(db), msg);
+}
+
+/* Is this the start of word @w in @p (which starts at @start)? */
+static bool is_word(const char *start, const char *p, const char *w)
+{
+	size_t len = strlen(w);
+
+	if (p != start && (cisalnum(p[-1]) || p[-1] == '_'))
+		return false;
+	if (!strstarts(p, w))
+		return false;
+	return !cisalnum(p[len]) && p[len] != '_';
+}
+
+/* Skips space and returns the previous word before @p, into @word */
+static const char *prev_word(const char *start, const char *p, char *word,
+			     size_t wordlen)
+{
+	const char *end;
+
+	while (p > start && cisspace(p[-1]))
+		p--;
+	end = p;
+	while (p > start && (cisalnum(p[-1]) || p[-1] == '_'))
+		p--;
+	if ((size_t)(end - p) >= wordlen)
+		end = p + wordlen - 1;
+	memcpy(word, p, end - p);
+	word[end - p] = '\0';
+	return p;
+}
+
+/* Things we say which postgres spells differently */
+static const struct {
+	const char *sqlite3, *postgres;
+} pg_phrases[] = {
+	{ "strftime('%s', 'now')", "CAST(EXTRACT(EPOCH FROM NOW()) AS BIGINT)" },
+	/* short_channel_id used to be a "blocknum:txnum:outnum" string */
+	{ "CAST(short_channel_id AS INTEGER)",
+	  "CAST(split_part(convert_from(short_channel_id, 'UTF8'), 'x', 1)"
+	  " AS BIGINT)" },
+	{ "==", "=" },
+	/* sqlite3 doesn't mind what we put in TEXT; postgres does */
+	{ "route_channels TEXT", "route_channels BYTEA" },
+};
+
+/* Translates one statement, and returns where it ended. */
+static const char *postgres_stmt(char **sql, const char *query,
+				 int *nparams)
+{
+	const char *p, *q;
+	size_t start = strlen(*sql);
+	bool create_table = strstarts(query, "CREATE TABLE");
+	bool ddl = create_table || strstarts(query, "ALTER TABLE");
+	bool or_ignore = false, id_alias = false;
+	int anon = 0;
+
+	for (p = query; *p && *p != ';'; p++) {
+		size_t i;
+
+		for (i = 0; i < ARRAY_SIZE(pg_phrases); i++) {
+			if (strstarts(p, pg_phrases[i].sqlite3))
+				break;
+		}
+		if (i < ARRAY_SIZE(pg_phrases)) {
+			tal_append_fmt(sql, "%s", pg_phrases[i].postgres);
+			p += strlen(pg_phrases[i].sqlite3) - 1;
+			continue;
+		}
+
+		/* Pass strings through untouched */
+		if (*p == '\'') {
+			q = strchr(p + 1, '\'');
+			if (!q)
+				q = p + strlen(p) - 1;
+			tal_append_fmt(sql, "%.*s", (int)(q - p + 1), p);
+			p = q;
+			continue;
+		}
+
+		if (*p == '?') {
+			int n;
+			if (cisdigit(p[1])) {
+				n = strtol(p + 1, (char **)&q, 10);
+				p = q - 1;
+			} else
+				n = ++anon;
+			if (n > *nparams)
+				*nparams = n;
+			tal_append_fmt(sql, "$%i", n);
+			continue;
+		}
+
+		if (is_word(query, p, "INSERT OR IGNORE")) {
+			tal_append_fmt(sql, "INSERT");
+			p += strlen("INSERT OR IGNORE") - 1;
+			or_ignore = true;
+			continue;
+		}
+
+		/* We store txids in this one */
+		if (ddl && is_word(query, p, "CHAR(64)")) {
+			tal_append_fmt(sql, "BYTEA");
+			p += strlen("CHAR(64)") - 1;
+			continue;
+		}
+
+		if (ddl && is_word(query, p, "BLOB")) {
+			tal_append_fmt(sql, "BYTEA");
+			p += strlen("BLOB") - 1;
+			continue;
+		}
+
+		if (ddl && (is_word(query, p, "INTEGER")
+			    || is_word(query, p, "INT"))) {
+			char word[10];
+			const char *w = prev_word(query, p, word, sizeof(word));
+
+			/* "(id INTEGER" is sqlite3's alias for rowid */
+			while (w > query && cisspace(w[-1]))
+				w--;
+			if (create_table && streq(word, "id")
+			    && w > query && w[-1] == '(') {
+				tal_append_fmt(sql, "BIGSERIAL");
+				id_alias = true;
+			} else
+				tal_append_fmt(sql, "BIGINT");
+			p += strstarts(p, "INTEGER") ? strlen("INTEGER") - 1
+				: strlen("INT") - 1;
+			continue;
+		}
+
+		tal_append_fmt(sql, "%c", *p);
+	}
+
+	/* sqlite3 gives every table an implicit rowid, and we use it; but
+	 * not another sequence where id is one already, as that would confuse
+	 * lastval(). */
+	if (create_table && !id_alias) {
+		char *close = strrchr(*sql + start, ')');
+		if (close) {
+			char *rest = tal_strdup(tmpctx, close);
+			*close = '\0';
+			tal_append_fmt(sql, ", rowid BIGSERIAL%s", rest);
+		}
+	}
+
+	if (or_ignore)
+		tal_append_fmt(sql, " ON CONFLICT DO NOTHING");
+	return p;
+}
+
+/* Our SQL is written for sqlite3: this turns it into something postgres
+ * understands, and sets *nparams to the number of parameters.  It only needs
+ * to handle what we actually say, so it's deliberately simple-minded. */
+static char *postgres_sql(const tal_t *ctx, const char *query, int *nparams)
+{
+	char *sql = tal_strdup(ctx, "");
+	const char *p = query;
+
+	*nparams = 0;
+	for (;;) {
+		while (cisspace(*p))
+			p++;
+		if (!*p)
+			break;
+		p = postgres_stmt(&sql, p, nparams);
+		if (*p == ';') {
+			tal_append_fmt(&sql, ";");
+			p++;
+		}
+	}
+	return sql;
+}
+
+static void pg_notice_ignore(void *arg UNUSED, const char *message UNUSED)
+{
+}
+
+static bool db_postgres_setup(struct db *db)
+{
+	struct db_postgres *p = tal(db, struct db_postgres);
+
+	p->changes = 0;
+	p->next_stmt = 0;
+	p->errmsg = NULL;
+	p->conn = PQconnectdb(tal_fmt(tmpctx, "postgres://%s", db->filename));
+	db->conn = p;
+
+	if (PQstatus(p->conn) != CONNECTION_OK) {
+		pg_seterr(db, PQerrorMessage(p->conn));
+		return false;
+	}
+
+	/* Otherwise, it chatters about implicit indexes etc. on stderr */
+	PQsetNoticeProcessor(p->conn, pg_notice_ignore, NULL);
+	return true;
+}
+
+static void db_postgres_teardown(struct db *db)
+{
+	PQfinish(pg(db)->conn);
+	tal_free(pg(db));
+}
+
+/* Returns false (and sets errmsg) unless it succeeded. */
+static bool pg_result_ok(struct db *db, PGresult *res)
+{
+	switch (PQresultStatus(res)) {
+	case PGRES_COMMAND_OK:
+	case PGRES_TUPLES_OK:
+		return true;
+	default:
+		pg_seterr(db, PQresultErrorMessage(res));
+		return false;
+	}
+}
+
+static bool pg_exec(struct db *db, const char *sql)
+{
+	PGresult *res = PQexec(pg(db)->conn, sql);
+	bool ok = pg_result_ok(db, res);
+
+	if (ok)
+		pg(db)->changes = strtoul(PQcmdTuples(res), NULL, 10);
+	PQclear(res);
+	return ok;
+}
+
+static bool db_postgres_exec(struct db *db, const char *sql)
+{
+	int nparams;
+
+	return pg_exec(db, postgres_sql(tmpctx, sql, &nparams));
+}
+
+static void pg_stmt_set_nparams(struct db_postgres_stmt *s, size_t n)
+{
+	size_t old = tal_count(s->values);
+
+	if (n <= old)
+		return;
+	tal_resize(&s->values, n);
+	tal_resize(&s->lengths, n);
+	tal_resize(&s->formats, n);
+	for (size_t i = old; i < n; i++) {
+		s->values[i] = NULL;
+		s->lengths[i] = s->formats[i] = 0;
+	}
+}
+
+static bool db_postgres_prepare(struct db_stmt *stmt)
+{
+	struct db *db = stmt->db;
+	struct db_postgres_stmt *s = tal(stmt, struct db_postgres_stmt);
+	int nparams;
+	const char *sql = postgres_sql(tmpctx, stmt->query, &nparams);
+	PGresult *res;
+	bool ok;
+
+	s->name = tal_fmt(s, "s%"PRIu64, pg(db)->next_stmt++);
+	s->values = tal_arr(s, char *, 0);
+	s->lengths = tal_arr(s, int, 0);
+	s->formats = tal_arr(s, int, 0);
+	pg_stmt_set_nparams(s, nparams);
+	s->res = NULL;
+	s->blobs = NULL;
+	s->bloblens = NULL;
+
+	/* A failed statement aborts the whole transaction in postgres, but
+	 * callers (eg. db_get_version) expect to try and carry on. */
+	if (db->in_transaction && !pg_exec(db, "SAVEPOINT prepare;"))
+		return false;
+
+	res = PQprepare(pg(db)->conn, s->name, sql, 0, NULL);
+	ok = pg_result_ok(db, res);
+	PQclear(res);
+
+	if (db->in_transaction) {
+		if (!pg_exec(db, ok ? "RELEASE SAVEPOINT prepare;"
+			     : "ROLLBACK TO SAVEPOINT prepare;"))
+			ok = false;
+	}
+	if (!ok)
+		return false;
+	stmt->inner_stmt = s;
+	return true;
+}
+
+static void pg_stmt_clear_row(struct db_postgres_stmt *s)
+{
+	for (size_t i = 0; i < tal_count(s->blobs); i++)
+		PQfreemem(s->blobs[i]);
+	s->blobs = tal_free(s->blobs);
+	s->bloblens = tal_free(s->bloblens);
+}
+
+static void db_postgres_reset(struct db_stmt *stmt)
+{
+	struct db_postgres_stmt *s = stmt->inner_stmt;
+
+	pg_stmt_clear_row(s);
+	PQclear(s->res);
+	s->res = NULL;
+	for (size_t i = 0; i < tal_count(s->values); i++) {
+		s->values[i] = tal_free(s->values[i]);
+		s->lengths[i] = s->formats[i] = 0;
+	}
+}
+
+static void db_postgres_finalize(struct db_stmt *stmt)
+{
+	struct db_postgres_stmt *s = stmt->inner_stmt;
+
+	db_postgres_reset(stmt);
+	/* The server keeps prepared statements until the session ends, and
+	 * every one we prepare gets a new name, so always drop it. */
+	PQclear(PQexec(pg(stmt->db)->conn,
+		       tal_fmt(tmpctx, "DEALLOCATE %s;", s->name)));
+}
+
+static void db_postgres_bind(struct db_stmt *stmt, int pos, char *val,
+			     size_t len, int format)
+{
+	struct db_postgres_stmt *s = stmt->inner_stmt;
+
+	pg_stmt_set_nparams(s, pos);
+	tal_free(s->values[pos-1]);
+	s->values[pos-1] = val ? tal_steal(s->values, val) : NULL;
+	s->lengths[pos-1] = len;
+	s->formats[pos-1] = format;
+}
+
+static void db_postgres_bind_null(struct db_stmt *stmt, int pos)
+{
+	db_postgres_bind(stmt, pos, NULL, 0, 0);
+}
+
+static void db_postgres_bind_int64(struct db_stmt *stmt, int pos, s64 val)
+{
+	char *str = tal_fmt(NULL, "%"PRId64, val);
+	db_postgres_bind(stmt, pos, str, strlen(str), 0);
+}
+
+static void db_postgres_bind_blob(struct db_stmt *stmt, int pos,
+				  const void *val, size_t len)
+{
+	/* Binary format: passed through as-is */
+	db_postgres_bind(stmt, pos, tal_dup_arr(NULL, char, val, len, 0),
+			 len, 1);
+}
+
+static void db_postgres_bind_text(struct db_stmt *stmt, int pos,
+				  const char *val, size_t len)
+{
+	db_postgres_bind(stmt, pos, tal_strndup(NULL, val, len), len, 0);
+}
+
+static int db_postgres_step(struct db_stmt *stmt)
+{
+	struct db *db = stmt->db;
+	struct db_postgres_stmt *s = stmt->inner_stmt;
+
+	pg_stmt_clear_row(s);
+	if (s->res) {
+		s->row++;
+	} else {
+		s->res = PQexecPrepared(pg(db)->conn, s->name,
+					tal_count(s->values),
+					(const char *const *)s->values,
+					s->lengths, s->formats, 0);
+		if (!pg_result_ok(db, s->res)) {
+			PQclear(s->res);
+			s->res = NULL;
+			return -1;
+		}
+		if (PQresultStatus(s->res) == PGRES_COMMAND_OK)
+			pg(db)->changes = strtoul(PQcmdTuples(s->res), NULL, 10);
+		s->row = 0;
+	}
+	return s->row < PQntuples(s->res) ? 1 : 0;
+}
+
+static bool db_postgres_column_is_null(struct db_stmt *stmt, int col)
+{
+	struct db_postgres_stmt *s = stmt->inner_stmt;
+	return PQgetisnull(s->res, s->row, col);
+}
+
+static s64 db_postgres_column_int64(struct db_stmt *stmt, int col)
+{
+	struct db_postgres_stmt *s = stmt->inner_stmt;
+	return strtoll(PQgetvalue(s->res, s->row, col), NULL, 10);
+}
+
+/* Results come back in text format, so bytea needs decoding */
+static const void *db_postgres_column_blob(struct db_stmt *stmt, int col)
+{
+	struct db_postgres_stmt *s = stmt->inner_stmt;
+
+	if (PQgetisnull(s->res, s->row, col))
+		return NULL;
+	if (PQftype(s->res, col) != BYTEAOID)
+		return PQgetvalue(s->res, s->row, col);
+
+	if (!s->blobs) {
+		size_t n = PQnfields(s->res);
+		s->blobs = tal_arrz(s, unsigned char *, n);
+		s->bloblens = tal_arrz(s, size_t, n);
+	}
+	if (!s->blobs[col])
+		s->blobs[col] = PQunescapeBytea(
+		    (const unsigned char *)PQgetvalue(s->res, s->row, col),
+		    &s->bloblens[col]);
+	return s->blobs[col];
+}
+
+static size_t db_postgres_column_bytes(struct db_stmt *stmt, int col)
+{
+	struct db_postgres_stmt *s = stmt->inner_stmt;
+
+	if (PQgetisnull(s->res, s->row, col))
+		return 0;
+	if (PQftype(s->res, col) != BYTEAOID)
+		return PQgetlength(s->res, s->row, col);
+
+	db_postgres_column_blob(stmt, col);
+	return s->bloblens[col];
+}
+
+static const char *db_postgres_column_text(struct db_stmt *stmt, int col)
+{
+	struct db_postgres_stmt *s = stmt->inner_stmt;
+
+	if (PQgetisnull(s->res, s->row, col))
+		return NULL;
+	/* Strings stored in BYTEA columns (eg. bolt11) come back escaped */
+	if (PQftype(s->res, col) == BYTEAOID) {
+		const void *blob = db_postgres_column_blob(stmt, col);
+		return tal_strndup(tmpctx, blob, s->bloblens[col]);
+	}
+	return PQgetvalue(s->res, s->row, col);
+}
+
+static size_t db_postgres_changes(struct db *db)
+{
+	return pg(db)->changes;
+}
+
+static u64 db_postgres_last_insert_id(struct db *db)
+{
+	PGresult *res = PQexec(pg(db)->conn, "SELECT lastval();");
+	u64 id = 0;
+
+	if (pg_result_ok(db, res) && PQntuples(res) == 1)
+		id = strtoull(PQgetvalue(res, 0, 0), NULL, 10);
+	PQclear(res);
+	return id;
+}
+
+static const char *db_postgres_errmsg(struct db *db)
+{
+	if (!pg(db) || !pg(db)->errmsg)
+		return "unknown error";
+	return pg(db)->errmsg;
+}
+
+/* For db_write plugins: the statement with its parameters filled in. */
+static char *db_postgres_expand(const tal_t *ctx, struct db_stmt *stmt)
+{
+	struct db_postgres_stmt *s = stmt->inner_stmt;
+	int nparams;
+	const char *sql = postgres_sql(tmpctx, stmt->query, &nparams);
+	char *ret = tal_strdup(ctx, "");
+
+	for (const char *p = sql; *p; p++) {
+		long n;
+		char *end;
+
+		if (*p == '\'') {
+			const char *q = strchr(p + 1, '\'');
+			if (!q)
+				q = p + strlen(p) - 1;
+			tal_append_fmt(&ret, "%.*s", (int)(q - p + 1), p);
+			p = q;
+			continue;
+		}
+		if (*p != '$' || !cisdigit(p[1])) {
+			tal_append_fmt(&ret, "%c", *p);
+			continue;
+		}
+		n = strtol(p + 1, &end, 10);
+		p = end - 1;
+		if (n < 1 || n > (long)tal_count(s->values) || !s->values[n-1])
+			tal_append_fmt(&ret, "NULL");
+		else if (s->formats[n-1])
+			tal_append_fmt(&ret, "'\\x%s'",
+				       tal_hexstr(tmpctx, s->values[n-1],
+						  s->lengths[n-1]));
+		else {
+			tal_append_fmt(&ret, "'");
+			for (const char *v = s->values[n-1]; *v; v++)
+				tal_append_fmt(&ret, *v == '\'' ? "''" : "%c",
+					       *v);
+			tal_append_fmt(&ret, "'");
+		}
+	}
+	return ret;
+}
+
+const struct db_config db_postgres_config = {
+	.name = "postgres",
+	.setup_fn = db_postgres_setup,
+	.teardown_fn = db_postgres_teardown,
+	.open_sql = NULL,
+	.tune_fn = NULL,
+	.exec_fn = db_postgres_exec,
+	.prepare_fn = db_postgres_prepare,
+	.reset_fn = db_postgres_reset,
+	.finalize_fn = db_postgres_finalize,
+	.bind_null_fn = db_postgres_bind_null,
+	.bind_int64_fn = db_postgres_bind_int64,
+	.bind_blob_fn = db_postgres_bind_blob,
+	.bind_text_fn = db_postgres_bind_text,
+	.step_fn = db_postgres_step,
+	.column_is_null_fn = db_postgres_column_is_null,
+	.column_int64_fn = db_postgres_column_int64,
+	.column_blob_fn = db_postgres_column_blob,
+	.column_bytes_fn = db_postgres_column_bytes,
+	.column_text_fn = db_postgres_column_text,
+	.changes_fn = db_postgres_changes,
+	.last_insert_id_fn = db_postgres_last_insert_id,
+	.errmsg_fn = db_postgres_errmsg,
+	.expand_fn = db_postgres_expand,
+	/* The server fsyncs (or not) as it's configured to. */
+	.sync_fn = NULL,
+};
+#endif /* HAVE_POSTGRES */
@@ -0,0 +1,257 @@
+#include "db.h"
+#include "db_common.h"
+#include <ccan/tal/str/str.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <lightningd/log.h>
+#include <limits.h>
+#include <sqlite3.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#if !HAVE_SQLITE3_EXPANDED_SQL
+/* Prior to sqlite3 v3.14, we have to use tracing to dump statements */
+static void trace_sqlite3(void *dbv, const char *stmt)
+{
+	struct db *db = dbv;
+
+	/* We get a "COMMIT;" after we've sent our changes. */
+	if (!db->changes) {
+		assert(streq(stmt, "COMMIT;"));
+		return;
+	}
+
+	db_changes_add(db, stmt);
+}
+#endif
+
+static bool db_sqlite3_setup(struct db *db)
+{
+	sqlite3 *sql;
+	int flags = SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE;
+	int err = sqlite3_open_v2(db->filename, &sql, flags, NULL);
+
+	/* Even on failure we (usually) get a handle, for the error message */
+	db->conn = sql;
+	if (err != SQLITE_OK)
+		return false;
+
+#if !HAVE_SQLITE3_EXPANDED_SQL
+	sqlite3_trace(sql, trace_sqlite3, db);
+#endif
+	return true;
+}
+
+static void db_sqlite3_teardown(struct db *db)
+{
+	if (sqlite3_close(db->conn) != SQLITE_OK)
+		db_fatal("sqlite3_close: %s", sqlite3_errmsg(db->conn));
+}
+
+static bool db_sqlite3_exec(struct db *db, const char *sql)
+{
+	return sqlite3_exec(db->conn, sql, NULL, NULL, NULL) == SQLITE_OK;
+}
+
+static void db_sqlite3_exec_or_die(struct db *db, const char *sql)
+{
+	if (!db_sqlite3_exec(db, sql))
+		db_fatal("%s: %s", sql, sqlite3_errmsg(db->conn));
+}
+
+static void db_sqlite3_tune(struct db *db)
+{
+	sqlite3_stmt *stmt;
+	const char *mode;
+
+	db_sqlite3_exec_or_die(db, tal_fmt(tmpctx, "PRAGMA journal_mode = %s;",
+					   db->tuning->journal_mode));
+	db_sqlite3_exec_or_die(db, tal_fmt(tmpctx, "PRAGMA synchronous = %s;",
+					   db->tuning->synchronous));
+	db_sqlite3_exec_or_die(db, tal_fmt(tmpctx,
+					   "PRAGMA mmap_size = %"PRIu64";",
+					   db->tuning->mmap_size));
+	if (db->tuning->cache_size)
+		db_sqlite3_exec_or_die(db,
+				       tal_fmt(tmpctx, "PRAGMA cache_size = -%u;",
+					       db->tuning->cache_size));
+
+	/* sqlite3 quietly keeps the old mode if it can't (eg. WAL on a
+	 * network filesystem). */
+	if (sqlite3_prepare_v2(db->conn, "PRAGMA journal_mode;", -1, &stmt,
+			       NULL) != SQLITE_OK
+	    || sqlite3_step(stmt) != SQLITE_ROW)
+		db_fatal("Reading journal_mode: %s", sqlite3_errmsg(db->conn));
+	mode = (const char *)sqlite3_column_text(stmt, 0);
+	if (!streq(mode, db->tuning->journal_mode))
+		db_fatal("Could not set journal_mode %s: still %s",
+			 db->tuning->journal_mode, mode);
+	sqlite3_finalize(stmt);
+}
+
+static bool db_sqlite3_prepare(struct db_stmt *stmt)
+{
+	sqlite3_stmt *s;
+
+	if (sqlite3_prepare_v2(stmt->db->conn, stmt->query, -1, &s, NULL)
+	    != SQLITE_OK)
+		return false;
+	stmt->inner_stmt = s;
+	return true;
+}
+
+static void db_sqlite3_reset(struct db_stmt *stmt)
+{
+	sqlite3_reset(stmt->inner_stmt);
+	sqlite3_clear_bindings(stmt->inner_stmt);
+}
+
+static void db_sqlite3_finalize(struct db_stmt *stmt)
+{
+	sqlite3_finalize(stmt->inner_stmt);
+}
+
+static void db_sqlite3_bind_null(struct db_stmt *stmt, int pos)
+{
+	sqlite3_bind_null(stmt->inner_stmt, pos);
+}
+
+static void db_sqlite3_bind_int64(struct db_stmt *stmt, int pos, s64 val)
+{
+	sqlite3_bind_int64(stmt->inner_stmt, pos, val);
+}
+
+static void db_sqlite3_bind_blob(struct db_stmt *stmt, int pos,
+				 const void *val, size_t len)
+{
+	sqlite3_bind_blob(stmt->inner_stmt, pos, val, len, SQLITE_TRANSIENT);
+}
+
+static void db_sqlite3_bind_text(struct db_stmt *stmt, int pos,
+				 const char *val, size_t len)
+{
+	sqlite3_bind_text(stmt->inner_stmt, pos, val, len, SQLITE_TRANSIENT);
+}
+
+static int db_sqlite3_step(struct db_stmt *stmt)
+{
+	switch (sqlite3_step(stmt->inner_stmt)) {
+	case SQLITE_ROW:
+		return 1;
+	case SQLITE_DONE:
+		return 0;
+	}
+	return -1;
+}
+
+static bool db_sqlite3_column_is_null(struct db_stmt *stmt, int col)
+{
+	return sqlite3_column_type(stmt->inner_stmt, col) == SQLITE_NULL;
+}
+
+static s64 db_sqlite3_column_int64(struct db_stmt *stmt, int col)
+{
+	return sqlite3_column_int64(stmt->inner_stmt, col);
+}
+
+static const void *db_sqlite3_column_blob(struct db_stmt *stmt, int col)
+{
+	return sqlite3_column_blob(stmt->inner_stmt, col);
+}
+
+static size_t db_sqlite3_column_bytes(struct db_stmt *stmt, int col)
+{
+	return sqlite3_column_bytes(stmt->inner_stmt, col);
+}
+
+static const char *db_sqlite3_column_text(struct db_stmt *stmt, int col)
+{
+	return (const char *)sqlite3_column_text(stmt->inner_stmt, col);
+}
+
+static size_t db_sqlite3_changes(struct db *db)
+{
+	return sqlite3_changes(db->conn);
+}
+
+static u64 db_sqlite3_last_insert_id(struct db *db)
+{
+	return sqlite3_last_insert_rowid(db->conn);
+}
+
+static const char *db_sqlite3_errmsg(struct db *db)
+{
+	if (!db->conn)
+		return "out of memory";
+	return sqlite3_errmsg(db->conn);
+}
+
+#if HAVE_SQLITE3_EXPANDED_SQL
+static char *db_sqlite3_expand(const tal_t *ctx, struct db_stmt *stmt)
+{
+	char *expanded_sql = sqlite3_expanded_sql(stmt->inner_stmt);
+	char *ret = tal_strdup(ctx, expanded_sql);
+
+	sqlite3_free(expanded_sql);
+	return ret;
+}
+#endif
+
+/* With journal_mode=wal and synchronous=normal, COMMIT only write()s to the
+ * -wal file: syncing that makes it durable.  Checkpoints sync the WAL
+ * themselves before copying it into the db, so if it's gone, so is the
+ * need. */
+static bool db_sqlite3_sync(const char *filename)
+{
+	char walname[PATH_MAX];
+	int fd, saved_errno;
+	bool ok;
+
+	if (snprintf(walname, sizeof(walname), "%s-wal", filename)
+	    >= sizeof(walname)) {
+		errno = ENAMETOOLONG;
+		return false;
+	}
+
+	fd = open(walname, O_RDWR);
+	if (fd < 0)
+		return errno == ENOENT;
+
+	ok = (fdatasync(fd) == 0);
+	saved_errno = errno;
+	close(fd);
+	errno = saved_errno;
+	return ok;
+}
+
+const struct db_config db_sqlite3_config = {
+	.name = "sqlite3",
+	.setup_fn = db_sqlite3_setup,
+	.teardown_fn = db_sqlite3_teardown,
+	.open_sql = "PRAGMA foreign_keys = ON;",
+	.tune_fn = db_sqlite3_tune,
+	.exec_fn = db_sqlite3_exec,
+	.prepare_fn = db_sqlite3_prepare,
+	.reset_fn = db_sqlite3_reset,
+	.finalize_fn = db_sqlite3_finalize,
+	.bind_null_fn = db_sqlite3_bind_null,
+	.bind_int64_fn = db_sqlite3_bind_int64,
+	.bind_blob_fn = db_sqlite3_bind_blob,
+	.bind_text_fn = db_sqlite3_bind_text,
+	.step_fn = db_sqlite3_step,
+	.column_is_null_fn = db_sqlite3_column_is_null,
+	.column_int64_fn = db_sqlite3_column_int64,
+	.column_blob_fn = db_sqlite3_column_blob,
+	.column_bytes_fn = db_sqlite3_column_bytes,
+	.column_text_fn = db_sqlite3_column_text,
+	.changes_fn = db_sqlite3_changes,
+	.last_insert_id_fn = db_sqlite3_last_insert_id,
+	.errmsg_fn = db_sqlite3_errmsg,
+#if HAVE_SQLITE3_EXPANDED_SQL
+	.expand_fn = db_sqlite3_expand,
+#else
+	.expand_fn = NULL,
+#endif
+	.sync_fn = db_sqlite3_sync,
+};
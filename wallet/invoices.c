@@ -2,6 +2,7 @@
 #include "invoices.h"
 #include "wallet.h"
 #include <assert.h>
+#include <ccan/intmap/intmap.h>
 #include <ccan/list/list.h>
 #include <ccan/tal/str/str.h>
 #include <ccan/time/time.h>
@@ -12,10 +13,9 @@
 #include <lightningd/invoice.h>
 #include <lightningd/log.h>
 #include <sodium/randombytes.h>
-#include <sqlite3.h>
 #include <string.h>
 
-#define INVOICE_TBL_FIELDS "state, payment_key, payment_hash, label, msatoshi, expiry_time, pay_index, msatoshi_received, paid_timestamp, bolt11, description"
+#define INVOICE_TBL_FIELDS "state, payment_key, payment_hash, label, msatoshi, expiry_time, pay_index, msatoshi_received, paid_timestamp, bolt11, description, id"
 
 struct invoice_waiter {
 	/* Is this waiter already triggered? */
@@ -41,12 +41,113 @@ struct invoices {
 	struct timers *timers;
 	/* Waiters waiting for invoices to be paid, expired, or deleted. */
 	struct list_head waiters;
+	/* Min-heap of unpaid invoices by expiry_time, and the same entries
+	 * by invoice id, so we can take them out when paid or deleted. */
+	struct invoice_expiry **expiries;
+	UINTMAP(struct invoice_expiry *) expiry_by_id;
 	/* Earliest time for some invoice to expire */
 	u64 min_expiry_time;
 	/* Expiration timer */
 	struct oneshot *expiration_timer;
 };
 
+struct invoice_expiry {
+	u64 expiry_time;
+	u64 id;
+	/* Where it is in invoices->expiries */
+	size_t index;
+};
+
+static bool expiry_before(const struct invoice_expiry *a,
+			  const struct invoice_expiry *b)
+{
+	if (a->expiry_time != b->expiry_time)
+		return a->expiry_time < b->expiry_time;
+	return a->id < b->id;
+}
+
+static void expiry_swap(struct invoice_expiry **heap, size_t a, size_t b)
+{
+	struct invoice_expiry *tmp = heap[a];
+	heap[a] = heap[b];
+	heap[b] = tmp;
+	heap[a]->index = a;
+	heap[b]->index = b;
+}
+
+static void expiries_sift_up(struct invoice_expiry **heap, size_t i)
+{
+	while (i > 0 && expiry_before(heap[i], heap[(i - 1) / 2])) {
+		expiry_swap(heap, i, (i - 1) / 2);
+		i = (i - 1) / 2;
+	}
+}
+
+static void expiries_sift_down(struct invoice_expiry **heap, size_t i)
+{
+	size_t n = tal_count(heap);
+
+	for (;;) {
+		size_t min = i, l = 2 * i + 1, r = 2 * i + 2;
+		if (l < n && expiry_before(heap[l], heap[min]))
+			min = l;
+		if (r < n && expiry_before(heap[r], heap[min]))
+			min = r;
+		if (min == i)
+			return;
+		expiry_swap(heap, i, min);
+		i = min;
+	}
+}
+
+static struct invoice_expiry *expiry_new(struct invoices *invoices,
+					 u64 expiry_time, u64 id)
+{
+	struct invoice_expiry *e = tal(invoices->expiries,
+				       struct invoice_expiry);
+
+	e->expiry_time = expiry_time;
+	e->id = id;
+	e->index = tal_count(invoices->expiries);
+	tal_arr_expand(&invoices->expiries, e);
+	if (!uintmap_add(&invoices->expiry_by_id, id, e))
+		abort();
+	return e;
+}
+
+static void expiries_push(struct invoices *invoices, u64 expiry_time, u64 id)
+{
+	struct invoice_expiry *e = expiry_new(invoices, expiry_time, id);
+	expiries_sift_up(invoices->expiries, e->index);
+}
+
+/* Take @e out of the heap (and free it) */
+static void expiries_remove(struct invoices *invoices,
+			    struct invoice_expiry *e)
+{
+	struct invoice_expiry **heap = invoices->expiries;
+	size_t i = e->index, n = tal_count(heap) - 1;
+
+	/* The last one fills the hole, then moves wherever it belongs. */
+	heap[i] = heap[n];
+	heap[i]->index = i;
+	tal_resize(&invoices->expiries, n);
+	if (i < n) {
+		expiries_sift_up(invoices->expiries, i);
+		expiries_sift_down(invoices->expiries, i);
+	}
+	uintmap_del(&invoices->expiry_by_id, e->id);
+	tal_free(e);
+}
+
+/* It's been paid or deleted, so it won't expire. */
+static void expiries_forget(struct invoices *invoices, u64 id)
+{
+	struct invoice_expiry *e = uintmap_get(&invoices->expiry_by_id, id);
+	if (e)
+		expiries_remove(invoices, e);
+}
+
 static void trigger_invoice_waiter(struct invoice_waiter *w,
 				   const struct invoice *invoice)
 {
@@ -87,61 +188,89 @@ trigger_invoice_waiter_expire_or_delete(struct invoices *invoices,
 }
 
 static struct invoice_details *wallet_stmt2invoice_details(const tal_t *ctx,
-							   sqlite3_stmt *stmt)
+							   struct db_stmt *stmt)
 {
 	struct invoice_details *dtl = tal(ctx, struct invoice_details);
-	dtl->state = sqlite3_column_int(stmt, 0);
+	dtl->state = db_column_int(stmt, 0);
 
-	sqlite3_column_preimage(stmt, 1, &dtl->r);
+	db_column_preimage(stmt, 1, &dtl->r);
 
-	sqlite3_column_sha256(stmt, 2, &dtl->rhash);
+	db_column_sha256(stmt, 2, &dtl->rhash);
 
-	dtl->label = sqlite3_column_json_escape(dtl, stmt, 3);
+	dtl->label = db_column_json_escape(dtl, stmt, 3);
 
-	if (sqlite3_column_type(stmt, 4) != SQLITE_NULL) {
+	if (!db_column_is_null(stmt, 4)) {
 		dtl->msat = tal(dtl, struct amount_msat);
-		*dtl->msat = sqlite3_column_amount_msat(stmt, 4);
+		*dtl->msat = db_column_amount_msat(stmt, 4);
 	} else {
 		dtl->msat = NULL;
 	}
 
-	dtl->expiry_time = sqlite3_column_int64(stmt, 5);
+	dtl->expiry_time = db_column_int64(stmt, 5);
 
 	if (dtl->state == PAID) {
-		dtl->pay_index = sqlite3_column_int64(stmt, 6);
-		dtl->received = sqlite3_column_amount_msat(stmt, 7);
-		dtl->paid_timestamp = sqlite3_column_int64(stmt, 8);
+		dtl->pay_index = db_column_int64(stmt, 6);
+		dtl->received = db_column_amount_msat(stmt, 7);
+		dtl->paid_timestamp = db_column_int64(stmt, 8);
 	}
 
-	dtl->bolt11 = tal_strndup(dtl, sqlite3_column_blob(stmt, 9),
-				  sqlite3_column_bytes(stmt, 9));
+	dtl->bolt11 = tal_strndup(dtl, db_column_blob(stmt, 9),
+				  db_column_bytes(stmt, 9));
 
-	if (sqlite3_column_type(stmt, 10) != SQLITE_NULL)
+	if (!db_column_is_null(stmt, 10))
 		dtl->description = tal_strdup(
-		    dtl, (const char *)sqlite3_column_text(stmt, 10));
+		    dtl, (const char *)db_column_text(stmt, 10));
 	else
 		dtl->description = NULL;
 
+	dtl->created_index = db_column_int64(stmt, 11);
 	return dtl;
 }
 
 /* Update expirations. */
 static void update_db_expirations(struct invoices *invoices, u64 now)
 {
-	sqlite3_stmt *stmt;
+	struct db_stmt *stmt;
 	stmt = db_prepare(invoices->db,
 			  "UPDATE invoices"
 			  "   SET state = ?"
 			  " WHERE state = ?"
 			  "   AND expiry_time <= ?;");
-	sqlite3_bind_int(stmt, 1, EXPIRED);
-	sqlite3_bind_int(stmt, 2, UNPAID);
-	sqlite3_bind_int64(stmt, 3, now);
+	db_bind_int(stmt, 1, EXPIRED);
+	db_bind_int(stmt, 2, UNPAID);
+	db_bind_int64(stmt, 3, now);
 	db_exec_prepared(invoices->db, stmt);
 }
 
+/* Load the unpaid invoices into the expiry heap. */
+static void load_expiries(struct invoices *invoices)
+{
+	struct db_stmt *stmt;
+	size_t n = 0;
+
+	invoices->expiries = tal_arr(invoices, struct invoice_expiry *, 0);
+	stmt = db_select_prepare(invoices->db,
+				 "id, expiry_time"
+				 "  FROM invoices"
+				 " WHERE state = ?;");
+	db_bind_int(stmt, 1, UNPAID);
+	while (db_select_step(invoices->db, stmt))
+		expiry_new(invoices, db_column_int64(stmt, 1),
+			   db_column_int64(stmt, 0));
+	n = tal_count(invoices->expiries);
+
+	/* Heapify */
+	for (size_t i = n / 2; i > 0; i--)
+		expiries_sift_down(invoices->expiries, i - 1);
+}
+
 static void install_expiration_timer(struct invoices *invoices);
 
+static void destroy_invoices(struct invoices *invoices)
+{
+	uintmap_clear(&invoices->expiry_by_id);
+}
+
 struct invoices *invoices_new(const tal_t *ctx,
 			      struct db *db,
 			      struct log *log,
@@ -156,53 +285,46 @@ struct invoices *invoices_new(const tal_t *ctx,
 	list_head_init(&invs->waiters);
 
 	invs->expiration_timer = NULL;
+	uintmap_init(&invs->expiry_by_id);
+	tal_add_destructor(invs, destroy_invoices);
 
 	update_db_expirations(invs, time_now().ts.tv_sec);
+	load_expiries(invs);
 	install_expiration_timer(invs);
 	return invs;
 }
 
-struct invoice_id_node {
-	struct list_node list;
-	u64 id;
-};
-
 static void trigger_expiration(struct invoices *invoices)
 {
-	struct list_head idlist;
-	struct invoice_id_node *idn;
 	u64 now = time_now().ts.tv_sec;
-	sqlite3_stmt *stmt;
+	struct db_stmt *stmt;
 	struct invoice i;
+	struct invoice_expiry e;
 
 	/* Free current expiration timer */
 	invoices->expiration_timer = tal_free(invoices->expiration_timer);
 
-	/* Acquire all expired invoices and save them in a list */
-	list_head_init(&idlist);
-	stmt = db_select_prepare(invoices->db,
-				 "id"
-				 "  FROM invoices"
-				 " WHERE state = ?"
-				 "   AND expiry_time <= ?;");
-	sqlite3_bind_int(stmt, 1, UNPAID);
-	sqlite3_bind_int64(stmt, 2, now);
-	while (db_select_step(invoices->db, stmt)) {
-		idn = tal(tmpctx, struct invoice_id_node);
-		list_add_tail(&idlist, &idn->list);
-		idn->id = sqlite3_column_int64(stmt, 0);
-	}
-
-	/* Expire all those invoices */
-	update_db_expirations(invoices, now);
+	while (tal_count(invoices->expiries)
+	       && invoices->expiries[0]->expiry_time <= now) {
+		e = *invoices->expiries[0];
+		expiries_remove(invoices, invoices->expiries[0]);
+
+		/* Paid and deleted ones are gone from the heap, but be
+		 * sure not to expire anything which isn't unpaid. */
+		stmt = db_prepare(invoices->db,
+				  "UPDATE invoices"
+				  "   SET state = ?"
+				  " WHERE id = ?"
+				  "   AND state = ?;");
+		db_bind_int(stmt, 1, EXPIRED);
+		db_bind_int64(stmt, 2, e.id);
+		db_bind_int(stmt, 3, UNPAID);
+		db_exec_prepared(invoices->db, stmt);
+		if (db_changes(invoices->db) != 1)
+			continue;
 
-	/* Trigger expirations */
-	list_for_each(&idlist, idn, list) {
-		/* Trigger expiration */
-		i.id = idn->id;
-		trigger_invoice_waiter_expire_or_delete(invoices,
-							idn->id,
-							&i);
+		i.id = e.id;
+		trigger_invoice_waiter_expire_or_delete(invoices, e.id, &i);
 	}
 
 	install_expiration_timer(invoices);
@@ -210,29 +332,18 @@ static void trigger_expiration(struct invoices *invoices)
 
 static void install_expiration_timer(struct invoices *invoices)
 {
-	bool res;
-	sqlite3_stmt *stmt;
 	struct timerel rel;
 	struct timeabs expiry;
 	struct timeabs now = time_now();
 
 	assert(!invoices->expiration_timer);
 
-	/* Find unpaid invoice with nearest expiry time */
-	stmt = db_select_prepare(invoices->db,
-				 "MIN(expiry_time)"
-				 "  FROM invoices"
-				 " WHERE state = ?;");
-	sqlite3_bind_int(stmt, 1, UNPAID);
-	res = db_select_step(invoices->db, stmt);
-	assert(res);
-	if (sqlite3_column_type(stmt, 0) == SQLITE_NULL) {
-		/* Nothing to install */
-		db_stmt_done(stmt);
+	/* Nothing to install */
+	if (tal_count(invoices->expiries) == 0)
 		return;
-	} else
-		invoices->min_expiry_time = sqlite3_column_int64(stmt, 0);
-	db_stmt_done(stmt);
+
+	/* Find unpaid invoice with nearest expiry time */
+	invoices->min_expiry_time = invoices->expiries[0]->expiry_time;
 
 	memset(&expiry, 0, sizeof(expiry));
 	expiry.ts.tv_sec = invoices->min_expiry_time;
@@ -262,7 +373,7 @@ bool invoices_create(struct invoices *invoices,
 		     const struct preimage *r,
 		     const struct sha256 *rhash)
 {
-	sqlite3_stmt *stmt;
+	struct db_stmt *stmt;
 	struct invoice dummy;
 	u64 expiry_time;
 	u64 now = time_now().ts.tv_sec;
@@ -279,7 +390,7 @@ bool invoices_create(struct invoices *invoices,
 	expiry_time = now + expiry;
 
 	/* Save to database. */
-	/* Need to use the lower level API of sqlite3 to bind
+	/* Need to use the lower level API of the db to bind
 	 * label. Otherwise we'd need to implement sanitization of
 	 * that string for sql injections... */
 	stmt = db_prepare(invoices->db,
@@ -293,21 +404,22 @@ bool invoices_create(struct invoices *invoices,
 			  "            , NULL, NULL"
 			  "            , NULL, ?, ?);");
 
-	sqlite3_bind_blob(stmt, 1, rhash, sizeof(struct sha256), SQLITE_TRANSIENT);
-	sqlite3_bind_blob(stmt, 2, r, sizeof(struct preimage), SQLITE_TRANSIENT);
-	sqlite3_bind_int(stmt, 3, UNPAID);
+	db_bind_blob(stmt, 1, rhash, sizeof(struct sha256));
+	db_bind_blob(stmt, 2, r, sizeof(struct preimage));
+	db_bind_int(stmt, 3, UNPAID);
 	if (msat)
-		sqlite3_bind_amount_msat(stmt, 4, *msat);
+		db_bind_amount_msat(stmt, 4, *msat);
 	else
-		sqlite3_bind_null(stmt, 4);
-	sqlite3_bind_json_escape(stmt, 5, label);
-	sqlite3_bind_int64(stmt, 6, expiry_time);
-	sqlite3_bind_text(stmt, 7, b11enc, strlen(b11enc), SQLITE_TRANSIENT);
-	sqlite3_bind_text(stmt, 8, description, strlen(description), SQLITE_TRANSIENT);
+		db_bind_null(stmt, 4);
+	db_bind_json_escape(stmt, 5, label);
+	db_bind_int64(stmt, 6, expiry_time);
+	db_bind_text(stmt, 7, b11enc);
+	db_bind_text(stmt, 8, description);
 
 	db_exec_prepared(invoices->db, stmt);
 
-	pinvoice->id = sqlite3_last_insert_rowid(invoices->db->sql);
+	pinvoice->id = db_last_insert_id(invoices->db);
+	expiries_push(invoices, expiry_time, pinvoice->id);
 
 	/* Install expiration trigger. */
 	if (!invoices->expiration_timer ||
@@ -329,17 +441,17 @@ bool invoices_find_by_label(struct invoices *invoices,
 			    struct invoice *pinvoice,
 			    const struct json_escape *label)
 {
-	sqlite3_stmt *stmt;
+	struct db_stmt *stmt;
 
 	stmt = db_select_prepare(invoices->db,
 				 "id"
 				 "  FROM invoices"
 				 " WHERE label = ?;");
-	sqlite3_bind_json_escape(stmt, 1, label);
+	db_bind_json_escape(stmt, 1, label);
 	if (!db_select_step(invoices->db, stmt))
 		return false;
 
-	pinvoice->id = sqlite3_column_int64(stmt, 0);
+	pinvoice->id = db_column_int64(stmt, 0);
 	db_stmt_done(stmt);
 	return true;
 }
@@ -348,17 +460,17 @@ bool invoices_find_by_rhash(struct invoices *invoices,
 			    struct invoice *pinvoice,
 			    const struct sha256 *rhash)
 {
-	sqlite3_stmt *stmt;
+	struct db_stmt *stmt;
 
 	stmt = db_select_prepare(invoices->db,
 				 "id"
 				 "  FROM invoices"
 				 " WHERE payment_hash = ?;");
-	sqlite3_bind_blob(stmt, 1, rhash, sizeof(*rhash), SQLITE_TRANSIENT);
+	db_bind_blob(stmt, 1, rhash, sizeof(*rhash));
 	if (!db_select_step(invoices->db, stmt))
 		return false;
 
-	pinvoice->id = sqlite3_column_int64(stmt, 0);
+	pinvoice->id = db_column_int64(stmt, 0);
 	db_stmt_done(stmt);
 	return true;
 }
@@ -367,19 +479,19 @@ bool invoices_find_unpaid(struct invoices *invoices,
 			  struct invoice *pinvoice,
 			  const struct sha256 *rhash)
 {
-	sqlite3_stmt *stmt;
+	struct db_stmt *stmt;
 
 	stmt = db_select_prepare(invoices->db,
 				 " id"
 				 "  FROM invoices"
 				 " WHERE payment_hash = ?"
 				 "   AND state = ?;");
-	sqlite3_bind_blob(stmt, 1, rhash, sizeof(*rhash), SQLITE_TRANSIENT);
-	sqlite3_bind_int(stmt, 2, UNPAID);
+	db_bind_blob(stmt, 1, rhash, sizeof(*rhash));
+	db_bind_int(stmt, 2, UNPAID);
 	if (!db_select_step(invoices->db, stmt))
 		return false;
 
-	pinvoice->id = sqlite3_column_int64(stmt, 0);
+	pinvoice->id = db_column_int64(stmt, 0);
 	db_stmt_done(stmt);
 	return true;
 }
@@ -387,15 +499,16 @@ bool invoices_find_unpaid(struct invoices *invoices,
 bool invoices_delete(struct invoices *invoices,
 		     struct invoice invoice)
 {
-	sqlite3_stmt *stmt;
+	struct db_stmt *stmt;
 
 	/* Delete from database. */
 	stmt = db_prepare(invoices->db, "DELETE FROM invoices WHERE id=?;");
-	sqlite3_bind_int64(stmt, 1, invoice.id);
+	db_bind_int64(stmt, 1, invoice.id);
 	db_exec_prepared(invoices->db, stmt);
 
-	if (sqlite3_changes(invoices->db->sql) != 1)
+	if (db_changes(invoices->db) != 1)
 		return false;
+	expiries_forget(invoices, invoice.id);
 
 	/* Tell all the waiters about the fact that it was deleted. */
 	trigger_invoice_waiter_expire_or_delete(invoices,
@@ -406,25 +519,77 @@ bool invoices_delete(struct invoices *invoices,
 void invoices_delete_expired(struct invoices *invoices,
 			     u64 max_expiry_time)
 {
-	sqlite3_stmt *stmt;
+	struct db_stmt *stmt;
 	stmt = db_prepare(invoices->db,
 			  "DELETE FROM invoices"
 			  " WHERE state = ?"
 			  "   AND expiry_time <= ?;");
-	sqlite3_bind_int(stmt, 1, EXPIRED);
-	sqlite3_bind_int64(stmt, 2, max_expiry_time);
+	db_bind_int(stmt, 1, EXPIRED);
+	db_bind_int64(stmt, 2, max_expiry_time);
 	db_exec_prepared(invoices->db, stmt);
 }
 
+/* Each condition is a single '?', bound in the same order. */
+static struct db_stmt *invoices_select_filtered(struct invoices *invoices,
+						const struct invoice_filter *f)
+{
+	char *query = tal_strdup(tmpctx, INVOICE_TBL_FIELDS " FROM invoices");
+	const char *sep = " WHERE ";
+	struct db_stmt *stmt;
+	int pos = 1;
+
+	if (f->by_pay_index) {
+		tal_append_fmt(&query, "%spay_index >= ?", sep);
+		sep = " AND ";
+	} else if (f->start) {
+		tal_append_fmt(&query, "%sid >= ?", sep);
+		sep = " AND ";
+	}
+	if (f->status) {
+		tal_append_fmt(&query, "%sstate = ?", sep);
+		sep = " AND ";
+	}
+	if (f->paid_since) {
+		tal_append_fmt(&query, "%spaid_timestamp >= ?", sep);
+		sep = " AND ";
+	}
+	if (f->expires_before) {
+		tal_append_fmt(&query, "%sexpiry_time < ?", sep);
+		sep = " AND ";
+	}
+	tal_append_fmt(&query, " ORDER BY %s",
+		       f->by_pay_index ? "pay_index" : "id");
+	if (f->limit)
+		tal_append_fmt(&query, " LIMIT ?");
+	tal_append_fmt(&query, ";");
+
+	stmt = db_select_prepare(invoices->db, query);
+	if (f->by_pay_index || f->start)
+		db_bind_int64(stmt, pos++, f->start);
+	if (f->status)
+		db_bind_int(stmt, pos++, invoice_status_in_db(*f->status));
+	if (f->paid_since)
+		db_bind_int64(stmt, pos++, *f->paid_since);
+	if (f->expires_before)
+		db_bind_int64(stmt, pos++, *f->expires_before);
+	if (f->limit)
+		db_bind_int64(stmt, pos++, f->limit);
+	return stmt;
+}
+
 bool invoices_iterate(struct invoices *invoices,
-		      struct invoice_iterator *it)
+		      struct invoice_iterator *it,
+		      const struct invoice_filter *filter)
 {
-	sqlite3_stmt *stmt;
+	struct db_stmt *stmt;
 
 	if (!it->p) {
-		stmt = db_select_prepare(invoices->db,
-					 INVOICE_TBL_FIELDS
-					 " FROM invoices;");
+		if (filter)
+			stmt = invoices_select_filtered(invoices, filter);
+		else
+			stmt = db_select_prepare(invoices->db,
+						 INVOICE_TBL_FIELDS
+						 " FROM invoices;");
 		it->p = stmt;
 	} else
 		stmt = it->p;
@@ -441,7 +606,7 @@ invoices_iterator_deref(const tal_t *ctx, struct invoices *invoices UNUSED,
 			const struct invoice_iterator *it)
 {
 	assert(it->p);
-	return wallet_stmt2invoice_details(ctx, (sqlite3_stmt*) it->p);
+	return wallet_stmt2invoice_details(ctx, (struct db_stmt*) it->p);
 }
 
 static s64 get_next_pay_index(struct db *db)
@@ -457,16 +622,16 @@ static s64 get_next_pay_index(struct db *db)
 
 static enum invoice_status invoice_get_status(struct invoices *invoices, struct invoice invoice)
 {
-	sqlite3_stmt *stmt;
+	struct db_stmt *stmt;
 	enum invoice_status state;
 	bool res;
 
 	stmt = db_select_prepare(invoices->db,
 				 "state FROM invoices WHERE id = ?;");
-	sqlite3_bind_int64(stmt, 1, invoice.id);
+	db_bind_int64(stmt, 1, invoice.id);
 	res = db_select_step(invoices->db, stmt);
 	assert(res);
-	state = sqlite3_column_int(stmt, 0);
+	state = db_column_int(stmt, 0);
 	db_stmt_done(stmt);
 	return state;
 }
@@ -475,7 +640,7 @@ void invoices_resolve(struct invoices *invoices,
 		      struct invoice invoice,
 		      struct amount_msat received)
 {
-	sqlite3_stmt *stmt;
+	struct db_stmt *stmt;
 	s64 pay_index;
 	u64 paid_timestamp;
 	enum invoice_status state = invoice_get_status(invoices, invoice);
@@ -494,12 +659,13 @@ void invoices_resolve(struct invoices *invoices,
 			  "     , msatoshi_received=?"
 			  "     , paid_timestamp=?"
 			  " WHERE id=?;");
-	sqlite3_bind_int(stmt, 1, PAID);
-	sqlite3_bind_int64(stmt, 2, pay_index);
-	sqlite3_bind_amount_msat(stmt, 3, received);
-	sqlite3_bind_int64(stmt, 4, paid_timestamp);
-	sqlite3_bind_int64(stmt, 5, invoice.id);
+	db_bind_int(stmt, 1, PAID);
+	db_bind_int64(stmt, 2, pay_index);
+	db_bind_amount_msat(stmt, 3, received);
+	db_bind_int64(stmt, 4, paid_timestamp);
+	db_bind_int64(stmt, 5, invoice.id);
 	db_exec_prepared(invoices->db, stmt);
+	expiries_forget(invoices, invoice.id);
 
 	/* Tell all the waiters about the paid invoice. */
 	trigger_invoice_waiter_resolve(invoices, invoice.id, &invoice);
@@ -539,7 +705,7 @@ void invoices_waitany(const tal_t *ctx,
 		      void (*cb)(const struct invoice *, void*),
 		      void *cbarg)
 {
-	sqlite3_stmt *stmt;
+	struct db_stmt *stmt;
 	struct invoice invoice;
 
 	/* Look for an already-paid invoice. */
@@ -549,10 +715,10 @@ void invoices_waitany(const tal_t *ctx,
 				 " WHERE pay_index NOT NULL"
 				 "   AND pay_index > ?"
 				 " ORDER BY pay_index ASC LIMIT 1;");
-	sqlite3_bind_int64(stmt, 1, lastpay_index);
+	db_bind_int64(stmt, 1, lastpay_index);
 
 	if (db_select_step(invoices->db, stmt)) {
-		invoice.id = sqlite3_column_int64(stmt, 0);
+		invoice.id = db_column_int64(stmt, 0);
 		db_stmt_done(stmt);
 
 		cb(&invoice, cbarg);
@@ -589,7 +755,7 @@ const struct invoice_details *invoices_get_details(const tal_t *ctx,
 						   struct invoices *invoices,
 						   struct invoice invoice)
 {
-	sqlite3_stmt *stmt;
+	struct db_stmt *stmt;
 	bool res;
 	struct invoice_details *details;
 
@@ -597,7 +763,7 @@ const struct invoice_details *invoices_get_details(const tal_t *ctx,
 				 INVOICE_TBL_FIELDS
 				 " FROM invoices"
 				 " WHERE id = ?;");
-	sqlite3_bind_int64(stmt, 1, invoice.id);
+	db_bind_int64(stmt, 1, invoice.id);
 	res = db_select_step(invoices->db, stmt);
 	assert(res);
 
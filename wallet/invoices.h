@@ -11,6 +11,7 @@ struct db;
 struct json_escape;
 struct invoice;
 struct invoice_details;
+struct invoice_filter;
 struct invoice_iterator;
 struct invoices;
 struct log;
@@ -138,22 +139,24 @@ void invoices_autoclean_set(struct invoices *invoices,
 			    u64 expired_by);
 
 /**
- * invoices_iterate - Iterate over all existing invoices
+ * invoices_iterate - Iterate over existing invoices
  *
  * @invoices - the invoice handler.
  * @iterator - the iterator object to use.
+ * @filter - which invoices, or NULL for all.  Only read on the first call.
  *
  * Return false at end-of-sequence, true if still iterating.
  * Usage:
  *
  *   struct invoice_iterator it;
  *   memset(&it, 0, sizeof(it))
- *   while (invoices_iterate(wallet, &it)) {
+ *   while (invoices_iterate(wallet, &it, NULL)) {
  *       ...
  *   }
  */
 bool invoices_iterate(struct invoices *invoices,
-		      struct invoice_iterator *it);
+		      struct invoice_iterator *it,
+		      const struct invoice_filter *filter);
 
 /**
  * wallet_invoice_iterator_deref - Read the details of the
@@ -9,9 +9,12 @@ static void db_log_(struct log *log UNUSED, enum log_level level UNUSED, bool ca
 #define log_ db_log_
 
 #include "wallet/db.c"
+#include "wallet/db_postgres.c"
+#include "wallet/db_sqlite3.c"
 
 #include "test_utils.h"
 
+#include <ccan/mem/mem.h>
 #include <common/amount.h>
 #include <common/memleak.h>
 #include <stdio.h>
@@ -37,12 +40,30 @@ void plugin_hook_db_sync(struct db *db UNNEEDED, const char **changes UNNEEDED,
 {
 }
 
-static struct db *create_test_db(void)
+/* With TEST_DB_POSTGRES set (eg. "postgres://postgres@localhost/ltests"),
+ * the tests which don't care about the driver run against that database
+ * too.  We empty it first, so don't point it at anything you want to keep! */
+static struct db *create_test_db(const char *dsn)
 {
 	struct db *db;
 	char filename[] = "/tmp/ldb-XXXXXX";
+	int fd;
 
-	int fd = mkstemp(filename);
+	if (dsn) {
+		db = db_open(NULL, dsn);
+		if (db_err) {
+			fprintf(stderr, "%s\n", db_err);
+			db_err = tal_free(db_err);
+			return tal_free(db);
+		}
+		db_begin_transaction(db);
+		db_exec(__func__, db, "DROP SCHEMA public CASCADE;");
+		db_exec(__func__, db, "CREATE SCHEMA public;");
+		db_commit_transaction(db);
+		return db;
+	}
+
+	fd = mkstemp(filename);
 	if (fd == -1)
 		return NULL;
 	close(fd);
@@ -51,25 +72,30 @@ static struct db *create_test_db(void)
 	return db;
 }
 
-static bool test_empty_db_migrate(struct lightningd *ld)
+static bool test_empty_db_migrate(struct lightningd *ld, const char *dsn)
 {
-	struct db *db = create_test_db();
+	struct db *db = create_test_db(dsn);
 	CHECK(db);
 	db_begin_transaction(db);
 	CHECK(db_get_version(db) == -1);
 	db_commit_transaction(db);
 	db_migrate(ld, db, NULL);
+	CHECK_MSG(!db_err, "Migrations failed");
 	db_begin_transaction(db);
 	CHECK(db_get_version(db) == ARRAY_SIZE(dbmigrations) - 1);
 	db_commit_transaction(db);
 
+	/* Nothing left to do the second time */
+	db_migrate(ld, db, NULL);
+	CHECK(!db_err);
+
 	tal_free(db);
 	return true;
 }
 
 static bool test_primitives(void)
 {
-	struct db *db = create_test_db();
+	struct db *db = create_test_db(NULL);
 	db_begin_transaction(db);
 	CHECK(db->in_transaction);
 	db_commit_transaction(db);
@@ -91,9 +117,9 @@ static bool test_primitives(void)
 	return true;
 }
 
-static bool test_vars(struct lightningd *ld)
+static bool test_vars(struct lightningd *ld, const char *dsn)
 {
-	struct db *db = create_test_db();
+	struct db *db = create_test_db(dsn);
 	char *varname = "testvar";
 	CHECK(db);
 	db_migrate(ld, db, NULL);
@@ -115,6 +141,272 @@ static bool test_vars(struct lightningd *ld)
 	return true;
 }
 
+static bool test_dsn(void)
+{
+	const char *filename;
+
+	CHECK(db_config_for("/tmp/ldb", &filename) == &db_sqlite3_config);
+	CHECK(streq(filename, "/tmp/ldb"));
+	CHECK(db_config_for("sqlite3:///tmp/ldb", &filename)
+	      == &db_sqlite3_config);
+	CHECK(streq(filename, "/tmp/ldb"));
+#if HAVE_POSTGRES
+	CHECK(db_config_for("postgresql://u@host/db", &filename)
+	      == &db_postgres_config);
+	CHECK(streq(filename, "u@host/db"));
+#endif
+	CHECK(!db_err);
+	db_config_for("mysql://u@host/db", &filename);
+	CHECK_MSG(db_err, "Unsupported database");
+	db_err = tal_free(db_err);
+	return true;
+}
+
+static bool test_stmt_cache(struct lightningd *ld, const char *dsn)
+{
+	struct db *db = create_test_db(dsn);
+	struct db_stmt *stmt, *stmt2, *stmt3;
+	CHECK(db);
+	db_migrate(ld, db, NULL);
+
+	db_begin_transaction(db);
+	stmt = db_prepare(db, "INSERT INTO vars (name, val) VALUES (?, ?);");
+	db_bind_text(stmt, 1, "a");
+	db_bind_int64(stmt, 2, 1);
+	db_exec_prepared(db, stmt);
+
+	/* Same query gets the same statement back, without old bindings */
+	stmt2 = db_prepare(db, "INSERT INTO vars (name, val) VALUES (?, ?);");
+	CHECK(stmt2 == stmt);
+	db_bind_text(stmt2, 1, "b");
+	db_exec_prepared(db, stmt2);
+
+	/* While it's in use, we get another one. */
+	stmt = db_select_prepare(db, "val FROM vars WHERE name = ?;");
+	stmt2 = db_select_prepare(db, "val FROM vars WHERE name = ?;");
+	CHECK(stmt2 != stmt);
+	db_bind_text(stmt, 1, "a");
+	CHECK(db_select_step(db, stmt));
+	CHECK(db_column_int64(stmt, 0) == 1);
+	db_stmt_done(stmt);
+	db_bind_text(stmt2, 1, "b");
+	CHECK(db_select_step(db, stmt2));
+	CHECK(db_column_is_null(stmt2, 0));
+	db_stmt_done(stmt2);
+
+	/* The first one went back in the cache. */
+	stmt3 = db_select_prepare(db, "val FROM vars WHERE name = ?;");
+	CHECK(stmt3 == stmt);
+	db_stmt_done(stmt3);
+
+	/* Plenty of one-off queries only push out the oldest statements. */
+	for (size_t i = 0; i < DB_STMT_CACHE_MAX * 2; i++) {
+		stmt2 = db_prepare(db, tal_fmt(tmpctx,
+					       "DELETE FROM vars WHERE val = '%zu';",
+					       i));
+		db_exec_prepared(db, stmt2);
+		CHECK(db->num_cached <= DB_STMT_CACHE_MAX);
+		if (i % 16 == 0) {
+			stmt3 = db_select_prepare(db, "val FROM vars WHERE name = ?;");
+			CHECK(stmt3 == stmt);
+			db_stmt_done(stmt3);
+		}
+	}
+	db_commit_transaction(db);
+
+	/* We can still close with them cached. */
+	tal_free(db);
+	return true;
+}
+
+/* What we write into the wallet's tables, we must read back unchanged. */
+static bool test_roundtrip(struct lightningd *ld, const char *dsn)
+{
+	struct db *db = create_test_db(dsn);
+	struct db_stmt *stmt;
+	struct sha256 hash, hash2;
+	struct amount_msat msat = AMOUNT_MSAT(1ULL << 62);
+	struct timeabs t;
+	u8 blob[33];
+	u64 peer_dbid;
+	CHECK(db);
+	db_migrate(ld, db, NULL);
+
+	memset(&hash, 0xAB, sizeof(hash));
+	t.ts.tv_sec = 1565000000;
+	t.ts.tv_nsec = 123456789;
+	/* Including the bytes text would choke on */
+	for (size_t i = 0; i < sizeof(blob); i++)
+		blob[i] = i * 8;
+
+	db_begin_transaction(db);
+	stmt = db_prepare(db, "INSERT INTO peers (node_id, address) VALUES (?, ?);");
+	db_bind_blob(stmt, 1, blob, sizeof(blob));
+	db_bind_text(stmt, 2, "it's 127.0.0.1:9735");
+	db_exec_prepared(db, stmt);
+	peer_dbid = db_last_insert_id(db);
+	CHECK(peer_dbid != 0);
+
+	/* Unique node_id: this is a no-op, not an error */
+	stmt = db_prepare(db, "INSERT OR IGNORE INTO peers (node_id, address) VALUES (?, ?);");
+	db_bind_blob(stmt, 1, blob, sizeof(blob));
+	db_bind_null(stmt, 2);
+	db_exec_prepared(db, stmt);
+	CHECK(db_changes(db) == 0);
+
+	stmt = db_select_prepare(db, "id, node_id, address FROM peers;");
+	CHECK(db_select_step(db, stmt));
+	CHECK(db_column_int64(stmt, 0) == (s64)peer_dbid);
+	CHECK(memeq(db_column_blob(stmt, 1), db_column_bytes(stmt, 1),
+		    blob, sizeof(blob)));
+	CHECK(streq((const char *)db_column_text(stmt, 2),
+		    "it's 127.0.0.1:9735"));
+	CHECK(!db_select_step(db, stmt));
+
+	db_exec(__func__, db,
+		"INSERT INTO channels (id, peer_id) VALUES (1, %"PRIu64");",
+		peer_dbid);
+	stmt = db_prepare(db, "INSERT INTO channel_htlcs (channel_id,"
+			  " channel_htlc_id, direction, msatoshi, cltv_expiry,"
+			  " payment_hash, payment_key, received_time)"
+			  " VALUES (1, ?, 0, ?, ?, ?, ?, ?);");
+	db_bind_int64(stmt, 1, INT64_MAX);
+	db_bind_amount_msat(stmt, 2, msat);
+	db_bind_int(stmt, 3, -1);
+	db_bind_sha256(stmt, 4, &hash);
+	db_bind_null(stmt, 5);
+	db_bind_timeabs(stmt, 6, t);
+	db_exec_prepared(db, stmt);
+	CHECK(db_changes(db) == 1);
+
+	stmt = db_select_prepare(db, "channel_htlc_id, msatoshi, cltv_expiry,"
+				 " payment_hash, payment_key, received_time,"
+				 " routing_onion FROM channel_htlcs"
+				 " WHERE payment_hash = ?;");
+	db_bind_sha256(stmt, 1, &hash);
+	CHECK(db_select_step(db, stmt));
+	CHECK(db_column_int64(stmt, 0) == INT64_MAX);
+	CHECK(amount_msat_eq(db_column_amount_msat(stmt, 1), msat));
+	CHECK(db_column_int(stmt, 2) == -1);
+	CHECK(db_column_sha256(stmt, 3, &hash2));
+	CHECK(sha256_eq(&hash, &hash2));
+	CHECK(db_column_is_null(stmt, 4));
+	CHECK(timeabs_eq(db_column_timeabs(stmt, 5), t));
+	CHECK(db_column_is_null(stmt, 6));
+	CHECK(!db_select_step(db, stmt));
+
+	/* Deleting the peer takes its channels and their HTLCs with it */
+	stmt = db_prepare(db, "DELETE FROM peers WHERE id = ?;");
+	db_bind_int64(stmt, 1, peer_dbid);
+	db_exec_prepared(db, stmt);
+	stmt = db_select(db, "COUNT(*) FROM channel_htlcs;");
+	CHECK(db_select_step(db, stmt));
+	CHECK(db_column_int(stmt, 0) == 0);
+	db_stmt_done(stmt);
+	db_commit_transaction(db);
+	CHECK(!db_err);
+
+	tal_free(db);
+	return true;
+}
+
+static bool test_tuning(void)
+{
+	struct db *db = create_test_db(NULL);
+	struct db_stmt *stmt;
+	CHECK(db);
+
+	db->tuning = tal(db, struct db_tuning);
+	db->tuning->journal_mode = "wal";
+	db->tuning->synchronous = "normal";
+	db->tuning->mmap_size = 1 << 20;
+	db->tuning->cache_size = 4096;
+	db_tune(db);
+	CHECK_MSG(!db_err, "Tuning pragmas");
+	CHECK(!db->changes);
+
+	db_begin_transaction(db);
+	stmt = db_query(__func__, db, "PRAGMA journal_mode;");
+	CHECK(db_select_step(db, stmt));
+	CHECK(streq((const char *)db_column_text(stmt, 0), "wal"));
+	db_stmt_done(stmt);
+	stmt = db_query(__func__, db, "PRAGMA synchronous;");
+	CHECK(db_select_step(db, stmt));
+	/* NORMAL */
+	CHECK(db_column_int(stmt, 0) == 1);
+	db_stmt_done(stmt);
+	db_commit_transaction(db);
+
+	/* It sticks across reopening, too */
+	db_close_for_fork(db);
+	db_reopen_after_fork(db);
+	db_begin_transaction(db);
+	stmt = db_query(__func__, db, "PRAGMA synchronous;");
+	CHECK(db_select_step(db, stmt));
+	CHECK(db_column_int(stmt, 0) == 1);
+	db_stmt_done(stmt);
+	db_commit_transaction(db);
+
+	tal_free(db);
+	return true;
+}
+
+static int num_durable;
+static void durable_cb(int *order)
+{
+	*order = ++num_durable;
+}
+
+static bool test_writer_thread(void)
+{
+	struct db *db = create_test_db(NULL);
+	/* When each callback ran */
+	int order[5] = { 0 };
+	const tal_t *cancel;
+	CHECK(db);
+
+	db->tuning = tal(db, struct db_tuning);
+	db->tuning->journal_mode = "wal";
+	db->tuning->synchronous = "normal";
+	db->tuning->mmap_size = 0;
+	db->tuning->cache_size = 0;
+	db_tune(db);
+	db_start_writer(db);
+	CHECK(!db_err);
+
+	/* Nothing committed yet: immediate */
+	db_after_durable(db, db, durable_cb, &order[1]);
+	CHECK(order[1] == 1);
+
+	db_begin_transaction(db);
+	db_exec(__func__, db, "CREATE TABLE foo (x INTEGER);");
+	db_after_durable(db, db, durable_cb, &order[2]);
+	cancel = tal(db, char);
+	db_after_durable(db, cancel, durable_cb, &order[3]);
+	CHECK(order[2] == 0);
+	db_commit_transaction(db);
+	/* This one waits for the same commit, so comes after */
+	db_after_durable(db, db, durable_cb, &order[4]);
+	tal_free(cancel);
+
+	db_writer_flush(db->writer);
+	CHECK(atomic_load(&db->writer->durable) == 1);
+	db_writer_release(db->writer);
+	CHECK(order[2] == 2);
+	CHECK(order[3] == 0);
+	CHECK(order[4] == 3);
+
+	/* It gets stopped and restarted across fork */
+	db_close_for_fork(db);
+	db_reopen_after_fork(db);
+	db_begin_transaction(db);
+	db_exec(__func__, db, "INSERT INTO foo VALUES (1);");
+	db_commit_transaction(db);
+	tal_free(db);
+	CHECK(!db_err);
+	return true;
+}
+
 int main(void)
 {
 	setup_locale();
@@ -122,11 +414,29 @@ int main(void)
 	bool ok = true;
 	/* Dummy for migration hooks */
 	struct lightningd *ld = tal(NULL, struct lightningd);
+	const char *pg_dsn = getenv("TEST_DB_POSTGRES");
 	ld->config = test_config;
 
-	ok &= test_empty_db_migrate(ld);
-	ok &= test_vars(ld);
+	ok &= test_empty_db_migrate(ld, NULL);
+	ok &= test_vars(ld, NULL);
 	ok &= test_primitives();
+	ok &= test_dsn();
+	ok &= test_stmt_cache(ld, NULL);
+	ok &= test_roundtrip(ld, NULL);
+	ok &= test_tuning();
+	ok &= test_writer_thread();
+
+	if (pg_dsn) {
+#if HAVE_POSTGRES
+		ok &= test_empty_db_migrate(ld, pg_dsn);
+		ok &= test_vars(ld, pg_dsn);
+		ok &= test_stmt_cache(ld, pg_dsn);
+		ok &= test_roundtrip(ld, pg_dsn);
+#else
+		fprintf(stderr, "TEST_DB_POSTGRES needs ./configure --enable-postgres\n");
+		ok = false;
+#endif
+	}
 
 	tal_free(ld);
 	return !ok;
@@ -10,12 +10,15 @@ static void db_log_(struct log *log UNUSED, enum log_level level UNUSED, bool ca
 #define log_ db_log_
 
 #include "wallet/wallet.c"
+#include "wallet/txfilter.c"
 #include "lightningd/htlc_end.c"
 #include "lightningd/peer_control.c"
 #include "lightningd/peer_htlcs.c"
 #include "lightningd/channel.c"
 
 #include "wallet/db.c"
+#include "wallet/db_postgres.c"
+#include "wallet/db_sqlite3.c"
 
 #include <ccan/mem/mem.h>
 #include <ccan/tal/str/str.h>
@@ -160,7 +163,8 @@ const struct invoice_details *invoices_get_details(const tal_t *ctx UNNEEDED,
 { fprintf(stderr, "invoices_get_details called!\n"); abort(); }
 /* Generated stub for invoices_iterate */
 bool invoices_iterate(struct invoices *invoices UNNEEDED,
-		      struct invoice_iterator *it UNNEEDED)
+		      struct invoice_iterator *it UNNEEDED,
+		      const struct invoice_filter *filter UNNEEDED)
 { fprintf(stderr, "invoices_iterate called!\n"); abort(); }
 /* Generated stub for invoices_iterator_deref */
 const struct invoice_details *invoices_iterator_deref(
@@ -375,21 +379,6 @@ enum watch_result onchaind_funding_spent(struct channel *channel UNNEEDED,
 /* Generated stub for onion_type_name */
 const char *onion_type_name(int e UNNEEDED)
 { fprintf(stderr, "onion_type_name called!\n"); abort(); }
-/* Generated stub for outpointfilter_add */
-void outpointfilter_add(struct outpointfilter *of UNNEEDED,
-			const struct bitcoin_txid *txid UNNEEDED, const u32 outnum UNNEEDED)
-{ fprintf(stderr, "outpointfilter_add called!\n"); abort(); }
-/* Generated stub for outpointfilter_matches */
-bool outpointfilter_matches(struct outpointfilter *of UNNEEDED,
-			    const struct bitcoin_txid *txid UNNEEDED, const u32 outnum UNNEEDED)
-{ fprintf(stderr, "outpointfilter_matches called!\n"); abort(); }
-/* Generated stub for outpointfilter_new */
-struct outpointfilter *outpointfilter_new(tal_t *ctx UNNEEDED)
-{ fprintf(stderr, "outpointfilter_new called!\n"); abort(); }
-/* Generated stub for outpointfilter_remove */
-void outpointfilter_remove(struct outpointfilter *of UNNEEDED,
-			   const struct bitcoin_txid *txid UNNEEDED, const u32 outnum UNNEEDED)
-{ fprintf(stderr, "outpointfilter_remove called!\n"); abort(); }
 /* Generated stub for param */
 bool param(struct command *cmd UNNEEDED, const char *buffer UNNEEDED,
 	   const jsmntok_t params[] UNNEEDED, ...)
@@ -673,12 +662,6 @@ const char *log_prefix(const struct log *log UNNEEDED)
 	return "";
 }
 
-void txfilter_add_scriptpubkey(struct txfilter *filter UNNEEDED, const u8 *script TAKES)
-{
-	if (taken(script))
-		tal_free(script);
-}
-
 /**
  * mempat -- Set the memory to a pattern
  *
@@ -725,6 +708,11 @@ static struct wallet *create_test_wallet(struct lightningd *ld, const tal_t *ctx
 	db_migrate(ld, w->db, w->log);
 	CHECK_MSG(!wallet_err, "DB migration failed");
 	w->max_channel_dbid = 0;
+	w->htlc_batch_depth = 0;
+	w->htlc_updates = NULL;
+	w->available_utxos = available_utxos_new(w);
+	w->owned_outpoints = outpointfilter_new(w);
+	w->utxoset_outpoints = outpointfilter_new(w);
 
 	return w;
 }
@@ -773,9 +761,20 @@ static bool test_wallet_outputs(struct lightningd *ld, const tal_t *ctx)
 	CHECK(u.close_info->channel_id == 42 &&
 	      pubkey_eq(&u.close_info->commitment_point, &pk) &&
 	      node_id_eq(&u.close_info->peer_id, &id));
+	/* Reserved ones can't be selected again */
+	CHECK(!wallet_select_coins(w, w, AMOUNT_SAT(1), 0, 21, 0,
+				   &fee_estimate, &change_satoshis));
+
 	/* Now un-reserve them for the tests below */
 	tal_free(utxos);
 
+	/* An exact match needs no change, and only one input */
+	utxos = wallet_select_coins(w, w, AMOUNT_SAT(1), 0, 21, 0,
+				    &fee_estimate, &change_satoshis);
+	CHECK(utxos && tal_count(utxos) == 1);
+	CHECK(amount_sat_eq(change_satoshis, AMOUNT_SAT(0)));
+	tal_free(utxos);
+
 
 	/* Attempt to reserve the utxo */
 	CHECK_MSG(wallet_update_output_status(w, &u.txid, u.outnum,
@@ -805,6 +804,284 @@ static bool test_wallet_outputs(struct lightningd *ld, const tal_t *ctx)
 	return true;
 }
 
+/* The in-memory set of available outputs must match the db. */
+static bool available_utxos_in_sync(struct wallet *w)
+{
+	struct utxo **utxos = wallet_get_utxos(tmpctx, w,
+					       output_state_available);
+	struct available_utxos_iter it;
+	size_t num = 0;
+
+	for (struct utxo *u = available_utxos_first(w->available_utxos, &it);
+	     u;
+	     u = available_utxos_next(w->available_utxos, &it))
+		num++;
+	CHECK(num == tal_count(utxos));
+
+	for (size_t i = 0; i < tal_count(utxos); i++) {
+		struct utxo *u = available_utxo_find(w, &utxos[i]->txid,
+						     utxos[i]->outnum);
+		CHECK(u);
+		CHECK(amount_sat_eq(u->amount, utxos[i]->amount));
+		CHECK(!u->blockheight == !utxos[i]->blockheight);
+		CHECK(!u->blockheight
+		      || *u->blockheight == *utxos[i]->blockheight);
+		CHECK(!u->spendheight == !utxos[i]->spendheight);
+	}
+	return true;
+}
+
+static bool test_wallet_coin_selection(struct lightningd *ld,
+				       const tal_t *ctx)
+{
+	struct wallet *w = create_test_wallet(ld, ctx);
+	/* The last one costs more to spend than it's worth. */
+	const u64 amounts[] = { 10000, 20000, 30000, 50000, 200 };
+	struct bitcoin_txid txids[ARRAY_SIZE(amounts)];
+	struct amount_sat fee_estimate, change_satoshis, total;
+	const struct utxo **utxos;
+	struct block b;
+	struct utxo u;
+	CHECK(w);
+
+	db_begin_transaction(w->db);
+	for (size_t i = 0; i < ARRAY_SIZE(amounts); i++) {
+		memset(&u, 0, sizeof(u));
+		memset(&u.txid, i + 1, sizeof(u.txid));
+		u.amount.satoshis = amounts[i]; /* Raw: test code */
+		CHECK(wallet_add_utxo(w, &u, p2wpkh));
+		txids[i] = u.txid;
+	}
+	CHECK(available_utxos_in_sync(w));
+
+	/* At 1000 sat/kw, each input costs 279 sats, a P2WPKH output 124 and
+	 * the rest of the tx 40.  Inputs worth 39442 (30000 and 10000, after
+	 * paying for themselves) are enough for 39200 and the tx, and within
+	 * the cost of a change output over: the 78 left goes to fees. */
+	utxos = wallet_select_coins(w, w, AMOUNT_SAT(39200), 1000,
+				    BITCOIN_SCRIPTPUBKEY_P2WPKH_LEN, 0,
+				    &fee_estimate, &change_satoshis);
+	CHECK(utxos && tal_count(utxos) == 2);
+	CHECK(amount_sat_eq(change_satoshis, AMOUNT_SAT(0)));
+	CHECK(amount_sat_eq(fee_estimate, AMOUNT_SAT(800)));
+	total = AMOUNT_SAT(0);
+	for (size_t i = 0; i < tal_count(utxos); i++)
+		CHECK(amount_sat_add(&total, total, utxos[i]->amount));
+	CHECK(amount_sat_eq(total, AMOUNT_SAT(40000)));
+	/* They're reserved now. */
+	CHECK(available_utxos_in_sync(w));
+	tal_free(utxos);
+	CHECK(available_utxos_in_sync(w));
+
+	/* Nothing lands close enough to 45000: largest first, with change. */
+	utxos = wallet_select_coins(w, w, AMOUNT_SAT(45000), 1000,
+				    BITCOIN_SCRIPTPUBKEY_P2WPKH_LEN, 0,
+				    &fee_estimate, &change_satoshis);
+	CHECK(utxos && tal_count(utxos) == 1);
+	CHECK(amount_sat_eq(utxos[0]->amount, AMOUNT_SAT(50000)));
+	CHECK(amount_sat_eq(fee_estimate, AMOUNT_SAT(288 + 279)));
+	CHECK(amount_sat_eq(change_satoshis, AMOUNT_SAT(50000 - 45000 - 567)));
+	tal_free(utxos);
+
+	/* Can't afford it (the dust doesn't help): nothing gets reserved. */
+	CHECK(!wallet_select_coins(w, w, AMOUNT_SAT(110000), 1000,
+				   BITCOIN_SCRIPTPUBKEY_P2WPKH_LEN, 0,
+				   &fee_estimate, &change_satoshis));
+	CHECK(available_utxos_in_sync(w));
+
+	/* Only confirmed outputs count once we ask for confirmations. */
+	memset(&b, 0, sizeof(b));
+	for (b.height = 100; b.height <= 101; b.height++) {
+		memset(&b.blkid, b.height, sizeof(b.blkid));
+		wallet_block_add(w, &b);
+	}
+	wallet_confirm_tx(w, &txids[3], 100);
+	CHECK(available_utxos_in_sync(w));
+	utxos = wallet_select_coins(w, w, AMOUNT_SAT(20000), 1000,
+				    BITCOIN_SCRIPTPUBKEY_P2WPKH_LEN, 100,
+				    &fee_estimate, &change_satoshis);
+	CHECK(utxos && tal_count(utxos) == 1);
+	CHECK(bitcoin_txid_eq(&utxos[0]->txid, &txids[3]));
+
+	/* Spending it takes it out for good. */
+	wallet_confirm_utxos(w, utxos);
+	tal_free(utxos);
+	CHECK(!available_utxo_find(w, &txids[3], 0));
+	CHECK(available_utxos_in_sync(w));
+
+	wallet_confirm_tx(w, &txids[2], 101);
+	CHECK(available_utxos_in_sync(w));
+	utxos = wallet_select_coins(w, w, AMOUNT_SAT(20000), 1000,
+				    BITCOIN_SCRIPTPUBKEY_P2WPKH_LEN, 101,
+				    &fee_estimate, &change_satoshis);
+	CHECK(utxos && tal_count(utxos) == 1);
+	CHECK(bitcoin_txid_eq(&utxos[0]->txid, &txids[2]));
+	tal_free(utxos);
+
+	/* Block 101 goes away, and with it that confirmation. */
+	wallet_blocks_rollback(w, 100);
+	CHECK(available_utxos_in_sync(w));
+	CHECK(!available_utxo_find(w, &txids[2], 0)->blockheight);
+	CHECK(!wallet_select_coins(w, w, AMOUNT_SAT(20000), 1000,
+				   BITCOIN_SCRIPTPUBKEY_P2WPKH_LEN, 101,
+				   &fee_estimate, &change_satoshis));
+	CHECK(available_utxos_in_sync(w));
+
+	db_commit_transaction(w->db);
+	return true;
+}
+
+static struct short_channel_id mk_scid(u32 blockheight, u32 txindex,
+				       u32 outnum)
+{
+	struct short_channel_id scid;
+
+	if (!mk_short_channel_id(&scid, blockheight, txindex, outnum))
+		abort();
+	return scid;
+}
+
+static bool utxoset_has(struct wallet *w, const struct outpoint *o)
+{
+	struct short_channel_id scid = mk_scid(o->blockheight, o->txindex,
+					       o->outnum);
+	struct outpoint *op = tal_steal(tmpctx,
+					wallet_outpoint_for_scid(w, NULL, &scid));
+
+	if (!op)
+		return false;
+	CHECK(bitcoin_txid_eq(&op->txid, &o->txid));
+	CHECK(op->blockheight == o->blockheight);
+	CHECK(op->txindex == o->txindex);
+	CHECK(op->outnum == o->outnum);
+	CHECK(amount_sat_eq(op->sat, o->sat));
+	CHECK(memeq(op->scriptpubkey, tal_bytelen(op->scriptpubkey),
+		    o->scriptpubkey, tal_bytelen(o->scriptpubkey)));
+	CHECK(outpointfilter_matches(w->utxoset_outpoints,
+				     &o->txid, o->outnum));
+	return true;
+}
+
+static bool test_wallet_utxoset(struct lightningd *ld, const tal_t *ctx)
+{
+	struct wallet *w = create_test_wallet(ld, ctx);
+	struct outpoint *ops = tal_arr(ctx, struct outpoint, 0);
+	const struct short_channel_id *spent;
+	struct short_channel_id scid;
+	struct db_stmt *stmt;
+	size_t num;
+	CHECK(w);
+
+	/* More than one INSERT's worth in block 100, then one in block 101
+	 * and one which can't have a short_channel_id (outnum > 65535). */
+	num = UTXOSET_INSERT_MAX_BATCH + 3;
+	for (size_t i = 0; i < num; i++) {
+		struct outpoint o;
+
+		memset(&o, 0, sizeof(o));
+		memset(&o.txid, i < num - 2 ? 1 : 2, sizeof(o.txid));
+		o.blockheight = i < num - 2 ? 100 : 101;
+		o.txindex = i < num - 2 ? 1 : 2;
+		o.outnum = i < num - 2 ? i : (i == num - 2 ? 0 : 65536);
+		o.sat.satoshis = 1000 + i; /* Raw: test code */
+		o.scriptpubkey = tal_arrz(ops, u8, 34);
+		o.scriptpubkey[33] = i;
+		tal_arr_expand(&ops, o);
+	}
+
+	db_begin_transaction(w->db);
+	wallet_utxoset_add(w, ops);
+
+	for (size_t i = 0; i < num - 1; i++)
+		CHECK(utxoset_has(w, &ops[i]));
+	CHECK(!outpointfilter_matches(w->utxoset_outpoints,
+				      &ops[num-1].txid, ops[num-1].outnum));
+	stmt = db_select(w->db, "COUNT(*) FROM utxoset;");
+	CHECK(db_select_step(w->db, stmt));
+	CHECK(db_column_int64(stmt, 0) == num - 1);
+	db_stmt_done(stmt);
+
+	/* Block 101 spends one from block 100: only once. */
+	spent = wallet_outpoint_spend(w, ctx, 101, &ops[3].txid, 3);
+	scid = mk_scid(100, 1, 3);
+	CHECK(spent && short_channel_id_eq(spent, &scid));
+	CHECK(!utxoset_has(w, &ops[3]));
+	CHECK(!outpointfilter_matches(w->utxoset_outpoints, &ops[3].txid, 3));
+	CHECK(!wallet_outpoint_spend(w, ctx, 101, &ops[3].txid, 3));
+
+	/* Block 101 goes away: the spend is undone, what it created gone. */
+	wallet_utxoset_rollback(w, 100);
+	CHECK(utxoset_has(w, &ops[3]));
+	CHECK(!utxoset_has(w, &ops[num-2]));
+	CHECK(!outpointfilter_matches(w->utxoset_outpoints,
+				      &ops[num-2].txid, ops[num-2].outnum));
+	stmt = db_select(w->db, "COUNT(*) FROM utxoset;");
+	CHECK(db_select_step(w->db, stmt));
+	CHECK(db_column_int64(stmt, 0) == num - 2);
+	db_stmt_done(stmt);
+
+	/* So the new block 101 can spend it again. */
+	spent = wallet_outpoint_spend(w, ctx, 101, &ops[3].txid, 3);
+	CHECK(spent && short_channel_id_eq(spent, &scid));
+	db_commit_transaction(w->db);
+
+	return true;
+}
+
+/* Rows from before utxoset was keyed by short_channel_id keep their place. */
+static bool test_utxoset_migration(struct lightningd *ld, const tal_t *ctx)
+{
+	char *filename = tal_fmt(ctx, "/tmp/ldb-XXXXXX");
+	int fd = mkstemp(filename);
+	struct short_channel_id scid = mk_scid(100, 7, 3);
+	struct db_stmt *stmt;
+	struct db *db;
+	size_t rekey;
+	CHECK_MSG(fd != -1, "Unable to generate temp filename");
+	close(fd);
+
+	for (rekey = 0; rekey < ARRAY_SIZE(dbmigrations); rekey++) {
+		if (dbmigrations[rekey].sql
+		    && strstarts(dbmigrations[rekey].sql,
+				 "CREATE TABLE utxoset_new"))
+			break;
+	}
+	CHECK(rekey < ARRAY_SIZE(dbmigrations));
+
+	db = db_open(ctx, filename);
+	CHECK_MSG(db, "Failed opening the db");
+	db_begin_transaction(db);
+	for (size_t i = 0; i < rekey; i++) {
+		if (dbmigrations[i].sql)
+			db_exec(__func__, db, "%s", dbmigrations[i].sql);
+		if (dbmigrations[i].func)
+			dbmigrations[i].func(ld, db);
+	}
+	db_exec(__func__, db, "UPDATE version SET version=%zu;", rekey - 1);
+	db_exec(__func__, db, "INSERT INTO blocks (height) VALUES (100), (101);");
+	db_exec(__func__, db,
+		"INSERT INTO utxoset (txid, outnum, blockheight, spendheight,"
+		" txindex, scriptpubkey, satoshis)"
+		" VALUES (x'01', 3, 100, 101, 7, x'00', 1000);");
+	db_commit_transaction(db);
+
+	db_migrate(ld, db, NULL);
+	CHECK_MSG(!wallet_err, "DB migration failed");
+
+	db_begin_transaction(db);
+	stmt = db_select(db, "scid, spendheight, satoshis FROM utxoset;");
+	CHECK(db_select_step(db, stmt));
+	CHECK(db_column_int64(stmt, 0) == scid.u64);
+	CHECK(db_column_int(stmt, 1) == 101);
+	CHECK(db_column_int64(stmt, 2) == 1000);
+	CHECK(!db_select_step(db, stmt));
+	db_commit_transaction(db);
+
+	tal_free(db);
+	unlink(filename);
+	return true;
+}
+
 static bool test_shachain_crud(struct lightningd *ld, const tal_t *ctx)
 {
 	struct wallet_shachain a, b;
@@ -932,10 +1209,10 @@ static struct channel *wallet_channel_load(struct wallet *w, const u64 dbid)
 static bool test_channel_crud(struct lightningd *ld, const tal_t *ctx)
 {
 	struct wallet *w = create_test_wallet(ld, ctx);
-	struct channel c1, *c2 = tal(w, struct channel);
+	struct channel *c1 = tal(w, struct channel), *c2 = tal(w, struct channel);
 	struct wireaddr_internal addr;
 	struct peer *p;
-	struct channel_info *ci = &c1.channel_info;
+	struct channel_info *ci = &c1->channel_info;
 	struct bitcoin_txid *hash = tal(w, struct bitcoin_txid);
 	struct pubkey pk;
 	struct node_id id;
@@ -946,8 +1223,9 @@ static bool test_channel_crud(struct lightningd *ld, const tal_t *ctx)
 	secp256k1_ecdsa_signature *bitcoin_sig1 = tal(w, secp256k1_ecdsa_signature);
 	secp256k1_ecdsa_signature *node_sig2, *bitcoin_sig2;
 	bool load;
+	size_t changes;
 
-	memset(&c1, 0, sizeof(c1));
+	memset(c1, 0, sizeof(*c1));
 	memset(c2, 0, sizeof(*c2));
 	memset(ci, 3, sizeof(*ci));
 	mempat(hash, sizeof(*hash));
@@ -960,14 +1238,14 @@ static bool test_channel_crud(struct lightningd *ld, const tal_t *ctx)
 	node_id_from_pubkey(&id, &pk);
 	ci->feerate_per_kw[LOCAL] = ci->feerate_per_kw[REMOTE] = 31337;
 	mempat(scriptpubkey, tal_count(scriptpubkey));
-	c1.first_blocknum = 1;
+	c1->first_blocknum = 1;
 	parse_wireaddr_internal("localhost:1234", &addr, 0, false, false, false,
 				NULL);
-	c1.final_key_idx = 1337;
+	c1->final_key_idx = 1337;
 	p = new_peer(ld, 0, &id, &addr);
-	c1.peer = p;
-	c1.dbid = wallet_get_channel_dbid(w);
-	c1.state = CHANNELD_NORMAL;
+	c1->peer = p;
+	c1->dbid = wallet_get_channel_dbid(w);
+	c1->state = CHANNELD_NORMAL;
 	memset(&ci->their_config, 0, sizeof(struct channel_config));
 	ci->remote_fundingkey = pk;
 	ci->theirbase.revocation = pk;
@@ -977,93 +1255,105 @@ static bool test_channel_crud(struct lightningd *ld, const tal_t *ctx)
 	ci->remote_per_commit = pk;
 	ci->old_remote_per_commit = pk;
 	/* last_tx taken from BOLT #3 */
-	c1.last_tx = bitcoin_tx_from_hex(w, "02000000000101bef67e4e2fb9ddeeb3461973cd4c62abb35050b1add772995b820b584a488489000000000038b02b8003a00f0000000000002200208c48d15160397c9731df9bc3b236656efb6665fbfe92b4a6878e88a499f741c4c0c62d0000000000160014ccf1af2f2aabee14bb40fa3851ab2301de843110ae8f6a00000000002200204adb4e2f00643db396dd120d4e7dc17625f5f2c11a40d857accc862d6b7dd80e040047304402206a2679efa3c7aaffd2a447fd0df7aba8792858b589750f6a1203f9259173198a022008d52a0e77a99ab533c36206cb15ad7aeb2aa72b93d4b571e728cb5ec2f6fe260147304402206d6cb93969d39177a09d5d45b583f34966195b77c7e585cf47ac5cce0c90cefb022031d71ae4e33a4e80df7f981d696fbdee517337806a3c7138b7491e2cbb077a0e01475221023da092f6980e58d2c037173180e9a465476026ee50f96695963e8efe436f54eb21030e9f7b623d2ccc7c9bd44d66d5ce21ce504c0acf6385a132cec6d3c39fa711c152ae3e195220", strlen("02000000000101bef67e4e2fb9ddeeb3461973cd4c62abb35050b1add772995b820b584a488489000000000038b02b8003a00f0000000000002200208c48d15160397c9731df9bc3b236656efb6665fbfe92b4a6878e88a499f741c4c0c62d0000000000160014ccf1af2f2aabee14bb40fa3851ab2301de843110ae8f6a00000000002200204adb4e2f00643db396dd120d4e7dc17625f5f2c11a40d857accc862d6b7dd80e040047304402206a2679efa3c7aaffd2a447fd0df7aba8792858b589750f6a1203f9259173198a022008d52a0e77a99ab533c36206cb15ad7aeb2aa72b93d4b571e728cb5ec2f6fe260147304402206d6cb93969d39177a09d5d45b583f34966195b77c7e585cf47ac5cce0c90cefb022031d71ae4e33a4e80df7f981d696fbdee517337806a3c7138b7491e2cbb077a0e01475221023da092f6980e58d2c037173180e9a465476026ee50f96695963e8efe436f54eb21030e9f7b623d2ccc7c9bd44d66d5ce21ce504c0acf6385a132cec6d3c39fa711c152ae3e195220"));
-	c1.last_sig.s = *sig;
-	c1.last_sig.sighash_type = SIGHASH_ALL;
+	c1->last_tx = bitcoin_tx_from_hex(w, "02000000000101bef67e4e2fb9ddeeb3461973cd4c62abb35050b1add772995b820b584a488489000000000038b02b8003a00f0000000000002200208c48d15160397c9731df9bc3b236656efb6665fbfe92b4a6878e88a499f741c4c0c62d0000000000160014ccf1af2f2aabee14bb40fa3851ab2301de843110ae8f6a00000000002200204adb4e2f00643db396dd120d4e7dc17625f5f2c11a40d857accc862d6b7dd80e040047304402206a2679efa3c7aaffd2a447fd0df7aba8792858b589750f6a1203f9259173198a022008d52a0e77a99ab533c36206cb15ad7aeb2aa72b93d4b571e728cb5ec2f6fe260147304402206d6cb93969d39177a09d5d45b583f34966195b77c7e585cf47ac5cce0c90cefb022031d71ae4e33a4e80df7f981d696fbdee517337806a3c7138b7491e2cbb077a0e01475221023da092f6980e58d2c037173180e9a465476026ee50f96695963e8efe436f54eb21030e9f7b623d2ccc7c9bd44d66d5ce21ce504c0acf6385a132cec6d3c39fa711c152ae3e195220", strlen("02000000000101bef67e4e2fb9ddeeb3461973cd4c62abb35050b1add772995b820b584a488489000000000038b02b8003a00f0000000000002200208c48d15160397c9731df9bc3b236656efb6665fbfe92b4a6878e88a499f741c4c0c62d0000000000160014ccf1af2f2aabee14bb40fa3851ab2301de843110ae8f6a00000000002200204adb4e2f00643db396dd120d4e7dc17625f5f2c11a40d857accc862d6b7dd80e040047304402206a2679efa3c7aaffd2a447fd0df7aba8792858b589750f6a1203f9259173198a022008d52a0e77a99ab533c36206cb15ad7aeb2aa72b93d4b571e728cb5ec2f6fe260147304402206d6cb93969d39177a09d5d45b583f34966195b77c7e585cf47ac5cce0c90cefb022031d71ae4e33a4e80df7f981d696fbdee517337806a3c7138b7491e2cbb077a0e01475221023da092f6980e58d2c037173180e9a465476026ee50f96695963e8efe436f54eb21030e9f7b623d2ccc7c9bd44d66d5ce21ce504c0acf6385a132cec6d3c39fa711c152ae3e195220"));
+	c1->last_sig.s = *sig;
+	c1->last_sig.sighash_type = SIGHASH_ALL;
 
 	db_begin_transaction(w->db);
 	CHECK(!wallet_err);
 
-	wallet_channel_insert(w, &c1);
+	wallet_channel_insert(w, c1);
 
 	/* Variant 1: insert with null for scid, last_sent_commit */
-	wallet_channel_save(w, &c1);
+	wallet_channel_save(w, c1);
 	CHECK_MSG(!wallet_err,
 		  tal_fmt(w, "Insert into DB: %s", wallet_err));
-	CHECK_MSG(c2 = wallet_channel_load(w, c1.dbid), tal_fmt(w, "Load from DB"));
+	CHECK_MSG(c2 = wallet_channel_load(w, c1->dbid), tal_fmt(w, "Load from DB"));
 	CHECK_MSG(!wallet_err,
 		  tal_fmt(w, "Load from DB: %s", wallet_err));
-	CHECK_MSG(channelseq(&c1, c2), "Compare loaded with saved (v1)");
+	CHECK_MSG(channelseq(c1, c2), "Compare loaded with saved (v1)");
 	tal_free(c2);
 
 	/* We just inserted them into an empty DB so this must be 1 */
-	CHECK(c1.dbid == 1);
-	CHECK(c1.peer->dbid == 1);
-	CHECK(c1.their_shachain.id == 1);
+	CHECK(c1->dbid == 1);
+	CHECK(c1->peer->dbid == 1);
+	CHECK(c1->their_shachain.id == 1);
 
 	/* Variant 2: update with scid set */
-	c1.scid = talz(w, struct short_channel_id);
-	c1.last_was_revoke = !c1.last_was_revoke;
-	wallet_channel_save(w, &c1);
+	c1->scid = talz(w, struct short_channel_id);
+	c1->last_was_revoke = !c1->last_was_revoke;
+	wallet_channel_save(w, c1);
 	CHECK_MSG(!wallet_err,
 		  tal_fmt(w, "Insert into DB: %s", wallet_err));
-	CHECK_MSG(c2 = wallet_channel_load(w, c1.dbid), tal_fmt(w, "Load from DB"));
+	CHECK_MSG(c2 = wallet_channel_load(w, c1->dbid), tal_fmt(w, "Load from DB"));
 	CHECK_MSG(!wallet_err,
 		  tal_fmt(w, "Load from DB: %s", wallet_err));
-	CHECK_MSG(channelseq(&c1, c2), "Compare loaded with saved (v2)");
+	CHECK_MSG(channelseq(c1, c2), "Compare loaded with saved (v2)");
 	tal_free(c2);
 
 	/* Updates should not result in new ids */
-	CHECK(c1.dbid == 1);
-	CHECK(c1.peer->dbid == 1);
-	CHECK(c1.their_shachain.id == 1);
+	CHECK(c1->dbid == 1);
+	CHECK(c1->peer->dbid == 1);
+	CHECK(c1->their_shachain.id == 1);
 
 	/* Variant 3: update with last_commit_sent */
-	c1.last_sent_commit = last_commit;
-	wallet_channel_save(w, &c1);
+	c1->last_sent_commit = last_commit;
+	wallet_channel_save(w, c1);
 	CHECK_MSG(!wallet_err, tal_fmt(w, "Insert into DB: %s", wallet_err));
-	CHECK_MSG(c2 = wallet_channel_load(w, c1.dbid), tal_fmt(w, "Load from DB"));
+	CHECK_MSG(c2 = wallet_channel_load(w, c1->dbid), tal_fmt(w, "Load from DB"));
 	CHECK_MSG(!wallet_err,
 		  tal_fmt(w, "Load from DB: %s", wallet_err));
-	CHECK_MSG(channelseq(&c1, c2), "Compare loaded with saved (v3)");
+	CHECK_MSG(channelseq(c1, c2), "Compare loaded with saved (v3)");
 	tal_free(c2);
 
 	/* Updates should not result in new ids */
-	CHECK(c1.dbid == 1);
-	CHECK(c1.peer->dbid == 1);
-	CHECK(c1.their_shachain.id == 1);
+	CHECK(c1->dbid == 1);
+	CHECK(c1->peer->dbid == 1);
+	CHECK(c1->their_shachain.id == 1);
 
 	/* Variant 4: update and add remote_shutdown_scriptpubkey */
-	c1.remote_shutdown_scriptpubkey = scriptpubkey;
-	wallet_channel_save(w, &c1);
+	c1->remote_shutdown_scriptpubkey = scriptpubkey;
+	wallet_channel_save(w, c1);
 	CHECK_MSG(!wallet_err, tal_fmt(w, "Insert into DB: %s", wallet_err));
-	CHECK_MSG(c2 = wallet_channel_load(w, c1.dbid), tal_fmt(w, "Load from DB"));
+	CHECK_MSG(c2 = wallet_channel_load(w, c1->dbid), tal_fmt(w, "Load from DB"));
 	CHECK_MSG(!wallet_err,
 		  tal_fmt(w, "Load from DB: %s", wallet_err));
-	CHECK_MSG(channelseq(&c1, c2), "Compare loaded with saved (v4)");
+	CHECK_MSG(channelseq(c1, c2), "Compare loaded with saved (v4)");
 	tal_free(c2);
 
 	/* Updates should not result in new ids */
-	CHECK(c1.dbid == 1);
-	CHECK(c1.peer->dbid == 1);
-	CHECK(c1.their_shachain.id == 1);
+	CHECK(c1->dbid == 1);
+	CHECK(c1->peer->dbid == 1);
+	CHECK(c1->their_shachain.id == 1);
 
 	/* Variant 5: update with remote_ann sigs */
 	/* set flag of CHANNEL_FLAGS_ANNOUNCE_CHANNEL */
-	c1.channel_flags |= 1;
-	wallet_channel_save(w, &c1);
+	c1->channel_flags |= 1;
+	wallet_channel_save(w, c1);
 	CHECK_MSG(!wallet_err,
 		  tal_fmt(w, "Insert into DB: %s", wallet_err));
-	wallet_announcement_save(w, c1.dbid, node_sig1, bitcoin_sig1);
+	wallet_announcement_save(w, c1->dbid, node_sig1, bitcoin_sig1);
 	CHECK_MSG(!wallet_err,
 		  tal_fmt(w, "Insert ann sigs into DB: %s", wallet_err));
-	CHECK_MSG(load = wallet_remote_ann_sigs_load(w, w, c1.dbid, &node_sig2, &bitcoin_sig2), tal_fmt(w, "Load ann sigs from DB"));
+	CHECK_MSG(load = wallet_remote_ann_sigs_load(w, w, c1->dbid, &node_sig2, &bitcoin_sig2), tal_fmt(w, "Load ann sigs from DB"));
 	CHECK_MSG(!wallet_err,
 		  tal_fmt(w, "Load ann sigs from DB: %s", wallet_err));
 	CHECK(load == true);
 	CHECK_MSG(!memcmp(node_sig1, node_sig2, sizeof(*node_sig1)), "Compare ann sigs loaded with saved (v5)");
 	CHECK_MSG(!memcmp(bitcoin_sig1, bitcoin_sig2, sizeof(*node_sig1)), "Compare ann sigs loaded with saved (v5)");
 
+	/* Variant 6: only what changed gets written */
+	changes = tal_count(w->db->changes);
+	wallet_channel_save(w, c1);
+	CHECK(tal_count(w->db->changes) == changes);
+	c1->next_index[LOCAL]++;
+	wallet_channel_save(w, c1);
+	CHECK(tal_count(w->db->changes) == changes + 1);
+	CHECK(strstr(w->db->changes[changes], "next_index_local"));
+	CHECK(!strstr(w->db->changes[changes], "last_tx"));
+	CHECK_MSG(c2 = wallet_channel_load(w, c1->dbid), tal_fmt(w, "Load from DB"));
+	CHECK_MSG(channelseq(c1, c2), "Compare loaded with saved (v6)");
+
 	db_commit_transaction(w->db);
 	CHECK(!wallet_err);
 
@@ -1187,6 +1477,134 @@ static bool test_htlc_crud(struct lightningd *ld, const tal_t *ctx)
 	return true;
 }
 
+/* Read back what wallet_htlc_update() wrote for one HTLC */
+static bool htlc_row_check(struct wallet *w, u64 dbid, enum htlc_state state,
+			   const struct preimage *payment_key,
+			   enum onion_type failcode, size_t failuremsg_len)
+{
+	struct db_stmt *stmt;
+	struct preimage key;
+	bool ok;
+
+	stmt = db_select_prepare(w->db, "hstate, payment_key, malformed_onion,"
+				 " failuremsg FROM channel_htlcs WHERE id = ?");
+	db_bind_int64(stmt, 1, dbid);
+	CHECK(db_select_step(w->db, stmt));
+
+	ok = db_column_int(stmt, 0) == state
+		&& db_column_int(stmt, 2) == failcode;
+	if (payment_key)
+		ok &= db_column_preimage(stmt, 1, &key)
+			&& preimage_eq(&key, payment_key);
+	else
+		ok &= db_column_is_null(stmt, 1);
+	if (failuremsg_len)
+		ok &= db_column_bytes(stmt, 3) == failuremsg_len;
+	else
+		ok &= db_column_is_null(stmt, 3);
+	db_stmt_done(stmt);
+	return ok;
+}
+
+static bool test_htlc_batch(struct lightningd *ld, const tal_t *ctx)
+{
+	/* Enough for more than one multi-row statement each */
+	const size_t num_htlcs = HTLC_UPDATE_MAX_BATCH * 2 + 3;
+	const size_t num_sigs = HTLC_SIGS_MAX_BATCH * 2 + 7;
+	struct wallet *w = create_test_wallet(ld, ctx);
+	struct preimage *keys = tal_arr(ctx, struct preimage, num_htlcs);
+	secp256k1_ecdsa_signature *sigs, *loaded;
+	bool *seen = tal_arrz(ctx, bool, num_sigs);
+	struct db_stmt *stmt;
+
+	db_begin_transaction(w->db);
+	CHECK(!wallet_err);
+	db_exec(__func__, w->db, "INSERT INTO channels (id) VALUES (1);");
+	for (size_t i = 0; i < num_htlcs; i++)
+		db_exec(__func__, w->db,
+			"INSERT INTO channel_htlcs (id, channel_id, channel_htlc_id,"
+			" direction, hstate) VALUES (%zu, 1, %zu, %d, %d);",
+			i + 1, i, DIRECTION_INCOMING, RCVD_ADD_HTLC);
+
+	wallet_htlc_batch_start(w);
+	/* Nested batches only write when the outermost one ends */
+	wallet_htlc_batch_start(w);
+	for (size_t i = 0; i < num_htlcs; i++) {
+		memset(&keys[i], i, sizeof(keys[i]));
+		wallet_htlc_update(w, i + 1, SENT_REMOVE_HTLC, &keys[i], 0,
+				   i % 2 ? tal_arrz(tmpctx, u8, i) : NULL);
+	}
+	wallet_htlc_batch_end(w);
+	CHECK(htlc_row_check(w, 1, RCVD_ADD_HTLC, NULL, 0, 0));
+
+	/* The last update for an HTLC in a batch is the one written; the
+	 * batch keeps its own copy of what we hand it. */
+	wallet_htlc_update(w, 5, SENT_REMOVE_ACK_REVOCATION, NULL,
+			   WIRE_INVALID_ONION_HMAC,
+			   tal_arrz(tmpctx, u8, 17));
+	memset(&keys[5], 0xFF, sizeof(keys[5]));
+	wallet_htlc_update(w, 6, SENT_REMOVE_ACK_REVOCATION, &keys[5], 0,
+			   NULL);
+	memset(&keys[5], 5, sizeof(keys[5]));
+	wallet_htlc_batch_end(w);
+	CHECK(!w->htlc_batch_depth);
+
+	CHECK(htlc_row_check(w, 5, SENT_REMOVE_ACK_REVOCATION, NULL,
+			     WIRE_INVALID_ONION_HMAC, 17));
+	memset(&keys[5], 0xFF, sizeof(keys[5]));
+	CHECK(htlc_row_check(w, 6, SENT_REMOVE_ACK_REVOCATION, &keys[5],
+			     0, 0));
+	for (size_t i = 0; i < num_htlcs; i++) {
+		if (i == 4 || i == 5)
+			continue;
+		CHECK(htlc_row_check(w, i + 1, SENT_REMOVE_HTLC,
+				     &keys[i], 0, i % 2 ? i : 0));
+	}
+
+	/* Outside a batch, updates go straight to the db */
+	wallet_htlc_update(w, 1, RCVD_REMOVE_HTLC, NULL, 0, NULL);
+	CHECK(htlc_row_check(w, 1, RCVD_REMOVE_HTLC, NULL, 0, 0));
+
+	/* Each sig is tagged with its index, so we can tell them apart */
+	sigs = tal_arr(ctx, secp256k1_ecdsa_signature, num_sigs);
+	for (size_t i = 0; i < num_sigs; i++) {
+		u8 compact[64];
+		memset(compact, 1, sizeof(compact));
+		compact[62] = i >> 8;
+		compact[63] = i;
+		CHECK(secp256k1_ecdsa_signature_parse_compact(secp256k1_ctx,
+							      &sigs[i],
+							      compact) == 1);
+	}
+	wallet_htlc_sigs_save(w, 1, sigs);
+	/* Saving again replaces, rather than adds to, the old ones */
+	wallet_htlc_sigs_save(w, 1, sigs);
+
+	loaded = wallet_htlc_sigs_load(ctx, w, 1);
+	CHECK(tal_count(loaded) == num_sigs);
+	for (size_t i = 0; i < tal_count(loaded); i++) {
+		u8 compact[64];
+		size_t idx;
+		secp256k1_ecdsa_signature_serialize_compact(secp256k1_ctx,
+							    compact,
+							    &loaded[i]);
+		idx = ((size_t)compact[62] << 8) | compact[63];
+		CHECK(idx < num_sigs && !seen[idx]);
+		CHECK(memeq(&loaded[i], sizeof(loaded[i]),
+			    &sigs[idx], sizeof(sigs[idx])));
+		seen[idx] = true;
+	}
+
+	stmt = db_select(w->db, "COUNT(*) FROM htlc_sigs");
+	CHECK(db_select_step(w->db, stmt));
+	CHECK(db_column_int64(stmt, 0) == (s64)num_sigs);
+	db_stmt_done(stmt);
+
+	db_commit_transaction(w->db);
+	CHECK(!wallet_err);
+	return true;
+}
+
 static bool test_payment_crud(struct lightningd *ld, const tal_t *ctx)
 {
 	struct wallet_payment *t = tal(ctx, struct wallet_payment), *t2;
@@ -1257,12 +1675,17 @@ int main(void)
 	/* Accessed in peer destructor sanity check */
 	htlc_in_map_init(&ld->htlcs_in);
 	htlc_out_map_init(&ld->htlcs_out);
+	ld->owned_txfilter = txfilter_new(ld);
 
 	ok &= test_wallet_outputs(ld, tmpctx);
+	ok &= test_wallet_coin_selection(ld, tmpctx);
+	ok &= test_wallet_utxoset(ld, tmpctx);
+	ok &= test_utxoset_migration(ld, tmpctx);
 	ok &= test_shachain_crud(ld, tmpctx);
 	ok &= test_channel_crud(ld, tmpctx);
 	ok &= test_channel_config_crud(ld, tmpctx);
 	ok &= test_htlc_crud(ld, tmpctx);
+	ok &= test_htlc_batch(ld, tmpctx);
 	ok &= test_payment_crud(ld, tmpctx);
 	ok &= test_wallet_payment_status_enum();
 
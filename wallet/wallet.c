@@ -2,10 +2,16 @@
 #include "wallet.h"
 
 #include <bitcoin/script.h>
+#include <ccan/array_size/array_size.h>
+#include <ccan/asort/asort.h>
+#include <ccan/crypto/siphash24/siphash24.h>
+#include <ccan/htable/htable_type.h>
+#include <ccan/intmap/intmap.h>
 #include <ccan/mem/mem.h>
 #include <ccan/tal/str/str.h>
 #include <common/key_derive.h>
 #include <common/memleak.h>
+#include <common/pseudorand.h>
 #include <common/wireaddr.h>
 #include <inttypes.h>
 #include <lightningd/bitcoind.h>
@@ -22,12 +28,149 @@
  * to prune? */
 #define UTXO_PRUNE_DEPTH 144
 
+#define UTXO_FIELDS							\
+	"prev_out_tx, prev_out_index, value, type, status, keyindex, "	\
+	"channel_id, peer_id, commitment_point, confirmation_height, "	\
+	"spend_height, scriptpubkey"
+
+static struct utxo *wallet_stmt2output(const tal_t *ctx, struct db_stmt *stmt);
+
+/* The available outputs are kept in memory, indexed by outpoint, so that
+ * coin selection doesn't have to walk the outputs table every time.  Every
+ * write to the outputs table below keeps this in step with the db. */
+static const struct utxo *available_utxo_keyof(const struct utxo *u)
+{
+	return u;
+}
+
+static size_t available_utxo_hash(const struct utxo *u)
+{
+	struct siphash24_ctx ctx;
+	siphash24_init(&ctx, siphash_seed());
+	siphash24_update(&ctx, &u->txid, sizeof(u->txid));
+	siphash24_u32(&ctx, u->outnum);
+	return siphash24_done(&ctx);
+}
+
+static bool available_utxo_eq(const struct utxo *u1, const struct utxo *u2)
+{
+	return bitcoin_txid_eq(&u1->txid, &u2->txid) && u1->outnum == u2->outnum;
+}
+
+HTABLE_DEFINE_TYPE(struct utxo, available_utxo_keyof, available_utxo_hash,
+		   available_utxo_eq, available_utxos);
+
+static void destroy_available_utxos(struct available_utxos *set)
+{
+	available_utxos_clear(set);
+}
+
+static struct available_utxos *available_utxos_new(const tal_t *ctx)
+{
+	struct available_utxos *set = tal(ctx, struct available_utxos);
+	available_utxos_init(set);
+	tal_add_destructor(set, destroy_available_utxos);
+	return set;
+}
+
+static struct utxo *dup_utxo(const tal_t *ctx, const struct utxo *u)
+{
+	struct utxo *dup = tal_dup(ctx, struct utxo, u);
+
+	if (u->close_info)
+		dup->close_info = tal_dup(dup, struct unilateral_close_info,
+					  u->close_info);
+	if (u->blockheight)
+		dup->blockheight = tal_dup(dup, u32, u->blockheight);
+	if (u->spendheight)
+		dup->spendheight = tal_dup(dup, u32, u->spendheight);
+	if (u->scriptPubkey)
+		dup->scriptPubkey = tal_dup_arr(dup, u8, u->scriptPubkey,
+						tal_count(u->scriptPubkey), 0);
+	return dup;
+}
+
+static struct utxo *available_utxo_find(struct wallet *w,
+					const struct bitcoin_txid *txid,
+					u32 outnum)
+{
+	struct utxo key;
+	key.txid = *txid;
+	key.outnum = outnum;
+	return available_utxos_get(w->available_utxos, &key);
+}
+
+/* Takes ownership of @u */
+static void available_utxo_add(struct wallet *w, struct utxo *u)
+{
+	u->status = output_state_available;
+	available_utxos_add(w->available_utxos,
+			    notleak(tal_steal(w->available_utxos, u)));
+}
+
+static void available_utxo_forget(struct wallet *w,
+				  const struct bitcoin_txid *txid,
+				  u32 outnum)
+{
+	struct utxo *u = available_utxo_find(w, txid, outnum);
+	if (u) {
+		available_utxos_del(w->available_utxos, u);
+		tal_free(u);
+	}
+}
+
+/* Re-read a single output after it has been changed in the db */
+static void available_utxo_refresh(struct wallet *w,
+				   const struct bitcoin_txid *txid,
+				   u32 outnum)
+{
+	struct db_stmt *stmt;
+
+	available_utxo_forget(w, txid, outnum);
+	stmt = db_select_prepare(w->db, UTXO_FIELDS
+				 " FROM outputs WHERE status=?"
+				 " AND prev_out_tx=? AND prev_out_index=?");
+	db_bind_int(stmt, 1, output_status_in_db(output_state_available));
+	db_bind_sha256_double(stmt, 2, &txid->shad);
+	db_bind_int(stmt, 3, outnum);
+	if (db_select_step(w->db, stmt)) {
+		available_utxo_add(w, wallet_stmt2output(w, stmt));
+		db_stmt_done(stmt);
+	}
+}
+
+/* Blocks above @height are gone: the db clears their heights for us */
+static void available_utxos_unconfirm(struct wallet *w, u32 height)
+{
+	struct available_utxos_iter it;
+
+	for (struct utxo *u = available_utxos_first(w->available_utxos, &it);
+	     u;
+	     u = available_utxos_next(w->available_utxos, &it)) {
+		if (u->blockheight && *u->blockheight > height)
+			u->blockheight = tal_free(u->blockheight);
+		if (u->spendheight && *u->spendheight > height)
+			u->spendheight = tal_free(u->spendheight);
+	}
+}
+
+static void available_utxos_load(struct wallet *w)
+{
+	struct db_stmt *stmt;
+
+	stmt = db_select_prepare(w->db, UTXO_FIELDS
+				 " FROM outputs WHERE status=?");
+	db_bind_int(stmt, 1, output_status_in_db(output_state_available));
+	while (db_select_step(w->db, stmt))
+		available_utxo_add(w, wallet_stmt2output(w, stmt));
+}
+
 static void outpointfilters_init(struct wallet *w)
 {
-	sqlite3_stmt *stmt;
+	struct db_stmt *stmt;
 	struct utxo **utxos = wallet_get_utxos(NULL, w, output_state_any);
 	struct bitcoin_txid txid;
-	u32 outnum;
+	struct short_channel_id scid;
 
 	w->owned_outpoints = outpointfilter_new(w);
 	for (size_t i = 0; i < tal_count(utxos); i++)
@@ -36,12 +179,13 @@ static void outpointfilters_init(struct wallet *w)
 	tal_free(utxos);
 
 	w->utxoset_outpoints = outpointfilter_new(w);
-	stmt = db_select_prepare(w->db, "txid, outnum FROM utxoset WHERE spendheight is NULL");
+	stmt = db_select_prepare(w->db, "txid, scid FROM utxoset WHERE spendheight is NULL");
 
 	while (db_select_step(w->db, stmt)) {
-		sqlite3_column_sha256_double(stmt, 0, &txid.shad);
-		outnum = sqlite3_column_int(stmt, 1);
-		outpointfilter_add(w->utxoset_outpoints, &txid, outnum);
+		db_column_sha256_double(stmt, 0, &txid.shad);
+		scid.u64 = db_column_int64(stmt, 1);
+		outpointfilter_add(w->utxoset_outpoints, &txid,
+				   short_channel_id_outnum(&scid));
 	}
 }
 
@@ -55,29 +199,28 @@ struct wallet *wallet_new(struct lightningd *ld,
 	wallet->bip32_base = NULL;
 	list_head_init(&wallet->unstored_payments);
 	list_head_init(&wallet->unreleased_txs);
+	wallet->htlc_batch_depth = 0;
+	wallet->htlc_updates = NULL;
+	wallet->available_utxos = available_utxos_new(wallet);
 
 	db_begin_transaction(wallet->db);
 	wallet->invoices = invoices_new(wallet, wallet->db, log, timers);
 	outpointfilters_init(wallet);
+	available_utxos_load(wallet);
 	db_commit_transaction(wallet->db);
 	return wallet;
 }
 
-#define UTXO_FIELDS							\
-	"prev_out_tx, prev_out_index, value, type, status, keyindex, "	\
-	"channel_id, peer_id, commitment_point, confirmation_height, "	\
-	"spend_height, scriptpubkey"
-
 /* This can fail if we've already seen UTXO. */
 bool wallet_add_utxo(struct wallet *w, struct utxo *utxo,
 		     enum wallet_output_type type)
 {
-	sqlite3_stmt *stmt;
+	struct db_stmt *stmt;
 
 	stmt = db_select_prepare(w->db,
 				 "* from outputs WHERE prev_out_tx=? AND prev_out_index=?");
-	sqlite3_bind_blob(stmt, 1, &utxo->txid, sizeof(utxo->txid), SQLITE_TRANSIENT);
-	sqlite3_bind_int(stmt, 2, utxo->outnum);
+	db_bind_blob(stmt, 1, &utxo->txid, sizeof(utxo->txid));
+	db_bind_int(stmt, 2, utxo->outnum);
 
 	/* If we get a result, that means a clash. */
 	if (db_select_step(w->db, stmt)) {
@@ -88,61 +231,61 @@ bool wallet_add_utxo(struct wallet *w, struct utxo *utxo,
 	stmt = db_prepare(w->db, "INSERT INTO outputs ("
 			  UTXO_FIELDS
 			  ") VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?);");
-	sqlite3_bind_blob(stmt, 1, &utxo->txid, sizeof(utxo->txid), SQLITE_TRANSIENT);
-	sqlite3_bind_int(stmt, 2, utxo->outnum);
-	sqlite3_bind_amount_sat(stmt, 3, utxo->amount);
-	sqlite3_bind_int(stmt, 4, wallet_output_type_in_db(type));
-	sqlite3_bind_int(stmt, 5, output_state_available);
-	sqlite3_bind_int(stmt, 6, utxo->keyindex);
+	db_bind_blob(stmt, 1, &utxo->txid, sizeof(utxo->txid));
+	db_bind_int(stmt, 2, utxo->outnum);
+	db_bind_amount_sat(stmt, 3, utxo->amount);
+	db_bind_int(stmt, 4, wallet_output_type_in_db(type));
+	db_bind_int(stmt, 5, output_state_available);
+	db_bind_int(stmt, 6, utxo->keyindex);
 	if (utxo->close_info) {
-		sqlite3_bind_int64(stmt, 7, utxo->close_info->channel_id);
-		sqlite3_bind_node_id(stmt, 8, &utxo->close_info->peer_id);
-		sqlite3_bind_pubkey(stmt, 9, &utxo->close_info->commitment_point);
+		db_bind_int64(stmt, 7, utxo->close_info->channel_id);
+		db_bind_node_id(stmt, 8, &utxo->close_info->peer_id);
+		db_bind_pubkey(stmt, 9, &utxo->close_info->commitment_point);
 	} else {
-		sqlite3_bind_null(stmt, 7);
-		sqlite3_bind_null(stmt, 8);
-		sqlite3_bind_null(stmt, 9);
+		db_bind_null(stmt, 7);
+		db_bind_null(stmt, 8);
+		db_bind_null(stmt, 9);
 	}
 
 	if (utxo->blockheight) {
-		sqlite3_bind_int(stmt, 10, *utxo->blockheight);
+		db_bind_int(stmt, 10, *utxo->blockheight);
 	} else
-		sqlite3_bind_null(stmt, 10);
+		db_bind_null(stmt, 10);
 
 	if (utxo->spendheight)
-		sqlite3_bind_int(stmt, 11, *utxo->spendheight);
+		db_bind_int(stmt, 11, *utxo->spendheight);
 	else
-		sqlite3_bind_null(stmt, 11);
+		db_bind_null(stmt, 11);
 
 	if (utxo->scriptPubkey)
-		sqlite3_bind_blob(stmt, 12, utxo->scriptPubkey,
-				  tal_bytelen(utxo->scriptPubkey),
-				  SQLITE_TRANSIENT);
+		db_bind_blob(stmt, 12, utxo->scriptPubkey,
+			     tal_bytelen(utxo->scriptPubkey));
 	else
-		sqlite3_bind_null(stmt, 12);
+		db_bind_null(stmt, 12);
 
 	db_exec_prepared(w->db, stmt);
+	available_utxo_refresh(w, &utxo->txid, utxo->outnum);
 	return true;
 }
 
 /**
  * wallet_stmt2output - Extract data from stmt and fill an UTXO
  */
-static struct utxo *wallet_stmt2output(const tal_t *ctx, sqlite3_stmt *stmt)
+static struct utxo *wallet_stmt2output(const tal_t *ctx, struct db_stmt *stmt)
 {
 	struct utxo *utxo = tal(ctx, struct utxo);
 	u32 *blockheight, *spendheight;
-	sqlite3_column_sha256_double(stmt, 0, &utxo->txid.shad);
-	utxo->outnum = sqlite3_column_int(stmt, 1);
-	utxo->amount = sqlite3_column_amount_sat(stmt, 2);
-	utxo->is_p2sh = sqlite3_column_int(stmt, 3) == p2sh_wpkh;
-	utxo->status = sqlite3_column_int(stmt, 4);
-	utxo->keyindex = sqlite3_column_int(stmt, 5);
-	if (sqlite3_column_type(stmt, 6) != SQLITE_NULL) {
+	db_column_sha256_double(stmt, 0, &utxo->txid.shad);
+	utxo->outnum = db_column_int(stmt, 1);
+	utxo->amount = db_column_amount_sat(stmt, 2);
+	utxo->is_p2sh = db_column_int(stmt, 3) == p2sh_wpkh;
+	utxo->status = db_column_int(stmt, 4);
+	utxo->keyindex = db_column_int(stmt, 5);
+	if (!db_column_is_null(stmt, 6)) {
 		utxo->close_info = tal(utxo, struct unilateral_close_info);
-		utxo->close_info->channel_id = sqlite3_column_int64(stmt, 6);
-		sqlite3_column_node_id(stmt, 7, &utxo->close_info->peer_id);
-		sqlite3_column_pubkey(stmt, 8, &utxo->close_info->commitment_point);
+		utxo->close_info->channel_id = db_column_int64(stmt, 6);
+		db_column_node_id(stmt, 7, &utxo->close_info->peer_id);
+		db_column_pubkey(stmt, 8, &utxo->close_info->commitment_point);
 	} else {
 		utxo->close_info = NULL;
 	}
@@ -151,22 +294,22 @@ static struct utxo *wallet_stmt2output(const tal_t *ctx, sqlite3_stmt *stmt)
 	utxo->spendheight = NULL;
 	utxo->scriptPubkey = NULL;
 
-	if (sqlite3_column_type(stmt, 9) != SQLITE_NULL) {
+	if (!db_column_is_null(stmt, 9)) {
 		blockheight = tal(utxo, u32);
-		*blockheight = sqlite3_column_int(stmt, 9);
+		*blockheight = db_column_int(stmt, 9);
 		utxo->blockheight = blockheight;
 	}
 
-	if (sqlite3_column_type(stmt, 10) != SQLITE_NULL) {
+	if (!db_column_is_null(stmt, 10)) {
 		spendheight = tal(utxo, u32);
-		*spendheight = sqlite3_column_int(stmt, 10);
+		*spendheight = db_column_int(stmt, 10);
 		utxo->spendheight = spendheight;
 	}
 
-	if (sqlite3_column_type(stmt, 11) != SQLITE_NULL) {
+	if (!db_column_is_null(stmt, 11)) {
 		utxo->scriptPubkey =
-		    tal_dup_arr(utxo, u8, sqlite3_column_blob(stmt, 11),
-				sqlite3_column_bytes(stmt, 11), 0);
+		    tal_dup_arr(utxo, u8, db_column_blob(stmt, 11),
+				db_column_bytes(stmt, 11), 0);
 	}
 
 	return utxo;
@@ -177,37 +320,106 @@ bool wallet_update_output_status(struct wallet *w,
 				 const u32 outnum, enum output_status oldstatus,
 				 enum output_status newstatus)
 {
-	sqlite3_stmt *stmt;
+	struct db_stmt *stmt;
+	bool changed;
+
 	if (oldstatus != output_state_any) {
 		stmt = db_prepare(
 			w->db, "UPDATE outputs SET status=? WHERE status=? AND prev_out_tx=? AND prev_out_index=?");
-		sqlite3_bind_int(stmt, 1, output_status_in_db(newstatus));
-		sqlite3_bind_int(stmt, 2, output_status_in_db(oldstatus));
-		sqlite3_bind_blob(stmt, 3, txid, sizeof(*txid), SQLITE_TRANSIENT);
-		sqlite3_bind_int(stmt, 4, outnum);
+		db_bind_int(stmt, 1, output_status_in_db(newstatus));
+		db_bind_int(stmt, 2, output_status_in_db(oldstatus));
+		db_bind_blob(stmt, 3, txid, sizeof(*txid));
+		db_bind_int(stmt, 4, outnum);
 	} else {
 		stmt = db_prepare(
 			w->db, "UPDATE outputs SET status=? WHERE prev_out_tx=? AND prev_out_index=?");
-		sqlite3_bind_int(stmt, 1, output_status_in_db(newstatus));
-		sqlite3_bind_blob(stmt, 2, txid, sizeof(*txid), SQLITE_TRANSIENT);
-		sqlite3_bind_int(stmt, 3, outnum);
+		db_bind_int(stmt, 1, output_status_in_db(newstatus));
+		db_bind_blob(stmt, 2, txid, sizeof(*txid));
+		db_bind_int(stmt, 3, outnum);
+	}
+	db_exec_prepared(w->db, stmt);
+	changed = db_changes(w->db) > 0;
+	if (changed)
+		available_utxo_refresh(w, txid, outnum);
+	return changed;
+}
+
+#define OUTPUTS_UPDATE_MAX_BATCH 64
+
+/* Move up to OUTPUTS_UPDATE_MAX_BATCH outputs from @oldstatus to
+ * @newstatus in one statement.  Returns how many actually moved. */
+static size_t outputs_status_write(struct wallet *w,
+				   const struct utxo **utxos, size_t num,
+				   enum output_status oldstatus,
+				   enum output_status newstatus)
+{
+	struct db_stmt *stmt;
+	char *query;
+
+	assert(num <= OUTPUTS_UPDATE_MAX_BATCH);
+	query = tal_strdup(tmpctx,
+			   "UPDATE outputs SET status=?1 WHERE status=?2 AND (");
+	for (size_t i = 0; i < num; i++)
+		tal_append_fmt(&query,
+			       "%s(prev_out_tx=?%zu AND prev_out_index=?%zu)",
+			       i ? " OR " : "", i * 2 + 3, i * 2 + 4);
+	tal_append_fmt(&query, ");");
+
+	stmt = db_prepare(w->db, query);
+	db_bind_int(stmt, 1, output_status_in_db(newstatus));
+	db_bind_int(stmt, 2, output_status_in_db(oldstatus));
+	for (size_t i = 0; i < num; i++) {
+		db_bind_sha256_double(stmt, i * 2 + 3,
+				      &utxos[i]->txid.shad);
+		db_bind_int(stmt, i * 2 + 4, utxos[i]->outnum);
 	}
 	db_exec_prepared(w->db, stmt);
-	return sqlite3_changes(w->db->sql) > 0;
+	return db_changes(w->db);
+}
+
+/**
+ * wallet_update_outputs_status - Batched wallet_update_output_status
+ *
+ * Returns the number of outputs that were in @oldstatus.
+ */
+static size_t wallet_update_outputs_status(struct wallet *w,
+					   const struct utxo **utxos,
+					   enum output_status oldstatus,
+					   enum output_status newstatus)
+{
+	size_t changed = 0, num;
+
+	assert(oldstatus != output_state_any);
+	for (size_t i = 0; i < tal_count(utxos); i += num) {
+		num = tal_count(utxos) - i;
+		if (num > OUTPUTS_UPDATE_MAX_BATCH)
+			num = OUTPUTS_UPDATE_MAX_BATCH;
+		changed += outputs_status_write(w, utxos + i, num,
+						oldstatus, newstatus);
+	}
+
+	for (size_t i = 0; i < tal_count(utxos); i++) {
+		if (oldstatus == output_state_available)
+			available_utxo_forget(w, &utxos[i]->txid,
+					      utxos[i]->outnum);
+		if (newstatus == output_state_available)
+			available_utxo_add(w, dup_utxo(w, utxos[i]));
+	}
+	return changed;
 }
 
 struct utxo **wallet_get_utxos(const tal_t *ctx, struct wallet *w, const enum output_status state)
 {
 	struct utxo **results;
 	int i;
-	sqlite3_stmt *stmt;
+	struct db_stmt *stmt;
 
 	if (state == output_state_any)
 		stmt = db_select_prepare(w->db, UTXO_FIELDS " FROM outputs");
 	else {
 		stmt = db_select_prepare(w->db, UTXO_FIELDS
 					 " FROM outputs WHERE status=?1");
-		sqlite3_bind_int(stmt, 1, output_status_in_db(state));
+		db_bind_int(stmt, 1, output_status_in_db(state));
 	}
 
 	results = tal_arr(ctx, struct utxo*, 0);
@@ -224,7 +436,7 @@ struct utxo **wallet_get_unconfirmed_closeinfo_utxos(const tal_t *ctx, struct wa
 	struct utxo **results;
 	int i;
 
-	sqlite3_stmt *stmt = db_select_prepare(
+	struct db_stmt *stmt = db_select_prepare(
 		w->db, UTXO_FIELDS
 		" FROM outputs WHERE channel_id IS NOT NULL and confirmation_height IS NULL");
 
@@ -237,54 +449,56 @@ struct utxo **wallet_get_unconfirmed_closeinfo_utxos(const tal_t *ctx, struct wa
 	return results;
 }
 
-/**
- * unreserve_utxo - Mark a reserved UTXO as available again
- */
-static void unreserve_utxo(struct wallet *w, const struct utxo *unres)
-{
-	if (!wallet_update_output_status(w, &unres->txid, unres->outnum,
-					 output_state_reserved,
-					 output_state_available)) {
-		fatal("Unable to unreserve output");
-	}
-}
-
 /**
  * destroy_utxos - Destructor for an array of pointers to utxo
+ *
+ * Marks the reserved UTXOs as available again.
  */
 static void destroy_utxos(const struct utxo **utxos, struct wallet *w)
 {
-	for (size_t i = 0; i < tal_count(utxos); i++)
-		unreserve_utxo(w, utxos[i]);
+	if (wallet_update_outputs_status(w, utxos, output_state_reserved,
+					 output_state_available)
+	    != tal_count(utxos))
+		fatal("Unable to unreserve outputs");
 }
 
 void wallet_confirm_utxos(struct wallet *w, const struct utxo **utxos)
 {
 	tal_del_destructor2(utxos, destroy_utxos, w);
-	for (size_t i = 0; i < tal_count(utxos); i++) {
-		if (!wallet_update_output_status(
-			w, &utxos[i]->txid, utxos[i]->outnum,
-			output_state_reserved, output_state_spent)) {
-			fatal("Unable to mark output as spent");
-		}
+	if (wallet_update_outputs_status(w, utxos, output_state_reserved,
+					 output_state_spent)
+	    != tal_count(utxos))
+		fatal("Unable to mark outputs as spent");
+}
+
+/* Take the chosen UTXOs out of the available set, and reserve them. */
+static const struct utxo **reserve_utxos(const tal_t *ctx, struct wallet *w,
+					 struct utxo **chosen)
+{
+	const struct utxo **utxos = tal_arr(ctx, const struct utxo *,
+					    tal_count(chosen));
+
+	for (size_t i = 0; i < tal_count(chosen); i++) {
+		struct utxo *u = dup_utxo(utxos, chosen[i]);
+		u->status = output_state_reserved;
+		utxos[i] = u;
 	}
+
+	if (wallet_update_outputs_status(w, utxos, output_state_available,
+					 output_state_reserved)
+	    != tal_count(utxos))
+		fatal("Unable to reserve outputs");
+
+	tal_add_destructor2(utxos, destroy_utxos, w);
+	return utxos;
 }
 
-static const struct utxo **wallet_select(const tal_t *ctx, struct wallet *w,
-					 struct amount_sat sat,
-					 const u32 feerate_per_kw,
-					 size_t outscriptlen,
-					 bool may_have_change,
-					 u32 maxheight,
-					 struct amount_sat *satoshi_in,
-					 struct amount_sat *fee_estimate)
+/* Weight of a transaction with our output (and maybe a P2WPKH change
+ * output), but no inputs yet. */
+static u64 tx_base_weight(size_t outscriptlen, bool with_change)
 {
-	size_t i = 0;
-	struct utxo **available;
 	u64 weight;
-	size_t num_outputs = may_have_change ? 2 : 1;
-	const struct utxo **utxos = tal_arr(ctx, const struct utxo *, 0);
-	tal_add_destructor2(utxos, destroy_utxos, w);
+	size_t num_outputs = with_change ? 2 : 1;
 
 	/* version, input count, output count, locktime */
 	weight = (4 + 1 + 1 + 4) * 4;
@@ -293,7 +507,7 @@ static const struct utxo **wallet_select(const tal_t *ctx, struct wallet *w,
 	weight += (8 + 1 + outscriptlen) * 4;
 
 	/* Change output will be P2WPKH */
-	if (may_have_change)
+	if (with_change)
 		weight += (8 + 1 + BITCOIN_SCRIPTPUBKEY_P2WPKH_LEN) * 4;
 
 	/* A couple of things need to change for elements: */
@@ -311,16 +525,69 @@ static const struct utxo **wallet_select(const tal_t *ctx, struct wallet *w,
 		weight += (8 + 1) * 4; /* Bitcoin style output */
 		weight += (32 + 1 + 1 + 1) * 4; /* Elements added fields */
 	}
+	return weight;
+}
 
-	*fee_estimate = AMOUNT_SAT(0);
-	*satoshi_in = AMOUNT_SAT(0);
+/* Weight one of our inputs adds to the transaction. */
+static size_t utxo_spend_weight(bool is_p2sh)
+{
+	/* Input weight: txid + index + sequence */
+	size_t input_weight = (32 + 4 + 4) * 4;
+
+	/* We always encode the length of the script, even if empty */
+	input_weight += 1 * 4;
+
+	/* P2SH variants include push of <0 <20-byte-key-hash>> */
+	if (is_p2sh)
+		input_weight += 23 * 4;
+
+	/* Account for witness (1 byte count + sig + key) */
+	input_weight += 1 + (1 + 73 + 1 + 33);
+
+	/* Elements inputs have 6 bytes of blank proofs attached. */
+	input_weight += 6;
+
+	return input_weight;
+}
+
+struct coin_candidate {
+	struct utxo *utxo;
+	size_t weight;
+	/* What it's worth after paying for its own input: > 0 */
+	u64 effective;
+};
+
+static int cmp_candidates(const struct coin_candidate *a,
+			  const struct coin_candidate *b,
+			  void *unused)
+{
+	int ret;
+
+	if (a->effective != b->effective)
+		return a->effective > b->effective ? -1 : 1;
+	ret = memcmp(&a->utxo->txid, &b->utxo->txid, sizeof(a->utxo->txid));
+	if (ret)
+		return ret;
+	return (int)a->utxo->outnum - (int)b->utxo->outnum;
+}
 
-	available = wallet_get_utxos(ctx, w, output_state_available);
+/* Available UTXOs which are confirmed at or below @maxheight (if set),
+ * largest effective value first.  Unless @uneconomic, those which cost
+ * more to spend than they're worth are left out. */
+static struct coin_candidate *coin_candidates(const tal_t *ctx,
+					      struct wallet *w,
+					      u32 feerate_per_kw,
+					      u32 maxheight,
+					      bool uneconomic)
+{
+	struct coin_candidate *cands = tal_arr(ctx, struct coin_candidate, 0);
+	struct available_utxos_iter it;
 
-	for (i = 0; i < tal_count(available); i++) {
-		size_t input_weight;
-		struct amount_sat needed;
-		struct utxo *u = tal_steal(utxos, available[i]);
+	for (struct utxo *u = available_utxos_first(w->available_utxos, &it);
+	     u;
+	     u = available_utxos_next(w->available_utxos, &it)) {
+		struct coin_candidate c;
+		struct amount_sat effective;
 
 		/* If we require confirmations check that we have a
 		 * confirmation height and that it is below the required
@@ -329,52 +596,162 @@ static const struct utxo **wallet_select(const tal_t *ctx, struct wallet *w,
 		    (!u->blockheight || *u->blockheight > maxheight))
 			continue;
 
-		tal_arr_expand(&utxos, u);
+		c.utxo = u;
+		c.weight = utxo_spend_weight(u->is_p2sh);
+		if (!amount_sat_sub(&effective, u->amount,
+				    amount_tx_fee(feerate_per_kw, c.weight))
+		    || amount_sat_eq(effective, AMOUNT_SAT(0))) {
+			if (!uneconomic)
+				continue;
+			effective = AMOUNT_SAT(0);
+		}
+		c.effective = effective.satoshis; /* Raw: search arithmetic */
+		tal_arr_expand(&cands, c);
+	}
+
+	asort(cands, tal_count(cands), cmp_candidates, NULL);
+	return cands;
+}
+
+#define BNB_MAX_TRIES 100000
 
-		if (!wallet_update_output_status(
-			w, &available[i]->txid, available[i]->outnum,
-			output_state_available, output_state_reserved))
-			fatal("Unable to reserve output");
+/* Branch-and-bound (as in Bitcoin Core's SelectCoinsBnB): depth-first
+ * search for the set of candidates whose effective values sum to within
+ * [target, target + slack], i.e. needing no change output, keeping the one
+ * with least excess.  Sets @best and returns true if one is found. */
+static bool select_coins_bnb(const struct coin_candidate *cands,
+			     u64 target, u64 slack, bool *best)
+{
+	size_t n = tal_count(cands), depth = 0;
+	bool *curr = tal_arr(tmpctx, bool, n);
+	u64 curr_value = 0, remaining = 0, best_excess = UINT64_MAX;
+
+	for (size_t i = 0; i < n; i++)
+		remaining += cands[i].effective;
+
+	for (size_t tries = 0; tries < BNB_MAX_TRIES; tries++) {
+		bool backtrack = false;
+
+		if (curr_value + remaining < target
+		    || curr_value > target + slack)
+			backtrack = true;
+		else if (curr_value >= target) {
+			if (curr_value - target < best_excess) {
+				best_excess = curr_value - target;
+				memset(best, 0, n * sizeof(*best));
+				memcpy(best, curr, depth * sizeof(*best));
+			}
+			if (best_excess == 0)
+				break;
+			backtrack = true;
+		}
 
-		/* Input weight: txid + index + sequence */
-		input_weight = (32 + 4 + 4) * 4;
+		if (backtrack) {
+			/* Walk back to the last coin we included... */
+			while (depth && !curr[depth - 1]) {
+				depth--;
+				remaining += cands[depth].effective;
+			}
+			if (!depth)
+				break;
+			/* ... and try without it. */
+			curr[depth - 1] = false;
+			curr_value -= cands[depth - 1].effective;
+		} else {
+			remaining -= cands[depth].effective;
+			curr[depth] = true;
+			curr_value += cands[depth].effective;
+			depth++;
+		}
+	}
+	return best_excess != UINT64_MAX;
+}
 
-		/* We always encode the length of the script, even if empty */
-		input_weight += 1 * 4;
+static const struct utxo **wallet_select(const tal_t *ctx, struct wallet *w,
+					 struct amount_sat sat,
+					 const u32 feerate_per_kw,
+					 size_t outscriptlen,
+					 u32 maxheight,
+					 struct amount_sat *satoshi_in,
+					 struct amount_sat *fee_estimate)
+{
+	struct coin_candidate *cands;
+	struct utxo **chosen = tal_arr(tmpctx, struct utxo *, 0);
+	bool *best;
+	u64 weight, target, slack;
+	struct amount_sat needed;
 
-		/* P2SH variants include push of <0 <20-byte-key-hash>> */
-		if (u->is_p2sh)
-			input_weight += 23 * 4;
+	*fee_estimate = AMOUNT_SAT(0);
+	*satoshi_in = AMOUNT_SAT(0);
 
-		/* Account for witness (1 byte count + sig + key) */
-		input_weight += 1 + (1 + 73 + 1 + 33);
+	cands = coin_candidates(tmpctx, w, feerate_per_kw, maxheight, false);
+
+	/* Look for an exact enough match first: anything within what a
+	 * change output would cost us (to create now, and spend later) is
+	 * better given to the fee. */
+	best = tal_arr(tmpctx, bool, tal_count(cands));
+	weight = tx_base_weight(outscriptlen, false);
+	slack = amount_tx_fee(feerate_per_kw,
+			      tx_base_weight(outscriptlen, true) - weight
+			      + utxo_spend_weight(false)).satoshis; /* Raw: search arithmetic */
+	if (!amount_sat_add(&needed, sat, amount_tx_fee(feerate_per_kw, weight)))
+		fatal("Overflow in fee estimate %s",
+		      type_to_string(tmpctx, struct amount_sat, &sat));
+	target = needed.satoshis; /* Raw: search arithmetic */
+
+	if (select_coins_bnb(cands, target, slack, best)) {
+		for (size_t i = 0; i < tal_count(cands); i++) {
+			if (!best[i])
+				continue;
+			tal_arr_expand(&chosen, cands[i].utxo);
+			weight += cands[i].weight;
+			if (!amount_sat_add(satoshi_in, *satoshi_in,
+					    cands[i].utxo->amount))
+				fatal("Overflow in available satoshis");
+		}
 
-		/* Elements inputs have 6 bytes of blank proofs attached. */
-		input_weight += 6;
+		/* Rounding may leave us a satoshi short of the real fee. */
+		*fee_estimate = amount_tx_fee(feerate_per_kw, weight);
+		if (amount_sat_add(&needed, sat, *fee_estimate)
+		    && amount_sat_greater_eq(*satoshi_in, needed)) {
+			/* No change: whatever's left over goes to fees */
+			if (!amount_sat_sub(fee_estimate, *satoshi_in, sat))
+				abort();
+			return reserve_utxos(ctx, w, chosen);
+		}
+		tal_resize(&chosen, 0);
+		*satoshi_in = AMOUNT_SAT(0);
+	}
 
-		weight += input_weight;
+	/* Otherwise take the largest first, with a change output. */
+	weight = tx_base_weight(outscriptlen, true);
+	for (size_t i = 0; i < tal_count(cands); i++) {
+		tal_arr_expand(&chosen, cands[i].utxo);
+		weight += cands[i].weight;
 
-		if (!amount_sat_add(satoshi_in, *satoshi_in, u->amount))
+		if (!amount_sat_add(satoshi_in, *satoshi_in,
+				    cands[i].utxo->amount))
 			fatal("Overflow in available satoshis %zu/%zu %s + %s",
-			      i, tal_count(available),
+			      i, tal_count(cands),
 			      type_to_string(tmpctx, struct amount_sat,
 					     satoshi_in),
 			      type_to_string(tmpctx, struct amount_sat,
-					     &u->amount));
+					     &cands[i].utxo->amount));
 
 		*fee_estimate = amount_tx_fee(feerate_per_kw, weight);
 		if (!amount_sat_add(&needed, sat, *fee_estimate))
 			fatal("Overflow in fee estimate %zu/%zu %s + %s",
-			      i, tal_count(available),
+			      i, tal_count(cands),
 			      type_to_string(tmpctx, struct amount_sat, &sat),
 			      type_to_string(tmpctx, struct amount_sat,
 					     fee_estimate));
 		if (amount_sat_greater_eq(*satoshi_in, needed))
-			break;
+			return reserve_utxos(ctx, w, chosen);
 	}
-	tal_free(available);
 
-	return utxos;
+	/* Can't afford it: reserve nothing. */
+	*satoshi_in = AMOUNT_SAT(0);
+	return tal_arr(ctx, const struct utxo *, 0);
 }
 
 const struct utxo **wallet_select_coins(const tal_t *ctx, struct wallet *w,
@@ -389,7 +766,7 @@ const struct utxo **wallet_select_coins(const tal_t *ctx, struct wallet *w,
 	const struct utxo **utxo;
 
 	utxo = wallet_select(ctx, w, sat, feerate_per_kw,
-			     outscriptlen, true, maxheight,
+			     outscriptlen, maxheight,
 			     &satoshi_in, fee_estimate);
 
 	/* Couldn't afford it? */
@@ -404,30 +781,25 @@ const struct utxo **wallet_select_specific(const tal_t *ctx, struct wallet *w,
 					struct bitcoin_txid **txids,
                     u32 **outnums)
 {
-	size_t i, j;
-	struct utxo **available;
-	const struct utxo **utxos = tal_arr(ctx, const struct utxo*, 0);
-	tal_add_destructor2(utxos, destroy_utxos, w);
-
-	available = wallet_get_utxos(ctx, w, output_state_available);
-	for (i = 0; i < tal_count(txids); i++) {
-		for (j = 0; j < tal_count(available); j++) {
+	struct utxo **chosen = tal_arr(tmpctx, struct utxo *, 0);
 
-			if (bitcoin_txid_eq(&available[j]->txid, txids[i])
-					&& available[j]->outnum == *outnums[i]) {
-				struct utxo *u = tal_steal(utxos, available[j]);
-				tal_arr_expand(&utxos, u);
+	for (size_t i = 0; i < tal_count(txids); i++) {
+		struct utxo *u = available_utxo_find(w, txids[i], *outnums[i]);
+		if (!u)
+			continue;
 
-				if (!wallet_update_output_status(
-					w, &available[j]->txid, available[j]->outnum,
-					output_state_available, output_state_reserved))
-					fatal("Unable to reserve output");
+		/* Once is enough, even if they asked twice */
+		for (size_t j = 0; j < tal_count(chosen); j++) {
+			if (chosen[j] == u) {
+				u = NULL;
+				break;
 			}
 		}
+		if (u)
+			tal_arr_expand(&chosen, u);
 	}
-	tal_free(available);
 
-	return utxos;
+	return reserve_utxos(ctx, w, chosen);
 }
 
 const struct utxo **wallet_select_all(const tal_t *ctx, struct wallet *w,
@@ -437,19 +809,31 @@ const struct utxo **wallet_select_all(const tal_t *ctx, struct wallet *w,
 				      struct amount_sat *value,
 				      struct amount_sat *fee_estimate)
 {
-	struct amount_sat satoshi_in;
-	const struct utxo **utxo;
-
-	/* Huge value, but won't overflow on addition */
-	utxo = wallet_select(ctx, w, AMOUNT_SAT(1ULL << 56), feerate_per_kw,
-			     outscriptlen, false, maxheight,
-			     &satoshi_in, fee_estimate);
+	struct amount_sat satoshi_in = AMOUNT_SAT(0);
+	struct coin_candidate *cands;
+	struct utxo **chosen = tal_arr(tmpctx, struct utxo *, 0);
+	u64 weight = tx_base_weight(outscriptlen, false);
+
+	/* Sweep everything, no change. */
+	cands = coin_candidates(tmpctx, w, feerate_per_kw, maxheight, true);
+	for (size_t i = 0; i < tal_count(cands); i++) {
+		tal_arr_expand(&chosen, cands[i].utxo);
+		weight += cands[i].weight;
+		if (!amount_sat_add(&satoshi_in, satoshi_in,
+				    cands[i].utxo->amount))
+			fatal("Overflow in available satoshis %s + %s",
+			      type_to_string(tmpctx, struct amount_sat,
+					     &satoshi_in),
+			      type_to_string(tmpctx, struct amount_sat,
+					     &cands[i].utxo->amount));
+	}
+	*fee_estimate = amount_tx_fee(feerate_per_kw, weight);
 
 	/* Can't afford fees? */
 	if (!amount_sat_sub(value, satoshi_in, *fee_estimate))
-		return tal_free(utxo);
+		return NULL;
 
-	return utxo;
+	return reserve_utxos(ctx, w, chosen);
 }
 
 bool wallet_can_spend(struct wallet *w, const u8 *script,
@@ -505,17 +889,17 @@ s64 wallet_get_newindex(struct lightningd *ld)
 static void wallet_shachain_init(struct wallet *wallet,
 				 struct wallet_shachain *chain)
 {
-	sqlite3_stmt *stmt;
+	struct db_stmt *stmt;
 
 	assert(chain->id == 0);
 
 	/* Create shachain */
 	shachain_init(&chain->chain);
 	stmt = db_prepare(wallet->db, "INSERT INTO shachains (min_index, num_valid) VALUES (?, 0);");
-	sqlite3_bind_int64(stmt, 1, chain->chain.min_index);
+	db_bind_int64(stmt, 1, chain->chain.min_index);
 	db_exec_prepared(wallet->db, stmt);
 
-	chain->id = sqlite3_last_insert_rowid(wallet->db->sql);
+	chain->id = db_last_insert_id(wallet->db);
 }
 
 /* TODO(cdecker) Stolen from shachain, move to some appropriate location */
@@ -539,7 +923,7 @@ bool wallet_shachain_add_hash(struct wallet *wallet,
 			      uint64_t index,
 			      const struct secret *hash)
 {
-	sqlite3_stmt *stmt;
+	struct db_stmt *stmt;
 	u32 pos = count_trailing_zeroes(index);
 	struct sha256 s;
 
@@ -552,18 +936,18 @@ bool wallet_shachain_add_hash(struct wallet *wallet,
 	}
 
 	stmt = db_prepare(wallet->db, "UPDATE shachains SET num_valid=?, min_index=? WHERE id=?");
-	sqlite3_bind_int(stmt, 1, chain->chain.num_valid);
-	sqlite3_bind_int64(stmt, 2, index);
-	sqlite3_bind_int64(stmt, 3, chain->id);
+	db_bind_int(stmt, 1, chain->chain.num_valid);
+	db_bind_int64(stmt, 2, index);
+	db_bind_int64(stmt, 3, chain->id);
 	db_exec_prepared(wallet->db, stmt);
 
 	stmt = db_prepare(
 		wallet->db,
 		"REPLACE INTO shachain_known (shachain_id, pos, idx, hash) VALUES (?, ?, ?, ?);");
-	sqlite3_bind_int64(stmt, 1, chain->id);
-	sqlite3_bind_int(stmt, 2, pos);
-	sqlite3_bind_int64(stmt, 3, index);
-	sqlite3_bind_blob(stmt, 4, hash, sizeof(*hash), SQLITE_TRANSIENT);
+	db_bind_int64(stmt, 1, chain->id);
+	db_bind_int(stmt, 2, pos);
+	db_bind_int64(stmt, 3, index);
+	db_bind_blob(stmt, 4, hash, sizeof(*hash));
 	db_exec_prepared(wallet->db, stmt);
 
 	return true;
@@ -572,74 +956,159 @@ bool wallet_shachain_add_hash(struct wallet *wallet,
 bool wallet_shachain_load(struct wallet *wallet, u64 id,
 			  struct wallet_shachain *chain)
 {
-	sqlite3_stmt *stmt;
+	struct db_stmt *stmt;
 	chain->id = id;
 	shachain_init(&chain->chain);
 
 	/* Load shachain metadata */
 	stmt = db_select_prepare(wallet->db, "min_index, num_valid FROM shachains WHERE id=?");
-	sqlite3_bind_int64(stmt, 1, id);
+	db_bind_int64(stmt, 1, id);
 
 	if (!db_select_step(wallet->db, stmt))
 		return false;
 
-	chain->chain.min_index = sqlite3_column_int64(stmt, 0);
-	chain->chain.num_valid = sqlite3_column_int64(stmt, 1);
+	chain->chain.min_index = db_column_int64(stmt, 0);
+	chain->chain.num_valid = db_column_int64(stmt, 1);
 	db_stmt_done(stmt);
 
 	/* Load shachain known entries */
 	stmt = db_select_prepare(wallet->db, "idx, hash, pos FROM shachain_known WHERE shachain_id=?");
-	sqlite3_bind_int64(stmt, 1, id);
+	db_bind_int64(stmt, 1, id);
 
 	while (db_select_step(wallet->db, stmt)) {
-		int pos = sqlite3_column_int(stmt, 2);
-		chain->chain.known[pos].index = sqlite3_column_int64(stmt, 0);
-		memcpy(&chain->chain.known[pos].hash, sqlite3_column_blob(stmt, 1), sqlite3_column_bytes(stmt, 1));
+		int pos = db_column_int(stmt, 2);
+		chain->chain.known[pos].index = db_column_int64(stmt, 0);
+		memcpy(&chain->chain.known[pos].hash, db_column_blob(stmt, 1), db_column_bytes(stmt, 1));
 	}
 	return true;
 }
 
-static struct peer *wallet_peer_load(struct wallet *w, const u64 dbid)
-{
-	const unsigned char *addrstr;
-	struct peer *peer;
+/* A peers row, before we create the struct peer for it. */
+struct peer_row {
 	struct node_id id;
 	struct wireaddr_internal addr;
+};
 
-	sqlite3_stmt *stmt =
-		db_select(w->db,
-			 "id, node_id, address FROM peers WHERE id=%"PRIu64";", dbid);
+/* What wallet_stmt2channel needs from other tables, read in a few passes
+ * up front instead of a few queries per channel. */
+struct channel_loader {
+	UINTMAP(struct peer_row *) peers;
+	UINTMAP(struct channel_config *) configs;
+	UINTMAP(struct wallet_shachain *) shachains;
+};
 
-	if (!db_select_step(w->db, stmt))
-		return NULL;
+static void destroy_channel_loader(struct channel_loader *cl)
+{
+	uintmap_clear(&cl->peers);
+	uintmap_clear(&cl->configs);
+	uintmap_clear(&cl->shachains);
+}
 
-	if (!sqlite3_column_node_id(stmt, 1, &id)) {
-		db_stmt_done(stmt);
-		return NULL;
+static void channel_loader_peers(struct channel_loader *cl, struct wallet *w)
+{
+	struct db_stmt *stmt;
+
+	stmt = db_select(w->db, "id, node_id, address FROM peers"
+			 " WHERE id IN (SELECT peer_id FROM channels);");
+	while (db_select_step(w->db, stmt)) {
+		struct peer_row *row = tal(cl, struct peer_row);
+		const unsigned char *addrstr = db_column_text(stmt, 2);
+
+		/* Channels without a valid peer fail to load. */
+		if (!db_column_node_id(stmt, 1, &row->id)
+		    || !parse_wireaddr_internal((const char *)addrstr,
+						&row->addr, DEFAULT_PORT,
+						false, false, true, NULL)) {
+			tal_free(row);
+			continue;
+		}
+		uintmap_add(&cl->peers, db_column_int64(stmt, 0), row);
 	}
-	addrstr = sqlite3_column_text(stmt, 2);
-	if (!parse_wireaddr_internal((const char*)addrstr, &addr, DEFAULT_PORT, false, false, true, NULL)) {
-		db_stmt_done(stmt);
-		return NULL;
+}
+
+static void channel_loader_configs(struct channel_loader *cl, struct wallet *w)
+{
+	struct db_stmt *stmt;
+
+	stmt = db_select(w->db,
+			 "id, dust_limit_satoshis, max_htlc_value_in_flight_msat, "
+			 "channel_reserve_satoshis, htlc_minimum_msat, "
+			 "to_self_delay, max_accepted_htlcs FROM channel_configs"
+			 " WHERE id IN (SELECT channel_config_local FROM channels"
+			 " UNION SELECT channel_config_remote FROM channels);");
+	while (db_select_step(w->db, stmt)) {
+		struct channel_config *cc = tal(cl, struct channel_config);
+
+		cc->id = db_column_int64(stmt, 0);
+		cc->dust_limit = db_column_amount_sat(stmt, 1);
+		cc->max_htlc_value_in_flight = db_column_amount_msat(stmt, 2);
+		cc->channel_reserve = db_column_amount_sat(stmt, 3);
+		cc->htlc_minimum = db_column_amount_msat(stmt, 4);
+		cc->to_self_delay = db_column_int(stmt, 5);
+		cc->max_accepted_htlcs = db_column_int(stmt, 6);
+		uintmap_add(&cl->configs, cc->id, cc);
+	}
+}
+
+static void channel_loader_shachains(struct channel_loader *cl,
+				     struct wallet *w)
+{
+	struct db_stmt *stmt;
+
+	stmt = db_select(w->db, "id, min_index, num_valid FROM shachains"
+			 " WHERE id IN (SELECT shachain_remote_id FROM channels);");
+	while (db_select_step(w->db, stmt)) {
+		struct wallet_shachain *chain = tal(cl, struct wallet_shachain);
+
+		chain->id = db_column_int64(stmt, 0);
+		shachain_init(&chain->chain);
+		chain->chain.min_index = db_column_int64(stmt, 1);
+		chain->chain.num_valid = db_column_int64(stmt, 2);
+		uintmap_add(&cl->shachains, chain->id, chain);
 	}
 
-	peer = new_peer(w->ld, sqlite3_column_int64(stmt, 0),
-			&id, &addr);
-	db_stmt_done(stmt);
+	stmt = db_select(w->db, "shachain_id, idx, hash, pos FROM shachain_known"
+			 " WHERE shachain_id IN"
+			 " (SELECT shachain_remote_id FROM channels);");
+	while (db_select_step(w->db, stmt)) {
+		struct wallet_shachain *chain;
+		int pos = db_column_int(stmt, 3);
 
-	return peer;
+		chain = uintmap_get(&cl->shachains, db_column_int64(stmt, 0));
+		if (!chain)
+			continue;
+		chain->chain.known[pos].index = db_column_int64(stmt, 1);
+		memcpy(&chain->chain.known[pos].hash, db_column_blob(stmt, 2),
+		       db_column_bytes(stmt, 2));
+	}
+}
+
+static struct channel_loader *channel_loader_new(const tal_t *ctx,
+						 struct wallet *w)
+{
+	struct channel_loader *cl = tal(ctx, struct channel_loader);
+
+	uintmap_init(&cl->peers);
+	uintmap_init(&cl->configs);
+	uintmap_init(&cl->shachains);
+	tal_add_destructor(cl, destroy_channel_loader);
+
+	channel_loader_peers(cl, w);
+	channel_loader_configs(cl, w);
+	channel_loader_shachains(cl, w);
+	return cl;
 }
 
-static secp256k1_ecdsa_signature *
+secp256k1_ecdsa_signature *
 wallet_htlc_sigs_load(const tal_t *ctx, struct wallet *w, u64 channelid)
 {
-	sqlite3_stmt *stmt = db_select_prepare(w->db, "signature FROM htlc_sigs WHERE channelid = ?");
+	struct db_stmt *stmt = db_select_prepare(w->db, "signature FROM htlc_sigs WHERE channelid = ?");
 	secp256k1_ecdsa_signature *htlc_sigs = tal_arr(ctx, secp256k1_ecdsa_signature, 0);
-	sqlite3_bind_int64(stmt, 1, channelid);
+	db_bind_int64(stmt, 1, channelid);
 
 	while (db_select_step(w->db, stmt)) {
 		secp256k1_ecdsa_signature sig;
-		sqlite3_column_signature(stmt, 0, &sig);
+		db_column_signature(stmt, 0, &sig);
 		tal_arr_expand(&htlc_sigs, sig);
 	}
 
@@ -652,21 +1121,21 @@ bool wallet_remote_ann_sigs_load(const tal_t *ctx, struct wallet *w, u64 id,
 				 secp256k1_ecdsa_signature **remote_ann_node_sig,
 				 secp256k1_ecdsa_signature **remote_ann_bitcoin_sig)
 {
-	sqlite3_stmt *stmt;
-	int res;
+	struct db_stmt *stmt;
+	bool res;
 	stmt = db_select_prepare(w->db,
 				 "remote_ann_node_sig, remote_ann_bitcoin_sig"
 				 " FROM channels WHERE id = ?");
-	sqlite3_bind_int64(stmt, 1, id);
+	db_bind_int64(stmt, 1, id);
 
-	res = sqlite3_step(stmt);
+	res = db_select_step(w->db, stmt);
 
 	/* This must succeed, since we know the channel exists */
-	assert(res == SQLITE_ROW);
+	assert(res);
 
 	/* if only one sig exists, forget the sig and hope peer send new ones*/
-	if(sqlite3_column_type(stmt, 0) == SQLITE_NULL ||
-			sqlite3_column_type(stmt, 1) == SQLITE_NULL) {
+	if(db_column_is_null(stmt, 0) ||
+			db_column_is_null(stmt, 1)) {
 		*remote_ann_node_sig = *remote_ann_bitcoin_sig = NULL;
 		db_stmt_done(stmt);
 		return true;
@@ -676,10 +1145,10 @@ bool wallet_remote_ann_sigs_load(const tal_t *ctx, struct wallet *w, u64 id,
 	*remote_ann_node_sig = tal(ctx, secp256k1_ecdsa_signature);
 	*remote_ann_bitcoin_sig = tal(ctx, secp256k1_ecdsa_signature);
 
-	if (!sqlite3_column_signature(stmt, 0, *remote_ann_node_sig))
+	if (!db_column_signature(stmt, 0, *remote_ann_node_sig))
 		goto fail;
 
-	if (!sqlite3_column_signature(stmt, 1, *remote_ann_bitcoin_sig))
+	if (!db_column_signature(stmt, 1, *remote_ann_bitcoin_sig))
 		goto fail;
 
 	db_stmt_done(stmt);
@@ -693,9 +1162,11 @@ fail:
 }
 
 /**
- * wallet_stmt2channel - Helper to populate a wallet_channel from a sqlite3_stmt
+ * wallet_stmt2channel - Helper to populate a wallet_channel from a struct db_stmt
  */
-static struct channel *wallet_stmt2channel(struct wallet *w, sqlite3_stmt *stmt)
+static struct channel *wallet_stmt2channel(struct wallet *w,
+					   const struct channel_loader *cl,
+					   struct db_stmt *stmt)
 {
 	bool ok = true;
 	struct channel_info channel_info;
@@ -713,33 +1184,37 @@ static struct channel *wallet_stmt2channel(struct wallet *w, sqlite3_stmt *stmt)
 	struct basepoints local_basepoints;
 	struct pubkey local_funding_pubkey;
 	struct pubkey *future_per_commitment_point;
+	const struct channel_config *cc;
+	const struct wallet_shachain *chain;
 
-	peer_dbid = sqlite3_column_int64(stmt, 1);
+	peer_dbid = db_column_int64(stmt, 1);
 	peer = find_peer_by_dbid(w->ld, peer_dbid);
 	if (!peer) {
-		peer = wallet_peer_load(w, peer_dbid);
-		if (!peer) {
+		const struct peer_row *row = uintmap_get(&cl->peers, peer_dbid);
+		if (!row)
 			return NULL;
-		}
+		peer = new_peer(w->ld, peer_dbid, &row->id, &row->addr);
 	}
 
-	if (sqlite3_column_type(stmt, 2) != SQLITE_NULL) {
+	if (!db_column_is_null(stmt, 2)) {
 		scid = tal(tmpctx, struct short_channel_id);
-		if (!sqlite3_column_short_channel_id(stmt, 2, scid))
+		if (!db_column_short_channel_id(stmt, 2, scid))
 			return NULL;
 	} else {
 		scid = NULL;
 	}
 
-	ok &= wallet_shachain_load(w, sqlite3_column_int64(stmt, 27),
-				   &wshachain);
+	chain = uintmap_get(&cl->shachains, db_column_int64(stmt, 27));
+	if (!chain)
+		return NULL;
+	wshachain = *chain;
 
-	remote_shutdown_scriptpubkey = sqlite3_column_arr(tmpctx, stmt, 28, u8);
+	remote_shutdown_scriptpubkey = db_column_arr(tmpctx, stmt, 28, u8);
 
 	/* Do we have a last_sent_commit, if yes, populate */
-	if (sqlite3_column_type(stmt, 41) != SQLITE_NULL) {
-		const u8 *cursor = sqlite3_column_blob(stmt, 41);
-		size_t len = sqlite3_column_bytes(stmt, 41);
+	if (!db_column_is_null(stmt, 41)) {
+		const u8 *cursor = db_column_blob(stmt, 41);
+		size_t len = db_column_bytes(stmt, 41);
 		size_t n = 0;
 		last_sent_commit = tal_arr(tmpctx, struct changed_htlc, n);
 		while (len) {
@@ -751,99 +1226,102 @@ static struct channel *wallet_stmt2channel(struct wallet *w, sqlite3_stmt *stmt)
 		last_sent_commit = NULL;
 
 #ifdef COMPAT_V060
-	if (!last_sent_commit && sqlite3_column_type(stmt, 30) != SQLITE_NULL) {
+	if (!last_sent_commit && !db_column_is_null(stmt, 30)) {
 		last_sent_commit = tal(tmpctx, struct changed_htlc);
-		last_sent_commit->newstate = sqlite3_column_int64(stmt, 30);
-		last_sent_commit->id = sqlite3_column_int64(stmt, 31);
+		last_sent_commit->newstate = db_column_int64(stmt, 30);
+		last_sent_commit->id = db_column_int64(stmt, 31);
 	}
 #endif
 
-	if (sqlite3_column_type(stmt, 40) != SQLITE_NULL) {
+	if (!db_column_is_null(stmt, 40)) {
 		future_per_commitment_point = tal(tmpctx, struct pubkey);
-		ok &= sqlite3_column_pubkey(stmt, 40,
-					    future_per_commitment_point);
+		ok &= db_column_pubkey(stmt, 40,
+				       future_per_commitment_point);
 	} else
 		future_per_commitment_point = NULL;
 
-	ok &= wallet_channel_config_load(w, sqlite3_column_int64(stmt, 3),
-					 &our_config);
-	ok &= sqlite3_column_sha256_double(stmt, 12, &funding_txid.shad);
+	cc = uintmap_get(&cl->configs, db_column_int64(stmt, 3));
+	if (!cc)
+		return NULL;
+	our_config = *cc;
+	ok &= db_column_sha256_double(stmt, 12, &funding_txid.shad);
 
-	ok &= sqlite3_column_signature(stmt, 33, &last_sig.s);
+	ok &= db_column_signature(stmt, 33, &last_sig.s);
 	last_sig.sighash_type = SIGHASH_ALL;
 
 	/* Populate channel_info */
-	ok &= sqlite3_column_pubkey(stmt, 18, &channel_info.remote_fundingkey);
-	ok &= sqlite3_column_pubkey(stmt, 19, &channel_info.theirbase.revocation);
-	ok &= sqlite3_column_pubkey(stmt, 20, &channel_info.theirbase.payment);
-	ok &= sqlite3_column_pubkey(stmt, 21, &channel_info.theirbase.htlc);
-	ok &= sqlite3_column_pubkey(stmt, 22, &channel_info.theirbase.delayed_payment);
-	ok &= sqlite3_column_pubkey(stmt, 23, &channel_info.remote_per_commit);
-	ok &= sqlite3_column_pubkey(stmt, 24, &channel_info.old_remote_per_commit);
-	channel_info.feerate_per_kw[LOCAL] = sqlite3_column_int(stmt, 25);
-	channel_info.feerate_per_kw[REMOTE] = sqlite3_column_int(stmt, 26);
-
-	wallet_channel_config_load(w, sqlite3_column_int64(stmt, 4),
-				   &channel_info.their_config);
+	ok &= db_column_pubkey(stmt, 18, &channel_info.remote_fundingkey);
+	ok &= db_column_pubkey(stmt, 19, &channel_info.theirbase.revocation);
+	ok &= db_column_pubkey(stmt, 20, &channel_info.theirbase.payment);
+	ok &= db_column_pubkey(stmt, 21, &channel_info.theirbase.htlc);
+	ok &= db_column_pubkey(stmt, 22, &channel_info.theirbase.delayed_payment);
+	ok &= db_column_pubkey(stmt, 23, &channel_info.remote_per_commit);
+	ok &= db_column_pubkey(stmt, 24, &channel_info.old_remote_per_commit);
+	channel_info.feerate_per_kw[LOCAL] = db_column_int(stmt, 25);
+	channel_info.feerate_per_kw[REMOTE] = db_column_int(stmt, 26);
+
+	cc = uintmap_get(&cl->configs, db_column_int64(stmt, 4));
+	if (cc)
+		channel_info.their_config = *cc;
 
 	if (!ok) {
 		return NULL;
 	}
 
-	final_key_idx = sqlite3_column_int64(stmt, 29);
+	final_key_idx = db_column_int64(stmt, 29);
 	if (final_key_idx < 0) {
 		log_broken(w->log, "%s: Final key < 0", __func__);
 		return NULL;
 	}
 
-	get_channel_basepoints(w->ld, &peer->id, sqlite3_column_int64(stmt, 0),
+	get_channel_basepoints(w->ld, &peer->id, db_column_int64(stmt, 0),
 			       &local_basepoints, &local_funding_pubkey);
-	chan = new_channel(peer, sqlite3_column_int64(stmt, 0),
+	chan = new_channel(peer, db_column_int64(stmt, 0),
 			   &wshachain,
-			   sqlite3_column_int(stmt, 5),
-			   sqlite3_column_int(stmt, 6),
+			   db_column_int(stmt, 5),
+			   db_column_int(stmt, 6),
 			   NULL, /* Set up fresh log */
 			   "Loaded from database",
-			   sqlite3_column_int(stmt, 7),
+			   db_column_int(stmt, 7),
 			   &our_config,
-			   sqlite3_column_int(stmt, 8),
-			   sqlite3_column_int64(stmt, 9),
-			   sqlite3_column_int64(stmt, 10),
-			   sqlite3_column_int64(stmt, 11),
+			   db_column_int(stmt, 8),
+			   db_column_int64(stmt, 9),
+			   db_column_int64(stmt, 10),
+			   db_column_int64(stmt, 11),
 			   &funding_txid,
-			   sqlite3_column_int(stmt, 13),
-			   sqlite3_column_amount_sat(stmt, 14),
-			   sqlite3_column_amount_msat(stmt, 16),
-			   sqlite3_column_int(stmt, 15) != 0,
+			   db_column_int(stmt, 13),
+			   db_column_amount_sat(stmt, 14),
+			   db_column_amount_msat(stmt, 16),
+			   db_column_int(stmt, 15) != 0,
 			   scid,
-			   sqlite3_column_amount_msat(stmt, 17),
-			   sqlite3_column_amount_msat(stmt, 38), /* msatoshi_to_us_min */
-			   sqlite3_column_amount_msat(stmt, 39), /* msatoshi_to_us_max */
-			   sqlite3_column_tx(tmpctx, stmt, 32),
+			   db_column_amount_msat(stmt, 17),
+			   db_column_amount_msat(stmt, 38), /* msatoshi_to_us_min */
+			   db_column_amount_msat(stmt, 39), /* msatoshi_to_us_max */
+			   db_column_tx(tmpctx, stmt, 32),
 			   &last_sig,
-			   wallet_htlc_sigs_load(tmpctx, w,
-						 sqlite3_column_int64(stmt, 0)),
+			   /* Only onchaind needs these: it loads them */
+			   NULL,
 			   &channel_info,
 			   remote_shutdown_scriptpubkey,
 			   final_key_idx,
-			   sqlite3_column_int(stmt, 34) != 0,
+			   db_column_int(stmt, 34) != 0,
 			   last_sent_commit,
-			   sqlite3_column_int64(stmt, 35),
-			   sqlite3_column_int(stmt, 36),
-			   sqlite3_column_int(stmt, 37),
+			   db_column_int64(stmt, 35),
+			   db_column_int(stmt, 36),
+			   db_column_int(stmt, 37),
 			   /* Not connected */
 			   false,
 			   &local_basepoints, &local_funding_pubkey,
 			   future_per_commitment_point,
-			   sqlite3_column_int(stmt, 42),
-			   sqlite3_column_int(stmt, 43),
-			   sqlite3_column_arr(tmpctx, stmt, 44, u8));
+			   db_column_int(stmt, 42),
+			   db_column_int(stmt, 43),
+			   db_column_arr(tmpctx, stmt, 44, u8));
 	return chan;
 }
 
 /* List of fields to retrieve from the channels DB table, in the order
  * that wallet_stmt2channel understands and will parse correctly */
-/* Numbers below are sqlite3_column indices for the first field
+/* Numbers below are db_column indices for the first field
  * of that line. */
 static const char *channel_fields =
     /*0*/ "id, peer_id, short_channel_id, channel_config_local, "
@@ -867,7 +1345,8 @@ static const char *channel_fields =
 bool wallet_channels_load_active(struct wallet *w)
 {
 	bool ok = true;
-	sqlite3_stmt *stmt;
+	struct db_stmt *stmt;
+	struct channel_loader *cl = channel_loader_new(tmpctx, w);
 
 	/* We load all channels */
 	stmt = db_select(w->db, "%s FROM channels;", channel_fields);
@@ -876,7 +1355,7 @@ bool wallet_channels_load_active(struct wallet *w)
 
 	int count = 0;
 	while (db_select_step(w->db, stmt)) {
-		struct channel *c = wallet_stmt2channel(w, stmt);
+		struct channel *c = wallet_stmt2channel(w, cl, stmt);
 		if (!c) {
 			ok = false;
 			db_stmt_done(stmt);
@@ -887,6 +1366,7 @@ bool wallet_channels_load_active(struct wallet *w)
 		count++;
 	}
 	log_debug(w->log, "Loaded %d channels from DB", count);
+	tal_free(cl);
 	return ok;
 }
 
@@ -909,7 +1389,7 @@ void wallet_channel_stats_incr_x(struct wallet *w,
 				  payments_stat, payments_stat,
 				  msatoshi_stat, msatoshi_stat, msat.millisatoshis, /* Raw: db access */
 				  cdbid);
-	sqlite3_stmt *stmt = db_prepare(w->db, qry);
+	struct db_stmt *stmt = db_prepare(w->db, qry);
 	db_exec_prepared(w->db, stmt);
 }
 void wallet_channel_stats_incr_in_offered(struct wallet *w, u64 id,
@@ -937,8 +1417,8 @@ void wallet_channel_stats_load(struct wallet *w,
 			       u64 id,
 			       struct channel_stats *stats)
 {
-	sqlite3_stmt *stmt;
-	int res;
+	struct db_stmt *stmt;
+	bool res;
 	stmt = db_select_prepare(w->db,
 			  "   in_payments_offered,  in_payments_fulfilled"
 			  ",  in_msatoshi_offered,  in_msatoshi_fulfilled"
@@ -946,37 +1426,37 @@ void wallet_channel_stats_load(struct wallet *w,
 			  ", out_msatoshi_offered, out_msatoshi_fulfilled"
 			  "  FROM channels"
 			  " WHERE id = ?");
-	sqlite3_bind_int64(stmt, 1, id);
+	db_bind_int64(stmt, 1, id);
 
-	res = sqlite3_step(stmt);
+	res = db_select_step(w->db, stmt);
 
 	/* This must succeed, since we know the channel exists */
-	assert(res == SQLITE_ROW);
-
-	stats->in_payments_offered = sqlite3_column_int64(stmt, 0);
-	stats->in_payments_fulfilled = sqlite3_column_int64(stmt, 1);
-	stats->in_msatoshi_offered = sqlite3_column_amount_msat(stmt, 2);
-	stats->in_msatoshi_fulfilled = sqlite3_column_amount_msat(stmt, 3);
-	stats->out_payments_offered = sqlite3_column_int64(stmt, 4);
-	stats->out_payments_fulfilled = sqlite3_column_int64(stmt, 5);
-	stats->out_msatoshi_offered = sqlite3_column_amount_msat(stmt, 6);
-	stats->out_msatoshi_fulfilled = sqlite3_column_amount_msat(stmt, 7);
+	assert(res);
+
+	stats->in_payments_offered = db_column_int64(stmt, 0);
+	stats->in_payments_fulfilled = db_column_int64(stmt, 1);
+	stats->in_msatoshi_offered = db_column_amount_msat(stmt, 2);
+	stats->in_msatoshi_fulfilled = db_column_amount_msat(stmt, 3);
+	stats->out_payments_offered = db_column_int64(stmt, 4);
+	stats->out_payments_fulfilled = db_column_int64(stmt, 5);
+	stats->out_msatoshi_offered = db_column_amount_msat(stmt, 6);
+	stats->out_msatoshi_fulfilled = db_column_amount_msat(stmt, 7);
 	db_stmt_done(stmt);
 }
 
 void wallet_blocks_heights(struct wallet *w, u32 def, u32 *min, u32 *max)
 {
 	assert(min != NULL && max != NULL);
-	sqlite3_stmt *stmt = db_select_prepare(w->db, "MIN(height), MAX(height) FROM blocks;");
+	struct db_stmt *stmt = db_select_prepare(w->db, "MIN(height), MAX(height) FROM blocks;");
 
 	*min = def;
 	*max = def;
 
 	/* If we ever processed a block we'll get the latest block in the chain */
 	if (db_select_step(w->db, stmt)) {
-		if (sqlite3_column_type(stmt, 0) != SQLITE_NULL) {
-			*min = sqlite3_column_int(stmt, 0);
-			*max = sqlite3_column_int(stmt, 1);
+		if (!db_column_is_null(stmt, 0)) {
+			*min = db_column_int(stmt, 0);
+			*max = db_column_int(stmt, 1);
 		}
 		db_stmt_done(stmt);
 	}
@@ -985,19 +1465,19 @@ void wallet_blocks_heights(struct wallet *w, u32 def, u32 *min, u32 *max)
 static void wallet_channel_config_insert(struct wallet *w,
 					 struct channel_config *cc)
 {
-	sqlite3_stmt *stmt;
+	struct db_stmt *stmt;
 
 	assert(cc->id == 0);
 
 	stmt = db_prepare(w->db, "INSERT INTO channel_configs DEFAULT VALUES;");
 	db_exec_prepared(w->db, stmt);
-	cc->id = sqlite3_last_insert_rowid(w->db->sql);
+	cc->id = db_last_insert_id(w->db);
 }
 
 static void wallet_channel_config_save(struct wallet *w,
 				       const struct channel_config *cc)
 {
-	sqlite3_stmt *stmt;
+	struct db_stmt *stmt;
 
 	assert(cc->id != 0);
 	stmt = db_prepare(w->db, "UPDATE channel_configs SET"
@@ -1008,13 +1488,13 @@ static void wallet_channel_config_save(struct wallet *w,
 			  "  to_self_delay=?,"
 			  "  max_accepted_htlcs=?"
 			  " WHERE id=?;");
-	sqlite3_bind_amount_sat(stmt, 1, cc->dust_limit);
-	sqlite3_bind_amount_msat(stmt, 2, cc->max_htlc_value_in_flight);
-	sqlite3_bind_amount_sat(stmt, 3, cc->channel_reserve);
-	sqlite3_bind_amount_msat(stmt, 4, cc->htlc_minimum);
-	sqlite3_bind_int(stmt, 5, cc->to_self_delay);
-	sqlite3_bind_int(stmt, 6, cc->max_accepted_htlcs);
-	sqlite3_bind_int64(stmt, 7, cc->id);
+	db_bind_amount_sat(stmt, 1, cc->dust_limit);
+	db_bind_amount_msat(stmt, 2, cc->max_htlc_value_in_flight);
+	db_bind_amount_sat(stmt, 3, cc->channel_reserve);
+	db_bind_amount_msat(stmt, 4, cc->htlc_minimum);
+	db_bind_int(stmt, 5, cc->to_self_delay);
+	db_bind_int(stmt, 6, cc->max_accepted_htlcs);
+	db_bind_int64(stmt, 7, cc->id);
 	db_exec_prepared(w->db, stmt);
 }
 
@@ -1027,17 +1507,17 @@ bool wallet_channel_config_load(struct wallet *w, const u64 id,
 	    "id, dust_limit_satoshis, max_htlc_value_in_flight_msat, "
 	    "channel_reserve_satoshis, htlc_minimum_msat, to_self_delay, "
 	    "max_accepted_htlcs FROM channel_configs WHERE id=%" PRIu64 ";";
-	sqlite3_stmt *stmt = db_select(w->db, query, id);
+	struct db_stmt *stmt = db_select(w->db, query, id);
 	if (!db_select_step(w->db, stmt))
 		return false;
 
 	cc->id = id;
-	cc->dust_limit = sqlite3_column_amount_sat(stmt, col++);
-	cc->max_htlc_value_in_flight = sqlite3_column_amount_msat(stmt, col++);
-	cc->channel_reserve = sqlite3_column_amount_sat(stmt, col++);
-	cc->htlc_minimum = sqlite3_column_amount_msat(stmt, col++);
-	cc->to_self_delay = sqlite3_column_int(stmt, col++);
-	cc->max_accepted_htlcs = sqlite3_column_int(stmt, col++);
+	cc->dust_limit = db_column_amount_sat(stmt, col++);
+	cc->max_htlc_value_in_flight = db_column_amount_msat(stmt, col++);
+	cc->channel_reserve = db_column_amount_sat(stmt, col++);
+	cc->htlc_minimum = db_column_amount_msat(stmt, col++);
+	cc->to_self_delay = db_column_int(stmt, col++);
+	cc->max_accepted_htlcs = db_column_int(stmt, col++);
 	assert(col == 7);
 	db_stmt_done(stmt);
 	return ok;
@@ -1053,199 +1533,429 @@ void wallet_announcement_save(struct wallet *w, u64 id,
 			      secp256k1_ecdsa_signature *remote_ann_node_sig,
 			      secp256k1_ecdsa_signature *remote_ann_bitcoin_sig)
 {
-	sqlite3_stmt *stmt;
+	struct db_stmt *stmt;
 
 	stmt = db_prepare(w->db, "UPDATE channels SET"
 			  "  remote_ann_node_sig=?,"
 			  "  remote_ann_bitcoin_sig=?"
 			  " WHERE id=?");
 
-	sqlite3_bind_signature(stmt, 1, remote_ann_node_sig);
-	sqlite3_bind_signature(stmt, 2, remote_ann_bitcoin_sig);
-	sqlite3_bind_int64(stmt, 3, id);
+	db_bind_signature(stmt, 1, remote_ann_node_sig);
+	db_bind_signature(stmt, 2, remote_ann_bitcoin_sig);
+	db_bind_int64(stmt, 3, id);
 	db_exec_prepared(w->db, stmt);
 }
 
-void wallet_channel_save(struct wallet *w, struct channel *chan)
+/* wallet_channel_save() only writes out the columns which changed since it
+ * last ran: these are the columns, and channel_db_image() their values. */
+static const char *channel_cols[] = {
+	"shachain_remote_id",
+	"short_channel_id",
+	"state",
+	"funder",
+	"channel_flags",
+	"minimum_depth",
+	"next_index_local",
+	"next_index_remote",
+	"next_htlc_id",
+	"funding_tx_id",
+	"funding_tx_outnum",
+	"funding_satoshi",
+	"funding_locked_remote",
+	"push_msatoshi",
+	"msatoshi_local",
+	"shutdown_scriptpubkey_remote",
+	"shutdown_keyidx_local",
+	"channel_config_local",
+	"last_tx",
+	"last_sig",
+	"last_was_revoke",
+	"min_possible_feerate",
+	"max_possible_feerate",
+	"msatoshi_to_us_min",
+	"msatoshi_to_us_max",
+	"feerate_base",
+	"feerate_ppm",
+	"remote_upfront_shutdown_script",
+	"fundingkey_remote",
+	"revocation_basepoint_remote",
+	"payment_basepoint_remote",
+	"htlc_basepoint_remote",
+	"delayed_payment_basepoint_remote",
+	"per_commit_remote",
+	"old_per_commit_remote",
+	"local_feerate_per_kw",
+	"remote_feerate_per_kw",
+	"channel_config_remote",
+	"future_per_commitment_point",
+	"last_sent_commit",
+	/* Not columns: our_config and their_config rows in channel_configs */
+	NULL,
+	NULL,
+};
+
+/* A value as we'd bind it: 'n' for NULL, 'i' then an s64, or 'b' then
+ * the blob. */
+static u8 *col_null(const tal_t *ctx)
 {
-	sqlite3_stmt *stmt;
-	u8 *last_sent_commit;
-	assert(chan->first_blocknum);
+	return tal_dup_arr(ctx, u8, (const u8 *)"n", 1, 0);
+}
 
-	wallet_channel_config_save(w, &chan->our_config);
+static u8 *col_int(const tal_t *ctx, s64 v)
+{
+	u8 *val = tal_arr(ctx, u8, 1 + sizeof(v));
+	val[0] = 'i';
+	memcpy(val + 1, &v, sizeof(v));
+	return val;
+}
 
-	stmt = db_prepare(w->db, "UPDATE channels SET"
-			  "  shachain_remote_id=?,"
-			  "  short_channel_id=?,"
-			  "  state=?,"
-			  "  funder=?,"
-			  "  channel_flags=?,"
-			  "  minimum_depth=?,"
-			  "  next_index_local=?,"
-			  "  next_index_remote=?,"
-			  "  next_htlc_id=?,"
-			  "  funding_tx_id=?,"
-			  "  funding_tx_outnum=?,"
-			  "  funding_satoshi=?,"
-			  "  funding_locked_remote=?,"
-			  "  push_msatoshi=?,"
-			  "  msatoshi_local=?,"
-			  "  shutdown_scriptpubkey_remote=?,"
-			  "  shutdown_keyidx_local=?,"
-			  "  channel_config_local=?,"
-			  "  last_tx=?, last_sig=?,"
-			  "  last_was_revoke=?,"
-			  "  min_possible_feerate=?,"
-			  "  max_possible_feerate=?,"
-			  "  msatoshi_to_us_min=?,"
-			  "  msatoshi_to_us_max=?,"
-			  "  feerate_base=?,"
-			  "  feerate_ppm=?,"
-			  "  remote_upfront_shutdown_script=?"
-			  " WHERE id=?");
-	sqlite3_bind_int64(stmt, 1, chan->their_shachain.id);
-	if (chan->scid)
-		sqlite3_bind_short_channel_id(stmt, 2, chan->scid);
-	else
-		sqlite3_bind_null(stmt, 2);
-	sqlite3_bind_int(stmt, 3, chan->state);
-	sqlite3_bind_int(stmt, 4, chan->funder);
-	sqlite3_bind_int(stmt, 5, chan->channel_flags);
-	sqlite3_bind_int(stmt, 6, chan->minimum_depth);
+static u8 *col_blob(const tal_t *ctx, const void *p, size_t len)
+{
+	u8 *val = tal_arr(ctx, u8, 1 + len);
+	val[0] = 'b';
+	memcpy(val + 1, p, len);
+	return val;
+}
+
+static u8 *col_pubkey(const tal_t *ctx, const struct pubkey *pk)
+{
+	u8 der[PUBKEY_CMPR_LEN];
+
+	if (!pk)
+		return col_null(ctx);
+	pubkey_to_der(der, pk);
+	return col_blob(ctx, der, sizeof(der));
+}
 
-	sqlite3_bind_int64(stmt, 7, chan->next_index[LOCAL]);
-	sqlite3_bind_int64(stmt, 8, chan->next_index[REMOTE]);
-	sqlite3_bind_int64(stmt, 9, chan->next_htlc_id);
+static u8 *col_config(const tal_t *ctx, const struct channel_config *cc)
+{
+	/* Never bound, only compared: there's padding in the struct */
+	s64 v[] = { cc->id,
+		    cc->dust_limit.satoshis, /* Raw: comparison only */
+		    cc->max_htlc_value_in_flight.millisatoshis, /* Raw: comparison only */
+		    cc->channel_reserve.satoshis, /* Raw: comparison only */
+		    cc->htlc_minimum.millisatoshis, /* Raw: comparison only */
+		    cc->to_self_delay,
+		    cc->max_accepted_htlcs };
+	return col_blob(ctx, v, sizeof(v));
+}
 
-	sqlite3_bind_sha256_double(stmt, 10, &chan->funding_txid.shad);
+static void db_bind_col(struct db_stmt *stmt, int pos, const u8 *val)
+{
+	s64 v;
 
-	sqlite3_bind_int(stmt, 11, chan->funding_outnum);
-	sqlite3_bind_amount_sat(stmt, 12, chan->funding);
-	sqlite3_bind_int(stmt, 13, chan->remote_funding_locked);
-	sqlite3_bind_amount_msat(stmt, 14, chan->push);
-	sqlite3_bind_amount_msat(stmt, 15, chan->our_msat);
+	switch (val[0]) {
+	case 'n':
+		db_bind_null(stmt, pos);
+		return;
+	case 'i':
+		memcpy(&v, val + 1, sizeof(v));
+		db_bind_int64(stmt, pos, v);
+		return;
+	case 'b':
+		db_bind_blob(stmt, pos, val + 1, tal_count(val) - 1);
+		return;
+	}
+	abort();
+}
 
+static u8 **channel_db_image(const tal_t *ctx, const struct channel *chan)
+{
+	u8 **img = tal_arr(ctx, u8 *, ARRAY_SIZE(channel_cols));
+	const struct channel_info *ci = &chan->channel_info;
+	u8 sig[64], *ser;
+	size_t n = 0;
+
+	img[n++] = col_int(img, chan->their_shachain.id);
+	if (chan->scid) {
+		char *scid = short_channel_id_to_str(tmpctx, chan->scid);
+		img[n++] = col_blob(img, scid, strlen(scid));
+	} else
+		img[n++] = col_null(img);
+	img[n++] = col_int(img, chan->state);
+	img[n++] = col_int(img, chan->funder);
+	img[n++] = col_int(img, chan->channel_flags);
+	img[n++] = col_int(img, chan->minimum_depth);
+	img[n++] = col_int(img, chan->next_index[LOCAL]);
+	img[n++] = col_int(img, chan->next_index[REMOTE]);
+	img[n++] = col_int(img, chan->next_htlc_id);
+	img[n++] = col_blob(img, &chan->funding_txid.shad,
+			    sizeof(chan->funding_txid.shad));
+	img[n++] = col_int(img, chan->funding_outnum);
+	img[n++] = col_int(img, chan->funding.satoshis); /* Raw: db access */
+	img[n++] = col_int(img, chan->remote_funding_locked);
+	img[n++] = col_int(img, chan->push.millisatoshis); /* Raw: db access */
+	img[n++] = col_int(img, chan->our_msat.millisatoshis); /* Raw: db access */
 	if (chan->remote_shutdown_scriptpubkey)
-		sqlite3_bind_blob(stmt, 16, chan->remote_shutdown_scriptpubkey,
-				  tal_count(chan->remote_shutdown_scriptpubkey),
-				  SQLITE_TRANSIENT);
+		img[n++] = col_blob(img, chan->remote_shutdown_scriptpubkey,
+				    tal_count(chan->remote_shutdown_scriptpubkey));
 	else
-		sqlite3_bind_null(stmt, 16);
-
-	sqlite3_bind_int64(stmt, 17, chan->final_key_idx);
-	sqlite3_bind_int64(stmt, 18, chan->our_config.id);
-	sqlite3_bind_tx(stmt, 19, chan->last_tx);
-	sqlite3_bind_signature(stmt, 20, &chan->last_sig.s);
-	sqlite3_bind_int(stmt, 21, chan->last_was_revoke);
-	sqlite3_bind_int(stmt, 22, chan->min_possible_feerate);
-	sqlite3_bind_int(stmt, 23, chan->max_possible_feerate);
-	sqlite3_bind_amount_msat(stmt, 24, chan->msat_to_us_min);
-	sqlite3_bind_amount_msat(stmt, 25, chan->msat_to_us_max);
-	sqlite3_bind_int(stmt, 26, chan->feerate_base);
-	sqlite3_bind_int(stmt, 27, chan->feerate_ppm);
+		img[n++] = col_null(img);
+	img[n++] = col_int(img, chan->final_key_idx);
+	img[n++] = col_int(img, chan->our_config.id);
+	ser = linearize_tx(tmpctx, chan->last_tx);
+	img[n++] = col_blob(img, ser, tal_count(ser));
+	secp256k1_ecdsa_signature_serialize_compact(secp256k1_ctx, sig,
+						    &chan->last_sig.s);
+	img[n++] = col_blob(img, sig, sizeof(sig));
+	img[n++] = col_int(img, chan->last_was_revoke);
+	img[n++] = col_int(img, chan->min_possible_feerate);
+	img[n++] = col_int(img, chan->max_possible_feerate);
+	img[n++] = col_int(img, chan->msat_to_us_min.millisatoshis); /* Raw: db access */
+	img[n++] = col_int(img, chan->msat_to_us_max.millisatoshis); /* Raw: db access */
+	img[n++] = col_int(img, chan->feerate_base);
+	img[n++] = col_int(img, chan->feerate_ppm);
 	if (chan->remote_upfront_shutdown_script)
-		sqlite3_bind_blob(stmt, 28, chan->remote_upfront_shutdown_script,
-				  tal_count(chan->remote_upfront_shutdown_script),
-				  SQLITE_TRANSIENT);
-	else
-		sqlite3_bind_null(stmt, 28);
-	sqlite3_bind_int64(stmt, 29, chan->dbid);
-	db_exec_prepared(w->db, stmt);
-
-	wallet_channel_config_save(w, &chan->channel_info.their_config);
-	stmt = db_prepare(w->db, "UPDATE channels SET"
-			  "  fundingkey_remote=?,"
-			  "  revocation_basepoint_remote=?,"
-			  "  payment_basepoint_remote=?,"
-			  "  htlc_basepoint_remote=?,"
-			  "  delayed_payment_basepoint_remote=?,"
-			  "  per_commit_remote=?,"
-			  "  old_per_commit_remote=?,"
-			  "  local_feerate_per_kw=?,"
-			  "  remote_feerate_per_kw=?,"
-			  "  channel_config_remote=?,"
-			  "  future_per_commitment_point=?"
-			  " WHERE id=?");
-	sqlite3_bind_pubkey(stmt, 1,  &chan->channel_info.remote_fundingkey);
-	sqlite3_bind_pubkey(stmt, 2,  &chan->channel_info.theirbase.revocation);
-	sqlite3_bind_pubkey(stmt, 3,  &chan->channel_info.theirbase.payment);
-	sqlite3_bind_pubkey(stmt, 4,  &chan->channel_info.theirbase.htlc);
-	sqlite3_bind_pubkey(stmt, 5,  &chan->channel_info.theirbase.delayed_payment);
-	sqlite3_bind_pubkey(stmt, 6,  &chan->channel_info.remote_per_commit);
-	sqlite3_bind_pubkey(stmt, 7,  &chan->channel_info.old_remote_per_commit);
-	sqlite3_bind_int(stmt, 8, chan->channel_info.feerate_per_kw[LOCAL]);
-	sqlite3_bind_int(stmt, 9, chan->channel_info.feerate_per_kw[REMOTE]);
-	sqlite3_bind_int64(stmt, 10, chan->channel_info.their_config.id);
-	if (chan->future_per_commitment_point)
-		sqlite3_bind_pubkey(stmt, 11, chan->future_per_commitment_point);
+		img[n++] = col_blob(img, chan->remote_upfront_shutdown_script,
+				    tal_count(chan->remote_upfront_shutdown_script));
 	else
-		sqlite3_bind_null(stmt, 11);
-	sqlite3_bind_int64(stmt, 12, chan->dbid);
-	db_exec_prepared(w->db, stmt);
+		img[n++] = col_null(img);
+
+	img[n++] = col_pubkey(img, &ci->remote_fundingkey);
+	img[n++] = col_pubkey(img, &ci->theirbase.revocation);
+	img[n++] = col_pubkey(img, &ci->theirbase.payment);
+	img[n++] = col_pubkey(img, &ci->theirbase.htlc);
+	img[n++] = col_pubkey(img, &ci->theirbase.delayed_payment);
+	img[n++] = col_pubkey(img, &ci->remote_per_commit);
+	img[n++] = col_pubkey(img, &ci->old_remote_per_commit);
+	img[n++] = col_int(img, ci->feerate_per_kw[LOCAL]);
+	img[n++] = col_int(img, ci->feerate_per_kw[REMOTE]);
+	img[n++] = col_int(img, ci->their_config.id);
+	img[n++] = col_pubkey(img, chan->future_per_commitment_point);
 
 	/* If we have a last_sent_commit, store it */
-	last_sent_commit = tal_arr(tmpctx, u8, 0);
+	ser = tal_arr(tmpctx, u8, 0);
 	for (size_t i = 0; i < tal_count(chan->last_sent_commit); i++)
-		towire_changed_htlc(&last_sent_commit,
-				    &chan->last_sent_commit[i]);
-
-	stmt = db_prepare(w->db,
-			  "UPDATE channels SET"
-			  "  last_sent_commit=?"
-			  " WHERE id=?");
-	if (tal_count(last_sent_commit))
-		sqlite3_bind_blob(stmt, 1,
-				  last_sent_commit, tal_count(last_sent_commit),
-				  SQLITE_TRANSIENT);
+		towire_changed_htlc(&ser, &chan->last_sent_commit[i]);
+	if (tal_count(ser))
+		img[n++] = col_blob(img, ser, tal_count(ser));
 	else
-		sqlite3_bind_null(stmt, 1);
-	sqlite3_bind_int64(stmt, 2, chan->dbid);
-	db_exec_prepared(w->db, stmt);
+		img[n++] = col_null(img);
+
+	img[n++] = col_config(img, &chan->our_config);
+	img[n++] = col_config(img, &ci->their_config);
+	assert(n == ARRAY_SIZE(channel_cols));
+	return img;
+}
+
+static bool col_changed(const struct channel *chan, u8 **img, size_t i)
+{
+	return !chan->db_image
+		|| !memeq(chan->db_image[i], tal_count(chan->db_image[i]),
+			  img[i], tal_count(img[i]));
+}
+
+void wallet_channel_save(struct wallet *w, struct channel *chan)
+{
+	struct db_stmt *stmt;
+	u8 **img;
+	char *query;
+	size_t i, n = 0;
+	assert(chan->first_blocknum);
+
+	img = channel_db_image(chan, chan);
+
+	/* The channel_configs rows. */
+	if (col_changed(chan, img, ARRAY_SIZE(channel_cols) - 2))
+		wallet_channel_config_save(w, &chan->our_config);
+	if (col_changed(chan, img, ARRAY_SIZE(channel_cols) - 1))
+		wallet_channel_config_save(w, &chan->channel_info.their_config);
+
+	query = tal_strdup(tmpctx, "UPDATE channels SET");
+	for (i = 0; channel_cols[i]; i++) {
+		if (col_changed(chan, img, i))
+			tal_append_fmt(&query, "%s %s=?",
+				       n++ ? "," : "", channel_cols[i]);
+	}
+
+	if (n) {
+		tal_append_fmt(&query, " WHERE id=?");
+		stmt = db_prepare(w->db, query);
+		n = 0;
+		for (i = 0; channel_cols[i]; i++) {
+			if (col_changed(chan, img, i))
+				db_bind_col(stmt, ++n, img[i]);
+		}
+		db_bind_int64(stmt, ++n, chan->dbid);
+		db_exec_prepared(w->db, stmt);
+	}
+
+	tal_free(chan->db_image);
+	chan->db_image = img;
 }
 
 void wallet_channel_insert(struct wallet *w, struct channel *chan)
 {
-	sqlite3_stmt *stmt;
+	struct db_stmt *stmt;
 
 	if (chan->peer->dbid == 0) {
 		/* Need to create the peer first */
 		stmt = db_prepare(w->db, "INSERT INTO peers (node_id, address) VALUES (?, ?);");
-		sqlite3_bind_node_id(stmt, 1, &chan->peer->id);
-		sqlite3_bind_text(stmt, 2,
-				  type_to_string(tmpctx, struct wireaddr_internal, &chan->peer->addr),
-				  -1, SQLITE_TRANSIENT);
+		db_bind_node_id(stmt, 1, &chan->peer->id);
+		db_bind_text(stmt, 2,
+			     type_to_string(tmpctx, struct wireaddr_internal, &chan->peer->addr));
 		db_exec_prepared(w->db, stmt);
-		chan->peer->dbid = sqlite3_last_insert_rowid(w->db->sql);
+		chan->peer->dbid = db_last_insert_id(w->db);
 	}
 
 	/* Insert a stub, that we update, unifies INSERT and UPDATE paths */
 	stmt = db_prepare(w->db, "INSERT INTO channels ("
 			  "peer_id, first_blocknum, id) VALUES (?, ?, ?);");
-	sqlite3_bind_int64(stmt, 1, chan->peer->dbid);
-	sqlite3_bind_int(stmt, 2, chan->first_blocknum);
-	sqlite3_bind_int(stmt, 3, chan->dbid);
+	db_bind_int64(stmt, 1, chan->peer->dbid);
+	db_bind_int(stmt, 2, chan->first_blocknum);
+	db_bind_int(stmt, 3, chan->dbid);
 	db_exec_prepared(w->db, stmt);
 
 	wallet_channel_config_insert(w, &chan->our_config);
 	wallet_channel_config_insert(w, &chan->channel_info.their_config);
 	wallet_shachain_init(w, &chan->their_shachain);
 
-	/* Now save path as normal */
+	/* Now save path as normal: all of it, this time */
+	chan->db_image = tal_free(chan->db_image);
 	wallet_channel_save(w, chan);
 }
 
 void wallet_channel_delete(struct wallet *w, u64 wallet_id)
 {
-	sqlite3_stmt *stmt;
+	struct db_stmt *stmt;
+
+	/* These aren't foreign keys the other way, so don't cascade. */
+	stmt = db_prepare(w->db,
+			  "DELETE FROM shachains WHERE id ="
+			  " (SELECT shachain_remote_id FROM channels WHERE id=?)");
+	db_bind_int64(stmt, 1, wallet_id);
+	db_exec_prepared(w->db, stmt);
+
+	stmt = db_prepare(w->db,
+			  "DELETE FROM channel_configs WHERE id IN"
+			  " (SELECT channel_config_local FROM channels WHERE id=?"
+			  "  UNION SELECT channel_config_remote FROM channels WHERE id=?)");
+	db_bind_int64(stmt, 1, wallet_id);
+	db_bind_int64(stmt, 2, wallet_id);
+	db_exec_prepared(w->db, stmt);
+
 	stmt = db_prepare(w->db,
 			  "DELETE FROM channels WHERE id=?");
-	sqlite3_bind_int64(stmt, 1, wallet_id);
+	db_bind_int64(stmt, 1, wallet_id);
+	db_exec_prepared(w->db, stmt);
+}
+
+void wallet_channel_archive(struct wallet *w, u64 wallet_id, u32 archived_height)
+{
+	struct db_stmt *stmt;
+
+	stmt = db_prepare(w->db,
+			  "INSERT INTO channels_archive ("
+			  "  id"
+			  ", peer_node_id"
+			  ", short_channel_id"
+			  ", funder"
+			  ", funding_tx_id"
+			  ", funding_tx_outnum"
+			  ", funding_satoshi"
+			  ", msatoshi_local"
+			  ", archived_height"
+			  ") SELECT"
+			  "  c.id"
+			  ", p.node_id"
+			  ", c.short_channel_id"
+			  ", c.funder"
+			  ", c.funding_tx_id"
+			  ", c.funding_tx_outnum"
+			  ", c.funding_satoshi"
+			  ", c.msatoshi_local"
+			  ", ?"
+			  " FROM channels c JOIN peers p ON (c.peer_id = p.id)"
+			  " WHERE c.id = ?;");
+	db_bind_int(stmt, 1, archived_height);
+	db_bind_int64(stmt, 2, wallet_id);
+	db_exec_prepared(w->db, stmt);
+
+	stmt = db_prepare(w->db,
+			  "INSERT INTO channel_htlcs_archive ("
+			  "  id"
+			  ", channel_id"
+			  ", channel_htlc_id"
+			  ", direction"
+			  ", msatoshi"
+			  ", payment_hash"
+			  ", payment_key"
+			  ", hstate"
+			  ", received_time"
+			  ") SELECT"
+			  "  id"
+			  ", channel_id"
+			  ", channel_htlc_id"
+			  ", direction"
+			  ", msatoshi"
+			  ", payment_hash"
+			  ", payment_key"
+			  ", hstate"
+			  ", received_time"
+			  " FROM channel_htlcs WHERE channel_id = ?;");
+	db_bind_int64(stmt, 1, wallet_id);
+	db_exec_prepared(w->db, stmt);
+
+	/* Deleting the HTLCs sets in_htlc_id NULL: keep what we show. */
+	stmt = db_prepare(w->db,
+			  "UPDATE forwarded_payments SET payment_hash ="
+			  " (SELECT payment_hash FROM channel_htlcs h"
+			  "   WHERE h.id = forwarded_payments.in_htlc_id)"
+			  " WHERE in_htlc_id IN"
+			  " (SELECT id FROM channel_htlcs WHERE channel_id = ?);");
+	db_bind_int64(stmt, 1, wallet_id);
 	db_exec_prepared(w->db, stmt);
 }
 
+const struct closed_channel *wallet_closed_channels_get(const tal_t *ctx,
+							struct wallet *w,
+							const struct node_id *peer_id)
+{
+	struct closed_channel *chans = tal_arr(ctx, struct closed_channel, 0);
+	struct db_stmt *stmt;
+
+	stmt = db_select_prepare(w->db,
+				 tal_fmt(tmpctx,
+					 "  id"
+					 ", peer_node_id"
+					 ", short_channel_id"
+					 ", funder"
+					 ", funding_tx_id"
+					 ", funding_tx_outnum"
+					 ", funding_satoshi"
+					 ", msatoshi_local"
+					 ", archived_height"
+					 " FROM channels_archive%s"
+					 " ORDER BY id;",
+					 peer_id ? " WHERE peer_node_id = ?" : ""));
+	if (peer_id)
+		db_bind_node_id(stmt, 1, peer_id);
+
+	while (db_select_step(w->db, stmt)) {
+		struct closed_channel c;
+
+		c.dbid = db_column_int64(stmt, 0);
+		db_column_node_id(stmt, 1, &c.peer_id);
+		if (!db_column_is_null(stmt, 2)) {
+			c.scid = tal(chans, struct short_channel_id);
+			if (!db_column_short_channel_id(stmt, 2, c.scid))
+				c.scid = tal_free(c.scid);
+		} else
+			c.scid = NULL;
+		c.funder = db_column_int(stmt, 3);
+		db_column_sha256_double(stmt, 4, &c.funding_txid.shad);
+		c.funding_outnum = db_column_int(stmt, 5);
+		c.funding = db_column_amount_sat(stmt, 6);
+		c.our_msat = db_column_amount_msat(stmt, 7);
+		c.archived_height = db_column_int(stmt, 8);
+		tal_arr_expand(&chans, c);
+	}
+	return chans;
+}
+
 void wallet_peer_delete(struct wallet *w, u64 peer_dbid)
 {
-	sqlite3_stmt *stmt;
+	struct db_stmt *stmt;
 
 	/* Must not have any channels still using this peer */
 	stmt = db_select(w->db,
@@ -1255,7 +1965,7 @@ void wallet_peer_delete(struct wallet *w, u64 peer_dbid)
 		fatal("We have channels using peer %"PRIu64, peer_dbid);
 
 	stmt = db_prepare(w->db, "DELETE FROM peers WHERE id=?");
-	sqlite3_bind_int64(stmt, 1, peer_dbid);
+	db_bind_int64(stmt, 1, peer_dbid);
 	db_exec_prepared(w->db, stmt);
 }
 
@@ -1263,16 +1973,26 @@ void wallet_confirm_tx(struct wallet *w,
 		       const struct bitcoin_txid *txid,
 		       const u32 confirmation_height)
 {
-	sqlite3_stmt *stmt;
+	struct db_stmt *stmt;
+	struct available_utxos_iter it;
 	assert(confirmation_height > 0);
 	stmt = db_prepare(w->db,
 			  "UPDATE outputs "
 			  "SET confirmation_height = ? "
 			  "WHERE prev_out_tx = ?");
-	sqlite3_bind_int(stmt, 1, confirmation_height);
-	sqlite3_bind_sha256_double(stmt, 2, &txid->shad);
+	db_bind_int(stmt, 1, confirmation_height);
+	db_bind_sha256_double(stmt, 2, &txid->shad);
 
 	db_exec_prepared(w->db, stmt);
+
+	for (struct utxo *u = available_utxos_first(w->available_utxos, &it);
+	     u;
+	     u = available_utxos_next(w->available_utxos, &it)) {
+		if (!bitcoin_txid_eq(&u->txid, txid))
+			continue;
+		tal_free(u->blockheight);
+		u->blockheight = tal_dup(u, u32, &confirmation_height);
+	}
 }
 
 int wallet_extract_owned_outputs(struct wallet *w, const struct bitcoin_tx *tx,
@@ -1344,7 +2064,7 @@ int wallet_extract_owned_outputs(struct wallet *w, const struct bitcoin_tx *tx,
 void wallet_htlc_save_in(struct wallet *wallet,
 			 const struct channel *chan, struct htlc_in *in)
 {
-	sqlite3_stmt *stmt;
+	struct db_stmt *stmt;
 
 	stmt = db_prepare(
 		wallet->db,
@@ -1362,39 +2082,39 @@ void wallet_htlc_save_in(struct wallet *wallet,
 		" received_time) VALUES "
 		"(?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?);");
 
-	sqlite3_bind_int64(stmt, 1, chan->dbid);
-	sqlite3_bind_int64(stmt, 2, in->key.id);
-	sqlite3_bind_int(stmt, 3, DIRECTION_INCOMING);
-	sqlite3_bind_amount_msat(stmt, 4, in->msat);
-	sqlite3_bind_int(stmt, 5, in->cltv_expiry);
-	sqlite3_bind_sha256(stmt, 6, &in->payment_hash);
+	db_bind_int64(stmt, 1, chan->dbid);
+	db_bind_int64(stmt, 2, in->key.id);
+	db_bind_int(stmt, 3, DIRECTION_INCOMING);
+	db_bind_amount_msat(stmt, 4, in->msat);
+	db_bind_int(stmt, 5, in->cltv_expiry);
+	db_bind_sha256(stmt, 6, &in->payment_hash);
 
 	if (in->preimage)
-		sqlite3_bind_preimage(stmt, 7, in->preimage);
+		db_bind_preimage(stmt, 7, in->preimage);
 	else
-		sqlite3_bind_null(stmt, 7);
-	sqlite3_bind_int(stmt, 8, in->hstate);
+		db_bind_null(stmt, 7);
+	db_bind_int(stmt, 8, in->hstate);
 
 	if (!in->shared_secret)
-		sqlite3_bind_null(stmt, 9);
+		db_bind_null(stmt, 9);
 	else
-		sqlite3_bind_blob(stmt, 9, in->shared_secret,
-				  sizeof(*in->shared_secret), SQLITE_TRANSIENT);
+		db_bind_blob(stmt, 9, in->shared_secret,
+			     sizeof(*in->shared_secret));
 
-	sqlite3_bind_blob(stmt, 10, &in->onion_routing_packet,
-			  sizeof(in->onion_routing_packet), SQLITE_TRANSIENT);
+	db_bind_blob(stmt, 10, &in->onion_routing_packet,
+		     sizeof(in->onion_routing_packet));
 
-	sqlite3_bind_timeabs(stmt, 11, in->received_time);
+	db_bind_timeabs(stmt, 11, in->received_time);
 
 	db_exec_prepared(wallet->db, stmt);
-	in->dbid = sqlite3_last_insert_rowid(wallet->db->sql);
+	in->dbid = db_last_insert_id(wallet->db);
 }
 
 void wallet_htlc_save_out(struct wallet *wallet,
 			  const struct channel *chan,
 			  struct htlc_out *out)
 {
-	sqlite3_stmt *stmt;
+	struct db_stmt *stmt;
 
 	/* We absolutely need the incoming HTLC to be persisted before
 	 * we can persist it's dependent */
@@ -1415,29 +2135,102 @@ void wallet_htlc_save_out(struct wallet *wallet,
 	    " hstate,"
 	    " routing_onion) VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?);");
 
-	sqlite3_bind_int64(stmt, 1, chan->dbid);
-	sqlite3_bind_int64(stmt, 2, out->key.id);
-	sqlite3_bind_int(stmt, 3, DIRECTION_OUTGOING);
+	db_bind_int64(stmt, 1, chan->dbid);
+	db_bind_int64(stmt, 2, out->key.id);
+	db_bind_int(stmt, 3, DIRECTION_OUTGOING);
 	if (out->in)
-		sqlite3_bind_int64(stmt, 4, out->in->dbid);
+		db_bind_int64(stmt, 4, out->in->dbid);
 	else
-		sqlite3_bind_null(stmt, 4);
-	sqlite3_bind_amount_msat(stmt, 5, out->msat);
-	sqlite3_bind_int(stmt, 6, out->cltv_expiry);
-	sqlite3_bind_sha256(stmt, 7, &out->payment_hash);
+		db_bind_null(stmt, 4);
+	db_bind_amount_msat(stmt, 5, out->msat);
+	db_bind_int(stmt, 6, out->cltv_expiry);
+	db_bind_sha256(stmt, 7, &out->payment_hash);
 
 	if (out->preimage)
-		sqlite3_bind_preimage(stmt, 8,out->preimage);
+		db_bind_preimage(stmt, 8,out->preimage);
 	else
-		sqlite3_bind_null(stmt, 8);
-	sqlite3_bind_int(stmt, 9, out->hstate);
+		db_bind_null(stmt, 8);
+	db_bind_int(stmt, 9, out->hstate);
 
-	sqlite3_bind_blob(stmt, 10, &out->onion_routing_packet,
-			  sizeof(out->onion_routing_packet), SQLITE_TRANSIENT);
+	db_bind_blob(stmt, 10, &out->onion_routing_packet,
+		     sizeof(out->onion_routing_packet));
 
 	db_exec_prepared(wallet->db, stmt);
 
-	out->dbid = sqlite3_last_insert_rowid(wallet->db->sql);
+	out->dbid = db_last_insert_id(wallet->db);
+}
+
+/* An HTLC update deferred by wallet_htlc_batch_start() */
+struct htlc_update {
+	u64 dbid;
+	enum htlc_state state;
+	const struct preimage *payment_key;
+	enum onion_type failcode;
+	const u8 *failuremsg;
+};
+
+/* We bind id, hstate, payment_key, malformed_onion and failuremsg for each
+ * HTLC, and sqlite3 allows 999 parameters. */
+#define HTLC_UPDATE_PARAMS 5
+#define HTLC_UPDATE_MAX_BATCH 64
+
+static void bind_htlc_update(struct db_stmt *stmt, int base,
+			     const struct htlc_update *u)
+{
+	db_bind_int64(stmt, base + 1, u->dbid);
+	/* FIXME: htlc_state_in_db */
+	db_bind_int(stmt, base + 2, u->state);
+
+	if (u->payment_key)
+		db_bind_preimage(stmt, base + 3, u->payment_key);
+	else
+		db_bind_null(stmt, base + 3);
+
+	db_bind_int(stmt, base + 4, u->failcode);
+	if (u->failuremsg)
+		db_bind_blob(stmt, base + 5,
+			     u->failuremsg, tal_bytelen(u->failuremsg));
+	else
+		db_bind_null(stmt, base + 5);
+}
+
+/* One statement for up to HTLC_UPDATE_MAX_BATCH HTLCs: each column is set
+ * by a CASE on the id. */
+static void htlc_updates_write(struct wallet *wallet,
+			       const struct htlc_update *u, size_t num)
+{
+	static const char *cols[] = { "hstate", "payment_key",
+				      "malformed_onion", "failuremsg" };
+	struct db_stmt *stmt;
+	char *query;
+
+	assert(num <= HTLC_UPDATE_MAX_BATCH);
+	if (num == 1) {
+		stmt = db_prepare(
+			wallet->db,
+			"UPDATE channel_htlcs SET hstate=?2, payment_key=?3, malformed_onion=?4, failuremsg=?5 WHERE id=?1");
+	} else {
+		query = tal_strdup(tmpctx, "UPDATE channel_htlcs SET");
+		for (size_t c = 0; c < ARRAY_SIZE(cols); c++) {
+			tal_append_fmt(&query, "%s %s = CASE id",
+				       c ? "," : "", cols[c]);
+			for (size_t i = 0; i < num; i++)
+				tal_append_fmt(&query, " WHEN ?%zu THEN ?%zu",
+					       i * HTLC_UPDATE_PARAMS + 1,
+					       i * HTLC_UPDATE_PARAMS + 2 + c);
+			tal_append_fmt(&query, " END");
+		}
+		tal_append_fmt(&query, " WHERE id IN (");
+		for (size_t i = 0; i < num; i++)
+			tal_append_fmt(&query, "%s?%zu", i ? ", " : "",
+				       i * HTLC_UPDATE_PARAMS + 1);
+		tal_append_fmt(&query, ");");
+		stmt = db_prepare(wallet->db, query);
+	}
+
+	for (size_t i = 0; i < num; i++)
+		bind_htlc_update(stmt, i * HTLC_UPDATE_PARAMS, &u[i]);
+	db_exec_prepared(wallet->db, stmt);
 }
 
 void wallet_htlc_update(struct wallet *wallet, const u64 htlc_dbid,
@@ -1445,33 +2238,67 @@ void wallet_htlc_update(struct wallet *wallet, const u64 htlc_dbid,
 			const struct preimage *payment_key,
 			enum onion_type failcode, const u8 *failuremsg)
 {
-	sqlite3_stmt *stmt;
+	struct htlc_update u, *pending;
 
 	/* The database ID must be set by a previous call to
 	 * `wallet_htlc_save_*` */
 	assert(htlc_dbid);
-	stmt = db_prepare(
-		wallet->db,
-		"UPDATE channel_htlcs SET hstate=?, payment_key=?, malformed_onion=?, failuremsg=? WHERE id=?");
 
-	/* FIXME: htlc_state_in_db */
-	sqlite3_bind_int(stmt, 1, new_state);
-	sqlite3_bind_int64(stmt, 5, htlc_dbid);
+	u.dbid = htlc_dbid;
+	u.state = new_state;
+	u.payment_key = payment_key;
+	u.failcode = failcode;
+	u.failuremsg = failuremsg;
 
-	if (payment_key)
-		sqlite3_bind_preimage(stmt, 2, payment_key);
-	else
-		sqlite3_bind_null(stmt, 2);
+	if (!wallet->htlc_batch_depth) {
+		htlc_updates_write(wallet, &u, 1);
+		return;
+	}
 
-	sqlite3_bind_int(stmt, 3, failcode);
+	/* The caller's copies may be gone by the time we write them. */
+	for (size_t i = 0; i < tal_count(wallet->htlc_updates); i++) {
+		pending = &wallet->htlc_updates[i];
+		if (pending->dbid == htlc_dbid) {
+			/* Every update sets every field, so last one wins */
+			tal_free(pending->payment_key);
+			tal_free(pending->failuremsg);
+			goto set;
+		}
+	}
+	tal_resize(&wallet->htlc_updates, tal_count(wallet->htlc_updates) + 1);
+	pending = &wallet->htlc_updates[tal_count(wallet->htlc_updates) - 1];
+
+set:
+	*pending = u;
+	if (payment_key)
+		pending->payment_key = tal_dup(wallet->htlc_updates,
+					       struct preimage, payment_key);
 	if (failuremsg)
-		sqlite3_bind_blob(stmt, 4,
-				  failuremsg, tal_bytelen(failuremsg),
-				  SQLITE_TRANSIENT);
-	else
-		sqlite3_bind_null(stmt, 4);
+		pending->failuremsg = tal_dup_arr(wallet->htlc_updates, u8,
+						  failuremsg,
+						  tal_count(failuremsg), 0);
+}
 
-	db_exec_prepared(wallet->db, stmt);
+void wallet_htlc_batch_start(struct wallet *wallet)
+{
+	if (wallet->htlc_batch_depth++ == 0)
+		wallet->htlc_updates = tal_arr(wallet, struct htlc_update, 0);
+}
+
+void wallet_htlc_batch_end(struct wallet *wallet)
+{
+	size_t num;
+
+	assert(wallet->htlc_batch_depth);
+	if (--wallet->htlc_batch_depth != 0)
+		return;
+
+	num = tal_count(wallet->htlc_updates);
+	for (size_t i = 0; i < num; i += HTLC_UPDATE_MAX_BATCH)
+		htlc_updates_write(wallet, wallet->htlc_updates + i,
+				   num - i < HTLC_UPDATE_MAX_BATCH
+				   ? num - i : HTLC_UPDATE_MAX_BATCH);
+	wallet->htlc_updates = tal_free(wallet->htlc_updates);
 }
 
 /* origin_htlc is htlc_out only, shared_secret is htlc_in only */
@@ -1482,38 +2309,38 @@ void wallet_htlc_update(struct wallet *wallet, const u64 htlc_dbid,
 	"origin_htlc, shared_secret, received_time"
 
 static bool wallet_stmt2htlc_in(struct channel *channel,
-				sqlite3_stmt *stmt, struct htlc_in *in)
+				struct db_stmt *stmt, struct htlc_in *in)
 {
 	bool ok = true;
-	in->dbid = sqlite3_column_int64(stmt, 0);
-	in->key.id = sqlite3_column_int64(stmt, 1);
+	in->dbid = db_column_int64(stmt, 0);
+	in->key.id = db_column_int64(stmt, 1);
 	in->key.channel = channel;
-	in->msat = sqlite3_column_amount_msat(stmt, 2);
-	in->cltv_expiry = sqlite3_column_int(stmt, 3);
-	in->hstate = sqlite3_column_int(stmt, 4);
+	in->msat = db_column_amount_msat(stmt, 2);
+	in->cltv_expiry = db_column_int(stmt, 3);
+	in->hstate = db_column_int(stmt, 4);
 
-	sqlite3_column_sha256(stmt, 5, &in->payment_hash);
+	db_column_sha256(stmt, 5, &in->payment_hash);
 
-	if (sqlite3_column_type(stmt, 6) != SQLITE_NULL) {
+	if (!db_column_is_null(stmt, 6)) {
 		in->preimage = tal(in, struct preimage);
-		sqlite3_column_preimage(stmt, 6, in->preimage);
+		db_column_preimage(stmt, 6, in->preimage);
 	} else {
 		in->preimage = NULL;
 	}
 
-	assert(sqlite3_column_bytes(stmt, 7) == sizeof(in->onion_routing_packet));
-	memcpy(&in->onion_routing_packet, sqlite3_column_blob(stmt, 7),
+	assert(db_column_bytes(stmt, 7) == sizeof(in->onion_routing_packet));
+	memcpy(&in->onion_routing_packet, db_column_blob(stmt, 7),
 	       sizeof(in->onion_routing_packet));
 
-	in->failuremsg = sqlite3_column_arr(in, stmt, 8, u8);
-	in->failcode = sqlite3_column_int(stmt, 9);
+	in->failuremsg = db_column_arr(in, stmt, 8, u8);
+	in->failcode = db_column_int(stmt, 9);
 
-	if (sqlite3_column_type(stmt, 11) == SQLITE_NULL) {
+	if (db_column_is_null(stmt, 11)) {
 		in->shared_secret = NULL;
 	} else {
-		assert(sqlite3_column_bytes(stmt, 11) == sizeof(struct secret));
+		assert(db_column_bytes(stmt, 11) == sizeof(struct secret));
 		in->shared_secret = tal(in, struct secret);
-		memcpy(in->shared_secret, sqlite3_column_blob(stmt, 11),
+		memcpy(in->shared_secret, db_column_blob(stmt, 11),
 		       sizeof(struct secret));
 #ifdef COMPAT_V062
 		if (memeqzero(in->shared_secret, sizeof(*in->shared_secret)))
@@ -1521,39 +2348,39 @@ static bool wallet_stmt2htlc_in(struct channel *channel,
 #endif
 	}
 
-	in->received_time = sqlite3_column_timeabs(stmt, 12);
+	in->received_time = db_column_timeabs(stmt, 12);
 
 	return ok;
 }
 
 static bool wallet_stmt2htlc_out(struct channel *channel,
-				sqlite3_stmt *stmt, struct htlc_out *out)
+				struct db_stmt *stmt, struct htlc_out *out)
 {
 	bool ok = true;
-	out->dbid = sqlite3_column_int64(stmt, 0);
-	out->key.id = sqlite3_column_int64(stmt, 1);
+	out->dbid = db_column_int64(stmt, 0);
+	out->key.id = db_column_int64(stmt, 1);
 	out->key.channel = channel;
-	out->msat = sqlite3_column_amount_msat(stmt, 2);
-	out->cltv_expiry = sqlite3_column_int(stmt, 3);
-	out->hstate = sqlite3_column_int(stmt, 4);
-	sqlite3_column_sha256(stmt, 5, &out->payment_hash);
+	out->msat = db_column_amount_msat(stmt, 2);
+	out->cltv_expiry = db_column_int(stmt, 3);
+	out->hstate = db_column_int(stmt, 4);
+	db_column_sha256(stmt, 5, &out->payment_hash);
 
-	if (sqlite3_column_type(stmt, 6) != SQLITE_NULL) {
+	if (!db_column_is_null(stmt, 6)) {
 		out->preimage = tal(out, struct preimage);
-		sqlite3_column_preimage(stmt, 6, out->preimage);
+		db_column_preimage(stmt, 6, out->preimage);
 	} else {
 		out->preimage = NULL;
 	}
 
-	assert(sqlite3_column_bytes(stmt, 7) == sizeof(out->onion_routing_packet));
-	memcpy(&out->onion_routing_packet, sqlite3_column_blob(stmt, 7),
+	assert(db_column_bytes(stmt, 7) == sizeof(out->onion_routing_packet));
+	memcpy(&out->onion_routing_packet, db_column_blob(stmt, 7),
 	       sizeof(out->onion_routing_packet));
 
-	out->failuremsg = sqlite3_column_arr(out, stmt, 8, u8);
-	out->failcode = sqlite3_column_int(stmt, 9);
+	out->failuremsg = db_column_arr(out, stmt, 8, u8);
+	out->failcode = db_column_int(stmt, 9);
 
-	if (sqlite3_column_type(stmt, 10) != SQLITE_NULL) {
-		out->origin_htlc_id = sqlite3_column_int64(stmt, 10);
+	if (!db_column_is_null(stmt, 10)) {
+		out->origin_htlc_id = db_column_int64(stmt, 10);
 		out->am_origin = false;
 	} else {
 		out->origin_htlc_id = 0;
@@ -1604,6 +2431,32 @@ static void fixup_hin(struct wallet *wallet, struct htlc_in *hin)
 #endif
 }
 
+static bool wallet_load_htlc_in(struct wallet *wallet, struct channel *chan,
+				struct db_stmt *stmt,
+				struct htlc_in_map *htlcs_in)
+{
+	struct htlc_in *in = tal(chan, struct htlc_in);
+	bool ok = wallet_stmt2htlc_in(chan, stmt, in);
+
+	connect_htlc_in(htlcs_in, in);
+	fixup_hin(wallet, in);
+	return ok && htlc_in_check(in, NULL) != NULL;
+}
+
+static bool wallet_load_htlc_out(struct channel *chan, struct db_stmt *stmt,
+				 struct htlc_out_map *htlcs_out)
+{
+	struct htlc_out *out = tal(chan, struct htlc_out);
+	bool ok = wallet_stmt2htlc_out(chan, stmt, out);
+
+	connect_htlc_out(htlcs_out, out);
+	/* Cannot htlc_out_check because we haven't wired the
+	 * dependencies in yet */
+	return ok;
+}
+
+/* The hstate conditions must match the partial indexes on channel_htlcs
+ * exactly (so they're literals, not parameters), or they won't be used. */
 bool wallet_htlcs_load_for_channel(struct wallet *wallet,
 				   struct channel *chan,
 				   struct htlc_in_map *htlcs_in,
@@ -1613,18 +2466,14 @@ bool wallet_htlcs_load_for_channel(struct wallet *wallet,
 	int incount = 0, outcount = 0;
 
 	log_debug(wallet->log, "Loading HTLCs for channel %"PRIu64, chan->dbid);
-	sqlite3_stmt *stmt = db_select(
+	struct db_stmt *stmt = db_select(
 	    wallet->db,
 	    HTLC_FIELDS " FROM channel_htlcs WHERE "
 	    "direction=%d AND channel_id=%" PRIu64 " AND hstate != %d",
 	    DIRECTION_INCOMING, chan->dbid, SENT_REMOVE_ACK_REVOCATION);
 
 	while (db_select_step(wallet->db, stmt)) {
-		struct htlc_in *in = tal(chan, struct htlc_in);
-		ok &= wallet_stmt2htlc_in(chan, stmt, in);
-		connect_htlc_in(htlcs_in, in);
-		fixup_hin(wallet, in);
-		ok &= htlc_in_check(in, NULL) != NULL;
+		ok &= wallet_load_htlc_in(wallet, chan, stmt, htlcs_in);
 		incount++;
 	}
 
@@ -1635,11 +2484,7 @@ bool wallet_htlcs_load_for_channel(struct wallet *wallet,
 	    DIRECTION_OUTGOING, chan->dbid, RCVD_REMOVE_ACK_REVOCATION);
 
 	while (db_select_step(wallet->db, stmt)) {
-		struct htlc_out *out = tal(chan, struct htlc_out);
-		ok &= wallet_stmt2htlc_out(chan, stmt, out);
-		connect_htlc_out(htlcs_out, out);
-		/* Cannot htlc_out_check because we haven't wired the
-		 * dependencies in yet */
+		ok &= wallet_load_htlc_out(chan, stmt, htlcs_out);
 		outcount++;
 	}
 
@@ -1648,6 +2493,59 @@ bool wallet_htlcs_load_for_channel(struct wallet *wallet,
 	return ok;
 }
 
+bool wallet_htlcs_load_all(struct wallet *wallet,
+			   struct htlc_in_map *htlcs_in,
+			   struct htlc_out_map *htlcs_out)
+{
+	bool ok = true;
+	int incount = 0, outcount = 0;
+	UINTMAP(struct channel *) channels;
+	struct peer *peer;
+	struct channel *chan;
+	struct db_stmt *stmt;
+
+	uintmap_init(&channels);
+	list_for_each(&wallet->ld->peers, peer, list) {
+		list_for_each(&peer->channels, chan, list)
+			uintmap_add(&channels, chan->dbid, chan);
+	}
+
+	/* HTLCs of channels we didn't load (there shouldn't be any) are
+	 * ignored, as they were when we loaded channel by channel. */
+	stmt = db_select(
+	    wallet->db,
+	    HTLC_FIELDS ", channel_id FROM channel_htlcs WHERE "
+	    "direction=%d AND hstate != %d ORDER BY channel_id",
+	    DIRECTION_INCOMING, SENT_REMOVE_ACK_REVOCATION);
+
+	while (db_select_step(wallet->db, stmt)) {
+		chan = uintmap_get(&channels, db_column_int64(stmt, 13));
+		if (!chan)
+			continue;
+		ok &= wallet_load_htlc_in(wallet, chan, stmt, htlcs_in);
+		incount++;
+	}
+
+	stmt = db_select(
+	    wallet->db,
+	    HTLC_FIELDS ", channel_id FROM channel_htlcs WHERE "
+	    "direction=%d AND hstate != %d ORDER BY channel_id",
+	    DIRECTION_OUTGOING, RCVD_REMOVE_ACK_REVOCATION);
+
+	while (db_select_step(wallet->db, stmt)) {
+		chan = uintmap_get(&channels, db_column_int64(stmt, 13));
+		if (!chan)
+			continue;
+		ok &= wallet_load_htlc_out(chan, stmt, htlcs_out);
+		outcount++;
+	}
+
+	uintmap_clear(&channels);
+	log_debug(wallet->log, "Restored %d incoming and %d outgoing HTLCS",
+		  incount, outcount);
+	return ok;
+}
+
 bool wallet_invoice_create(struct wallet *wallet,
 			   struct invoice *pinvoice,
 			   const struct amount_msat *msat TAKES,
@@ -1688,9 +2586,10 @@ void wallet_invoice_delete_expired(struct wallet *wallet, u64 e)
 	invoices_delete_expired(wallet->invoices, e);
 }
 bool wallet_invoice_iterate(struct wallet *wallet,
-			    struct invoice_iterator *it)
+			    struct invoice_iterator *it,
+			    const struct invoice_filter *filter)
 {
-	return invoices_iterate(wallet->invoices, it);
+	return invoices_iterate(wallet->invoices, it, filter);
 }
 const struct invoice_details *
 wallet_invoice_iterator_deref(const tal_t *ctx, struct wallet *wallet,
@@ -1733,25 +2632,25 @@ struct htlc_stub *wallet_htlc_stubs(const tal_t *ctx, struct wallet *wallet,
 {
 	struct htlc_stub *stubs;
 	struct sha256 payment_hash;
-	sqlite3_stmt *stmt = db_select_prepare(wallet->db,
+	struct db_stmt *stmt = db_select_prepare(wallet->db,
 		"channel_id, direction, cltv_expiry, channel_htlc_id, payment_hash "
 		"FROM channel_htlcs WHERE channel_id = ?;");
 
-	sqlite3_bind_int64(stmt, 1, chan->dbid);
+	db_bind_int64(stmt, 1, chan->dbid);
 
 	stubs = tal_arr(ctx, struct htlc_stub, 0);
 
 	while (db_select_step(wallet->db, stmt)) {
 		struct htlc_stub stub;
 
-		assert(sqlite3_column_int64(stmt, 0) == chan->dbid);
+		assert(db_column_int64(stmt, 0) == chan->dbid);
 
 		/* FIXME: merge these two enums */
-		stub.owner = sqlite3_column_int(stmt, 1)==DIRECTION_INCOMING?REMOTE:LOCAL;
-		stub.cltv_expiry = sqlite3_column_int(stmt, 2);
-		stub.id = sqlite3_column_int(stmt, 3);
+		stub.owner = db_column_int(stmt, 1)==DIRECTION_INCOMING?REMOTE:LOCAL;
+		stub.cltv_expiry = db_column_int(stmt, 2);
+		stub.id = db_column_int(stmt, 3);
 
-		sqlite3_column_sha256(stmt, 4, &payment_hash);
+		db_column_sha256(stmt, 4, &payment_hash);
 		ripemd160(&stub.ripemd, payment_hash.u.u8, sizeof(payment_hash.u));
 		tal_arr_expand(&stubs, stub);
 	}
@@ -1762,16 +2661,16 @@ void wallet_local_htlc_out_delete(struct wallet *wallet,
 				  struct channel *chan,
 				  const struct sha256 *payment_hash)
 {
-	sqlite3_stmt *stmt;
+	struct db_stmt *stmt;
 
 	stmt = db_prepare(wallet->db,
 			  "DELETE FROM channel_htlcs"
 			  " WHERE direction = ?"
 			  " AND origin_htlc = ?"
 			  " AND payment_hash = ?");
-	sqlite3_bind_int(stmt, 1, DIRECTION_OUTGOING);
-	sqlite3_bind_int(stmt, 2, 0);
-	sqlite3_bind_sha256(stmt, 3, payment_hash);
+	db_bind_int(stmt, 1, DIRECTION_OUTGOING);
+	db_bind_int(stmt, 2, 0);
+	db_bind_sha256(stmt, 3, payment_hash);
 
 	db_exec_prepared(wallet->db, stmt);
 }
@@ -1804,7 +2703,7 @@ void wallet_payment_setup(struct wallet *wallet, struct wallet_payment *payment)
 void wallet_payment_store(struct wallet *wallet,
 			  const struct sha256 *payment_hash)
 {
-	sqlite3_stmt *stmt;
+	struct db_stmt *stmt;
 	struct wallet_payment *payment;
 
 	payment = find_unstored_payment(wallet, payment_hash);
@@ -1818,7 +2717,7 @@ void wallet_payment_store(struct wallet *wallet,
 		stmt = db_select_prepare(wallet->db,
 					 "status FROM payments"
 					 " WHERE payment_hash=?;");
-		sqlite3_bind_sha256(stmt, 1, payment_hash);
+		db_bind_sha256(stmt, 1, payment_hash);
 		res = db_select_step(wallet->db, stmt);
 		assert(res);
 		db_stmt_done(stmt);
@@ -1845,32 +2744,27 @@ void wallet_payment_store(struct wallet *wallet,
 		"  bolt11"
 		") VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?);");
 
-	sqlite3_bind_int(stmt, 1, payment->status);
-	sqlite3_bind_sha256(stmt, 2, &payment->payment_hash);
-	sqlite3_bind_node_id(stmt, 3, &payment->destination);
-	sqlite3_bind_amount_msat(stmt, 4, payment->msatoshi);
-	sqlite3_bind_int(stmt, 5, payment->timestamp);
-	sqlite3_bind_blob(stmt, 6, payment->path_secrets,
-				   tal_bytelen(payment->path_secrets),
-				   SQLITE_TRANSIENT);
-	sqlite3_bind_node_id_array(stmt, 7, payment->route_nodes);
-	sqlite3_bind_short_channel_id_array(stmt, 8,
-					    payment->route_channels);
-	sqlite3_bind_amount_msat(stmt, 9, payment->msatoshi_sent);
+	db_bind_int(stmt, 1, payment->status);
+	db_bind_sha256(stmt, 2, &payment->payment_hash);
+	db_bind_node_id(stmt, 3, &payment->destination);
+	db_bind_amount_msat(stmt, 4, payment->msatoshi);
+	db_bind_int(stmt, 5, payment->timestamp);
+	db_bind_blob(stmt, 6, payment->path_secrets,
+				   tal_bytelen(payment->path_secrets));
+	db_bind_node_id_array(stmt, 7, payment->route_nodes);
+	db_bind_short_channel_id_array(stmt, 8,
+				       payment->route_channels);
+	db_bind_amount_msat(stmt, 9, payment->msatoshi_sent);
 
 	if (payment->label != NULL)
-		sqlite3_bind_text(stmt, 10, payment->label,
-				  strlen(payment->label),
-				  SQLITE_TRANSIENT);
+		db_bind_text(stmt, 10, payment->label);
 	else
-		sqlite3_bind_null(stmt, 10);
+		db_bind_null(stmt, 10);
 
 	if (payment->bolt11 != NULL)
-		sqlite3_bind_text(stmt, 11, payment->bolt11,
-				  strlen(payment->bolt11),
-				  SQLITE_TRANSIENT);
+		db_bind_text(stmt, 11, payment->bolt11);
 	else
-		sqlite3_bind_null(stmt, 11);
+		db_bind_null(stmt, 11);
 
 	db_exec_prepared(wallet->db, stmt);
 
@@ -1880,7 +2774,7 @@ void wallet_payment_store(struct wallet *wallet,
 void wallet_payment_delete(struct wallet *wallet,
 			   const struct sha256 *payment_hash)
 {
-	sqlite3_stmt *stmt;
+	struct db_stmt *stmt;
 	struct wallet_payment *payment;
 
 	payment = find_unstored_payment(wallet, payment_hash);
@@ -1893,47 +2787,47 @@ void wallet_payment_delete(struct wallet *wallet,
 		wallet->db,
 		"DELETE FROM payments WHERE payment_hash = ?");
 
-	sqlite3_bind_sha256(stmt, 1, payment_hash);
+	db_bind_sha256(stmt, 1, payment_hash);
 
 	db_exec_prepared(wallet->db, stmt);
 }
 
 static struct wallet_payment *wallet_stmt2payment(const tal_t *ctx,
-						  sqlite3_stmt *stmt)
+						  struct db_stmt *stmt)
 {
 	struct wallet_payment *payment = tal(ctx, struct wallet_payment);
-	payment->id = sqlite3_column_int64(stmt, 0);
-	payment->status = sqlite3_column_int(stmt, 1);
+	payment->id = db_column_int64(stmt, 0);
+	payment->status = db_column_int(stmt, 1);
 
-	sqlite3_column_node_id(stmt, 2, &payment->destination);
-	payment->msatoshi = sqlite3_column_amount_msat(stmt, 3);
-	sqlite3_column_sha256(stmt, 4, &payment->payment_hash);
+	db_column_node_id(stmt, 2, &payment->destination);
+	payment->msatoshi = db_column_amount_msat(stmt, 3);
+	db_column_sha256(stmt, 4, &payment->payment_hash);
 
-	payment->timestamp = sqlite3_column_int(stmt, 5);
-	if (sqlite3_column_type(stmt, 6) != SQLITE_NULL) {
+	payment->timestamp = db_column_int(stmt, 5);
+	if (!db_column_is_null(stmt, 6)) {
 		payment->payment_preimage = tal(payment, struct preimage);
-		sqlite3_column_preimage(stmt, 6, payment->payment_preimage);
+		db_column_preimage(stmt, 6, payment->payment_preimage);
 	} else
 		payment->payment_preimage = NULL;
 
 	/* Can be NULL for old db! */
-	payment->path_secrets = sqlite3_column_secrets(payment, stmt, 7);
+	payment->path_secrets = db_column_secrets(payment, stmt, 7);
 
-	payment->route_nodes = sqlite3_column_node_id_array(payment, stmt, 8);
+	payment->route_nodes = db_column_node_id_array(payment, stmt, 8);
 	payment->route_channels
-		= sqlite3_column_short_channel_id_array(payment, stmt, 9);
+		= db_column_short_channel_id_array(payment, stmt, 9);
 
-	payment->msatoshi_sent = sqlite3_column_amount_msat(stmt, 10);
+	payment->msatoshi_sent = db_column_amount_msat(stmt, 10);
 
-	if (sqlite3_column_type(stmt, 11) != SQLITE_NULL)
+	if (!db_column_is_null(stmt, 11))
 		payment->label = tal_strdup(
-		    payment, (const char *)sqlite3_column_text(stmt, 11));
+		    payment, (const char *)db_column_text(stmt, 11));
 	else
 		payment->label = NULL;
 
-	if (sqlite3_column_type(stmt, 12) != SQLITE_NULL)
+	if (!db_column_is_null(stmt, 12))
 		payment->bolt11 = tal_strdup(payment,
-					     (const char *)sqlite3_column_text(stmt, 12));
+					     (const char *)db_column_text(stmt, 12));
 	else
 		payment->bolt11 = NULL;
 
@@ -1950,7 +2844,7 @@ struct wallet_payment *
 wallet_payment_by_hash(const tal_t *ctx, struct wallet *wallet,
 		       const struct sha256 *payment_hash)
 {
-	sqlite3_stmt *stmt;
+	struct db_stmt *stmt;
 	struct wallet_payment *payment;
 
 	/* Present the illusion that it's in the db... */
@@ -1961,7 +2855,7 @@ wallet_payment_by_hash(const tal_t *ctx, struct wallet *wallet,
 	stmt = db_select_prepare(wallet->db, PAYMENT_FIELDS " FROM payments "
 				      "WHERE payment_hash = ?");
 
-	sqlite3_bind_sha256(stmt, 1, payment_hash);
+	db_bind_sha256(stmt, 1, payment_hash);
 	if (db_select_step(wallet->db, stmt)) {
 		payment = wallet_stmt2payment(ctx, stmt);
 		db_stmt_done(stmt);
@@ -1974,7 +2868,7 @@ void wallet_payment_set_status(struct wallet *wallet,
 			       const enum wallet_payment_status newstatus,
 			       const struct preimage *preimage)
 {
-	sqlite3_stmt *stmt;
+	struct db_stmt *stmt;
 	struct wallet_payment *payment;
 
 	/* We can only fail an unstored payment! */
@@ -1989,8 +2883,8 @@ void wallet_payment_set_status(struct wallet *wallet,
 			  "UPDATE payments SET status=? "
 			  "WHERE payment_hash=?");
 
-	sqlite3_bind_int(stmt, 1, wallet_payment_status_in_db(newstatus));
-	sqlite3_bind_sha256(stmt, 2, payment_hash);
+	db_bind_int(stmt, 1, wallet_payment_status_in_db(newstatus));
+	db_bind_sha256(stmt, 2, payment_hash);
 	db_exec_prepared(wallet->db, stmt);
 
 	if (preimage) {
@@ -1998,8 +2892,8 @@ void wallet_payment_set_status(struct wallet *wallet,
 				  "UPDATE payments SET payment_preimage=? "
 				  "WHERE payment_hash=?");
 
-		sqlite3_bind_preimage(stmt, 1, preimage);
-		sqlite3_bind_sha256(stmt, 2, payment_hash);
+		db_bind_preimage(stmt, 1, preimage);
+		db_bind_sha256(stmt, 2, payment_hash);
 		db_exec_prepared(wallet->db, stmt);
 	}
 	if (newstatus != PAYMENT_PENDING) {
@@ -2009,7 +2903,7 @@ void wallet_payment_set_status(struct wallet *wallet,
 				  "     , route_nodes = NULL"
 				  "     , route_channels = NULL"
 				  " WHERE payment_hash = ?;");
-		sqlite3_bind_sha256(stmt, 1, payment_hash);
+		db_bind_sha256(stmt, 1, payment_hash);
 		db_exec_prepared(wallet->db, stmt);
 	}
 }
@@ -2028,7 +2922,7 @@ void wallet_payment_get_failinfo(const tal_t *ctx,
 				 char **faildetail,
 				 int *faildirection)
 {
-	sqlite3_stmt *stmt;
+	struct db_stmt *stmt;
 	bool resb;
 	size_t len;
 
@@ -2039,45 +2933,45 @@ void wallet_payment_get_failinfo(const tal_t *ctx,
 				 ", failupdate, faildetail, faildirection"
 				 "  FROM payments"
 				 " WHERE payment_hash=?;");
-	sqlite3_bind_sha256(stmt, 1, payment_hash);
+	db_bind_sha256(stmt, 1, payment_hash);
 	resb = db_select_step(wallet->db, stmt);
 	assert(resb);
-	if (sqlite3_column_type(stmt, 0) == SQLITE_NULL)
+	if (db_column_is_null(stmt, 0))
 		*failonionreply = NULL;
 	else {
-		len = sqlite3_column_bytes(stmt, 0);
+		len = db_column_bytes(stmt, 0);
 		*failonionreply = tal_arr(ctx, u8, len);
-		memcpy(*failonionreply, sqlite3_column_blob(stmt, 0), len);
+		memcpy(*failonionreply, db_column_blob(stmt, 0), len);
 	}
-	*faildestperm = sqlite3_column_int(stmt, 1) != 0;
-	*failindex = sqlite3_column_int(stmt, 2);
-	*failcode = (enum onion_type) sqlite3_column_int(stmt, 3);
-	if (sqlite3_column_type(stmt, 4) == SQLITE_NULL)
+	*faildestperm = db_column_int(stmt, 1) != 0;
+	*failindex = db_column_int(stmt, 2);
+	*failcode = (enum onion_type) db_column_int(stmt, 3);
+	if (db_column_is_null(stmt, 4))
 		*failnode = NULL;
 	else {
 		*failnode = tal(ctx, struct node_id);
-		resb = sqlite3_column_node_id(stmt, 4, *failnode);
+		resb = db_column_node_id(stmt, 4, *failnode);
 		assert(resb);
 	}
-	if (sqlite3_column_type(stmt, 5) == SQLITE_NULL)
+	if (db_column_is_null(stmt, 5))
 		*failchannel = NULL;
 	else {
 		*failchannel = tal(ctx, struct short_channel_id);
-		resb = sqlite3_column_short_channel_id(stmt, 5, *failchannel);
+		resb = db_column_short_channel_id(stmt, 5, *failchannel);
 		assert(resb);
 
 		/* For pre-0.6.2 dbs, direction will be 0 */
-		*faildirection = sqlite3_column_int(stmt, 8);
+		*faildirection = db_column_int(stmt, 8);
 	}
-	if (sqlite3_column_type(stmt, 6) == SQLITE_NULL)
+	if (db_column_is_null(stmt, 6))
 		*failupdate = NULL;
 	else {
-		len = sqlite3_column_bytes(stmt, 6);
+		len = db_column_bytes(stmt, 6);
 		*failupdate = tal_arr(ctx, u8, len);
-		memcpy(*failupdate, sqlite3_column_blob(stmt, 6), len);
+		memcpy(*failupdate, db_column_blob(stmt, 6), len);
 	}
-	*faildetail = tal_strndup(ctx, sqlite3_column_blob(stmt, 7),
-				  sqlite3_column_bytes(stmt, 7));
+	*faildetail = tal_strndup(ctx, db_column_blob(stmt, 7),
+				  db_column_bytes(stmt, 7));
 
 	db_stmt_done(stmt);
 }
@@ -2094,7 +2988,7 @@ void wallet_payment_set_failinfo(struct wallet *wallet,
 				 const char *faildetail,
 				 int faildirection)
 {
-	sqlite3_stmt *stmt;
+	struct db_stmt *stmt;
 
 	stmt = db_prepare(wallet->db,
 			  "UPDATE payments"
@@ -2109,95 +3003,184 @@ void wallet_payment_set_failinfo(struct wallet *wallet,
 			  "     , faildirection=?"
 			  " WHERE payment_hash=?;");
 	if (failonionreply)
-		sqlite3_bind_blob(stmt, 1,
-				  failonionreply, tal_count(failonionreply),
-				  SQLITE_TRANSIENT);
+		db_bind_blob(stmt, 1,
+			     failonionreply, tal_count(failonionreply));
 	else
-		sqlite3_bind_null(stmt, 1);
-	sqlite3_bind_int(stmt, 2, faildestperm ? 1 : 0);
-	sqlite3_bind_int(stmt, 3, failindex);
-	sqlite3_bind_int(stmt, 4, (int) failcode);
+		db_bind_null(stmt, 1);
+	db_bind_int(stmt, 2, faildestperm ? 1 : 0);
+	db_bind_int(stmt, 3, failindex);
+	db_bind_int(stmt, 4, (int) failcode);
 	if (failnode)
-		sqlite3_bind_node_id(stmt, 5, failnode);
+		db_bind_node_id(stmt, 5, failnode);
 	else
-		sqlite3_bind_null(stmt, 5);
+		db_bind_null(stmt, 5);
 	if (failchannel) {
-		/* sqlite3_bind_short_channel_id requires the input
+		/* db_bind_short_channel_id requires the input
 		 * channel to be tal-allocated... */
 		struct short_channel_id *scid = tal(tmpctx, struct short_channel_id);
 		*scid = *failchannel;
-		sqlite3_bind_short_channel_id(stmt, 6, scid);
-		sqlite3_bind_int(stmt, 9, faildirection);
+		db_bind_short_channel_id(stmt, 6, scid);
+		db_bind_int(stmt, 9, faildirection);
 	} else {
-		sqlite3_bind_null(stmt, 6);
-		sqlite3_bind_null(stmt, 9);
+		db_bind_null(stmt, 6);
+		db_bind_null(stmt, 9);
 	}
 	if (failupdate)
-		sqlite3_bind_blob(stmt, 7,
-				  failupdate, tal_count(failupdate),
-				  SQLITE_TRANSIENT);
+		db_bind_blob(stmt, 7,
+			     failupdate, tal_count(failupdate));
 	else
-		sqlite3_bind_null(stmt, 7);
-	sqlite3_bind_blob(stmt, 8,
-			  faildetail, strlen(faildetail),
-			  SQLITE_TRANSIENT);
+		db_bind_null(stmt, 7);
+	db_bind_blob(stmt, 8,
+		     faildetail, strlen(faildetail));
 
-	sqlite3_bind_sha256(stmt, 10, payment_hash);
+	db_bind_sha256(stmt, 10, payment_hash);
 
 	db_exec_prepared(wallet->db, stmt);
 }
 
-const struct wallet_payment **
-wallet_payment_list(const tal_t *ctx,
-		    struct wallet *wallet,
-		    const struct sha256 *payment_hash)
+/* Each condition is a single '?', bound in the same order. */
+static struct db_stmt *payments_select_filtered(struct wallet *w,
+						const struct payment_filter *f)
 {
-	const struct wallet_payment **payments;
-	sqlite3_stmt *stmt;
-	struct wallet_payment *p;
-	size_t i;
-
-	payments = tal_arr(ctx, const struct wallet_payment *, 0);
-	if (payment_hash) {
-		stmt = db_select_prepare(wallet->db,
-					 PAYMENT_FIELDS " FROM payments "
-					 "WHERE payment_hash = ?;");
-		sqlite3_bind_sha256(stmt, 1, payment_hash);
-	} else {
-		stmt = db_select_prepare(wallet->db,
-					 PAYMENT_FIELDS " FROM payments;");
+	char *query = tal_strdup(tmpctx, PAYMENT_FIELDS "FROM payments");
+	const char *sep = " WHERE ";
+	struct db_stmt *stmt;
+	int pos = 1;
+
+	if (f && f->start) {
+		tal_append_fmt(&query, "%sid >= ?", sep);
+		sep = " AND ";
 	}
-
-	for (i = 0; db_select_step(wallet->db, stmt); i++) {
-		tal_resize(&payments, i+1);
-		payments[i] = wallet_stmt2payment(payments, stmt);
+	if (f && f->payment_hash) {
+		tal_append_fmt(&query, "%spayment_hash = ?", sep);
+		sep = " AND ";
+	}
+	if (f && f->status) {
+		tal_append_fmt(&query, "%sstatus = ?", sep);
+		sep = " AND ";
 	}
+	if (f && f->created_since) {
+		tal_append_fmt(&query, "%stimestamp >= ?", sep);
+		sep = " AND ";
+	}
+	if (f && f->created_before) {
+		tal_append_fmt(&query, "%stimestamp < ?", sep);
+		sep = " AND ";
+	}
+	tal_append_fmt(&query, " ORDER BY id");
+	if (f && f->limit)
+		tal_append_fmt(&query, " LIMIT ?");
+	tal_append_fmt(&query, ";");
+
+	stmt = db_select_prepare(w->db, query);
+	if (!f)
+		return stmt;
+	if (f->start)
+		db_bind_int64(stmt, pos++, f->start);
+	if (f->payment_hash)
+		db_bind_sha256(stmt, pos++, f->payment_hash);
+	if (f->status)
+		db_bind_int(stmt, pos++,
+			    wallet_payment_status_in_db(*f->status));
+	if (f->created_since)
+		db_bind_int64(stmt, pos++, *f->created_since);
+	if (f->created_before)
+		db_bind_int64(stmt, pos++, *f->created_before);
+	if (f->limit)
+		db_bind_int64(stmt, pos++, f->limit);
+	return stmt;
+}
 
-	/* Now attach payments not yet in db. */
-	list_for_each(&wallet->unstored_payments, p, list) {
-		if (payment_hash && !sha256_eq(&p->payment_hash, payment_hash))
-			continue;
-		tal_resize(&payments, i+1);
-		payments[i++] = p;
+static bool unstored_payment_matches(const struct wallet_payment *p,
+				     const struct payment_filter *f)
+{
+	if (!f)
+		return true;
+	/* They've no id yet: they're on the page without a start. */
+	if (f->start)
+		return false;
+	if (f->payment_hash && !sha256_eq(&p->payment_hash, f->payment_hash))
+		return false;
+	if (f->status && p->status != *f->status)
+		return false;
+	if (f->created_since && p->timestamp < *f->created_since)
+		return false;
+	if (f->created_before && p->timestamp >= *f->created_before)
+		return false;
+	return true;
+}
+
+bool wallet_payments_iterate(struct wallet *w,
+			     struct payment_iterator *it,
+			     const struct payment_filter *filter)
+{
+	if (!it->db_done) {
+		if (!it->p)
+			it->p = payments_select_filtered(w, filter);
+		if (db_select_step(w->db, it->p)) {
+			it->count++;
+			return true;
+		}
+		it->p = NULL;
+		it->db_done = true;
 	}
 
-	return payments;
+	if (filter && filter->limit && it->count >= filter->limit)
+		return false;
+
+	/* Now the payments not yet in db. */
+	if (!it->unstored)
+		it->unstored = list_top(&w->unstored_payments,
+					struct wallet_payment, list);
+	else
+		it->unstored = list_next(&w->unstored_payments, it->unstored,
+					 list);
+	while (it->unstored && !unstored_payment_matches(it->unstored, filter))
+		it->unstored = list_next(&w->unstored_payments, it->unstored,
+					 list);
+	if (!it->unstored)
+		return false;
+	it->count++;
+	return true;
+}
+
+const struct wallet_payment *
+wallet_payments_deref(const tal_t *ctx, struct wallet *w,
+		      const struct payment_iterator *it)
+{
+	if (!it->db_done)
+		return wallet_stmt2payment(ctx, it->p);
+	return it->unstored;
 }
 
+#define HTLC_SIGS_MAX_BATCH 100
+
 void wallet_htlc_sigs_save(struct wallet *w, u64 channel_id,
 			   secp256k1_ecdsa_signature *htlc_sigs)
 {
 	/* Clear any existing HTLC sigs for this channel */
-	sqlite3_stmt *stmt =
+	struct db_stmt *stmt =
 	    db_prepare(w->db, "DELETE FROM htlc_sigs WHERE channelid = ?");
-	sqlite3_bind_int64(stmt, 1, channel_id);
+	db_bind_int64(stmt, 1, channel_id);
 	db_exec_prepared(w->db, stmt);
 
-	/* Now insert the new ones */
-	for (size_t i=0; i<tal_count(htlc_sigs); i++) {
-		stmt = db_prepare(w->db, "INSERT INTO htlc_sigs (channelid, signature) VALUES (?, ?)");
-		sqlite3_bind_int64(stmt, 1, channel_id);
-		sqlite3_bind_signature(stmt, 2, &htlc_sigs[i]);
+	/* Now insert the new ones, many rows at a time: sqlite3 allows 999
+	 * parameters, and a channel can have 483 HTLCs each way. */
+	for (size_t i = 0; i < tal_count(htlc_sigs); i += HTLC_SIGS_MAX_BATCH) {
+		size_t num = tal_count(htlc_sigs) - i;
+		char *query;
+
+		if (num > HTLC_SIGS_MAX_BATCH)
+			num = HTLC_SIGS_MAX_BATCH;
+
+		query = tal_strdup(tmpctx, "INSERT INTO htlc_sigs (channelid, signature) VALUES");
+		for (size_t j = 0; j < num; j++)
+			tal_append_fmt(&query, "%s (?1, ?%zu)",
+				       j ? "," : "", j + 2);
+		stmt = db_prepare(w->db, query);
+		db_bind_int64(stmt, 1, channel_id);
+		for (size_t j = 0; j < num; j++)
+			db_bind_signature(stmt, j + 2, &htlc_sigs[i + j]);
 		db_exec_prepared(w->db, stmt);
 	}
 }
@@ -2205,12 +3188,12 @@ void wallet_htlc_sigs_save(struct wallet *w, u64 channel_id,
 bool wallet_network_check(struct wallet *w,
 			  const struct chainparams *chainparams)
 {
-	sqlite3_stmt *stmt = db_select(w->db,
-				      "val FROM vars WHERE name='genesis_hash'");
+	struct db_stmt *stmt = db_select(w->db,
+					 "val FROM vars WHERE name='genesis_hash'");
 	struct bitcoin_blkid chainhash;
 
 	if (db_select_step(w->db, stmt)) {
-		sqlite3_column_sha256_double(stmt, 0, &chainhash.shad);
+		db_column_sha256_double(stmt, 0, &chainhash.shad);
 		db_stmt_done(stmt);
 		if (!bitcoin_blkid_eq(&chainhash,
 				      &chainparams->genesis_blockhash)) {
@@ -2230,7 +3213,7 @@ bool wallet_network_check(struct wallet *w,
 		/* Still a pristine wallet, claim it for the chain
 		 * that we are running */
 		stmt = db_prepare(w->db, "INSERT INTO vars (name, val) VALUES ('genesis_hash', ?);");
-		sqlite3_bind_sha256_double(stmt, 1, &chainparams->genesis_blockhash.shad);
+		db_bind_sha256_double(stmt, 1, &chainparams->genesis_blockhash.shad);
 		db_exec_prepared(w->db, stmt);
 	}
 	return true;
@@ -2238,37 +3221,68 @@ bool wallet_network_check(struct wallet *w,
 
 /**
  * wallet_utxoset_prune -- Remove spent UTXO entries that are old
+ *
+ * They already left utxoset_outpoints when they were spent.
  */
 static void wallet_utxoset_prune(struct wallet *w, const u32 blockheight)
 {
-	sqlite3_stmt *stmt;
-	struct bitcoin_txid txid;
+	struct db_stmt *stmt;
+
+	stmt = db_prepare(w->db, "DELETE FROM utxoset WHERE spendheight < ?");
+	db_bind_int(stmt, 1, blockheight - UTXO_PRUNE_DEPTH);
+	db_exec_prepared(w->db, stmt);
+}
 
-	stmt = db_select_prepare(w->db, "txid, outnum FROM utxoset WHERE spendheight < ?");
-	sqlite3_bind_int(stmt, 1, blockheight - UTXO_PRUNE_DEPTH);
+/**
+ * wallet_utxoset_rollback -- Forget what blocks above @height did
+ */
+static void wallet_utxoset_rollback(struct wallet *w, const u32 height)
+{
+	struct db_stmt *stmt;
+	struct bitcoin_txid txid;
+	struct short_channel_id scid, first;
 
+	/* Outputs they spent are unspent again... */
+	stmt = db_select_prepare(w->db, "txid, scid FROM utxoset WHERE spendheight > ?");
+	db_bind_int(stmt, 1, height);
 	while (db_select_step(w->db, stmt)) {
-		sqlite3_column_sha256_double(stmt, 0, &txid.shad);
-		outpointfilter_remove(w->utxoset_outpoints, &txid, sqlite3_column_int(stmt, 1));
+		db_column_sha256_double(stmt, 0, &txid.shad);
+		scid.u64 = db_column_int64(stmt, 1);
+		outpointfilter_add(w->utxoset_outpoints, &txid,
+				   short_channel_id_outnum(&scid));
 	}
+	stmt = db_prepare(w->db, "UPDATE utxoset SET spendheight = NULL WHERE spendheight > ?");
+	db_bind_int(stmt, 1, height);
+	db_exec_prepared(w->db, stmt);
 
-	stmt = db_prepare(w->db, "DELETE FROM utxoset WHERE spendheight < ?");
-	sqlite3_bind_int(stmt, 1, blockheight - UTXO_PRUNE_DEPTH);
+	/* ... and outputs they created are gone. */
+	if (!mk_short_channel_id(&first, height + 1, 0, 0))
+		return;
+	stmt = db_select_prepare(w->db, "txid, scid FROM utxoset WHERE scid >= ?");
+	db_bind_int64(stmt, 1, first.u64);
+	while (db_select_step(w->db, stmt)) {
+		db_column_sha256_double(stmt, 0, &txid.shad);
+		scid.u64 = db_column_int64(stmt, 1);
+		outpointfilter_remove(w->utxoset_outpoints, &txid,
+				      short_channel_id_outnum(&scid));
+	}
+	stmt = db_prepare(w->db, "DELETE FROM utxoset WHERE scid >= ?");
+	db_bind_int64(stmt, 1, first.u64);
 	db_exec_prepared(w->db, stmt);
 }
 
 void wallet_block_add(struct wallet *w, struct block *b)
 {
-	sqlite3_stmt *stmt = db_prepare(w->db,
-					"INSERT INTO blocks "
-					"(height, hash, prev_hash) "
-					"VALUES (?, ?, ?);");
-	sqlite3_bind_int(stmt, 1, b->height);
-	sqlite3_bind_sha256_double(stmt, 2, &b->blkid.shad);
+	struct db_stmt *stmt = db_prepare(w->db,
+					  "INSERT INTO blocks "
+					  "(height, hash, prev_hash) "
+					  "VALUES (?, ?, ?);");
+	db_bind_int(stmt, 1, b->height);
+	db_bind_sha256_double(stmt, 2, &b->blkid.shad);
 	if (b->prev) {
-		sqlite3_bind_sha256_double(stmt, 3, &b->prev->blkid.shad);
+		db_bind_sha256_double(stmt, 3, &b->prev->blkid.shad);
 	}else {
-		sqlite3_bind_null(stmt, 3);
+		db_bind_null(stmt, 3);
 	}
 	db_exec_prepared(w->db, stmt);
 
@@ -2278,22 +3292,26 @@ void wallet_block_add(struct wallet *w, struct block *b)
 
 void wallet_block_remove(struct wallet *w, struct block *b)
 {
-	sqlite3_stmt *stmt = db_prepare(w->db,
-					"DELETE FROM blocks WHERE hash = ?");
-	sqlite3_bind_sha256_double(stmt, 1, &b->blkid.shad);
+	struct db_stmt *stmt = db_prepare(w->db,
+					  "DELETE FROM blocks WHERE hash = ?");
+	db_bind_sha256_double(stmt, 1, &b->blkid.shad);
 	db_exec_prepared(w->db, stmt);
+	available_utxos_unconfirm(w, b->height - 1);
+	wallet_utxoset_rollback(w, b->height - 1);
 
 	stmt = db_select_prepare(w->db, "* FROM blocks WHERE height >= ?;");
-	sqlite3_bind_int(stmt, 1, b->height);
+	db_bind_int(stmt, 1, b->height);
 	assert(!db_select_step(w->db, stmt));
 }
 
 void wallet_blocks_rollback(struct wallet *w, u32 height)
 {
-	sqlite3_stmt *stmt = db_prepare(w->db, "DELETE FROM blocks "
-					"WHERE height > ?");
-	sqlite3_bind_int(stmt, 1, height);
+	struct db_stmt *stmt = db_prepare(w->db, "DELETE FROM blocks "
+					  "WHERE height > ?");
+	db_bind_int(stmt, 1, height);
 	db_exec_prepared(w->db, stmt);
+	available_utxos_unconfirm(w, height);
+	wallet_utxoset_rollback(w, height);
 }
 
 const struct short_channel_id *
@@ -2301,8 +3319,7 @@ wallet_outpoint_spend(struct wallet *w, const tal_t *ctx, const u32 blockheight,
 		      const struct bitcoin_txid *txid, const u32 outnum)
 {
 	struct short_channel_id *scid;
-	sqlite3_stmt *stmt;
-	bool res;
+	struct db_stmt *stmt;
 	if (outpointfilter_matches(w->owned_outpoints, txid, outnum)) {
 		stmt = db_prepare(w->db,
 				  "UPDATE outputs "
@@ -2310,87 +3327,120 @@ wallet_outpoint_spend(struct wallet *w, const tal_t *ctx, const u32 blockheight,
 				  "WHERE prev_out_tx = ?"
 				  " AND prev_out_index = ?");
 
-		sqlite3_bind_int(stmt, 1, blockheight);
-		sqlite3_bind_sha256_double(stmt, 2, &txid->shad);
-		sqlite3_bind_int(stmt, 3, outnum);
+		db_bind_int(stmt, 1, blockheight);
+		db_bind_sha256_double(stmt, 2, &txid->shad);
+		db_bind_int(stmt, 3, outnum);
 
 		db_exec_prepared(w->db, stmt);
+		available_utxo_refresh(w, txid, outnum);
 	}
 
 	if (outpointfilter_matches(w->utxoset_outpoints, txid, outnum)) {
-		stmt = db_prepare(w->db,
-				  "UPDATE utxoset "
-				  "SET spendheight = ? "
-				  "WHERE txid = ?"
-				  " AND outnum = ?");
-
-		sqlite3_bind_int(stmt, 1, blockheight);
-		sqlite3_bind_sha256_double(stmt, 2, &txid->shad);
-		sqlite3_bind_int(stmt, 3, outnum);
-
-		db_exec_prepared(w->db, stmt);
-
-		if (sqlite3_changes(w->db->sql) == 0) {
-			return NULL;
-		}
-
-		/* Now look for the outpoint's short_channel_id */
 		stmt = db_select_prepare(w->db,
-					 "blockheight, txindex "
-					 "FROM utxoset "
-					 "WHERE txid = ? AND outnum = ?");
-		sqlite3_bind_sha256_double(stmt, 1, &txid->shad);
-		sqlite3_bind_int(stmt, 2, outnum);
-
-		res = db_select_step(w->db, stmt);
-		assert(res);
+					 "scid FROM utxoset "
+					 "WHERE txid = ? AND (scid & 65535) = ?"
+					 " AND spendheight IS NULL");
+		db_bind_sha256_double(stmt, 1, &txid->shad);
+		db_bind_int(stmt, 2, outnum);
+		if (!db_select_step(w->db, stmt))
+			return NULL;
 
 		scid = tal(ctx, struct short_channel_id);
-		if (!mk_short_channel_id(scid, sqlite3_column_int(stmt, 0),
-					 sqlite3_column_int(stmt, 1), outnum))
-			fatal("wallet_outpoint_spend: invalid scid %u:%u:%u",
-			      sqlite3_column_int(stmt, 0),
-			      sqlite3_column_int(stmt, 1), outnum);
+		scid->u64 = db_column_int64(stmt, 0);
 		db_stmt_done(stmt);
+
+		stmt = db_prepare(w->db,
+				  "UPDATE utxoset SET spendheight = ? WHERE scid = ?");
+		db_bind_int(stmt, 1, blockheight);
+		db_bind_int64(stmt, 2, scid->u64);
+		db_exec_prepared(w->db, stmt);
+
+		/* Can't be spent again, unless the block is rolled back */
+		outpointfilter_remove(w->utxoset_outpoints, txid, outnum);
 		return scid;
 	}
 	return NULL;
 }
 
-void wallet_utxoset_add(struct wallet *w, const struct bitcoin_tx *tx,
-			const u32 outnum, const u32 blockheight,
-			const u32 txindex, const u8 *scriptpubkey,
-			struct amount_sat sat)
-{
-	sqlite3_stmt *stmt;
-	struct bitcoin_txid txid;
-	bitcoin_txid(tx, &txid);
+#define UTXOSET_INSERT_PARAMS 4
+#define UTXOSET_INSERT_MAX_BATCH 64
 
-	stmt = db_prepare(w->db, "INSERT INTO utxoset ("
-			  " txid,"
-			  " outnum,"
-			  " blockheight,"
-			  " spendheight,"
-			  " txindex,"
-			  " scriptpubkey,"
-			  " satoshis"
-			  ") VALUES(?, ?, ?, ?, ?, ?, ?);");
-	sqlite3_bind_sha256_double(stmt, 1, &txid.shad);
-	sqlite3_bind_int(stmt, 2, outnum);
-	sqlite3_bind_int(stmt, 3, blockheight);
-	sqlite3_bind_null(stmt, 4);
-	sqlite3_bind_int(stmt, 5, txindex);
-	sqlite3_bind_blob(stmt, 6, scriptpubkey, tal_count(scriptpubkey), SQLITE_TRANSIENT);
-	sqlite3_bind_amount_sat(stmt, 7, sat);
+static void utxoset_insert(struct wallet *w,
+			   const struct outpoint *outpoints, size_t num)
+{
+	struct db_stmt *stmt;
+	char *query;
+
+	assert(num <= UTXOSET_INSERT_MAX_BATCH);
+	query = tal_strdup(tmpctx, "INSERT INTO utxoset ("
+			   " scid,"
+			   " txid,"
+			   " scriptpubkey,"
+			   " satoshis"
+			   ") VALUES");
+	for (size_t i = 0; i < num; i++)
+		tal_append_fmt(&query, "%s (?, ?, ?, ?)", i ? "," : "");
+	tal_append_fmt(&query, ";");
+
+	stmt = db_prepare(w->db, query);
+	for (size_t i = 0; i < num; i++) {
+		const struct outpoint *op = &outpoints[i];
+		int base = i * UTXOSET_INSERT_PARAMS;
+		struct short_channel_id scid;
+
+		/* wallet_utxoset_add() only gives us ones which have one. */
+		if (!mk_short_channel_id(&scid, op->blockheight, op->txindex,
+					 op->outnum))
+			abort();
+		db_bind_int64(stmt, base + 1, scid.u64);
+		db_bind_sha256_double(stmt, base + 2, &op->txid.shad);
+		db_bind_blob(stmt, base + 3, op->scriptpubkey,
+			     tal_count(op->scriptpubkey));
+		db_bind_amount_sat(stmt, base + 4, op->sat);
+	}
 	db_exec_prepared(w->db, stmt);
+}
+
+void wallet_utxoset_add(struct wallet *w, const struct outpoint *outpoints)
+{
+	struct outpoint *ops = tal_arr(tmpctx, struct outpoint, 0);
+	size_t num;
+
+	/* We key them by short_channel_id, but a valid transaction can
+	 * have outputs which can't have one (eg. outnum > 65535): no
+	 * channel can use those anyway. */
+	for (size_t i = 0; i < tal_count(outpoints); i++) {
+		const struct outpoint *op = &outpoints[i];
+		struct short_channel_id scid;
+
+		if (!mk_short_channel_id(&scid, op->blockheight, op->txindex,
+					 op->outnum)) {
+			log_debug(w->log, "Not tracking %s:%u (at %u:%u):"
+				  " no short_channel_id for it",
+				  type_to_string(tmpctx, struct bitcoin_txid,
+						 &op->txid),
+				  op->outnum, op->blockheight, op->txindex);
+			continue;
+		}
+		tal_arr_expand(&ops, *op);
+	}
+
+	for (size_t i = 0; i < tal_count(ops); i += num) {
+		num = tal_count(ops) - i;
+		if (num > UTXOSET_INSERT_MAX_BATCH)
+			num = UTXOSET_INSERT_MAX_BATCH;
+		utxoset_insert(w, ops + i, num);
+	}
 
-	outpointfilter_add(w->utxoset_outpoints, &txid, outnum);
+	for (size_t i = 0; i < tal_count(ops); i++)
+		outpointfilter_add(w->utxoset_outpoints,
+				   &ops[i].txid, ops[i].outnum);
 }
 
 struct outpoint *wallet_outpoint_for_scid(struct wallet *w, tal_t *ctx,
 					  const struct short_channel_id *scid)
 {
-	sqlite3_stmt *stmt;
+	struct db_stmt *stmt;
 	struct outpoint *op;
 	stmt = db_select_prepare(w->db,
 			  " txid,"
@@ -2398,13 +3448,9 @@ struct outpoint *wallet_outpoint_for_scid(struct wallet *w, tal_t *ctx,
 			  " scriptpubkey,"
 			  " satoshis "
 			  "FROM utxoset "
-			  "WHERE blockheight = ?"
-			  " AND txindex = ?"
-			  " AND outnum = ?"
+			  "WHERE scid = ?"
 			  " AND spendheight IS NULL");
-	sqlite3_bind_int(stmt, 1, short_channel_id_blocknum(scid));
-	sqlite3_bind_int(stmt, 2, short_channel_id_txnum(scid));
-	sqlite3_bind_int(stmt, 3, short_channel_id_outnum(scid));
+	db_bind_int64(stmt, 1, scid->u64);
 
 
 	if (!db_select_step(w->db, stmt))
@@ -2414,11 +3460,11 @@ struct outpoint *wallet_outpoint_for_scid(struct wallet *w, tal_t *ctx,
 	op->blockheight = short_channel_id_blocknum(scid);
 	op->txindex = short_channel_id_txnum(scid);
 	op->outnum = short_channel_id_outnum(scid);
-	sqlite3_column_sha256_double(stmt, 0, &op->txid.shad);
-	op->spendheight = sqlite3_column_int(stmt, 1);
-	op->scriptpubkey = tal_arr(op, u8, sqlite3_column_bytes(stmt, 2));
-	memcpy(op->scriptpubkey, sqlite3_column_blob(stmt, 2), sqlite3_column_bytes(stmt, 2));
-	op->sat = sqlite3_column_amount_sat(stmt, 3);
+	db_column_sha256_double(stmt, 0, &op->txid.shad);
+	op->spendheight = db_column_int(stmt, 1);
+	op->scriptpubkey = tal_arr(op, u8, db_column_bytes(stmt, 2));
+	memcpy(op->scriptpubkey, db_column_blob(stmt, 2), db_column_bytes(stmt, 2));
+	op->sat = db_column_amount_sat(stmt, 3);
 	db_stmt_done(stmt);
 
 	return op;
@@ -2428,10 +3474,10 @@ void wallet_transaction_add(struct wallet *w, const struct bitcoin_tx *tx,
 			    const u32 blockheight, const u32 txindex)
 {
 	struct bitcoin_txid txid;
-	sqlite3_stmt *stmt = db_select_prepare(w->db, "blockheight FROM transactions WHERE id=?");
+	struct db_stmt *stmt = db_select_prepare(w->db, "blockheight FROM transactions WHERE id=?");
 
 	bitcoin_txid(tx, &txid);
-	sqlite3_bind_sha256(stmt, 1, &txid.shad.sha);
+	db_bind_sha256(stmt, 1, &txid.shad.sha);
 	if (!db_select_step(w->db, stmt)) {
 		/* This transaction is still unknown, insert */
 		stmt = db_prepare(w->db,
@@ -2440,15 +3486,15 @@ void wallet_transaction_add(struct wallet *w, const struct bitcoin_tx *tx,
 				  ", blockheight"
 				  ", txindex"
 				  ", rawtx) VALUES (?, ?, ?, ?);");
-		sqlite3_bind_sha256(stmt, 1, &txid.shad.sha);
+		db_bind_sha256(stmt, 1, &txid.shad.sha);
 		if (blockheight) {
-			sqlite3_bind_int(stmt, 2, blockheight);
-			sqlite3_bind_int(stmt, 3, txindex);
+			db_bind_int(stmt, 2, blockheight);
+			db_bind_int(stmt, 3, txindex);
 		} else {
-			sqlite3_bind_null(stmt, 2);
-			sqlite3_bind_null(stmt, 3);
+			db_bind_null(stmt, 2);
+			db_bind_null(stmt, 3);
 		}
-		sqlite3_bind_tx(stmt, 4, tx);
+		db_bind_tx(stmt, 4, tx);
 		db_exec_prepared(w->db, stmt);
 	} else {
 		db_stmt_done(stmt);
@@ -2459,9 +3505,9 @@ void wallet_transaction_add(struct wallet *w, const struct bitcoin_tx *tx,
 					  "UPDATE transactions "
 					  "SET blockheight = ?, txindex = ? "
 					  "WHERE id = ?");
-			sqlite3_bind_int(stmt, 1, blockheight);
-			sqlite3_bind_int(stmt, 2, txindex);
-			sqlite3_bind_sha256(stmt, 3, &txid.shad.sha);
+			db_bind_int(stmt, 1, blockheight);
+			db_bind_int(stmt, 2, txindex);
+			db_bind_sha256(stmt, 3, &txid.shad.sha);
 			db_exec_prepared(w->db, stmt);
 		}
 	}
@@ -2471,14 +3517,14 @@ void wallet_transaction_annotate(struct wallet *w,
 				 const struct bitcoin_txid *txid, enum wallet_tx_type type,
 				 u64 channel_id)
 {
-	sqlite3_stmt *stmt = db_select_prepare(w->db, "type, channel_id FROM transactions WHERE id=?");
-	sqlite3_bind_sha256(stmt, 1, &txid->shad.sha);
+	struct db_stmt *stmt = db_select_prepare(w->db, "type, channel_id FROM transactions WHERE id=?");
+	db_bind_sha256(stmt, 1, &txid->shad.sha);
 	if (!db_select_step(w->db, stmt))
 		fatal("Attempting to annotate a transaction we don't have: %s",
 		      type_to_string(tmpctx, struct bitcoin_txid, txid));
-	type |= sqlite3_column_int(stmt, 0);
+	type |= db_column_int(stmt, 0);
 	if (channel_id == 0)
-		channel_id = sqlite3_column_int64(stmt, 1);
+		channel_id = db_column_int64(stmt, 1);
 
 	db_stmt_done(stmt);
 
@@ -2487,26 +3533,26 @@ void wallet_transaction_annotate(struct wallet *w,
 				 ", channel_id = ? "
 				 "WHERE id = ?");
 
-	sqlite3_bind_int(stmt, 1, type);
+	db_bind_int(stmt, 1, type);
 	if (channel_id)
-		sqlite3_bind_int(stmt, 2, channel_id);
+		db_bind_int(stmt, 2, channel_id);
 	else
-		sqlite3_bind_null(stmt, 2);
-	sqlite3_bind_sha256(stmt, 3, &txid->shad.sha);
+		db_bind_null(stmt, 2);
+	db_bind_sha256(stmt, 3, &txid->shad.sha);
 	db_exec_prepared(w->db, stmt);
 }
 
 u32 wallet_transaction_height(struct wallet *w, const struct bitcoin_txid *txid)
 {
 	u32 blockheight;
-	sqlite3_stmt *stmt = db_select_prepare(
+	struct db_stmt *stmt = db_select_prepare(
 		w->db, "blockheight FROM transactions WHERE id=?");
-	sqlite3_bind_sha256(stmt, 1, &txid->shad.sha);
+	db_bind_sha256(stmt, 1, &txid->shad.sha);
 
 	if (!db_select_step(w->db, stmt))
 		return 0;
 
-	blockheight = sqlite3_column_int(stmt, 0);
+	blockheight = db_column_int(stmt, 0);
 	db_stmt_done(stmt);
 	return blockheight;
 }
@@ -2515,21 +3561,21 @@ struct txlocator *wallet_transaction_locate(const tal_t *ctx, struct wallet *w,
 					    const struct bitcoin_txid *txid)
 {
 	struct txlocator *loc;
-	sqlite3_stmt *stmt;
+	struct db_stmt *stmt;
 
 	stmt = db_select_prepare(
 	    w->db, "blockheight, txindex FROM transactions WHERE id=?");
-	sqlite3_bind_sha256(stmt, 1, &txid->shad.sha);
+	db_bind_sha256(stmt, 1, &txid->shad.sha);
 
 	if (!db_select_step(w->db, stmt))
 		return NULL;
 
-	if (sqlite3_column_type(stmt, 0) == SQLITE_NULL)
+	if (db_column_is_null(stmt, 0))
 		loc = NULL;
 	else {
 		loc = tal(ctx, struct txlocator);
-		loc->blkheight = sqlite3_column_int(stmt, 0);
-		loc->index = sqlite3_column_int(stmt, 1);
+		loc->blkheight = db_column_int(stmt, 0);
+		loc->index = db_column_int(stmt, 1);
 	}
 	db_stmt_done(stmt);
 	return loc;
@@ -2539,17 +3585,17 @@ struct bitcoin_txid *wallet_transactions_by_height(const tal_t *ctx,
 						   struct wallet *w,
 						   const u32 blockheight)
 {
-	sqlite3_stmt *stmt;
+	struct db_stmt *stmt;
 	struct bitcoin_txid *txids = tal_arr(ctx, struct bitcoin_txid, 0);
 	int count = 0;
 	stmt = db_select_prepare(
 	    w->db, "id FROM transactions WHERE blockheight=?");
-	sqlite3_bind_int(stmt, 1, blockheight);
+	db_bind_int(stmt, 1, blockheight);
 
 	while (db_select_step(w->db, stmt)) {
 		count++;
 		tal_resize(&txids, count);
-		sqlite3_column_sha256(stmt, 0, &txids[count-1].shad.sha);
+		db_column_sha256(stmt, 0, &txids[count-1].shad.sha);
 	}
 
 	return txids;
@@ -2559,7 +3605,7 @@ void wallet_channeltxs_add(struct wallet *w, struct channel *chan,
 			   const int type, const struct bitcoin_txid *txid,
 			   const u32 input_num, const u32 blockheight)
 {
-	sqlite3_stmt *stmt;
+	struct db_stmt *stmt;
 	stmt = db_prepare(w->db, "INSERT INTO channeltxs ("
 			  "  channel_id"
 			  ", type"
@@ -2567,11 +3613,11 @@ void wallet_channeltxs_add(struct wallet *w, struct channel *chan,
 			  ", input_num"
 			  ", blockheight"
 			  ") VALUES (?, ?, ?, ?, ?);");
-	sqlite3_bind_int(stmt, 1, chan->dbid);
-	sqlite3_bind_int(stmt, 2, type);
-	sqlite3_bind_sha256(stmt, 3, &txid->shad.sha);
-	sqlite3_bind_int(stmt, 4, input_num);
-	sqlite3_bind_int(stmt, 5, blockheight);
+	db_bind_int(stmt, 1, chan->dbid);
+	db_bind_int(stmt, 2, type);
+	db_bind_sha256(stmt, 3, &txid->shad.sha);
+	db_bind_int(stmt, 4, input_num);
+	db_bind_int(stmt, 5, blockheight);
 
 	db_exec_prepared(w->db, stmt);
 }
@@ -2579,16 +3625,16 @@ void wallet_channeltxs_add(struct wallet *w, struct channel *chan,
 u32 *wallet_onchaind_channels(struct wallet *w,
 			      const tal_t *ctx)
 {
-	sqlite3_stmt *stmt;
+	struct db_stmt *stmt;
 	size_t count = 0;
 	u32 *channel_ids = tal_arr(ctx, u32, 0);
 	stmt = db_select_prepare(w->db, "DISTINCT(channel_id) FROM channeltxs WHERE type = ?;");
-	sqlite3_bind_int(stmt, 1, WIRE_ONCHAIN_INIT);
+	db_bind_int(stmt, 1, WIRE_ONCHAIN_INIT);
 
 	while (db_select_step(w->db, stmt)) {
 		count++;
 		tal_resize(&channel_ids, count);
-			channel_ids[count-1] = sqlite3_column_int64(stmt, 0);
+			channel_ids[count-1] = db_column_int64(stmt, 0);
 	}
 
 	return channel_ids;
@@ -2597,7 +3643,7 @@ u32 *wallet_onchaind_channels(struct wallet *w,
 struct channeltx *wallet_channeltxs_get(struct wallet *w, const tal_t *ctx,
 					u32 channel_id)
 {
-	sqlite3_stmt *stmt;
+	struct db_stmt *stmt;
 	size_t count = 0;
 	struct channeltx *res = tal_arr(ctx, struct channeltx, 0);
 	stmt = db_select_prepare(w->db,
@@ -2611,32 +3657,131 @@ struct channeltx *wallet_channeltxs_get(struct wallet *w, const tal_t *ctx,
 			  "JOIN transactions t ON t.id == c.transaction_id "
 			  "WHERE c.channel_id = ? "
 			  "ORDER BY c.id ASC;");
-	sqlite3_bind_int(stmt, 1, channel_id);
+	db_bind_int(stmt, 1, channel_id);
 
 	while (db_select_step(w->db, stmt)) {
 		count++;
 		tal_resize(&res, count);
 
 		res[count-1].channel_id = channel_id;
-		res[count-1].type = sqlite3_column_int(stmt, 0);
-		res[count-1].blockheight = sqlite3_column_int(stmt, 1);
-		res[count-1].tx = sqlite3_column_tx(ctx, stmt, 2);
-		res[count-1].input_num = sqlite3_column_int(stmt, 3);
-		res[count-1].depth = sqlite3_column_int(stmt, 4);
-		sqlite3_column_sha256(stmt, 5, &res[count-1].txid.shad.sha);
+		res[count-1].type = db_column_int(stmt, 0);
+		res[count-1].blockheight = db_column_int(stmt, 1);
+		res[count-1].tx = db_column_tx(ctx, stmt, 2);
+		res[count-1].input_num = db_column_int(stmt, 3);
+		res[count-1].depth = db_column_int(stmt, 4);
+		db_column_sha256(stmt, 5, &res[count-1].txid.shad.sha);
 	}
 	return res;
 }
 
+/* forward_stats rows are hourly */
+#define FORWARD_STATS_BUCKET 3600
+
+/* Add @count forwards (which may be negative, to take them away) to the
+ * forward_stats row for their hour, channels and state. */
+static void forward_stats_add(struct wallet *w, struct timeabs received_time,
+			      u64 in_scid, u64 out_scid,
+			      enum forward_status state, s64 count,
+			      s64 in_msat, s64 out_msat)
+{
+	struct db_stmt *stmt;
+	u64 bucket = received_time.ts.tv_sec
+		/ FORWARD_STATS_BUCKET * FORWARD_STATS_BUCKET;
+
+	stmt = db_prepare(w->db,
+			  "INSERT OR IGNORE INTO forward_stats"
+			  " (bucket, in_channel_scid, out_channel_scid, state,"
+			  "  count, in_msatoshi, out_msatoshi)"
+			  " VALUES (?, ?, ?, ?, 0, 0, 0);");
+	db_bind_int64(stmt, 1, bucket);
+	db_bind_int64(stmt, 2, in_scid);
+	db_bind_int64(stmt, 3, out_scid);
+	db_bind_int(stmt, 4, wallet_forward_status_in_db(state));
+	db_exec_prepared(w->db, stmt);
+
+	stmt = db_prepare(w->db,
+			  "UPDATE forward_stats"
+			  "   SET count = count + ?"
+			  "     , in_msatoshi = in_msatoshi + ?"
+			  "     , out_msatoshi = out_msatoshi + ?"
+			  " WHERE bucket = ? AND in_channel_scid = ?"
+			  "   AND out_channel_scid = ? AND state = ?;");
+	db_bind_int64(stmt, 1, count);
+	db_bind_int64(stmt, 2, in_msat);
+	db_bind_int64(stmt, 3, out_msat);
+	db_bind_int64(stmt, 4, bucket);
+	db_bind_int64(stmt, 5, in_scid);
+	db_bind_int64(stmt, 6, out_scid);
+	db_bind_int(stmt, 7, wallet_forward_status_in_db(state));
+	db_exec_prepared(w->db, stmt);
+}
+
+/* wallet_forwarded_payment_add() is about to DELETE this forward and INSERT
+ * it again, if we have it already: take it out of forward_stats. */
+static void forward_stats_remove_old(struct wallet *w,
+				     const struct htlc_in *in,
+				     const struct htlc_out *out)
+{
+	struct db_stmt *stmt;
+
+	/* NULL out_htlc_id never matches, so is never deleted. */
+	if (!out)
+		return;
+
+	stmt = db_select_prepare(w->db,
+				 "  state"
+				 ", in_channel_scid"
+				 ", COALESCE(out_channel_scid, 0)"
+				 ", in_msatoshi"
+				 ", COALESCE(out_msatoshi, 0)"
+				 ", COALESCE(received_time, 0)"
+				 " FROM forwarded_payments"
+				 " WHERE in_htlc_id = ? AND out_htlc_id = ?;");
+	db_bind_int64(stmt, 1, in->dbid);
+	db_bind_int64(stmt, 2, out->dbid);
+	if (db_select_step(w->db, stmt)) {
+		enum forward_status state = db_column_int(stmt, 0);
+		u64 in_scid = db_column_int64(stmt, 1);
+		u64 out_scid = db_column_int64(stmt, 2);
+		s64 in_msat = db_column_int64(stmt, 3);
+		s64 out_msat = db_column_int64(stmt, 4);
+		struct timeabs received = db_column_timeabs(stmt, 5);
+
+		db_stmt_done(stmt);
+		forward_stats_add(w, received, in_scid, out_scid, state,
+				  -1, -in_msat, -out_msat);
+	}
+}
+
 void wallet_forwarded_payment_add(struct wallet *w, const struct htlc_in *in,
 				  const struct htlc_out *out,
 				  enum forward_status state,
 				  enum onion_type failcode)
 {
-	sqlite3_stmt *stmt;
+	struct db_stmt *stmt;
+
+	forward_stats_remove_old(w, in, out);
+	forward_stats_add(w, in->received_time,
+			  in->key.channel->scid->u64,
+			  out ? out->key.channel->scid->u64 : 0,
+			  state, 1,
+			  in->msat.millisatoshis, /* Raw: db access */
+			  out ? out->msat.millisatoshis : 0); /* Raw: db access */
+
+	/* Replaces any previous entry for this pair: NULL out_htlc_id never
+	 * matches, so never replaces. */
+	if (out) {
+		stmt = db_prepare(w->db,
+				  "DELETE FROM forwarded_payments"
+				  " WHERE in_htlc_id = ? AND out_htlc_id = ?;");
+		db_bind_int64(stmt, 1, in->dbid);
+		db_bind_int64(stmt, 2, out->dbid);
+		db_exec_prepared(w->db, stmt);
+	}
+
 	stmt = db_prepare(
 		w->db,
-		"INSERT OR REPLACE INTO forwarded_payments ("
+		"INSERT INTO forwarded_payments ("
 		"  in_htlc_id"
 		", out_htlc_id"
 		", in_channel_scid"
@@ -2648,38 +3793,38 @@ void wallet_forwarded_payment_add(struct wallet *w, const struct htlc_in *in,
 		", resolved_time"
 		", failcode"
 		") VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?);");
-	sqlite3_bind_int64(stmt, 1, in->dbid);
+	db_bind_int64(stmt, 1, in->dbid);
 
 	if(out) {
-		sqlite3_bind_int64(stmt, 2, out->dbid);
-		sqlite3_bind_int64(stmt, 4, out->key.channel->scid->u64);
-		sqlite3_bind_amount_msat(stmt, 6, out->msat);
+		db_bind_int64(stmt, 2, out->dbid);
+		db_bind_int64(stmt, 4, out->key.channel->scid->u64);
+		db_bind_amount_msat(stmt, 6, out->msat);
 	} else {
 		/* FORWARD_LOCAL_FAILED may occur before we get htlc_out */
 		assert(failcode != 0);
 		assert(state == FORWARD_LOCAL_FAILED);
-		sqlite3_bind_null(stmt, 2);
-		sqlite3_bind_null(stmt, 4);
-		sqlite3_bind_null(stmt, 6);
+		db_bind_null(stmt, 2);
+		db_bind_null(stmt, 4);
+		db_bind_null(stmt, 6);
 	}
 
-	sqlite3_bind_int64(stmt, 3, in->key.channel->scid->u64);
+	db_bind_int64(stmt, 3, in->key.channel->scid->u64);
 
-	sqlite3_bind_amount_msat(stmt, 5, in->msat);
+	db_bind_amount_msat(stmt, 5, in->msat);
 
-	sqlite3_bind_int(stmt, 7, wallet_forward_status_in_db(state));
-	sqlite3_bind_timeabs(stmt, 8, in->received_time);
+	db_bind_int(stmt, 7, wallet_forward_status_in_db(state));
+	db_bind_timeabs(stmt, 8, in->received_time);
 
 	if (state == FORWARD_SETTLED || state == FORWARD_FAILED)
-		sqlite3_bind_timeabs(stmt, 9, time_now());
+		db_bind_timeabs(stmt, 9, time_now());
 	else
-		sqlite3_bind_null(stmt, 9);
+		db_bind_null(stmt, 9);
 
 	if(failcode != 0) {
 		assert(state == FORWARD_FAILED || state == FORWARD_LOCAL_FAILED);
-		sqlite3_bind_int(stmt, 10, (int)failcode);
+		db_bind_int(stmt, 10, (int)failcode);
 	} else {
-		sqlite3_bind_null(stmt, 10);
+		db_bind_null(stmt, 10);
 	}
 
 	db_exec_prepared(w->db, stmt);
@@ -2687,101 +3832,249 @@ void wallet_forwarded_payment_add(struct wallet *w, const struct htlc_in *in,
 
 struct amount_msat wallet_total_forward_fees(struct wallet *w)
 {
-	sqlite3_stmt *stmt;
+	struct db_stmt *stmt;
 	struct amount_msat total;
 	bool res;
 
 	stmt = db_select_prepare(w->db,
 			  " SUM(in_msatoshi - out_msatoshi) "
-			  "FROM forwarded_payments "
+			  "FROM forward_stats "
 			  "WHERE state = ?;");
 
-	sqlite3_bind_int(stmt, 1, wallet_forward_status_in_db(FORWARD_SETTLED));
+	db_bind_int(stmt, 1, wallet_forward_status_in_db(FORWARD_SETTLED));
 
 	res = db_select_step(w->db, stmt);
 	assert(res);
 
-	total = sqlite3_column_amount_msat(stmt, 0);
+	total = db_column_amount_msat(stmt, 0);
 	db_stmt_done(stmt);
 
 	return total;
 }
 
-const struct forwarding *wallet_forwarded_payments_get(struct wallet *w,
-						       const tal_t *ctx)
+const struct forwarding_stats *
+wallet_forwarding_stats_get(const tal_t *ctx, struct wallet *w,
+			    u64 period, u64 since, u64 before,
+			    bool per_channel)
 {
-	struct forwarding *results = tal_arr(ctx, struct forwarding, 0);
-	size_t count = 0;
-	sqlite3_stmt *stmt;
-	stmt = db_select_prepare(w->db,
-			  "  f.state"
-			  ", in_msatoshi"
-			  ", out_msatoshi"
-			  ", hin.payment_hash as payment_hash"
-			  ", in_channel_scid"
-			  ", out_channel_scid"
-			  ", f.received_time"
-			  ", f.resolved_time"
-			  ", f.failcode "
-			  "FROM forwarded_payments f "
-			  "LEFT JOIN channel_htlcs hin ON (f.in_htlc_id == hin.id)");
-
-	for (count=0; db_select_step(w->db, stmt); count++) {
-		tal_resize(&results, count+1);
-		struct forwarding *cur = &results[count];
-		cur->status = sqlite3_column_int(stmt, 0);
-		cur->msat_in = sqlite3_column_amount_msat(stmt, 1);
-
-		if (sqlite3_column_type(stmt, 2) != SQLITE_NULL)
-			cur->msat_out = sqlite3_column_amount_msat(stmt, 2);
-		else {
-			assert(cur->status == FORWARD_LOCAL_FAILED);
-			cur->msat_out = AMOUNT_MSAT(0);
-		}
+	struct forwarding_stats *stats = tal_arr(ctx, struct forwarding_stats, 0);
+	struct forwarding_stats *cur = NULL;
+	struct db_stmt *stmt;
+	char *query;
+
+	/* Buckets start on the hour: round so the bucket containing @since
+	 * counts, and the one containing @before doesn't. */
+	since = since / FORWARD_STATS_BUCKET * FORWARD_STATS_BUCKET;
+	before = before / FORWARD_STATS_BUCKET * FORWARD_STATS_BUCKET;
+
+	/* One row per state, for each (period, channels).  Careful: a
+	 * bare integer in GROUP BY or ORDER BY is a column number. */
+	query = tal_fmt(tmpctx,
+			"  %s AS b"
+			", %s AS i"
+			", %s AS o"
+			", state"
+			", SUM(count)"
+			", SUM(in_msatoshi)"
+			", SUM(out_msatoshi)"
+			" FROM forward_stats"
+			" WHERE bucket >= ? AND bucket < ?"
+			" GROUP BY b, i, o, state"
+			" ORDER BY b, i, o;",
+			period ? "bucket / ? * ?" : "0",
+			per_channel ? "in_channel_scid" : "0",
+			per_channel ? "out_channel_scid" : "0");
+	stmt = db_select_prepare(w->db, query);
+	if (period) {
+		db_bind_int64(stmt, 1, period);
+		db_bind_int64(stmt, 2, period);
+		db_bind_int64(stmt, 3, since);
+		db_bind_int64(stmt, 4, before);
+	} else {
+		db_bind_int64(stmt, 1, since);
+		db_bind_int64(stmt, 2, before);
+	}
 
-		if (!amount_msat_sub(&cur->fee, cur->msat_in, cur->msat_out)) {
-			log_broken(w->log, "Forwarded in %s less than out %s!",
-				   type_to_string(tmpctx, struct amount_msat,
-						  &cur->msat_in),
-				   type_to_string(tmpctx, struct amount_msat,
-						  &cur->msat_out));
-			cur->fee = AMOUNT_MSAT(0);
+	while (db_select_step(w->db, stmt)) {
+		u64 bucket = db_column_int64(stmt, 0);
+		u64 in_scid = db_column_int64(stmt, 1);
+		u64 out_scid = db_column_int64(stmt, 2);
+		enum forward_status state = db_column_int(stmt, 3);
+
+		if (!cur || cur->bucket != bucket
+		    || cur->channel_in.u64 != in_scid
+		    || cur->channel_out.u64 != out_scid) {
+			struct forwarding_stats s;
+
+			memset(&s, 0, sizeof(s));
+			s.bucket = bucket;
+			s.channel_in.u64 = in_scid;
+			s.channel_out.u64 = out_scid;
+			tal_arr_expand(&stats, s);
+			cur = &stats[tal_count(stats) - 1];
 		}
 
-		if (sqlite3_column_type(stmt, 3) != SQLITE_NULL) {
-			cur->payment_hash = tal(ctx, struct sha256_double);
-			sqlite3_column_sha256_double(stmt, 3, cur->payment_hash);
-		} else {
-			cur->payment_hash = NULL;
+		if (state > FORWARD_LOCAL_FAILED) {
+			log_broken(w->log, "Unknown forward state %u", state);
+			continue;
 		}
+		cur->count[state] = db_column_int64(stmt, 4);
+		if (state == FORWARD_SETTLED) {
+			cur->msat_in = db_column_amount_msat(stmt, 5);
+			cur->msat_out = db_column_amount_msat(stmt, 6);
+			if (!amount_msat_sub(&cur->fee, cur->msat_in,
+					     cur->msat_out))
+				cur->fee = AMOUNT_MSAT(0);
+		}
+	}
+	return stats;
+}
+
+/* Each condition is a single '?', bound in the same order. */
+static struct db_stmt *forwards_select_filtered(struct wallet *w,
+						const struct forwarding_filter *f)
+{
+	char *query = tal_strdup(tmpctx,
+				 "  f.state"
+				 ", in_msatoshi"
+				 ", out_msatoshi"
+				 ", COALESCE(hin.payment_hash, f.payment_hash)"
+				 ", in_channel_scid"
+				 ", out_channel_scid"
+				 ", f.received_time"
+				 ", f.resolved_time"
+				 ", f.failcode"
+				 ", f.rowid "
+				 "FROM forwarded_payments f "
+				 "LEFT JOIN channel_htlcs hin ON (f.in_htlc_id == hin.id)");
+	const char *sep = " WHERE ";
+	struct db_stmt *stmt;
+	int pos = 1;
+
+	if (f && f->start) {
+		tal_append_fmt(&query, "%sf.rowid >= ?", sep);
+		sep = " AND ";
+	}
+	if (f && f->status) {
+		tal_append_fmt(&query, "%sf.state = ?", sep);
+		sep = " AND ";
+	}
+	if (f && f->in_channel) {
+		tal_append_fmt(&query, "%sin_channel_scid = ?", sep);
+		sep = " AND ";
+	}
+	if (f && f->out_channel) {
+		tal_append_fmt(&query, "%sout_channel_scid = ?", sep);
+		sep = " AND ";
+	}
+	if (f && f->received_since) {
+		tal_append_fmt(&query, "%sf.received_time >= ?", sep);
+		sep = " AND ";
+	}
+	if (f && f->received_before) {
+		tal_append_fmt(&query, "%sf.received_time < ?", sep);
+		sep = " AND ";
+	}
+	tal_append_fmt(&query, " ORDER BY f.rowid");
+	if (f && f->limit)
+		tal_append_fmt(&query, " LIMIT ?");
+	tal_append_fmt(&query, ";");
+
+	stmt = db_select_prepare(w->db, query);
+	if (!f)
+		return stmt;
+	if (f->start)
+		db_bind_int64(stmt, pos++, f->start);
+	if (f->status)
+		db_bind_int(stmt, pos++,
+			    wallet_forward_status_in_db(*f->status));
+	if (f->in_channel)
+		db_bind_int64(stmt, pos++, f->in_channel->u64);
+	if (f->out_channel)
+		db_bind_int64(stmt, pos++, f->out_channel->u64);
+	if (f->received_since)
+		db_bind_timeabs(stmt, pos++, *f->received_since);
+	if (f->received_before)
+		db_bind_timeabs(stmt, pos++, *f->received_before);
+	if (f->limit)
+		db_bind_int64(stmt, pos++, f->limit);
+	return stmt;
+}
 
-		cur->channel_in.u64 = sqlite3_column_int64(stmt, 4);
+bool wallet_forwarded_payments_iterate(struct wallet *w,
+				       struct forwarding_iterator *it,
+				       const struct forwarding_filter *filter)
+{
+	if (!it->p)
+		it->p = forwards_select_filtered(w, filter);
 
-		if (sqlite3_column_type(stmt, 5) != SQLITE_NULL) {
-			cur->channel_out.u64 = sqlite3_column_int64(stmt, 5);
-		} else {
-			assert(cur->status == FORWARD_LOCAL_FAILED);
-			cur->channel_out.u64 = 0;
-		}
+	if (db_select_step(w->db, it->p))
+		return true;
+
+	it->p = NULL;
+	return false;
+}
 
-		cur->received_time = sqlite3_column_timeabs(stmt, 6);
+const struct forwarding *
+wallet_forwarded_payments_deref(const tal_t *ctx, struct wallet *w,
+				const struct forwarding_iterator *it)
+{
+	struct db_stmt *stmt = it->p;
+	struct forwarding *cur = tal(ctx, struct forwarding);
 
-		if (sqlite3_column_type(stmt, 7) != SQLITE_NULL) {
-			cur->resolved_time = tal(ctx, struct timeabs);
-			*cur->resolved_time = sqlite3_column_timeabs(stmt, 7);
-		} else {
-			cur->resolved_time = NULL;
-		}
+	cur->status = db_column_int(stmt, 0);
+	cur->msat_in = db_column_amount_msat(stmt, 1);
 
-		if (sqlite3_column_type(stmt, 8) != SQLITE_NULL) {
-			assert(cur->status == FORWARD_FAILED || cur->status == FORWARD_LOCAL_FAILED);
-			cur->failcode = sqlite3_column_int(stmt, 8);
-		} else {
-			cur->failcode = 0;
-		}
+	if (!db_column_is_null(stmt, 2))
+		cur->msat_out = db_column_amount_msat(stmt, 2);
+	else {
+		assert(cur->status == FORWARD_LOCAL_FAILED);
+		cur->msat_out = AMOUNT_MSAT(0);
 	}
 
-	return results;
+	if (!amount_msat_sub(&cur->fee, cur->msat_in, cur->msat_out)) {
+		log_broken(w->log, "Forwarded in %s less than out %s!",
+			   type_to_string(tmpctx, struct amount_msat,
+					  &cur->msat_in),
+			   type_to_string(tmpctx, struct amount_msat,
+					  &cur->msat_out));
+		cur->fee = AMOUNT_MSAT(0);
+	}
+
+	if (!db_column_is_null(stmt, 3)) {
+		cur->payment_hash = tal(cur, struct sha256_double);
+		db_column_sha256_double(stmt, 3, cur->payment_hash);
+	} else {
+		cur->payment_hash = NULL;
+	}
+
+	cur->channel_in.u64 = db_column_int64(stmt, 4);
+
+	if (!db_column_is_null(stmt, 5)) {
+		cur->channel_out.u64 = db_column_int64(stmt, 5);
+	} else {
+		assert(cur->status == FORWARD_LOCAL_FAILED);
+		cur->channel_out.u64 = 0;
+	}
+
+	cur->received_time = db_column_timeabs(stmt, 6);
+
+	if (!db_column_is_null(stmt, 7)) {
+		cur->resolved_time = tal(cur, struct timeabs);
+		*cur->resolved_time = db_column_timeabs(stmt, 7);
+	} else {
+		cur->resolved_time = NULL;
+	}
+
+	if (!db_column_is_null(stmt, 8)) {
+		assert(cur->status == FORWARD_FAILED || cur->status == FORWARD_LOCAL_FAILED);
+		cur->failcode = db_column_int(stmt, 8);
+	} else {
+		cur->failcode = 0;
+	}
+
+	cur->updated_index = db_column_int64(stmt, 9);
+	return cur;
 }
 
 struct unreleased_tx *find_unreleased_tx(struct wallet *w,
@@ -2861,7 +4154,7 @@ void wallet_clean_utxos(struct wallet *w, struct bitcoind *bitcoind)
 
 struct wallet_transaction *wallet_transactions_get(struct wallet *w, const tal_t *ctx)
 {
-	sqlite3_stmt *stmt;
+	struct db_stmt *stmt;
 	size_t count;
 	struct wallet_transaction *cur, *txs = tal_arr(ctx, struct wallet_transaction, 0);
 
@@ -2871,13 +4164,13 @@ struct wallet_transaction *wallet_transactions_get(struct wallet *w, const tal_t
 	for (count = 0; db_select_step(w->db, stmt); count++) {
 		tal_resize(&txs, count + 1);
 		cur = &txs[count];
-		sqlite3_column_sha256_double(stmt, 1, &cur->id.shad);
-		cur->rawtx = tal_dup_arr(txs, u8, sqlite3_column_blob(stmt, 2),
-					 sqlite3_column_bytes(stmt, 2), 0);
-		cur->blockheight = sqlite3_column_int(stmt, 3);
-		cur->txindex = sqlite3_column_int(stmt, 4);
-		cur->type = sqlite3_column_int(stmt, 5);
-		cur->channel_id = sqlite3_column_int(stmt, 6);
+		db_column_sha256_double(stmt, 1, &cur->id.shad);
+		cur->rawtx = tal_dup_arr(txs, u8, db_column_blob(stmt, 2),
+					 db_column_bytes(stmt, 2), 0);
+		cur->blockheight = db_column_int(stmt, 3);
+		cur->txindex = db_column_int(stmt, 4);
+		cur->type = db_column_int(stmt, 5);
+		cur->channel_id = db_column_int(stmt, 6);
 	}
 
 	return txs;
@@ -22,6 +22,7 @@
 
 enum onion_type;
 struct amount_msat;
+struct available_utxos;
 struct invoices;
 struct channel;
 struct lightningd;
@@ -49,6 +50,13 @@ struct wallet {
 
 	/* Unreleased txs, waiting for txdiscard/txsend */
 	struct list_head unreleased_txs;
+
+	/* wallet_htlc_update()s deferred by wallet_htlc_batch_start() */
+	size_t htlc_batch_depth;
+	struct htlc_update *htlc_updates;
+
+	/* Our available outputs, for coin selection */
+	struct available_utxos *available_utxos;
 };
 
 /* A transaction we've txprepared, but  haven't signed and released yet */
@@ -195,6 +203,57 @@ struct forwarding {
 	struct timeabs received_time;
 	/* May not be present if the HTLC was not resolved yet. */
 	struct timeabs *resolved_time;
+	/* Order of last change: a forward moves to the end when updated. */
+	u64 updated_index;
+};
+
+/* Forwarding totals for one period (and pair of channels) */
+struct forwarding_stats {
+	/* Start of the period, UNIX seconds */
+	u64 bucket;
+	/* Zero unless asked for per channel (channel_out zero for some
+	 * FORWARD_LOCAL_FAILED) */
+	struct short_channel_id channel_in, channel_out;
+	/* How many forwards, indexed by enum forward_status */
+	u64 count[FORWARD_LOCAL_FAILED + 1];
+	/* Of the FORWARD_SETTLED ones */
+	struct amount_msat msat_in, msat_out, fee;
+};
+
+/* A channel archived once it was closed and fully resolved. */
+struct closed_channel {
+	u64 dbid;
+	struct node_id peer_id;
+	/* NULL if it never had one. */
+	struct short_channel_id *scid;
+	enum side funder;
+	struct bitcoin_txid funding_txid;
+	u16 funding_outnum;
+	struct amount_sat funding;
+	/* Our balance when it closed. */
+	struct amount_msat our_msat;
+	u32 archived_height;
+};
+
+struct forwarding_iterator {
+	/* The contents of this object is subject to change
+	 * and should not be depended upon */
+	void *p;
+};
+
+/* Which forwards to iterate over: NULL pointers and zeroes mean no
+ * restriction. */
+struct forwarding_filter {
+	/* Only forwards in this state */
+	const enum forward_status *status;
+	/* Only forwards in from, or out to, this channel */
+	const struct short_channel_id *in_channel, *out_channel;
+	/* Only forwards received in [received_since, received_before) */
+	const struct timeabs *received_since, *received_before;
+	/* Start at this updated_index */
+	u64 start;
+	/* At most this many */
+	u64 limit;
 };
 
 /* A database backed shachain struct. The datastructure is
@@ -261,6 +320,31 @@ struct wallet_payment {
 	const char *label;
 };
 
+struct payment_iterator {
+	/* The contents of this object is subject to change
+	 * and should not be depended upon */
+	void *p;
+	/* Once the db rows are done, payments not stored yet. */
+	const struct wallet_payment *unstored;
+	bool db_done;
+	u64 count;
+};
+
+/* Which payments to iterate over: NULL pointers and zeroes mean no
+ * restriction. */
+struct payment_filter {
+	/* Only the payment with this hash */
+	const struct sha256 *payment_hash;
+	/* Only payments in this state */
+	const enum wallet_payment_status *status;
+	/* Only payments created in [created_since, created_before) */
+	const u64 *created_since, *created_before;
+	/* Start at this id */
+	u64 start;
+	/* At most this many */
+	u64 limit;
+};
+
 struct outpoint {
 	struct bitcoin_txid txid;
 	u32 blockheight;
@@ -356,6 +440,14 @@ struct utxo **wallet_get_utxos(const tal_t *ctx, struct wallet *w,
 struct utxo **wallet_get_unconfirmed_closeinfo_utxos(const tal_t *ctx,
 						     struct wallet *w);
 
+/**
+ * wallet_select_coins - Reserve utxos to pay @value plus fees
+ *
+ * Prefers a set of utxos which needs no change output (any excess smaller
+ * than a change output would cost goes to @fee_estimate, and
+ * @change_satoshi is 0), otherwise takes the largest utxos first.  Returns
+ * NULL if we can't afford it.
+ */
 const struct utxo **wallet_select_coins(const tal_t *ctx, struct wallet *w,
 					struct amount_sat value,
 					const u32 feerate_per_kw,
@@ -458,6 +550,30 @@ void wallet_channel_insert(struct wallet *w, struct channel *chan);
  */
 void wallet_channel_delete(struct wallet *w, u64 wallet_id);
 
+/**
+ * wallet_channel_archive -- Keep a closed channel's history before deleting it
+ *
+ * Copies a summary of the channel and its HTLCs into the archive tables,
+ * which nothing consults at startup, so wallet_channel_delete() can then
+ * remove it from the ones we work with.
+ *
+ * @w: the wallet
+ * @wallet_id: the channel's dbid
+ * @archived_height: the blockheight we archived it at (not where it closed)
+ */
+void wallet_channel_archive(struct wallet *w, u64 wallet_id, u32 archived_height);
+
+/**
+ * wallet_closed_channels_get -- List archived channels, oldest first
+ *
+ * @ctx: allocation context for the return value
+ * @w: the wallet
+ * @peer_id: if non-NULL, only this peer's channels
+ */
+const struct closed_channel *wallet_closed_channels_get(const tal_t *ctx,
+							struct wallet *w,
+							const struct node_id *peer_id);
+
 /**
  * wallet_peer_delete -- After no more channels in peer, forget about it
  */
@@ -567,6 +683,25 @@ void wallet_htlc_update(struct wallet *wallet, const u64 htlc_dbid,
 			const struct preimage *payment_key,
 			enum onion_type failcode, const u8 *failuremsg);
 
+/**
+ * wallet_htlc_batch_start - defer wallet_htlc_update() until batch_end
+ *
+ * @wallet: the wallet
+ *
+ * A commitment round moves many HTLCs, often through more than one state:
+ * between this and wallet_htlc_batch_end() we only remember the latest
+ * update for each, then write them all in as few statements as possible.
+ * Nothing may read channel_htlcs in between.  These nest.
+ */
+void wallet_htlc_batch_start(struct wallet *wallet);
+
+/**
+ * wallet_htlc_batch_end - write out the HTLC updates since batch_start
+ *
+ * @wallet: the wallet
+ */
+void wallet_htlc_batch_end(struct wallet *wallet);
+
 /**
  * wallet_htlcs_load_for_channel - Load HTLCs associated with chan from DB.
  *
@@ -592,6 +727,28 @@ bool wallet_htlcs_load_for_channel(struct wallet *wallet,
 				   struct htlc_in_map *htlcs_in,
 				   struct htlc_out_map *htlcs_out);
 
+/**
+ * wallet_htlcs_load_all - Load HTLCs for every loaded channel from DB.
+ *
+ * @wallet: wallet to load from
+ * @htlcs_in: htlc_in_map to store loaded htlc_in in
+ * @htlcs_out: htlc_out_map to store loaded htlc_out in
+ *
+ * Like wallet_htlcs_load_for_channel() for every channel in
+ * wallet->ld->peers, but in two queries instead of two per channel.
+ */
+bool wallet_htlcs_load_all(struct wallet *wallet,
+			   struct htlc_in_map *htlcs_in,
+			   struct htlc_out_map *htlcs_out);
+
+/**
+ * wallet_htlc_sigs_load - Load the latest HTLC sigs for the channel
+ *
+ * Channels are loaded without them (they're only needed for onchaind).
+ */
+secp256k1_ecdsa_signature *
+wallet_htlc_sigs_load(const tal_t *ctx, struct wallet *w, u64 channelid);
+
 /**
  * wallet_announcement_save - Save remote announcement information with channel.
  *
@@ -657,6 +814,9 @@ struct invoice_details {
 
 	/* The description of the payment. */
 	char *description;
+
+	/* Order of creation (the db id) */
+	u64 created_index;
 };
 
 /* An object that handles iteration over the set of invoices */
@@ -666,6 +826,23 @@ struct invoice_iterator {
 	void *p;
 };
 
+/* Which invoices to iterate over, and in what order: NULL pointers and
+ * zeroes mean no restriction. */
+struct invoice_filter {
+	/* Only invoices in this state */
+	const enum invoice_status *status;
+	/* Paid invoices in pay_index order, rather than by created_index */
+	bool by_pay_index;
+	/* Start at this created_index (or pay_index) */
+	u64 start;
+	/* Paid at or after this time */
+	const u64 *paid_since;
+	/* Expiring strictly before this time */
+	const u64 *expires_before;
+	/* At most this many */
+	u64 limit;
+};
+
 struct invoice {
 	/* Internal, rest of lightningd should not use */
 	/* Database ID */
@@ -776,22 +953,24 @@ void wallet_invoice_autoclean(struct wallet * wallet,
 			      u64 expired_by);
 
 /**
- * wallet_invoice_iterate - Iterate over all existing invoices
+ * wallet_invoice_iterate - Iterate over existing invoices
  *
  * @wallet - the wallet whose invoices are to be iterated over.
  * @iterator - the iterator object to use.
+ * @filter - which invoices, or NULL for all.
  *
  * Return false at end-of-sequence, true if still iterating.
  * Usage:
  *
  *   struct invoice_iterator it;
  *   memset(&it, 0, sizeof(it))
- *   while (wallet_invoice_iterate(wallet, &it)) {
+ *   while (wallet_invoice_iterate(wallet, &it, NULL)) {
  *       ...
  *   }
  */
 bool wallet_invoice_iterate(struct wallet *wallet,
-			    struct invoice_iterator *it);
+			    struct invoice_iterator *it,
+			    const struct invoice_filter *filter);
 
 /**
  * wallet_invoice_iterator_deref - Read the details of the
@@ -984,13 +1163,34 @@ void wallet_payment_set_failinfo(struct wallet *wallet,
 				 int faildirection);
 
 /**
- * wallet_payment_list - Retrieve a list of payments
+ * wallet_payments_iterate - Iterate over payments, in id order
+ *
+ * @w: the wallet
+ * @it: the iterator object to use, zeroed before the first call.
+ * @filter: which payments, or NULL for all.  Read on every call.
+ *
+ * Payments which aren't in the db yet come last, and have no id: they're
+ * left out if @filter has a start, so paging doesn't repeat them.
+ *
+ * Returns false at end-of-sequence, true if still iterating: use
+ * wallet_payments_deref() to read the current one.
+ */
+bool wallet_payments_iterate(struct wallet *w,
+			     struct payment_iterator *it,
+			     const struct payment_filter *filter);
+
+/**
+ * wallet_payments_deref - Read the current payment
  *
- * payment_hash: optional filter for only this payment hash.
+ * @ctx: allocation context for the return value
+ * @w: the wallet
+ * @it: the iterator, on which wallet_payments_iterate() just returned true.
+ *
+ * A payment not yet stored is owned by the wallet, not @ctx.
  */
-const struct wallet_payment **wallet_payment_list(const tal_t *ctx,
-						  struct wallet *wallet,
-						  const struct sha256 *payment_hash);
+const struct wallet_payment *
+wallet_payments_deref(const tal_t *ctx, struct wallet *w,
+		      const struct payment_iterator *it);
 
 /**
  * wallet_htlc_sigs_save - Store the latest HTLC sigs for the channel
@@ -1039,10 +1239,13 @@ wallet_outpoint_spend(struct wallet *w, const tal_t *ctx, const u32 blockheight,
 struct outpoint *wallet_outpoint_for_scid(struct wallet *w, tal_t *ctx,
 					  const struct short_channel_id *scid);
 
-void wallet_utxoset_add(struct wallet *w, const struct bitcoin_tx *tx,
-			const u32 outnum, const u32 blockheight,
-			const u32 txindex, const u8 *scriptpubkey,
-			struct amount_sat sat);
+/**
+ * wallet_utxoset_add - Track a block's P2WSH outputs in the UTXO set
+ *
+ * @outpoints is a tal_arr; spendheight is ignored.  Outputs which can't
+ * have a short_channel_id (so can't be a channel) are skipped.
+ */
+void wallet_utxoset_add(struct wallet *w, const struct outpoint *outpoints);
 
 void wallet_transaction_add(struct wallet *w, const struct bitcoin_tx *tx,
 			    const u32 blockheight, const u32 txindex);
@@ -1112,10 +1315,48 @@ void wallet_forwarded_payment_add(struct wallet *w, const struct htlc_in *in,
 struct amount_msat wallet_total_forward_fees(struct wallet *w);
 
 /**
- * Retrieve a list of all forwarded_payments
+ * wallet_forwarding_stats_get - Forwarding totals, from forward_stats
+ *
+ * @ctx: allocation context for the return value
+ * @w: the wallet
+ * @period: length of each period in seconds, multiple of an hour (or 0
+ *	for one total).
+ * @since, @before: only forwards received in [since, before), rounded
+ *	down to the hour.
+ * @per_channel: separate totals per pair of channels, too.
+ *
+ * Returns an array ordered by bucket (then channels), omitting empty ones.
+ */
+const struct forwarding_stats *
+wallet_forwarding_stats_get(const tal_t *ctx, struct wallet *w,
+			    u64 period, u64 since, u64 before,
+			    bool per_channel);
+
+/**
+ * wallet_forwarded_payments_iterate - Iterate over forwarded_payments
+ *
+ * @w: the wallet
+ * @it: the iterator object to use, zeroed before the first call.
+ * @filter: which forwards, or NULL for all.  Only read on the first call.
+ *
+ * Returns false at end-of-sequence, true if still iterating: use
+ * wallet_forwarded_payments_deref() to read the current one.
+ */
+bool wallet_forwarded_payments_iterate(struct wallet *w,
+				       struct forwarding_iterator *it,
+				       const struct forwarding_filter *filter);
+
+/**
+ * wallet_forwarded_payments_deref - Read the current forward
+ *
+ * @ctx: allocation context for the return value
+ * @w: the wallet
+ * @it: the iterator, on which wallet_forwarded_payments_iterate() just
+ *	returned true.
  */
-const struct forwarding *wallet_forwarded_payments_get(struct wallet *w,
-						       const tal_t *ctx);
+const struct forwarding *
+wallet_forwarded_payments_deref(const tal_t *ctx, struct wallet *w,
+				const struct forwarding_iterator *it);
 
 /**
  * Load remote_ann_node_sig and remote_ann_bitcoin_sig
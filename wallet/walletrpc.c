@@ -25,6 +25,7 @@
 #include <lightningd/log.h>
 #include <lightningd/options.h>
 #include <lightningd/peer_control.h>
+#include <lightningd/plugin_hook.h>
 #include <lightningd/subd.h>
 #include <wallet/wallet.h>
 #include <wally_bip32.h>
@@ -103,6 +104,16 @@ static struct command_result *param_bitcoin_address(struct command *cmd,
 	abort();
 }
 
+/* Once the utxos it spends are marked in the db, we can broadcast it */
+static void withdrawal_saved(struct unreleased_tx *utx)
+{
+	struct lightningd *ld = utx->wtx->cmd->ld;
+
+	bitcoind_sendrawtx(ld->topology->bitcoind,
+			   tal_hex(tmpctx, linearize_tx(tmpctx, utx->tx)),
+			   wallet_withdrawal_broadcast, utx);
+}
+
 /* Signs the tx, broadcasts it: broadcast calls wallet_withdrawal_broadcast */
 static struct command_result *broadcast_and_wait(struct command *cmd,
 						 struct unreleased_tx *utx)
@@ -141,9 +152,7 @@ static struct command_result *broadcast_and_wait(struct command *cmd,
 	utx->tx = signed_tx;
 
 	/* Now broadcast the transaction */
-	bitcoind_sendrawtx(cmd->ld->topology->bitcoind,
-			   tal_hex(tmpctx, linearize_tx(tmpctx, signed_tx)),
-			   wallet_withdrawal_broadcast, utx);
+	db_after_saved(cmd->ld->wallet->db, utx, withdrawal_saved, utx);
 
 	return command_still_pending(cmd);
 }